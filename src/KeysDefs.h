@@ -41,12 +41,25 @@
 #define kConfigKeyOwner             kConfigKey      ":owner"
 #define kConfigKeyGenLength         kConfigPrefix   "keygen:length"
 #define kConfigSignature            kConfigPrefix   "signature"
+#define kConfigJob                  kConfigPrefix   "job"
+#define kConfigJobDone              kConfigJob      ":done"
+#define kConfigJobTotal             kConfigJob      ":total"
+#define kConfigJobRate              kConfigJob      ":rate"
+#define kConfigJobETA               kConfigJob      ":eta"
 
 /* Message subjects  */
 #define M_ASK_FOR_REFRESH           'rfsh'
 #define M_ASK_FOR_CLIPBOARD_CLEANUP 'clcl'
+#define M_KEYRING_LOADED            'krld'
+#define M_MODEL_REBUILD             'rbmd'
 #define M_KEYSTORE_BACKUP           'bkp_'
 #define M_KEYSTORE_RESTORE          'rstr'
+#define M_KEYSTORE_VERIFY           'vrfy'
+#define M_KEYSTORE_RESTORE_KEYS     'rsky'
+#define M_KEYSTORE_DIFF             'kdif'
+#define M_JOB_PROGRESS              'jbpr'
+#define M_JOB_FINISHED              'jbfn'
+#define M_JOB_CANCEL                'jbcn'
 #define M_KEYSTORE_WIPE_CONTENTS    'wipe'
 #define M_KEYRING_CREATE            'adkr'
 #define M_KEYRING_DELETE            'rmkr'
@@ -58,6 +71,7 @@
 #define M_KEY_GENERATE_PASSWORD     'kygn'
 #define M_KEY_IMPORT                'imky'
 #define M_KEY_EXPORT                'exky'
+#define M_KEYS_EXPORT               'exks'
 #define M_KEY_COPY_SECRET           'cpky'
 #define M_KEY_DELETE                'rmky'
 #define M_APP_DELETE                'rmap'
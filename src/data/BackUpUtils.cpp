@@ -3,27 +3,87 @@
  * All rights reserved. Distributed under the terms of the MIT license.
  */
 #include <DateTime.h>
+#include <Directory.h>
 #include <File.h>
 #include <FindDirectory.h>
 #include <Path.h>
 #include <Roster.h>
+#include <atomic>
 #include <cstdio>
 #include <openssl/evp.h>
 #include "BackUpUtils.h"
+#include "BackupCatalog.h"
+#include "BackupRepository.h"
+#include "DataPipeline.h"
+#include "FlatMessage.h"
+#include "KeystoreServer.h"
+#include "SnapshotKeystoreBackend.h"
+#include "../KeysDefs.h"
 // #if defined(USE_OPENSSL)
 #include "CryptoUtils.h"
 // #endif
 
 status_t DBBasePath(BPath* path);
-const char* CurrentDateTimeString();
+BString CurrentDateTimeString();
 status_t InitDataBaseFile(BFile* file, BString* path);
-status_t WriteMetadata(const char* basepath, const char* original_filename, ssize_t inlenght,
+status_t ReplaceDataBaseFile(const BPath& restorepath);
+status_t CopyDataBaseFile(const BPath& from, const BPath& to);
+status_t DecryptBackup(const BMessage& metadata, const char* cryptopath,
+    const char* password, BDataIO* out, const progress_func& progress);
+void CatalogBackup(const catalog_entry& entry);
+status_t WriteMetadata(const char* basepath, const char* original_filename,
     const char* target_filename,const char* pass, const char* iv,
-    const unsigned char* derived_pass, const unsigned char* derived_iv);
+    const unsigned char* derived_pass, const unsigned char* derived_iv,
+    const char* cipher, const char* codec, int32 level,
+    const crypto_digests& digests);
+
+/* Passes everything through to another BPositionIO, telling the progress
+    of the bytes read and written, and failing them with B_CANCELED once the
+    progress asks to stop. */
+class ProgressIO : public BPositionIO
+{
+public:
+    ProgressIO(BPositionIO* io, off_t total, const progress_func& progress)
+    : fIO(io), fTotal(total), fProgress(progress), fDone(0), fCancelled(false) {}
+
+    virtual ssize_t ReadAt(off_t position, void* buffer, size_t size)
+    {
+        if(fCancelled)
+            return B_CANCELED;
+        return _Done(fIO->ReadAt(position, buffer, size));
+    }
+    virtual ssize_t WriteAt(off_t position, const void* buffer, size_t size)
+    {
+        if(fCancelled)
+            return B_CANCELED;
+        return _Done(fIO->WriteAt(position, buffer, size));
+    }
+    virtual off_t Seek(off_t position, uint32 seekMode) { return fIO->Seek(position, seekMode); }
+    virtual off_t Position() const { return fIO->Position(); }
+    virtual status_t SetSize(off_t size) { return fIO->SetSize(size); }
+    virtual status_t GetSize(off_t* size) const { return fIO->GetSize(size); }
+
+    bool Cancelled() { return fCancelled; }
+private:
+    ssize_t _Done(ssize_t result)
+    {
+        if(result > 0 && fProgress && !fProgress(fDone += result, fTotal)) {
+            fCancelled = true;
+            return B_CANCELED;
+        }
+        return result;
+    }
+private:
+    BPositionIO *fIO;
+    off_t       fTotal;
+    progress_func fProgress;
+    std::atomic<off_t> fDone;
+    std::atomic<bool> fCancelled;
+};
 
 // #pragma mark - Public
 
-status_t DoPlainKeystoreBackup()
+status_t DoPlainKeystoreBackup(const progress_func& progress)
 {
     BFile infile;
     BString inpath;
@@ -34,45 +94,72 @@ status_t DoPlainKeystoreBackup()
         return B_ERROR;
 
     off_t size = 0;
-    infile.GetSize(&size);
-    unsigned char* buffer = new unsigned char[size];
-    ssize_t readbytes = infile.Read(buffer, size);
-    if(readbytes != size) {
-        delete[] buffer;
+    BPath outpath;
+    if(infile.GetSize(&size) != B_OK || DBBasePath(&outpath) != B_OK) {
         infile.Unlock();
         return B_ERROR;
     }
-
-    BPath outpath;
-    if(DBBasePath(&outpath) != B_OK)
-        return B_ERROR;
     BString targetname("keystore_database_");
     targetname.Append(CurrentDateTimeString());
     outpath.Append(targetname.String());
     BFile outfile(outpath.Path(), B_READ_WRITE | B_CREATE_FILE | B_ERASE_FILE);
     if(outfile.InitCheck() != B_OK) {
-        delete[] buffer;
         infile.Unlock();
         return B_ERROR;
     }
-    ssize_t writtenbytes = outfile.Write(buffer, size);
-    if(writtenbytes != size) {
-        BEntry entry(outpath.Path());
-        entry.Remove();
-        delete[] buffer;
+
+    EVP_MD_CTX* context = EVP_MD_CTX_new();
+    if(!context || EVP_DigestInit_ex(context, EVP_sha256(), NULL) != 1) {
+        if(context)
+            EVP_MD_CTX_free(context);
         infile.Unlock();
-        return B_ERROR;
+        outfile.Unset();
+        BEntry(outpath.Path()).Remove();
+        return B_NO_MEMORY;
     }
 
-    delete[] buffer;
+    // Streamed through a few fixed size buffers, reading and writing at the
+    //  same time, so memory use does not grow with the database
+    ProgressIO input(&infile, size, progress);
+    DataPipeline pipeline;
+    status_t status = pipeline.Run(&input, 0, size, &outfile,
+        [&](const uint8* in, size_t inlength, uint8* out, size_t* outlength) {
+            memcpy(out, in, inlength);
+            *outlength = inlength;
+            return EVP_DigestUpdate(context, in, inlength) == 1 ? B_OK : B_ERROR;
+        });
     infile.Unlock();
+
+    catalog_entry entry;
+    unsigned int hashlength = 0;
+    if(status == B_OK && EVP_DigestFinal_ex(context, entry.originalHash, &hashlength) != 1)
+        status = B_ERROR;
+    EVP_MD_CTX_free(context);
+    if(status != B_OK || pipeline.BytesWritten() != size) {
+        outfile.Unset();
+        BEntry(outpath.Path()).Remove();
+        return input.Cancelled() ? B_CANCELED : B_ERROR;
+    }
+
+    entry.name = targetname;
+    entry.kind = BACKUP_KIND_PLAIN;
+    entry.originalSize = entry.storedSize = size;
+    entry.hasHashes = true;
+    memcpy(entry.storedHash, entry.originalHash, sizeof(entry.storedHash));
+    entry.codec = kCodecNone;
+    CatalogBackup(entry);
+
     return B_OK;
 }
 
 // #if defined(USE_OPENSSL)
 
-status_t DoEncryptedKeystoreBackup(const char* password)
+status_t DoEncryptedKeystoreBackup(const char* password, backup_cipher cipher,
+    int32 compression, const progress_func& progress)
 {
+    if(cipher == BACKUP_CIPHER_AES_GCM_CHUNKED && compression != kNoCompression)
+        return B_NOT_SUPPORTED;
+
     BFile infile;
     BString inpath;
     if(InitDataBaseFile(&infile, &inpath) != B_OK)
@@ -91,13 +178,6 @@ status_t DoEncryptedKeystoreBackup(const char* password)
     if(GenerateSalt(16, &salt) != B_OK)
         return B_ERROR;
 
-    BMallocIO alloc, outdp, outiv;
-    if(EncryptData(&infile, filesize, inpath.String(), password, (const unsigned char*)salt.Buffer(), &alloc, &outdp, &outiv) != B_OK) {
-        alloc.SetSize(0);
-        infile.Unlock();
-        return B_ERROR;
-    }
-
     BPath basepath;
     DBBasePath(&basepath);
     BString outpathstr;
@@ -106,23 +186,62 @@ status_t DoEncryptedKeystoreBackup(const char* password)
     BFile outfile(outpath.Path(), B_READ_WRITE | B_CREATE_FILE | B_ERASE_FILE);
     if(outfile.InitCheck() != B_OK) {
        fprintf(stderr, "Error!!! Unable to open outfile %s.\n", outpath.Path());
+       infile.Unlock();
         return -1;
     }
 
-    if(outfile.Write(alloc.Buffer(), alloc.BufferLength()) < 0)
-        fprintf(stderr, "Error!!! Not any bytes written to outfile.\n");
+    // Encrypted straight into the file, never held whole in memory, and
+    //  checksummed on the way: both files are only gone through once
+    ProgressIO input(&infile, filesize, progress);
+    BMallocIO outdp, outiv;
+    crypto_digests digests;
+    status_t status = B_OK;
+    if(cipher == BACKUP_CIPHER_AES_GCM_CHUNKED) {
+        // The container keeps its own salt, and nothing derived from the password
+        status = EncryptDataChunked(&input, filesize, password, &outfile,
+            kDefaultCryptoChunkSize, 0, &digests);
+        outdp.Write("", 1);
+        outiv.Write("", 1);
+    }
+    else
+        status = EncryptData(&input, filesize, inpath.String(), password,
+            (const unsigned char*)salt.Buffer(), &outfile, &outdp, &outiv,
+            kDefaultCryptoBufferSize, &digests, compression);
+    if(status != B_OK) {
+        fprintf(stderr, "Error: encryption error.\n");
+        outfile.Unset();
+        BEntry(outpath.Path()).Remove();
+        infile.Unlock();
+        return input.Cancelled() ? B_CANCELED : B_ERROR;
+    }
 
     infile.Unlock();
 
-    if(WriteMetadata(basepath.Path(), BPath(inpath.String()).Leaf(), filesize,
+    catalog_entry entry;
+    entry.name = outpathstr;
+    entry.kind = BACKUP_KIND_ENCRYPTED;
+    entry.originalSize = filesize;
+    outfile.GetSize(&entry.storedSize);
+    entry.hasHashes = true;
+    memcpy(entry.originalHash, digests.input, sizeof(entry.originalHash));
+    memcpy(entry.storedHash, digests.output, sizeof(entry.storedHash));
+    entry.cipher = cipher == BACKUP_CIPHER_AES_GCM_CHUNKED ? kCipherAESGCMChunked : kCipherAESCBC;
+    entry.codec = compression != kNoCompression ? kCodecZlib : kCodecNone;
+    CatalogBackup(entry);
+
+    if(WriteMetadata(basepath.Path(), BPath(inpath.String()).Leaf(),
     outpathstr.String(), password, (char*)salt.Buffer(),
-    (const unsigned char*)outdp.Buffer(), (const unsigned char*)outiv.Buffer()) != 0)
+    (const unsigned char*)outdp.Buffer(), (const unsigned char*)outiv.Buffer(),
+    cipher == BACKUP_CIPHER_AES_GCM_CHUNKED ? kCipherAESGCMChunked : kCipherAESCBC,
+    compression != kNoCompression ? kCodecZlib : kCodecNone, compression,
+    digests) != 0)
         fprintf(stderr, "Warning: the metadata file could not be written. Please remember your data.\n");
 
     return B_OK;
 }
 
-status_t RestoreEncryptedKeystoreBackup(const char* path, const char* password)
+status_t RestoreEncryptedKeystoreBackup(const char* path, const char* password,
+    const progress_func& progress)
 {
     BFile datafile(path, B_READ_ONLY);
     if(datafile.InitCheck() != B_OK)
@@ -131,10 +250,8 @@ status_t RestoreEncryptedKeystoreBackup(const char* path, const char* password)
     BMessage data;
     data.Unflatten(&datafile);
 
-    BString originalfn, targetfn, ivec;
-    if(data.FindString("original_file_name", &originalfn) != B_OK ||
-    data.FindString("target_file_name", &targetfn) != B_OK ||
-    data.FindString("ivec", &ivec) != B_OK) {
+    BString targetfn;
+    if(data.FindString("target_file_name", &targetfn) != B_OK) {
         fprintf(stderr, "Error: bad data. Unrecognized data file or the file has missing fields.\n");
         return B_BAD_DATA;
     }
@@ -142,46 +259,212 @@ status_t RestoreEncryptedKeystoreBackup(const char* path, const char* password)
     BPath basepath;
     DBBasePath(&basepath);
     BPath cryptopath(basepath.Path(), targetfn.String(), true);
-    BFile cryptofile(cryptopath.Path(), B_READ_ONLY);
-    ssize_t inlength = 0;
-    cryptofile.GetSize(&inlength);
-    BMallocIO alloc, outdp, outiv;
-    alloc.SetBlockSize(1024);
-    if(DecryptData(&cryptofile, inlength, password, (const unsigned char*)ivec.String(), &alloc, &outdp, &outiv) != B_OK) {
-        fprintf(stderr, "Error: decryption error.\n");
+
+    // Decrypted into a file next to the database, and only moved in place
+    //  once the whole backup has been decrypted
+    BPath restorepath(basepath.Path(), "keystore_database.restore");
+    BFile restorefile(restorepath.Path(), B_READ_WRITE | B_CREATE_FILE | B_ERASE_FILE);
+    if(restorefile.InitCheck() != B_OK) {
+        fprintf(stderr, "Error: could not create %s.\n", restorepath.Path());
         return B_ERROR;
     }
 
-    BPath dbpath;
-    DBPath(&dbpath);
-    if(BEntry(dbpath.Path()).Exists()) {
-        // First we try to stop the keystore server to prevent conflicts with the current database file
-        while(be_roster->IsRunning("application/x-vnd.Haiku-keystore_server")) {
-            team_id team = be_roster->TeamFor("application/x-vnd.Haiku-keystore_server");
-            BMessenger msgr("application/x-vnd.Haiku-keystore_server", team);
-            msgr.SendMessage(B_QUIT_REQUESTED);
-        }
+    status_t status = DecryptBackup(data, cryptopath.Path(), password,
+        &restorefile, progress);
+    restorefile.Unset();
+    if(status != B_OK) {
+        BEntry(restorepath.Path()).Remove();
+        return status;
+    }
 
-        // Check again
-        if(be_roster->IsRunning("application/x-vnd.Haiku-keystore_server")) {
-            fprintf(stderr, "Error: despite the attempt to stop it, it is still running.\n");
-            return B_NOT_ALLOWED;
-        }
+    return ReplaceDataBaseFile(restorepath);
+}
+
+// #endif
 
-        // Rename the file
-        if(BEntry(dbpath.Path()).Rename(BString(dbpath.Leaf()).Append("_").Append(CurrentDateTimeString()), false) != B_OK)
-            fprintf(stderr, "Error: the old database file could not be renamed.\n");
+status_t DoRepositoryKeystoreBackup(BString* snapshot, const progress_func& progress)
+{
+    BFile infile;
+    BString inpath;
+    if(InitDataBaseFile(&infile, &inpath) != B_OK)
+        return B_ERROR;
+
+    BPath repopath;
+    if(BackupRepositoryPath(&repopath) != B_OK)
+        return B_ERROR;
+    BackupRepository repository(repopath.Path());
+    if(repository.InitCheck() != B_OK)
+        return repository.InitCheck();
+
+    if(infile.Lock() != B_OK)
+        return B_ERROR;
+
+    off_t size = 0;
+    if(infile.GetSize(&size) != B_OK) {
+        infile.Unlock();
+        return B_ERROR;
     }
 
-    // With the old file moved (or not existing), now we can create the new decrypted file
-    BFile outfile(BPath(dbpath.Path(), "keystore_database").Path(), B_READ_WRITE | B_CREATE_FILE | B_FAIL_IF_EXISTS);
-    if(outfile.Write(alloc.Buffer(), alloc.BufferLength()) < 0)
-        fprintf(stderr, "Error: the data was not written properly or at all.\n");
+    BString name("keystore_database_");
+    name.Append(CurrentDateTimeString());
+    int32 newchunks = 0;
+    off_t newbytes = 0;
+    ProgressIO input(&infile, size, progress);
+    status_t status = repository.StoreSnapshot(name.String(), &input, size,
+        &newchunks, &newbytes);
+    infile.Unlock();
+    if(status != B_OK) {
+        fprintf(stderr, "Error: the snapshot could not be stored (%s).\n", strerror(status));
+        return status;
+    }
 
-    return 0;
+    fprintf(stderr, "Snapshot %s: %" B_PRId32 " new chunks, %" B_PRIdOFF " of %"
+        B_PRIdOFF " bytes stored.\n", name.String(), newchunks, newbytes, size);
+
+    catalog_entry entry;
+    entry.name = name;
+    entry.kind = BACKUP_KIND_SNAPSHOT;
+    entry.originalSize = size;
+    entry.storedSize = newbytes;
+    entry.codec = kCodecNone;
+    CatalogBackup(entry);
+
+    if(snapshot)
+        snapshot->SetTo(name);
+    return B_OK;
 }
 
-// #endif
+/* RestoreRepositoryKeystoreBackup: the snapshot is told by its manifest,
+    which lives in the snapshots directory of its repository.
+*/
+status_t RestoreRepositoryKeystoreBackup(const char* manifestpath,
+    const progress_func& progress)
+{
+    BPath manifest(manifestpath), snapshots, repopath;
+    if(manifest.InitCheck() != B_OK || manifest.GetParent(&snapshots) != B_OK ||
+    snapshots.GetParent(&repopath) != B_OK)
+        return B_BAD_VALUE;
+    BackupRepository repository(repopath.Path());
+    if(repository.InitCheck() != B_OK)
+        return repository.InitCheck();
+
+    BPath basepath;
+    DBBasePath(&basepath);
+    BPath restorepath(basepath.Path(), "keystore_database.restore");
+    BFile restorefile(restorepath.Path(), B_READ_WRITE | B_CREATE_FILE | B_ERASE_FILE);
+    if(restorefile.InitCheck() != B_OK) {
+        fprintf(stderr, "Error: could not create %s.\n", restorepath.Path());
+        return B_ERROR;
+    }
+
+    // The progress goes by what is written, out of the length in the manifest
+    BFile manifestfile(manifestpath, B_READ_ONLY);
+    BMessage data;
+    data.Unflatten(&manifestfile);
+    ProgressIO output(&restorefile, data.GetInt64("length", 0), progress);
+    status_t status = repository.RestoreSnapshot(manifest.Leaf(), &output);
+    restorefile.Unset();
+    if(status != B_OK) {
+        BEntry(restorepath.Path()).Remove();
+        return output.Cancelled() ? B_CANCELED : status;
+    }
+
+    return ReplaceDataBaseFile(restorepath);
+}
+
+/* ReadKeystoreBackup: whichever kind the backup is, the database it holds
+    is read into memory, leaving the database and the server alone.
+*/
+status_t ReadKeystoreBackup(const char* path, const char* password,
+    BMallocIO* database, const progress_func& progress)
+{
+    if(!path || !database)
+        return B_BAD_VALUE;
+
+    BFile file(path, B_READ_ONLY);
+    status_t status = file.InitCheck();
+    off_t size = 0;
+    if(status != B_OK || (status = file.GetSize(&size)) != B_OK)
+        return status;
+
+    BPath backuppath(path), parent;
+    if(backuppath.InitCheck() != B_OK || backuppath.GetParent(&parent) != B_OK)
+        return B_BAD_VALUE;
+
+    database->SetSize(0);
+    database->Seek(0, SEEK_SET);
+
+    // Told apart in place, a plain database is not unflattened just for that
+    FlatMessageReader reader(path);
+    if(reader.InitCheck() == B_OK && reader.What() == BACKUP_MANIFEST) {
+        // A snapshot, in the snapshots directory of its repository
+        BPath repopath;
+        if(parent.GetParent(&repopath) != B_OK)
+            return B_BAD_VALUE;
+        BackupRepository repository(repopath.Path());
+        if(repository.InitCheck() != B_OK)
+            return repository.InitCheck();
+        int64 length = 0;
+        reader.FindInt64("length", 0, &length);
+        ProgressIO output(database, length, progress);
+        status = repository.RestoreSnapshot(backuppath.Leaf(), &output);
+        return status != B_OK && output.Cancelled() ? B_CANCELED : status;
+    }
+    const char* target;
+    if(reader.InitCheck() == B_OK && reader.FindString("target_file_name", 0, &target) == B_OK) {
+        // The metadata of an encrypted backup, next to it, small enough to unflatten
+        BMessage data;
+        if(!password)
+            return B_NOT_ALLOWED;
+        if((status = data.Unflatten(&file)) != B_OK)
+            return status;
+        BPath cryptopath(parent.Path(), data.GetString("target_file_name", ""), true);
+        return DecryptBackup(data, cryptopath.Path(), password, database, progress);
+    }
+    reader.Unset();
+
+    // A plain copy of the database
+    if((status = database->SetSize(size)) != B_OK)
+        return status;
+    ProgressIO input(&file, size, progress);
+    ssize_t read = input.ReadAt(0, const_cast<void*>(database->Buffer()), size);
+    if(read < 0)
+        return read;
+    return read == size ? B_OK : B_IO_ERROR;
+}
+
+// ReadKeystoreBackupKeys: nothing is read unless all of the selection is found
+status_t ReadKeystoreBackupKeys(const char* path, const char* password,
+    const BMessage& selection, BMessage* keys, const progress_func& progress)
+{
+    if(!keys)
+        return B_BAD_VALUE;
+
+    SnapshotKeystoreBackend backup;
+    status_t status = backup.SetTo(path, password, progress);
+    if(status != B_OK)
+        return status;
+
+    keys->MakeEmpty();
+    const char* keyring;
+    for(int32 i = 0; selection.FindString(kConfigKeyring, i, &keyring) == B_OK; i++) {
+        const char* identifier = selection.GetString(kConfigKeyName, i, "");
+        bool anySecondary = false;
+        selection.FindBool("any_secondary", i, &anySecondary);
+        const char* secondary = anySecondary ? nullptr
+            : selection.GetString(kConfigKeyAltName, i, "");
+        status = backup.CopyKeys(keyring, identifier[0] != '\0' ? identifier : nullptr,
+            secondary, keys);
+        if(status != B_OK) {
+            fprintf(stderr, "Error: %s%s%s is not in the backup.\n", keyring,
+                identifier[0] != '\0' ? "/" : "", identifier);
+            keys->MakeEmpty();
+            return status;
+        }
+    }
+
+    return B_OK;
+}
 
 status_t DBPath(BPath* path)
 {
@@ -195,6 +478,30 @@ status_t DBPath(BPath* path)
     return B_OK;
 }
 
+status_t BackupRepositoryPath(BPath* path)
+{
+    BPath repopath;
+    if(DBBasePath(&repopath) != B_OK)
+        return B_ERROR;
+    if(repopath.Append("keystore_repository", true) != B_OK)
+        return B_ERROR;
+    if(path->SetTo(repopath.Path()) != B_OK)
+        return B_ERROR;
+    return B_OK;
+}
+
+status_t BackupCatalogPath(BPath* path)
+{
+    BPath catalogpath;
+    if(DBBasePath(&catalogpath) != B_OK)
+        return B_ERROR;
+    if(catalogpath.Append("keystore_backups.catalog", true) != B_OK)
+        return B_ERROR;
+    if(path->SetTo(catalogpath.Path()) != B_OK)
+        return B_ERROR;
+    return B_OK;
+}
+
 // #pragma mark - Private
 
 status_t DBBasePath(BPath* path)
@@ -209,7 +516,7 @@ status_t DBBasePath(BPath* path)
     return B_OK;
 }
 
-const char* CurrentDateTimeString()
+BString CurrentDateTimeString()
 {
     BDateTime now(BDateTime::CurrentDateTime(B_GMT_TIME));
     BString targetname("");
@@ -219,7 +526,7 @@ const char* CurrentDateTimeString()
                << (now.Time().Hour()   < 10 ? "0" : "") << now.Time().Hour()   << "-"
                << (now.Time().Minute() < 10 ? "0" : "") << now.Time().Minute() << "-"
                << (now.Time().Second() < 10 ? "0" : "") << now.Time().Second();
-    return targetname.String();
+    return targetname;
 }
 
 status_t InitDataBaseFile(BFile* file, BString* path)
@@ -241,13 +548,181 @@ status_t InitDataBaseFile(BFile* file, BString* path)
     return B_OK;
 }
 
+// CatalogBackup: a backup missing from the catalog is still a good backup
+void CatalogBackup(const catalog_entry& entry)
+{
+    BPath catalogpath;
+    if(BackupCatalogPath(&catalogpath) != B_OK ||
+    BackupCatalog(catalogpath.Path()).AddBackup(entry) != B_OK)
+        fprintf(stderr, "Warning: %s could not be added to the backup catalog.\n",
+            entry.name.String());
+}
+
+/* ReplaceDataBaseFile: the restored file is flushed to disk, the database
+    is copied aside, and the restored file is renamed over it in one step, so
+    at any point there is either the old database or the new one in place.
+    The restored file is removed if it cannot be put in place. */
+status_t ReplaceDataBaseFile(const BPath& restorepath)
+{
+    BFile restorefile(restorepath.Path(), B_READ_WRITE);
+    status_t status = restorefile.InitCheck();
+    if(status == B_OK)
+        status = restorefile.Sync();
+    restorefile.Unset();
+    if(status != B_OK) {
+        fprintf(stderr, "Error: the restored data could not be written to disk.\n");
+        BEntry(restorepath.Path()).Remove();
+        return status;
+    }
+
+    // First we try to stop the keystore server to prevent conflicts with the
+    //  database file. It may create one of its own even if there is none yet
+    if(StopKeystoreServer() != B_OK) {
+        fprintf(stderr, "Error: despite the attempt to stop it, it is still running.\n");
+        BEntry(restorepath.Path()).Remove();
+        return B_NOT_ALLOWED;
+    }
+
+    BPath dbpath;
+    DBPath(&dbpath);
+    if(BEntry(dbpath.Path()).Exists()) {
+        // The old database is kept under a dated name, as a copy so it does
+        //  not leave its place before the restored one takes it
+        BPath oldpath;
+        dbpath.GetParent(&oldpath);
+        oldpath.Append(BString(dbpath.Leaf()).Append("_").Append(CurrentDateTimeString()));
+        if((status = CopyDataBaseFile(dbpath, oldpath)) != B_OK) {
+            fprintf(stderr, "Error: the old database file could not be kept.\n");
+            BEntry(restorepath.Path()).Remove();
+            return status;
+        }
+    }
+
+    // Renaming over the database replaces it atomically
+    if((status = BEntry(restorepath.Path()).Rename(dbpath.Leaf(), true)) != B_OK) {
+        fprintf(stderr, "Error: the restored file could not take the place of the database.\n");
+        BEntry(restorepath.Path()).Remove();
+        return status;
+    }
+
+    // The rename itself only lasts once the directory is on disk
+    BPath parent;
+    BDirectory directory;
+    if((status = dbpath.GetParent(&parent)) == B_OK &&
+    (status = directory.SetTo(parent.Path())) == B_OK)
+        status = directory.Sync();
+    if(status != B_OK) {
+        fprintf(stderr, "Error: the database directory could not be written to disk.\n");
+        return status;
+    }
+
+    return B_OK;
+}
+
+/* CopyDataBaseFile: streamed like a plain backup, and flushed to disk */
+status_t CopyDataBaseFile(const BPath& from, const BPath& to)
+{
+    BFile infile(from.Path(), B_READ_ONLY);
+    BFile outfile(to.Path(), B_READ_WRITE | B_CREATE_FILE | B_ERASE_FILE);
+    off_t size = 0;
+    status_t status = infile.InitCheck();
+    if(status == B_OK)
+        status = outfile.InitCheck();
+    if(status == B_OK)
+        status = infile.GetSize(&size);
+    if(status != B_OK)
+        return status;
+
+    DataPipeline pipeline;
+    status = pipeline.Run(&infile, 0, size, &outfile,
+        [](const uint8* in, size_t inlength, uint8* out, size_t* outlength) {
+            memcpy(out, in, inlength);
+            *outlength = inlength;
+            return B_OK;
+        });
+    if(status == B_OK && pipeline.BytesWritten() != size)
+        status = B_IO_ERROR;
+    if(status == B_OK)
+        status = outfile.Sync();
+    if(status != B_OK) {
+        outfile.Unset();
+        BEntry(to.Path()).Remove();
+    }
+    return status;
+}
+
 // #if defined(USE_OPENSSL)
 
+/* DecryptBackup: the encrypted backup told by the metadata is decompressed
+    as it is decrypted, and hashed as it is written. Backups older than the
+    hashes in the metadata cannot be checked. */
+status_t DecryptBackup(const BMessage& metadata, const char* cryptopath,
+    const char* password, BDataIO* out, const progress_func& progress)
+{
+    BString originalfn, ivec;
+    if(metadata.FindString("original_file_name", &originalfn) != B_OK ||
+    metadata.FindString("ivec", &ivec) != B_OK) {
+        fprintf(stderr, "Error: bad data. Unrecognized data file or the file has missing fields.\n");
+        return B_BAD_DATA;
+    }
+
+    BFile cryptofile(cryptopath, B_READ_ONLY);
+    if(cryptofile.InitCheck() != B_OK) {
+        fprintf(stderr, "Error: could not open %s.\n", cryptopath);
+        return B_ENTRY_NOT_FOUND;
+    }
+    ssize_t inlength = 0;
+    cryptofile.GetSize(&inlength);
+
+    // Backups without a cipher or a codec field predate the chunked format
+    //  and the compression
+    BString cipher(metadata.GetString("cipher", kCipherAESCBC));
+    BString codec(metadata.GetString("codec", kCodecNone));
+    if(codec != kCodecNone && codec != kCodecZlib) {
+        fprintf(stderr, "Error: unknown codec %s.\n", codec.String());
+        return B_NOT_SUPPORTED;
+    }
+
+    DigestIO digestout(out);
+    DecompressingIO decompressor(&digestout);
+    BDataIO* plainout = codec == kCodecZlib ? (BDataIO*)&decompressor : &digestout;
+    ProgressIO input(&cryptofile, inlength, progress);
+    BMallocIO outdp, outiv;
+    status_t status = B_OK;
+    if(cipher == kCipherAESGCMChunked)
+        status = DecryptDataChunked(&input, inlength, password, plainout);
+    else if(cipher == kCipherAESCBC)
+        status = DecryptData(&input, inlength, password, (const unsigned char*)ivec.String(), plainout, &outdp, &outiv);
+    else {
+        fprintf(stderr, "Error: unknown cipher %s.\n", cipher.String());
+        return B_NOT_SUPPORTED;
+    }
+    if(status == B_OK && codec == kCodecZlib)
+        status = decompressor.Finish();
+    if(status != B_OK) {
+        fprintf(stderr, "Error: decryption error.\n");
+        return input.Cancelled() ? B_CANCELED : B_ERROR;
+    }
+
+    BString originalhash(metadata.GetString("original_file_hash", ""));
+    if(!originalhash.IsEmpty() && digestout.Hashstring() != originalhash) {
+        fprintf(stderr, "Error: the decrypted database does not match the hash of the backup.\n");
+        return B_BAD_DATA;
+    }
+
+    return B_OK;
+}
+
 status_t WriteMetadata(const char* basepath, const char* original_filename,
-    ssize_t inlenght, const char* target_filename, const char* pass, const char* iv,
-    const unsigned char* derived_pass, const unsigned char* derived_iv)
+    const char* target_filename, const char* pass, const char* iv,
+    const unsigned char* derived_pass, const unsigned char* derived_iv,
+    const char* cipher, const char* codec, int32 level,
+    const crypto_digests& digests)
 {
     BMessage metadata;
+    metadata.AddString("cipher", cipher);
+    metadata.AddString("codec", codec);
+    metadata.AddInt32("codec_level", level);
     metadata.AddString("base_path", basepath);
     metadata.AddString("original_file_name", original_filename);
     metadata.AddString("target_file_name", target_filename);
@@ -256,29 +731,11 @@ status_t WriteMetadata(const char* basepath, const char* original_filename,
     metadata.AddData("hashed_pass", B_RAW_TYPE, derived_pass, strlen((const char*)derived_pass));
     metadata.AddData("hashed_ivec", B_RAW_TYPE, derived_iv, strlen((const char*)derived_iv));
 
-    BPath path(basepath, original_filename, true);
-    BFile infile(path.Path(), B_READ_ONLY);
-
-    infile.Lock();
-    BMallocIO sum;
-    SHA256CheckSum(&infile, inlenght, &sum);
-    const char* sumstring = HashToHashstring((const unsigned char*)sum.Buffer(), sum.BufferLength());
-    infile.Unlock();
-
-    metadata.AddString("original_file_hash", sumstring);
-
-    BPath outpath(basepath, target_filename, true);
-    BFile outfile(outpath.Path(), B_READ_ONLY);
-
-    outfile.Lock();
-    ssize_t outlength = 0;
-    outfile.GetSize(&outlength);
-    BMallocIO tgsum;
-    SHA256CheckSum(&outfile, outlength, &tgsum);
-    const char* tgsumstring = HashToHashstring((const unsigned char*)tgsum.Buffer(), tgsum.BufferLength());
-    outfile.Unlock();
-
-    metadata.AddString("target_file_hash", tgsumstring);
+    // Taken while encrypting, the files are not read again
+    metadata.AddString("original_file_hash",
+        HashToHashstring(digests.input, sizeof(digests.input)));
+    metadata.AddString("target_file_hash",
+        HashToHashstring(digests.output, sizeof(digests.output)));
 
     BPath targetfilepath(target_filename);
     BPath parentpath;
@@ -5,13 +5,61 @@
 #ifndef __BACKUP_UTILS_H_
 #define __BACKUP_UTILS_H_
 
+#include <DataIO.h>
+#include <Message.h>
 #include <Path.h>
+#include <String.h>
 #include <SupportDefs.h>
+#include <functional>
+#include "Compression.h"
 
-status_t DoPlainKeystoreBackup();
-status_t DoEncryptedKeystoreBackup(const char* password);
-status_t RestoreEncryptedKeystoreBackup(const char* path, const char* password);
+enum backup_cipher {
+    BACKUP_CIPHER_AES_CBC = 0,      // a single AES-256-CBC stream
+    BACKUP_CIPHER_AES_GCM_CHUNKED   // AES-256-GCM chunks, made in parallel
+};
+
+// Values of the cipher and codec fields of the metadata of a backup
+static const char* const kCipherAESCBC = "aes-256-cbc";
+static const char* const kCipherAESGCMChunked = "aes-256-gcm-chunked";
+static const char* const kCodecNone = "none";
+static const char* const kCodecZlib = "zlib";
+
+/* Told of the bytes done out of the total every now and then, maybe from
+    several threads at once. Returning false stops the operation, which then
+    fails with B_CANCELED and leaves nothing behind. */
+typedef std::function<bool(off_t done, off_t total)> progress_func;
+
+status_t DoPlainKeystoreBackup(const progress_func& progress = nullptr);
+// The compression level only applies to BACKUP_CIPHER_AES_CBC
+status_t DoEncryptedKeystoreBackup(const char* password,
+    backup_cipher cipher = BACKUP_CIPHER_AES_CBC,
+    int32 compression = kNoCompression,
+    const progress_func& progress = nullptr);
+status_t RestoreEncryptedKeystoreBackup(const char* path, const char* password,
+    const progress_func& progress = nullptr);
+// Deduplicated snapshots in the backup repository, see BackupRepository
+status_t DoRepositoryKeystoreBackup(BString* snapshot = nullptr,
+    const progress_func& progress = nullptr);
+status_t RestoreRepositoryKeystoreBackup(const char* manifestpath,
+    const progress_func& progress = nullptr);
+/* Reads the database out of any backup, by the path of a plain copy, of the
+    metadata file of an encrypted backup, which needs the password, or of
+    the manifest of a snapshot. */
+status_t ReadKeystoreBackup(const char* path, const char* password,
+    BMallocIO* database, const progress_func& progress = nullptr);
+/* Reads the keys selected out of a backup into a message with a field per
+    keyring, named after it, with its flattened keys. The selection has a
+    kConfigKeyring for every keyring or key chosen, and a kConfigKeyName and
+    kConfigKeyAltName at the same index, empty for the whole keyring. A true
+    "any_secondary" at that index takes the key whatever its secondary
+    identifier is. */
+status_t ReadKeystoreBackupKeys(const char* path, const char* password,
+    const BMessage& selection, BMessage* keys,
+    const progress_func& progress = nullptr);
 
 status_t DBPath(BPath* path);
+status_t BackupRepositoryPath(BPath* path);
+// Every backup made is recorded there, see BackupCatalog
+status_t BackupCatalogPath(BPath* path);
 
 #endif /* __BACKUP_UTILS_H_ */
@@ -0,0 +1,327 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#include <ByteOrder.h>
+#include <DataIO.h>
+#include <File.h>
+#include <OS.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <zlib.h>
+#include "BackupCatalog.h"
+
+/* Layout, little endian:
+    header:  magic[8]
+    records: length:uint32 crc32:uint32 body[length]
+    body:    type:uint8 time:int64, then
+        backup:        kind:uint8 flags:uint8 original_size:int64
+                       stored_size:int64 original_hash[32] stored_hash[32]
+                       name cipher codec
+        verification:  result:int32 name
+    strings: length:uint16 data[length]
+*/
+static const char kCatalogMagic[8] = { 'K', 'E', 'Y', 'S', 'C', 'T', 'L', '1' };
+static const uint8 kRecordBackup = 1;
+static const uint8 kRecordVerification = 2;
+static const uint8 kFlagHasHashes = 0x01;
+static const size_t kRecordHeaderSize = 8;
+static const size_t kMaxRecordSize = 64 * 1024;
+
+catalog_entry::catalog_entry()
+: kind(BACKUP_KIND_PLAIN),
+  time(0),
+  originalSize(0),
+  storedSize(0),
+  hasHashes(false),
+  verifiedTime(0),
+  verification(B_OK)
+{
+    memset(originalHash, 0, sizeof(originalHash));
+    memset(storedHash, 0, sizeof(storedHash));
+}
+
+// Record building and parsing
+
+static void WriteUInt8(BMallocIO& out, uint8 value)
+{
+    out.Write(&value, sizeof(value));
+}
+
+static void WriteInt32(BMallocIO& out, int32 value)
+{
+    value = B_HOST_TO_LENDIAN_INT32(value);
+    out.Write(&value, sizeof(value));
+}
+
+static void WriteInt64(BMallocIO& out, int64 value)
+{
+    value = B_HOST_TO_LENDIAN_INT64(value);
+    out.Write(&value, sizeof(value));
+}
+
+static void WriteString(BMallocIO& out, const BString& string)
+{
+    uint16 length = string.Length() > 0xffff ? 0xffff : string.Length();
+    uint16 value = B_HOST_TO_LENDIAN_INT16(length);
+    out.Write(&value, sizeof(value));
+    out.Write(string.String(), length);
+}
+
+class RecordReader
+{
+public:
+    RecordReader(const uint8* data, size_t length)
+    : fData(data), fLength(length), fPosition(0), fFailed(false) {}
+
+    bool Failed() { return fFailed; }
+
+    const uint8* Take(size_t length)
+    {
+        if(fFailed || fLength - fPosition < length) {
+            fFailed = true;
+            return nullptr;
+        }
+        const uint8* data = fData + fPosition;
+        fPosition += length;
+        return data;
+    }
+    uint8 UInt8()
+    {
+        const uint8* data = Take(1);
+        return data ? *data : 0;
+    }
+    int32 Int32()
+    {
+        int32 value = 0;
+        if(const uint8* data = Take(sizeof(value)))
+            memcpy(&value, data, sizeof(value));
+        return B_LENDIAN_TO_HOST_INT32(value);
+    }
+    int64 Int64()
+    {
+        int64 value = 0;
+        if(const uint8* data = Take(sizeof(value)))
+            memcpy(&value, data, sizeof(value));
+        return B_LENDIAN_TO_HOST_INT64(value);
+    }
+    BString String()
+    {
+        uint16 length = 0;
+        if(const uint8* data = Take(sizeof(length)))
+            memcpy(&length, data, sizeof(length));
+        length = B_LENDIAN_TO_HOST_INT16(length);
+        const uint8* data = Take(length);
+        return data ? BString((const char*)data, length) : BString();
+    }
+private:
+    const uint8 *fData;
+    size_t      fLength,
+                fPosition;
+    bool        fFailed;
+};
+
+/* RecordsEnd: where the last record that is whole and matches its CRC ends,
+    0 if the data is not a catalog */
+static size_t RecordsEnd(const uint8* data, size_t length)
+{
+    if(length < sizeof(kCatalogMagic) ||
+    memcmp(data, kCatalogMagic, sizeof(kCatalogMagic)) != 0)
+        return 0;
+
+    size_t position = sizeof(kCatalogMagic);
+    while(position + kRecordHeaderSize <= length) {
+        uint32 recordLength, crc;
+        memcpy(&recordLength, data + position, 4);
+        memcpy(&crc, data + position + 4, 4);
+        recordLength = B_LENDIAN_TO_HOST_INT32(recordLength);
+        crc = B_LENDIAN_TO_HOST_INT32(crc);
+        if(recordLength > kMaxRecordSize ||
+        position + kRecordHeaderSize + recordLength > length ||
+        crc32(0, data + position + kRecordHeaderSize, recordLength) != crc)
+            break;
+        position += kRecordHeaderSize + recordLength;
+    }
+
+    return position;
+}
+
+// #pragma mark - BackupCatalog
+
+BackupCatalog::BackupCatalog(const char* path)
+: fPath(path)
+{
+}
+
+status_t BackupCatalog::AddBackup(const catalog_entry& entry)
+{
+    if(entry.name.IsEmpty())
+        return B_BAD_VALUE;
+
+    BMallocIO record;
+    WriteUInt8(record, kRecordBackup);
+    WriteInt64(record, entry.time > 0 ? entry.time : (int64)real_time_clock());
+    WriteUInt8(record, entry.kind);
+    WriteUInt8(record, entry.hasHashes ? kFlagHasHashes : 0);
+    WriteInt64(record, entry.originalSize);
+    WriteInt64(record, entry.storedSize);
+    record.Write(entry.originalHash, sizeof(entry.originalHash));
+    record.Write(entry.storedHash, sizeof(entry.storedHash));
+    WriteString(record, entry.name);
+    WriteString(record, entry.cipher);
+    WriteString(record, entry.codec);
+
+    return _Append(record.Buffer(), record.BufferLength());
+}
+
+status_t BackupCatalog::SetVerification(const char* name, status_t result, int64 time)
+{
+    if(!name || !*name)
+        return B_BAD_VALUE;
+
+    BMallocIO record;
+    WriteUInt8(record, kRecordVerification);
+    WriteInt64(record, time >= 0 ? time : (int64)real_time_clock());
+    WriteInt32(record, result);
+    WriteString(record, name);
+
+    return _Append(record.Buffer(), record.BufferLength());
+}
+
+status_t BackupCatalog::GetEntries(BObjectList<catalog_entry>* entries)
+{
+    if(!entries)
+        return B_BAD_VALUE;
+
+    BFile file(fPath.String(), B_READ_ONLY);
+    if(file.InitCheck() != B_OK) // No catalog, no backups yet
+        return file.InitCheck() == B_ENTRY_NOT_FOUND ? B_OK : file.InitCheck();
+
+    off_t size = 0;
+    if(file.GetSize(&size) != B_OK)
+        return B_ERROR;
+    if(size == 0)
+        return B_OK;
+
+    uint8* data = new uint8[size];
+    ssize_t read = file.ReadAt(0, data, size);
+    if(read < (ssize_t)sizeof(kCatalogMagic) ||
+    memcmp(data, kCatalogMagic, sizeof(kCatalogMagic)) != 0) {
+        delete[] data;
+        fprintf(stderr, "Error: %s is not a backup catalog.\n", fPath.String());
+        return B_BAD_DATA;
+    }
+
+    // A damaged end is left out here, and cut off by the next _Append()
+    size_t end = RecordsEnd(data, read);
+    if(end < (size_t)read)
+        fprintf(stderr, "Warning: the backup catalog is damaged past %zu bytes.\n", end);
+
+    // A backup made again under the same name takes the place of the old one
+    std::unordered_map<std::string, catalog_entry*> byname;
+    size_t position = sizeof(kCatalogMagic);
+    while(position < end) {
+        uint32 length;
+        memcpy(&length, data + position, 4);
+        length = B_LENDIAN_TO_HOST_INT32(length);
+        const uint8* body = data + position + kRecordHeaderSize;
+        position += kRecordHeaderSize + length;
+
+        RecordReader reader(body, length);
+        uint8 type = reader.UInt8();
+        int64 time = reader.Int64();
+        if(type == kRecordBackup) {
+            catalog_entry* entry = new catalog_entry;
+            entry->time = time;
+            entry->kind = (backup_kind)reader.UInt8();
+            entry->hasHashes = reader.UInt8() & kFlagHasHashes;
+            entry->originalSize = reader.Int64();
+            entry->storedSize = reader.Int64();
+            if(const uint8* hash = reader.Take(sizeof(entry->originalHash)))
+                memcpy(entry->originalHash, hash, sizeof(entry->originalHash));
+            if(const uint8* hash = reader.Take(sizeof(entry->storedHash)))
+                memcpy(entry->storedHash, hash, sizeof(entry->storedHash));
+            entry->name = reader.String();
+            entry->cipher = reader.String();
+            entry->codec = reader.String();
+            if(reader.Failed()) {
+                delete entry;
+                continue;
+            }
+
+            auto found = byname.find(entry->name.String());
+            if(found != byname.end()) {
+                entries->RemoveItem(found->second, true);
+                found->second = entry;
+            }
+            else
+                byname[entry->name.String()] = entry;
+            entries->AddItem(entry);
+        }
+        else if(type == kRecordVerification) {
+            status_t result = reader.Int32();
+            BString name(reader.String());
+            auto found = byname.find(name.String());
+            if(reader.Failed() || found == byname.end())
+                continue;
+            found->second->verifiedTime = time;
+            found->second->verification = result;
+        }
+        // Records of unknown types are skipped, they come from a newer version
+    }
+    delete[] data;
+
+    return B_OK;
+}
+
+// #pragma mark - Private
+
+/* _Append: the whole record goes in one write after the last good record.
+    A record torn by a crash is cut off first, or it would hide every record
+    written after it. */
+status_t BackupCatalog::_Append(const void* record, size_t length)
+{
+    if(length > kMaxRecordSize)
+        return B_BAD_VALUE;
+
+    BFile file(fPath.String(), B_READ_WRITE | B_CREATE_FILE);
+    status_t status = file.InitCheck();
+    if(status != B_OK)
+        return status;
+
+    off_t size = 0;
+    if((status = file.GetSize(&size)) != B_OK)
+        return status;
+
+    off_t end = 0;
+    if(size > 0) {
+        uint8* data = new uint8[size];
+        ssize_t read = file.ReadAt(0, data, size);
+        end = read == size ? RecordsEnd(data, size) : 0;
+        delete[] data;
+        if(end == 0) {
+            fprintf(stderr, "Error: %s is not a backup catalog.\n", fPath.String());
+            return B_BAD_DATA;
+        }
+        if(end < size) {
+            fprintf(stderr, "Warning: the damaged end of the backup catalog is cut off.\n");
+            if((status = file.SetSize(end)) != B_OK)
+                return status;
+        }
+    }
+
+    BMallocIO buffer;
+    if(end == 0)
+        buffer.Write(kCatalogMagic, sizeof(kCatalogMagic));
+    uint32 value = B_HOST_TO_LENDIAN_INT32((uint32)length);
+    buffer.Write(&value, sizeof(value));
+    value = B_HOST_TO_LENDIAN_INT32((uint32)crc32(0, (const Bytef*)record, length));
+    buffer.Write(&value, sizeof(value));
+    buffer.Write(record, length);
+
+    if(file.WriteAt(end, buffer.Buffer(), buffer.BufferLength()) != (ssize_t)buffer.BufferLength())
+        return B_IO_ERROR;
+    return file.Sync();
+}
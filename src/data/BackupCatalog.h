@@ -0,0 +1,60 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef __BACKUP_CATALOG_H_
+#define __BACKUP_CATALOG_H_
+
+#include <ObjectList.h>
+#include <String.h>
+#include <SupportDefs.h>
+
+enum backup_kind {
+    BACKUP_KIND_PLAIN = 0,      // keystore_database_<date>
+    BACKUP_KIND_ENCRYPTED,      // keystore_database_<date>.crypt and its .dat
+    BACKUP_KIND_SNAPSHOT        // a snapshot of the backup repository
+};
+
+struct catalog_entry {
+    BString     name;           // of the backup file, or of the snapshot
+    backup_kind kind;
+    int64       time;           // seconds since the epoch
+    off_t       originalSize,
+                storedSize;     // what it took on disk, new chunks for a snapshot
+    bool        hasHashes;
+    uint8       originalHash[32],
+                storedHash[32];
+    BString     cipher,
+                codec;
+    int64       verifiedTime;   // 0 if it was never verified
+    status_t    verification;
+
+                catalog_entry();
+};
+
+/* An append-only list of the backups made, so they can be listed without
+    looking for them and opening every one of them.
+
+    The file is a header followed by records, each with its length and a
+    CRC-32 in front. A record adds a backup, or the result of verifying one;
+    later records win, so nothing is ever rewritten. A record cut short by
+    a crash ends the catalog there, until the next record is added in its
+    place.
+*/
+class BackupCatalog
+{
+public:
+                BackupCatalog(const char* path);
+
+    status_t    AddBackup(const catalog_entry& entry);
+    status_t    SetVerification(const char* name, status_t result,
+                    int64 time = -1);
+    // All of the backups, the oldest first, out of one sequential read
+    status_t    GetEntries(BObjectList<catalog_entry>* entries);
+private:
+    status_t    _Append(const void* record, size_t length);
+private:
+    BString     fPath;
+};
+
+#endif /* __BACKUP_CATALOG_H_ */
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#include <Autolock.h>
+#include "BackupJobQueue.h"
+#include "../KeysDefs.h"
+
+static const bigtime_t kProgressInterval = 250000;
+
+BackupJobQueue::BackupJobQueue(BMessenger target)
+: fTarget(target),
+  fLock("backup jobs"),
+  fNextID(1),
+  fRunning(-1),
+  fCancelRunning(false),
+  fWorker(-1),
+  fStarted(0),
+  fLastReport(0)
+{
+}
+
+// The job being run is cancelled too, and waited for
+BackupJobQueue::~BackupJobQueue()
+{
+    CancelAll();
+
+    fLock.Lock();
+    thread_id worker = fWorker;
+    fLock.Unlock();
+    if(worker >= 0) {
+        status_t result;
+        wait_for_thread(worker, &result);
+    }
+}
+
+// AddJob: returns the ID of the job, or an error
+int32 BackupJobQueue::AddJob(uint32 what, const job_func& job)
+{
+    if(!job)
+        return B_BAD_VALUE;
+
+    BAutolock lock(fLock);
+    backup_job entry = { fNextID++, what, job };
+    fQueue.push_back(entry);
+
+    // The worker leaves once the queue is empty, and comes back with a new job
+    if(fWorker < 0) {
+        fWorker = spawn_thread(_CallWorker, "backup jobs", B_LOW_PRIORITY, this);
+        if(fWorker < 0 || resume_thread(fWorker) != B_OK) {
+            status_t status = fWorker < 0 ? fWorker : B_ERROR;
+            fWorker = -1;
+            fQueue.pop_back();
+            return status;
+        }
+    }
+
+    return entry.id;
+}
+
+// Cancel: a queued job is dropped, a running one stops at its next progress
+status_t BackupJobQueue::Cancel(int32 id)
+{
+    BAutolock lock(fLock);
+    if(id == fRunning) {
+        fCancelRunning = true;
+        return B_OK;
+    }
+
+    for(auto job = fQueue.begin(); job != fQueue.end(); job++) {
+        if(job->id == id) {
+            backup_job cancelled = *job;
+            fQueue.erase(job);
+            BMessage result(M_JOB_FINISHED);
+            _Finish(cancelled, &result, B_CANCELED);
+            return B_OK;
+        }
+    }
+
+    return B_ENTRY_NOT_FOUND;
+}
+
+void BackupJobQueue::CancelAll()
+{
+    BAutolock lock(fLock);
+    while(!fQueue.empty())
+        Cancel(fQueue.front().id);
+    if(fRunning >= 0)
+        fCancelRunning = true;
+}
+
+// CountJobs: the queued ones and the one running
+int32 BackupJobQueue::CountJobs()
+{
+    BAutolock lock(fLock);
+    return fQueue.size() + (fRunning >= 0 ? 1 : 0);
+}
+
+// #pragma mark - Private
+
+int32 BackupJobQueue::_CallWorker(void* data)
+{
+    static_cast<BackupJobQueue*>(data)->_Work();
+    return 0;
+}
+
+void BackupJobQueue::_Work()
+{
+    while(true) {
+        fLock.Lock();
+        if(fQueue.empty()) {
+            fRunning = -1;
+            fWorker = -1;
+            fLock.Unlock();
+            return;
+        }
+        backup_job job = fQueue.front();
+        fQueue.pop_front();
+        fRunning = job.id;
+        fCancelRunning = false;
+        fLock.Unlock();
+
+        fStarted = system_time();
+        fLastReport = 0;
+        BMessage result(M_JOB_FINISHED);
+        status_t status = job.work(
+            [&](off_t done, off_t total) {
+                return _Progress(job, done, total);
+            }, &result);
+        // Work cancelled at its very end may still have been finished
+        if(status != B_OK && fCancelRunning)
+            status = B_CANCELED;
+
+        fLock.Lock();
+        fRunning = -1;
+        fLock.Unlock();
+        _Finish(job, &result, status);
+    }
+}
+
+/* _Progress: may be called by several threads of a job at once, and only
+    one of them gets to report at a time. */
+bool BackupJobQueue::_Progress(const backup_job& job, off_t done, off_t total)
+{
+    if(fCancelRunning)
+        return false;
+
+    bigtime_t now = system_time();
+    bigtime_t last = fLastReport;
+    if(now - last < kProgressInterval || !fLastReport.compare_exchange_strong(last, now))
+        return true;
+
+    // bytes per microsecond are MB/s
+    bigtime_t elapsed = now - fStarted;
+    double rate = elapsed > 0 ? done / (double)elapsed : 0.0;
+    BMessage progress(M_JOB_PROGRESS);
+    progress.AddInt32(kConfigJob, job.id);
+    progress.AddInt32(kConfigWhat, job.what);
+    progress.AddInt64(kConfigJobDone, done);
+    progress.AddInt64(kConfigJobTotal, total);
+    progress.AddDouble(kConfigJobRate, rate);
+    progress.AddInt64(kConfigJobETA, rate > 0 && total > done
+        ? (bigtime_t)((total - done) / rate) : 0);
+    // Left out rather than waited for when the target is busy
+    fTarget.SendMessage(&progress, (BHandler*)NULL, 0);
+
+    return !fCancelRunning;
+}
+
+void BackupJobQueue::_Finish(const backup_job& job, BMessage* result, status_t status)
+{
+    result->what = M_JOB_FINISHED;
+    result->AddInt32(kConfigJob, job.id);
+    result->AddInt32(kConfigWhat, job.what);
+    result->AddInt32(kConfigResult, status);
+    fTarget.SendMessage(result);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef __BACKUP_JOB_QUEUE_H_
+#define __BACKUP_JOB_QUEUE_H_
+
+#include <Locker.h>
+#include <Message.h>
+#include <Messenger.h>
+#include <OS.h>
+#include <SupportDefs.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include "BackUpUtils.h"
+
+/* Runs backups and restores one after the other in a thread of its own, in
+    the order they were added, so the looper that adds them never waits.
+
+    Every job gets an ID. While it runs the target gets M_JOB_PROGRESS
+    messages with the bytes done, the total, the rate in MB/s and the time
+    left, a few times per second at most. When it ends, or is cancelled
+    before it started, the target gets a M_JOB_FINISHED message with its
+    result, along with whatever the job added to it.
+*/
+class BackupJobQueue
+{
+public:
+    typedef std::function<status_t(const progress_func& progress,
+        BMessage* result)> job_func;
+
+                BackupJobQueue(BMessenger target);
+               ~BackupJobQueue();
+
+    int32       AddJob(uint32 what, const job_func& job);
+    status_t    Cancel(int32 id);
+    void        CancelAll();
+    int32       CountJobs();
+private:
+    struct backup_job {
+        int32       id;
+        uint32      what;
+        job_func    work;
+    };
+
+    static int32 _CallWorker(void* data);
+    void        _Work();
+    bool        _Progress(const backup_job& job, off_t done, off_t total);
+    void        _Finish(const backup_job& job, BMessage* result, status_t status);
+private:
+    BMessenger  fTarget;
+    BLocker     fLock;
+    std::deque<backup_job> fQueue;
+    int32       fNextID,
+                fRunning;       // -1 if none
+    std::atomic<bool> fCancelRunning;
+    thread_id   fWorker;
+
+    bigtime_t   fStarted;
+    std::atomic<bigtime_t> fLastReport;
+};
+
+#endif /* __BACKUP_JOB_QUEUE_H_ */
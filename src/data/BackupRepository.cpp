@@ -0,0 +1,405 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#include <Directory.h>
+#include <Entry.h>
+#include <File.h>
+#include <Message.h>
+#include <OS.h>
+#include <cstdio>
+#include <openssl/evp.h>
+#include "BackupRepository.h"
+#include "CryptoUtils.h"
+
+static const size_t kDigestSize = 32;
+// Enough to always have a whole chunk of the largest size ahead
+static const size_t kRepositoryBufferSize = 16 * kMaxBackupChunkSize;
+/* Normalized chunking: before the average size a cut point is harder to
+    find than after it, which keeps most chunks close to the average. The
+    masks take the highest bits, which depend on the last 64 bytes. */
+static const uint64 kHardChunkMask = ~0ULL << (64 - 16);
+static const uint64 kEasyChunkMask = ~0ULL << (64 - 12);
+
+static uint64 sGear[256];
+
+static void InitGear();
+static size_t NextChunkLength(const uint8* data, size_t length);
+
+BackupRepository::BackupRepository(const char* path)
+: fInitStatus(B_NO_INIT)
+{
+    if(!path || fPath.SetTo(path) != B_OK)
+        return;
+
+    BPath chunks(fPath.Path(), "chunks"), snapshots(fPath.Path(), "snapshots");
+    if(create_directory(chunks.Path(), 0700) != B_OK ||
+    create_directory(snapshots.Path(), 0700) != B_OK) {
+        fprintf(stderr, "Error: could not create the backup repository at %s.\n", path);
+        fInitStatus = B_ERROR;
+        return;
+    }
+
+    InitGear();
+    fInitStatus = B_OK;
+}
+
+status_t BackupRepository::InitCheck()
+{
+    return fInitStatus;
+}
+
+const char* BackupRepository::Path()
+{
+    return fPath.Path();
+}
+
+/* StoreSnapshot: cuts length bytes of data in chunks, stores the ones the
+    repository does not have yet, and writes the manifest of the snapshot.
+*/
+status_t BackupRepository::StoreSnapshot(const char* name, BPositionIO* data,
+    off_t length, int32* newchunks, off_t* newbytes)
+{
+    if(fInitStatus != B_OK)
+        return fInitStatus;
+    if(!name || !data || length < 0 || strchr(name, '/'))
+        return B_BAD_VALUE;
+
+    BPath manifestpath;
+    if(SnapshotPath(name, &manifestpath) != B_OK)
+        return B_BAD_VALUE;
+    if(BEntry(manifestpath.Path()).Exists())
+        return B_FILE_EXISTS;
+
+    EVP_MD_CTX* context = EVP_MD_CTX_new();
+    if(!context || EVP_DigestInit_ex(context, EVP_sha256(), NULL) != 1) {
+        if(context)
+            EVP_MD_CTX_free(context);
+        return B_NO_MEMORY;
+    }
+
+    BMessage manifest(BACKUP_MANIFEST);
+    manifest.AddString("name", name);
+    manifest.AddInt64("date", real_time_clock());
+    manifest.AddInt64("length", length);
+
+    uint8* buffer = new uint8[kRepositoryBufferSize];
+    size_t start = 0, end = 0;
+    off_t readlength = 0;
+    int32 added = 0;
+    off_t addedbytes = 0;
+    status_t status = B_OK;
+    while(status == B_OK && (readlength < length || start < end)) {
+        // Refill once less than a chunk of the largest size is left
+        if(readlength < length && end - start < kMaxBackupChunkSize) {
+            memmove(buffer, buffer + start, end - start);
+            end -= start;
+            start = 0;
+            size_t wanted = kRepositoryBufferSize - end;
+            if((off_t)wanted > length - readlength)
+                wanted = length - readlength;
+            ssize_t read = data->ReadAt(readlength, buffer + end, wanted);
+            if(read <= 0) {
+                fprintf(stderr, "Error: bad read at %" B_PRIdOFF ".\n", readlength);
+                status = read < 0 ? read : B_IO_ERROR;
+                break;
+            }
+            if(EVP_DigestUpdate(context, buffer + end, read) != 1) {
+                status = B_ERROR;
+                break;
+            }
+            end += read;
+            readlength += read;
+            continue;
+        }
+
+        size_t chunklength = NextChunkLength(buffer + start, end - start);
+        unsigned char digest[kDigestSize];
+        unsigned int digestlength = 0;
+        if(EVP_Digest(buffer + start, chunklength, digest, &digestlength,
+        EVP_sha256(), NULL) != 1) {
+            status = B_ERROR;
+            break;
+        }
+
+        bool stored = false;
+        if((status = _StoreChunk(digest, buffer + start, chunklength, &stored)) != B_OK)
+            break;
+        if(stored) {
+            added++;
+            addedbytes += chunklength;
+        }
+        manifest.AddData("chunk", B_RAW_TYPE, digest, kDigestSize);
+        manifest.AddInt32("chunk_length", chunklength);
+        start += chunklength;
+    }
+    delete[] buffer;
+
+    unsigned char digest[kDigestSize];
+    unsigned int digestlength = 0;
+    if(status == B_OK && EVP_DigestFinal_ex(context, digest, &digestlength) != 1)
+        status = B_ERROR;
+    EVP_MD_CTX_free(context);
+    if(status != B_OK)
+        return status;
+    manifest.AddData("hash", B_RAW_TYPE, digest, kDigestSize);
+
+    // The manifest only shows up once it is whole
+    BPath temppath(BString(manifestpath.Path()).Append(".tmp").String());
+    BFile manifestfile(temppath.Path(), B_READ_WRITE | B_CREATE_FILE | B_ERASE_FILE);
+    if((status = manifestfile.InitCheck()) != B_OK ||
+    (status = manifest.Flatten(&manifestfile)) != B_OK ||
+    (status = manifestfile.Sync()) != B_OK) {
+        manifestfile.Unset();
+        BEntry(temppath.Path()).Remove();
+        return status;
+    }
+    manifestfile.Unset();
+    if((status = BEntry(temppath.Path()).Rename(manifestpath.Leaf(), false)) != B_OK) {
+        BEntry(temppath.Path()).Remove();
+        return status;
+    }
+
+    if(newchunks)
+        *newchunks = added;
+    if(newbytes)
+        *newbytes = addedbytes;
+    return B_OK;
+}
+
+/* RestoreSnapshot: writes the chunks of a snapshot in order, checking every
+    one of them and the whole, so a damaged repository is not silently restored.
+*/
+status_t BackupRepository::RestoreSnapshot(const char* name, BDataIO* out)
+{
+    if(fInitStatus != B_OK)
+        return fInitStatus;
+    if(!name || !out)
+        return B_BAD_VALUE;
+
+    BPath manifestpath;
+    if(SnapshotPath(name, &manifestpath) != B_OK)
+        return B_BAD_VALUE;
+    BFile manifestfile(manifestpath.Path(), B_READ_ONLY);
+    BMessage manifest;
+    if(manifestfile.InitCheck() != B_OK || manifest.Unflatten(&manifestfile) != B_OK ||
+    manifest.what != BACKUP_MANIFEST) {
+        fprintf(stderr, "Error: %s is not a snapshot of the repository.\n", name);
+        return B_BAD_DATA;
+    }
+
+    const void* hash = nullptr;
+    ssize_t hashlength = 0;
+    off_t length = 0;
+    if(manifest.FindData("hash", B_RAW_TYPE, &hash, &hashlength) != B_OK ||
+    hashlength != (ssize_t)kDigestSize ||
+    manifest.FindInt64("length", &length) != B_OK) {
+        fprintf(stderr, "Error: the manifest of %s has missing fields.\n", name);
+        return B_BAD_DATA;
+    }
+
+    EVP_MD_CTX* context = EVP_MD_CTX_new();
+    if(!context || EVP_DigestInit_ex(context, EVP_sha256(), NULL) != 1) {
+        if(context)
+            EVP_MD_CTX_free(context);
+        return B_NO_MEMORY;
+    }
+
+    uint8* buffer = new uint8[kMaxBackupChunkSize];
+    off_t written = 0;
+    status_t status = B_OK;
+    const void* chunk = nullptr;
+    ssize_t chunksize = 0;
+    for(int32 i = 0; status == B_OK &&
+    manifest.FindData("chunk", B_RAW_TYPE, i, &chunk, &chunksize) == B_OK; i++) {
+        int32 chunklength = manifest.GetInt32("chunk_length", i, -1);
+        BPath chunkpath;
+        if(chunksize != (ssize_t)kDigestSize || chunklength < 0 ||
+        chunklength > (int32)kMaxBackupChunkSize ||
+        _ChunkPath((const unsigned char*)chunk, &chunkpath) != B_OK) {
+            status = B_BAD_DATA;
+            break;
+        }
+
+        BFile chunkfile(chunkpath.Path(), B_READ_ONLY);
+        unsigned char digest[kDigestSize];
+        unsigned int digestlength = 0;
+        if(chunkfile.InitCheck() != B_OK ||
+        chunkfile.ReadAt(0, buffer, chunklength) != chunklength ||
+        EVP_Digest(buffer, chunklength, digest, &digestlength, EVP_sha256(), NULL) != 1 ||
+        memcmp(digest, chunk, kDigestSize) != 0) {
+            fprintf(stderr, "Error: chunk %s is missing or damaged.\n",
+                HashToHashstring((const unsigned char*)chunk, kDigestSize).String());
+            status = B_BAD_DATA;
+            break;
+        }
+
+        if(EVP_DigestUpdate(context, buffer, chunklength) != 1)
+            status = B_ERROR;
+        else if(out->Write(buffer, chunklength) != chunklength)
+            status = B_IO_ERROR;
+        written += chunklength;
+    }
+    delete[] buffer;
+
+    unsigned char digest[kDigestSize];
+    unsigned int digestlength = 0;
+    if(status == B_OK && (EVP_DigestFinal_ex(context, digest, &digestlength) != 1 ||
+    written != length || memcmp(digest, hash, kDigestSize) != 0)) {
+        fprintf(stderr, "Error: the restored snapshot %s does not match its manifest.\n", name);
+        status = B_BAD_DATA;
+    }
+    EVP_MD_CTX_free(context);
+
+    return status;
+}
+
+status_t BackupRepository::GetSnapshots(BStringList* names)
+{
+    if(fInitStatus != B_OK)
+        return fInitStatus;
+    if(!names)
+        return B_BAD_VALUE;
+
+    BDirectory snapshots(BPath(fPath.Path(), "snapshots").Path());
+    if(snapshots.InitCheck() != B_OK)
+        return snapshots.InitCheck();
+
+    BEntry entry;
+    char name[B_FILE_NAME_LENGTH];
+    while(snapshots.GetNextEntry(&entry) == B_OK) {
+        if(entry.GetName(name) != B_OK)
+            continue;
+        BString snapshot(name);
+        if(!snapshot.EndsWith(".tmp"))
+            names->Add(snapshot);
+    }
+    names->Sort();
+
+    return B_OK;
+}
+
+status_t BackupRepository::SnapshotPath(const char* name, BPath* path)
+{
+    if(!name || !path || strchr(name, '/'))
+        return B_BAD_VALUE;
+    return path->SetTo(BPath(fPath.Path(), "snapshots").Path(), name);
+}
+
+// #pragma mark - Private
+
+status_t BackupRepository::_ChunkPath(const unsigned char* digest, BPath* path,
+    bool create)
+{
+    BString hex(HashToHashstring(digest, kDigestSize));
+    BString prefix;
+    hex.CopyInto(prefix, 0, 2);
+    BPath directory(BPath(fPath.Path(), "chunks").Path(), prefix.String());
+    if(create) {
+        status_t status = create_directory(directory.Path(), 0700);
+        if(status != B_OK)
+            return status;
+    }
+    return path->SetTo(directory.Path(), hex.String());
+}
+
+/* _StoreChunk: a chunk already in the repository is left alone once its
+    contents are checked, and one that does not match is written again. New
+    chunks are synced with their directory before the manifest that lists
+    them is written, so a manifest never outlives its chunks. */
+status_t BackupRepository::_StoreChunk(const unsigned char* digest, const uint8* data,
+    size_t length, bool* stored)
+{
+    *stored = false;
+    BPath chunkpath;
+    status_t status = _ChunkPath(digest, &chunkpath, true);
+    if(status != B_OK)
+        return status;
+
+    off_t size = -1;
+    BEntry entry(chunkpath.Path());
+    if(entry.Exists() && entry.GetSize(&size) == B_OK && size == (off_t)length) {
+        BFile existing(chunkpath.Path(), B_READ_ONLY);
+        uint8* contents = new uint8[length];
+        bool same = existing.InitCheck() == B_OK &&
+            existing.ReadAt(0, contents, length) == (ssize_t)length &&
+            memcmp(contents, data, length) == 0;
+        delete[] contents;
+        if(same)
+            return B_OK;
+        fprintf(stderr, "Warning: chunk %s is damaged, it is written again.\n",
+            chunkpath.Leaf());
+    }
+
+    // Written aside and moved in place, so a chunk is either whole or missing
+    BPath temppath(BString(chunkpath.Path()).Append(".tmp").String());
+    BFile chunkfile(temppath.Path(), B_READ_WRITE | B_CREATE_FILE | B_ERASE_FILE);
+    if((status = chunkfile.InitCheck()) != B_OK)
+        return status;
+    if(chunkfile.Write(data, length) != (ssize_t)length ||
+    (status = chunkfile.Sync()) != B_OK) {
+        chunkfile.Unset();
+        BEntry(temppath.Path()).Remove();
+        return status != B_OK ? status : B_IO_ERROR;
+    }
+    chunkfile.Unset();
+    if((status = BEntry(temppath.Path()).Rename(chunkpath.Leaf(), true)) != B_OK) {
+        BEntry(temppath.Path()).Remove();
+        return status;
+    }
+
+    BPath parent;
+    BDirectory directory;
+    if((status = chunkpath.GetParent(&parent)) != B_OK ||
+    (status = directory.SetTo(parent.Path())) != B_OK ||
+    (status = directory.Sync()) != B_OK)
+        return status;
+
+    *stored = true;
+    return B_OK;
+}
+
+// #pragma mark - Chunking
+
+// InitGear: one pseudo-random value per byte value, the same in every run
+static void InitGear()
+{
+    static bool initialized = false;
+    if(initialized)
+        return;
+
+    uint64 seed = 0x4b45595347454152ULL;
+    for(int i = 0; i < 256; i++) {
+        // splitmix64
+        uint64 value = (seed += 0x9e3779b97f4a7c15ULL);
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+        sGear[i] = value ^ (value >> 31);
+    }
+    initialized = true;
+}
+
+/* NextChunkLength: where the chunk starting at data ends, with a gear hash
+    rolling over the bytes between the minimum and the maximum sizes.
+*/
+static size_t NextChunkLength(const uint8* data, size_t length)
+{
+    if(length <= kMinBackupChunkSize)
+        return length;
+
+    size_t limit = length < kMaxBackupChunkSize ? length : kMaxBackupChunkSize;
+    size_t normal = limit < kAverageBackupChunkSize ? limit : kAverageBackupChunkSize;
+    uint64 hash = 0;
+    size_t i = kMinBackupChunkSize;
+    for(; i < normal; i++) {
+        hash = (hash << 1) + sGear[data[i]];
+        if(!(hash & kHardChunkMask))
+            return i + 1;
+    }
+    for(; i < limit; i++) {
+        hash = (hash << 1) + sGear[data[i]];
+        if(!(hash & kEasyChunkMask))
+            return i + 1;
+    }
+    return limit;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef __BACKUP_REPOSITORY_H_
+#define __BACKUP_REPOSITORY_H_
+
+#include <DataIO.h>
+#include <Path.h>
+#include <String.h>
+#include <StringList.h>
+#include <SupportDefs.h>
+
+#define BACKUP_MANIFEST 'bkmf'
+
+// Content defined chunks are never shorter or longer than these, except the last one
+const size_t kMinBackupChunkSize = 4 * 1024;
+const size_t kAverageBackupChunkSize = 16 * 1024;
+const size_t kMaxBackupChunkSize = 64 * 1024;
+
+/* A deduplicated store of database snapshots.
+
+    Snapshots are cut in chunks where the content itself says so, and not at
+    fixed offsets, so what is inserted or removed in a database only changes
+    the chunks around it. Every chunk is kept once, named after its SHA-256:
+
+        <path>/chunks/<first two hex digits>/<hex digest>
+        <path>/snapshots/<name>
+
+    and a snapshot is a manifest (a flattened BACKUP_MANIFEST message)
+    listing its chunks in order, so storing a database that barely changed
+    only costs the chunks that did.
+*/
+class BackupRepository
+{
+public:
+                BackupRepository(const char* path);
+
+    status_t    InitCheck();
+    const char* Path();
+
+    status_t    StoreSnapshot(const char* name, BPositionIO* data, off_t length,
+                    int32* newchunks = nullptr, off_t* newbytes = nullptr);
+    status_t    RestoreSnapshot(const char* name, BDataIO* out);
+    status_t    GetSnapshots(BStringList* names);
+    status_t    SnapshotPath(const char* name, BPath* path);
+private:
+    status_t    _ChunkPath(const unsigned char* digest, BPath* path,
+                    bool create = false);
+    status_t    _StoreChunk(const unsigned char* digest, const uint8* data,
+                    size_t length, bool* stored);
+private:
+    BPath       fPath;
+    status_t    fInitStatus;
+};
+
+#endif /* __BACKUP_REPOSITORY_H_ */
@@ -0,0 +1,255 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#include <Directory.h>
+#include <Entry.h>
+#include <File.h>
+#include <Message.h>
+#include <Path.h>
+#include <algorithm>
+#include "BackUpUtils.h"
+#include "BackupCatalog.h"
+#include "BackupVerifier.h"
+#include "Compression.h"
+#include "CryptoUtils.h"
+
+static const size_t kVerifyReadSize = 1024 * 1024;
+
+bool verify_result::Passed() const
+{
+    return hash == B_OK && (decryption == B_OK || decryption == B_NO_INIT);
+}
+
+BackupVerifier::BackupVerifier(const char* directory, int32 threads)
+: fDirectory(directory),
+  fThreads(threads),
+  fNext(0),
+  fBytesRead(0),
+  fElapsed(0)
+{
+    if(fThreads <= 0) {
+        system_info info;
+        get_system_info(&info);
+        fThreads = info.cpu_count;
+    }
+    if(fThreads <= 0)
+        fThreads = 1;
+}
+
+BackupVerifier::~BackupVerifier()
+{
+    // The password does not outlive the verifier
+    size_t length = fPassword.Length();
+    if(length > 0) {
+        memzero(fPassword.LockBuffer(0), length);
+        fPassword.UnlockBuffer(-1);
+    }
+}
+
+// SetCatalog: every result is recorded there, under the name of the encrypted file
+void BackupVerifier::SetCatalog(const char* path)
+{
+    fCatalog.SetTo(path);
+}
+
+status_t BackupVerifier::Run(const char* password)
+{
+    BDirectory directory(fDirectory.String());
+    if(directory.InitCheck() != B_OK)
+        return directory.InitCheck();
+
+    fResults.clear();
+    BEntry entry;
+    char name[B_FILE_NAME_LENGTH];
+    while(directory.GetNextEntry(&entry) == B_OK) {
+        if(entry.GetName(name) != B_OK || !BString(name).EndsWith(".dat"))
+            continue;
+        verify_result result;
+        result.name = name;
+        result.size = 0;
+        result.hash = B_NO_INIT;
+        result.decryption = B_NO_INIT;
+        result.elapsed = 0;
+        fResults.push_back(result);
+    }
+    std::sort(fResults.begin(), fResults.end(),
+        [](const verify_result& a, const verify_result& b) {
+            return strcmp(a.name.String(), b.name.String()) < 0;
+        });
+
+    fPassword.SetTo(password);
+    fNext = 0;
+    fBytesRead = 0;
+    bigtime_t start = system_time();
+
+    std::vector<thread_id> workers;
+    int32 count = (int32)fResults.size() < fThreads ? (int32)fResults.size() : fThreads;
+    for(int32 i = 0; i < count; i++) {
+        thread_id worker = spawn_thread(_CallWorker, "backup verifier",
+            B_LOW_PRIORITY, this);
+        if(worker < 0)
+            break;
+        workers.push_back(worker);
+        resume_thread(worker);
+    }
+    if(workers.empty() && !fResults.empty())
+        _Work();
+    for(thread_id worker : workers) {
+        status_t result;
+        wait_for_thread(worker, &result);
+    }
+    fElapsed = system_time() - start;
+
+    if(!fCatalog.IsEmpty()) {
+        BackupCatalog catalog(fCatalog.String());
+        for(const verify_result& result : fResults) {
+            if(!result.target.IsEmpty())
+                catalog.SetVerification(result.target.String(),
+                    result.hash != B_OK ? result.hash : result.decryption == B_NO_INIT
+                        ? B_OK : result.decryption);
+        }
+    }
+
+    return B_OK;
+}
+
+int32 BackupVerifier::CountResults()
+{
+    return fResults.size();
+}
+
+const verify_result* BackupVerifier::ResultAt(int32 index)
+{
+    return index >= 0 && index < (int32)fResults.size() ? &fResults[index] : nullptr;
+}
+
+int32 BackupVerifier::CountFailed()
+{
+    return std::count_if(fResults.begin(), fResults.end(),
+        [](const verify_result& result) { return !result.Passed(); });
+}
+
+off_t BackupVerifier::BytesRead()
+{
+    return fBytesRead;
+}
+
+bigtime_t BackupVerifier::Elapsed()
+{
+    return fElapsed;
+}
+
+void BackupVerifier::PrintReport(FILE* out)
+{
+    for(const verify_result& result : fResults) {
+        fprintf(out, "%s  %s", result.Passed() ? "PASS" : "FAIL", result.name.String());
+        if(result.hash != B_OK)
+            fprintf(out, "  (%s)", strerror(result.hash));
+        else if(result.decryption != B_OK && result.decryption != B_NO_INIT)
+            fprintf(out, "  (decryption: %s)", strerror(result.decryption));
+        else
+            fprintf(out, "  %" B_PRIdOFF " bytes, %.1f MB/s%s", result.size,
+                result.elapsed > 0 ? result.size / (double)result.elapsed : 0.0,
+                result.decryption == B_OK ? ", decrypted" : "");
+        fprintf(out, "\n");
+    }
+    fprintf(out, "%s\n", Summary().String());
+}
+
+BString BackupVerifier::Summary()
+{
+    // bytes per microsecond are MB/s
+    BString summary;
+    summary.SetToFormat("%" B_PRId32 " backups verified, %" B_PRId32 " failed. "
+        "%" B_PRIdOFF " bytes read in %.2f s (%.1f MB/s) with %" B_PRId32 " threads.",
+        CountResults(), CountFailed(), BytesRead(), fElapsed / 1000000.0,
+        fElapsed > 0 ? BytesRead() / (double)fElapsed : 0.0, fThreads);
+    return summary;
+}
+
+// #pragma mark - Private
+
+int32 BackupVerifier::_CallWorker(void* data)
+{
+    static_cast<BackupVerifier*>(data)->_Work();
+    return 0;
+}
+
+void BackupVerifier::_Work()
+{
+    int32 index;
+    while((index = fNext++) < (int32)fResults.size()) {
+        bigtime_t start = system_time();
+        _Verify(fResults[index]);
+        fResults[index].elapsed = system_time() - start;
+    }
+}
+
+void BackupVerifier::_Verify(verify_result& result)
+{
+    BPath datapath(fDirectory.String(), result.name.String());
+    BFile datafile(datapath.Path(), B_READ_ONLY);
+    BMessage metadata;
+    BString targethash, originalhash;
+    if(datafile.InitCheck() != B_OK || metadata.Unflatten(&datafile) != B_OK ||
+    metadata.FindString("target_file_name", &result.target) != B_OK ||
+    metadata.FindString("target_file_hash", &targethash) != B_OK) {
+        result.hash = B_BAD_DATA;
+        return;
+    }
+    originalhash = metadata.GetString("original_file_hash", "");
+
+    BPath targetpath(fDirectory.String(), result.target.String());
+    BFile target(targetpath.Path(), B_READ_ONLY);
+    if(target.InitCheck() != B_OK || target.GetSize(&result.size) != B_OK) {
+        result.hash = B_ENTRY_NOT_FOUND;
+        return;
+    }
+
+    // Large sequential reads, so many of them at once still read well
+    DigestIO digest;
+    uint8* buffer = new uint8[kVerifyReadSize];
+    off_t position = 0;
+    while(position < result.size) {
+        ssize_t read = target.ReadAt(position, buffer, kVerifyReadSize);
+        if(read <= 0 || digest.Write(buffer, read) != read)
+            break;
+        position += read;
+    }
+    delete[] buffer;
+    fBytesRead += position;
+    if(position != result.size) {
+        result.hash = B_IO_ERROR;
+        return;
+    }
+    result.hash = digest.Hashstring() == targethash ? B_OK : B_BAD_DATA;
+    if(result.hash != B_OK || fPassword.IsEmpty())
+        return;
+
+    // Trial decryption, into nothing but a hash
+    BString cipher(metadata.GetString("cipher", kCipherAESCBC));
+    BString codec(metadata.GetString("codec", kCodecNone));
+    DigestIO plain;
+    DecompressingIO decompressor(&plain);
+    BDataIO* out = codec == kCodecZlib ? (BDataIO*)&decompressor : &plain;
+    if(codec != kCodecNone && codec != kCodecZlib)
+        result.decryption = B_NOT_SUPPORTED;
+    else if(cipher == kCipherAESGCMChunked)
+        result.decryption = DecryptDataChunked(&target, result.size,
+            fPassword.String(), out, 1);
+    else if(cipher == kCipherAESCBC) {
+        BMallocIO outdp, outiv;
+        result.decryption = DecryptData(&target, result.size, fPassword.String(),
+            (const unsigned char*)metadata.GetString("ivec", ""), out, &outdp, &outiv);
+    }
+    else
+        result.decryption = B_NOT_SUPPORTED;
+    if(result.decryption == B_OK && out == &decompressor)
+        result.decryption = decompressor.Finish();
+    fBytesRead += result.size;
+
+    if(result.decryption == B_OK && !originalhash.IsEmpty() &&
+    plain.Hashstring() != originalhash)
+        result.decryption = B_BAD_DATA;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef __BACKUP_VERIFIER_H_
+#define __BACKUP_VERIFIER_H_
+
+#include <OS.h>
+#include <String.h>
+#include <SupportDefs.h>
+#include <atomic>
+#include <cstdio>
+#include <vector>
+
+struct verify_result {
+    BString     name;           // of the metadata file
+    BString     target;         // of the encrypted file
+    off_t       size;
+    status_t    hash;           // the encrypted file against its metadata
+    status_t    decryption;     // B_NO_INIT when not tried
+    bigtime_t   elapsed;
+
+    bool        Passed() const;
+};
+
+/* Checks the encrypted backups of a directory against their metadata, many
+    at once, one per processor by default.
+
+    Every encrypted file is read sequentially in large pieces and hashed, and
+    given the password, it is also decrypted and the result hashed, without
+    writing it anywhere. The results can go into a backup catalog.
+*/
+class BackupVerifier
+{
+public:
+                BackupVerifier(const char* directory, int32 threads = 0);
+               ~BackupVerifier();
+
+    void        SetCatalog(const char* path);
+    status_t    Run(const char* password = nullptr);
+
+    int32       CountResults();
+    const verify_result* ResultAt(int32 index);
+    int32       CountFailed();
+    off_t       BytesRead();
+    bigtime_t   Elapsed();
+
+    void        PrintReport(FILE* out);
+    BString     Summary();
+private:
+    static int32 _CallWorker(void* data);
+    void        _Work();
+    void        _Verify(verify_result& result);
+private:
+    BString     fDirectory,
+                fCatalog,
+                fPassword;
+    int32       fThreads;
+    std::vector<verify_result> fResults;
+    std::atomic<int32> fNext;
+    std::atomic<off_t> fBytesRead;
+    bigtime_t   fElapsed;
+};
+
+#endif /* __BACKUP_VERIFIER_H_ */
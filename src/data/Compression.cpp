@@ -0,0 +1,201 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#include <ByteOrder.h>
+#include <cstdio>
+#include <cstring>
+#include <zlib.h>
+#include "Compression.h"
+
+static const size_t kFrameHeaderSize = 4;
+static const size_t kMaxFrameSize = 64 * 1024 * 1024;
+static const size_t kInflateBufferSize = 256 * 1024;
+
+BlockCompressor::BlockCompressor(int32 level)
+: fStream(nullptr),
+  fLevel(level < Z_BEST_SPEED ? Z_BEST_SPEED : level > Z_BEST_COMPRESSION
+    ? Z_BEST_COMPRESSION : level),
+  fInitStatus(B_NO_INIT)
+{
+    z_stream* stream = new z_stream;
+    memset(stream, 0, sizeof(z_stream));
+    if(deflateInit(stream, fLevel) != Z_OK) {
+        delete stream;
+        fInitStatus = B_NO_MEMORY;
+        return;
+    }
+    fStream = stream;
+    fInitStatus = B_OK;
+}
+
+BlockCompressor::~BlockCompressor()
+{
+    if(fStream) {
+        deflateEnd(static_cast<z_stream*>(fStream));
+        delete static_cast<z_stream*>(fStream);
+    }
+}
+
+status_t BlockCompressor::InitCheck()
+{
+    return fInitStatus;
+}
+
+int32 BlockCompressor::Level()
+{
+    return fLevel;
+}
+
+// FrameBound: the most a frame of length bytes of input can take
+size_t BlockCompressor::FrameBound(size_t length)
+{
+    return kFrameHeaderSize + compressBound(length);
+}
+
+status_t BlockCompressor::Compress(const uint8* in, size_t inlength, uint8* out,
+    size_t* outlength)
+{
+    if(fInitStatus != B_OK)
+        return fInitStatus;
+
+    z_stream* stream = static_cast<z_stream*>(fStream);
+    if(deflateReset(stream) != Z_OK)
+        return B_ERROR;
+    stream->next_in = const_cast<Bytef*>(in);
+    stream->avail_in = inlength;
+    stream->next_out = out + kFrameHeaderSize;
+    stream->avail_out = compressBound(inlength);
+    // With room for the bound a frame is always done in one call
+    if(deflate(stream, Z_FINISH) != Z_STREAM_END) {
+        fprintf(stderr, "Error: compression error (%s).\n", stream->msg ? stream->msg : "");
+        return B_ERROR;
+    }
+
+    uint32 length = B_HOST_TO_LENDIAN_INT32((uint32)stream->total_out);
+    memcpy(out, &length, kFrameHeaderSize);
+    *outlength = kFrameHeaderSize + stream->total_out;
+    return B_OK;
+}
+
+// #pragma mark - DecompressingIO
+
+DecompressingIO::DecompressingIO(BDataIO* target)
+: fTarget(target),
+  fStream(nullptr),
+  fBuffer(new uint8[kInflateBufferSize]),
+  fHeaderLength(0),
+  fFrameLeft(0),
+  fStatus(B_NO_INIT)
+{
+    z_stream* stream = new z_stream;
+    memset(stream, 0, sizeof(z_stream));
+    if(!target || inflateInit(stream) != Z_OK) {
+        delete stream;
+        return;
+    }
+    fStream = stream;
+    fStatus = B_OK;
+}
+
+DecompressingIO::~DecompressingIO()
+{
+    if(fStream) {
+        inflateEnd(static_cast<z_stream*>(fStream));
+        delete static_cast<z_stream*>(fStream);
+    }
+    delete[] fBuffer;
+}
+
+ssize_t DecompressingIO::Write(const void* buffer, size_t size)
+{
+    if(fStatus != B_OK)
+        return fStatus;
+
+    const uint8* data = static_cast<const uint8*>(buffer);
+    size_t left = size;
+    while(left > 0) {
+        if(fFrameLeft == 0) {
+            // Gathering the header of the next frame
+            size_t wanted = kFrameHeaderSize - fHeaderLength;
+            size_t taken = left < wanted ? left : wanted;
+            memcpy(fHeader + fHeaderLength, data, taken);
+            fHeaderLength += taken;
+            data += taken;
+            left -= taken;
+            if(fHeaderLength < kFrameHeaderSize)
+                break;
+
+            uint32 length;
+            memcpy(&length, fHeader, kFrameHeaderSize);
+            length = B_LENDIAN_TO_HOST_INT32(length);
+            if(length == 0 || length > kMaxFrameSize) {
+                fprintf(stderr, "Error: damaged compressed data.\n");
+                return fStatus = B_BAD_DATA;
+            }
+            fFrameLeft = length;
+            fHeaderLength = 0;
+            if(inflateReset(static_cast<z_stream*>(fStream)) != Z_OK)
+                return fStatus = B_ERROR;
+            continue;
+        }
+
+        size_t taken = left < fFrameLeft ? left : fFrameLeft;
+        if((fStatus = _Inflate(data, taken)) != B_OK)
+            return fStatus;
+        fFrameLeft -= taken;
+        data += taken;
+        left -= taken;
+    }
+
+    return size;
+}
+
+status_t DecompressingIO::Finish()
+{
+    if(fStatus != B_OK)
+        return fStatus;
+    if(fFrameLeft > 0 || fHeaderLength > 0) {
+        fprintf(stderr, "Error: the compressed data is truncated.\n");
+        return B_BAD_DATA;
+    }
+    return B_OK;
+}
+
+// #pragma mark - Private
+
+status_t DecompressingIO::_Inflate(const uint8* data, size_t length)
+{
+    z_stream* stream = static_cast<z_stream*>(fStream);
+    stream->next_in = const_cast<Bytef*>(data);
+    stream->avail_in = length;
+    // Whatever a piece of a frame turns into is written out before taking more
+    do {
+        stream->next_out = fBuffer;
+        stream->avail_out = kInflateBufferSize;
+        int result = inflate(stream, Z_NO_FLUSH);
+        // Out of input with all its output already taken
+        if(result == Z_BUF_ERROR && stream->avail_in == 0)
+            break;
+        // Only the last piece of a frame can end its stream
+        bool frameend = result == Z_STREAM_END;
+        if((result != Z_OK && !frameend) ||
+        (frameend && (stream->avail_in > 0 || fFrameLeft != length))) {
+            fprintf(stderr, "Error: damaged compressed data (%s).\n",
+                stream->msg ? stream->msg : "");
+            return B_BAD_DATA;
+        }
+        size_t produced = kInflateBufferSize - stream->avail_out;
+        if(produced > 0 && fTarget->Write(fBuffer, produced) != (ssize_t)produced)
+            return B_IO_ERROR;
+        if(frameend)
+            return B_OK;
+    } while(stream->avail_in > 0 || stream->avail_out == 0);
+
+    // The last piece of a frame has to end its stream
+    if(fFrameLeft == length) {
+        fprintf(stderr, "Error: damaged compressed data.\n");
+        return B_BAD_DATA;
+    }
+    return B_OK;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef __COMPRESSION_H_
+#define __COMPRESSION_H_
+
+#include <DataIO.h>
+#include <SupportDefs.h>
+
+const int32 kNoCompression = -1;
+const int32 kDefaultCompressionLevel = 6;
+
+/* Compressed data is a sequence of frames, one per buffer that went through
+    the compressor:
+
+        length:uint32 (little endian) zlib stream[length]
+
+    Every frame stands on its own, so its size is bounded by the size of the
+    buffer it comes from, which is what a DataPipeline transformation needs.
+*/
+class BlockCompressor
+{
+public:
+                BlockCompressor(int32 level = kDefaultCompressionLevel);
+               ~BlockCompressor();
+
+    status_t    InitCheck();
+    int32       Level();
+
+    static size_t FrameBound(size_t length);
+    status_t    Compress(const uint8* in, size_t inlength, uint8* out,
+                    size_t* outlength);
+private:
+    void       *fStream;
+    int32       fLevel;
+    status_t    fInitStatus;
+};
+
+/* Takes the frames of a BlockCompressor, in pieces of any size, and writes
+    the decompressed data to its target as it goes.
+*/
+class DecompressingIO : public BDataIO
+{
+public:
+                DecompressingIO(BDataIO* target);
+    virtual    ~DecompressingIO();
+
+    virtual ssize_t Write(const void* buffer, size_t size);
+
+    // Tells whether the data ended at the end of a frame
+    status_t    Finish();
+private:
+    status_t    _Inflate(const uint8* data, size_t length);
+private:
+    BDataIO    *fTarget;
+    void       *fStream;
+    uint8      *fBuffer;
+    uint8       fHeader[4];
+    size_t      fHeaderLength;
+    size_t      fFrameLeft;
+    status_t    fStatus;
+};
+
+#endif /* __COMPRESSION_H_ */
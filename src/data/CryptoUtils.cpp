@@ -2,11 +2,17 @@
  * Copyright 2024, cafeina <cafeina@world>
  * All rights reserved. Distributed under the terms of the MIT license.
  */
+#include <ByteOrder.h>
+#include <OS.h>
 #include <String.h>
+#include <atomic>
 #include <fcntl.h>
+#include <functional>
 #include <openssl/evp.h>
 #include <openssl/err.h>
+#include <vector>
 #include "CryptoUtils.h"
+#include "DataPipeline.h"
 
 struct CryptoUtilsStore {
     EVP_CIPHER_CTX* context = nullptr;
@@ -31,21 +37,94 @@ struct CryptoUtilsStore {
     }
 };
 status_t InitializeKeyData(CryptoUtilsStore* store, const char* key, const unsigned char* iv);
+
+/* Chunked container layout, little endian:
+    header:  magic[8] chunk_size:uint32 iterations:uint32 length:uint64 salt[16]
+    chunks:  tag[16] ciphertext[chunk_size], the last one may be shorter
+   The key is derived from the password and the random salt of the header, so
+   it is never reused across backups and the chunk index can be the nonce.
+   The header, the index and whether it is the last chunk are authenticated
+   with every chunk, so chunks cannot be reordered, dropped or mixed.
+*/
+static const char kChunkedMagic[8] = { 'K', 'E', 'Y', 'S', 'G', 'C', 'M', '1' };
+static const size_t kChunkedHeaderSize = 40;
+static const size_t kChunkedTagSize = 16;
+static const size_t kChunkedSaltSize = 16;
+static const uint32 kChunkedIterations = 100000;
+static const size_t kMaxCryptoChunkSize = 64 * 1024 * 1024;
+
+/* Feeds both digests of a crypto_digests as the data goes by. A disabled one
+    does nothing, so callers do not need to tell whether they were asked for. */
+class DigestStream
+{
+public:
+                DigestStream(bool enabled);
+               ~DigestStream();
+
+    void        AddInput(const void* data, size_t length);
+    void        AddOutput(const void* data, size_t length);
+    status_t    Finish(crypto_digests* digests);
+private:
+    EVP_MD_CTX  *fInput,
+                *fOutput;
+    bool        fFailed;
+};
+
+class ChunkedCipher
+{
+public:
+    typedef std::function<status_t(EVP_CIPHER_CTX* context, uint64 index,
+        const uint8* in, size_t inlength, uint8* out, size_t* outlength)> chunk_func;
+    // Called for every chunk once written, in order
+    typedef std::function<void(const uint8* in, size_t inlength,
+        const uint8* out, size_t outlength)> written_func;
+
+                ChunkedCipher(int32 threads, size_t insize, size_t outsize);
+               ~ChunkedCipher();
+
+    status_t    Run(uint64 count, const std::function<ssize_t(uint64, uint8*)>& read,
+                    const chunk_func& process, BDataIO* outdata,
+                    const written_func* written = nullptr);
+private:
+    struct chunk_slot {
+        uint8  *in,
+               *out;
+        size_t  inlength,
+                outlength;
+        status_t status;
+        sem_id  ready;
+    };
+
+    static int32 _CallWorker(void* data);
+    void        _Work();
+private:
+    int32       fThreads;
+    size_t      fInSize,
+                fOutSize;
+    std::vector<chunk_slot> fSlots;
+    sem_id      fWindow;    // slots not holding a chunk yet to be written
+    std::atomic<uint64> fNext;
+    std::atomic<bool> fFailed;
+    uint64      fCount;
+    const std::function<ssize_t(uint64, uint8*)>* fRead;
+    const chunk_func* fProcess;
+};
+
+static status_t ChunkedKey(const char* pass, const unsigned char* salt,
+    uint32 iterations, unsigned char* key);
+static void ChunkedNonce(uint64 index, unsigned char* nonce);
 int MakeDerivatedKey(const char* pass, const unsigned char* salt, int iterations, int length, unsigned char*& outbuffer);
 
 // #pragma mark - Public
 
 status_t EncryptData(BPositionIO* indata, ssize_t inlenght, const char* inpath, const char* pass,
-    const unsigned char* iv, BMallocIO* outdata, BPositionIO* outdp, BPositionIO* outiv)
+    const unsigned char* iv, BPositionIO* outdata, BPositionIO* outdp, BPositionIO* outiv,
+    size_t buffersize, crypto_digests* digests, int32 compression)
 {
     CryptoUtilsStore store;
     store.context = EVP_CIPHER_CTX_new();
     store.passphrase = new unsigned char[32];
     store.init_vector = new unsigned char[16];
-    int blocksize = 1024;
-    store.inbuffer = new unsigned char[blocksize];
-    store.outbuffer = new unsigned char[blocksize];
-    outdata->SetBlockSize(blocksize);
 
     if(!store.context || !store.passphrase || !store.init_vector) {
         fprintf(stderr, "Error: data store could not be initialized.\n");
@@ -55,49 +134,76 @@ status_t EncryptData(BPositionIO* indata, ssize_t inlenght, const char* inpath,
     if(InitializeKeyData(&store, pass, iv) != B_OK)
         return B_ERROR;
 
+    DigestStream digest(digests != nullptr);
     if(EVP_EncryptInit_ex(store.context, EVP_aes_256_cbc(), NULL,
     store.passphrase, store.init_vector) != 1) {
         fprintf(stderr, "Error: could not initialize encryption.\n");
         return B_ERROR;
     }
 
-    int cryptolength = 0;
-    ssize_t readlength = 0;
-    ssize_t readchunk = 0;
-    int outlength = 0;
-
-    while(readlength < inlenght) {
-        ssize_t curBlockSize = (inlenght - readlength < blocksize) ? (inlenght - readlength) : blocksize;
-        readchunk = indata->ReadAt(readlength, store.inbuffer, curBlockSize);
-        if(readchunk < 0) {
-            fprintf(stderr, "Error: bad read during encryption, at %zd.\n", readlength);
-            return B_FILE_ERROR;
+    BlockCompressor* compressor = nullptr;
+    uint8* frame = nullptr;
+    if(compression != kNoCompression) {
+        // A frame and the padding of its last block fit in the output buffer
+        if(BlockCompressor::FrameBound(buffersize) + EVP_MAX_BLOCK_LENGTH >
+        buffersize + kPipelineSlack) {
+            fprintf(stderr, "Error: the buffer is too large to be compressed.\n");
+            return B_BAD_VALUE;
         }
-
-        if(EVP_EncryptUpdate(store.context, store.outbuffer, &outlength, store.inbuffer, readchunk) != 1) {
-            fprintf(stderr, "Error: encryption error in chunk at %zd.\n", readlength);
-            return B_ERROR;
+        compressor = new BlockCompressor(compression);
+        frame = new uint8[BlockCompressor::FrameBound(buffersize)];
+        if(compressor->InitCheck() != B_OK) {
+            delete compressor;
+            delete[] frame;
+            return B_NO_MEMORY;
         }
-
-        if(outdata->WriteAt(cryptolength, store.outbuffer, outlength) < 0) {
-            fprintf(stderr, "Error writing to alloc during encryption\n");
-            return B_ERROR;
-        }
-
-        readlength += readchunk;
-        cryptolength += outlength;
     }
 
-    if(EVP_EncryptFinal_ex(store.context, store.outbuffer, &outlength) != 1) {
-        fprintf(stderr, "Error: encryption error during final step.\n");
-        return B_ERROR;
-    }
-
-    if (outlength > 0) {
-        if (outdata->WriteAt(cryptolength, store.outbuffer, outlength) < 0) {
-            fprintf(stderr, "Error writing final encrypted data\n");
-        }
+    // Reads, encryption and writes overlap, and never hold more than a few buffers
+    DataPipeline pipeline(buffersize);
+    status_t status = pipeline.Run(indata, 0, inlenght, outdata,
+        [&](const uint8* in, size_t inlength, uint8* out, size_t* outlength) -> status_t {
+            digest.AddInput(in, inlength);
+            const uint8* plain = in;
+            size_t plainlength = inlength;
+            if(compressor) {
+                status_t status = compressor->Compress(in, inlength, frame, &plainlength);
+                if(status != B_OK)
+                    return status;
+                plain = frame;
+            }
+
+            int outlen = 0;
+            if(EVP_EncryptUpdate(store.context, out, &outlen, plain, plainlength) != 1) {
+                fprintf(stderr, "Error: encryption error in chunk at %" B_PRIdOFF ".\n",
+                    pipeline.BytesRead());
+                return B_ERROR;
+            }
+            *outlength = outlen;
+            digest.AddOutput(out, outlen);
+            return B_OK;
+        },
+        [&](uint8* out, size_t* outlength) {
+            int outlen = 0;
+            if(EVP_EncryptFinal_ex(store.context, out, &outlen) != 1) {
+                fprintf(stderr, "Error: encryption error during final step.\n");
+                return B_ERROR;
+            }
+            *outlength = outlen;
+            digest.AddOutput(out, outlen);
+            return B_OK;
+        });
+    delete compressor;
+    delete[] frame;
+    if(status == B_OK && pipeline.BytesRead() != inlenght) {
+        fprintf(stderr, "Error: %" B_PRIdOFF " bytes encrypted of %zd.\n",
+            pipeline.BytesRead(), inlenght);
+        status = B_IO_ERROR;
     }
+    if(status != B_OK)
+        return status;
+    if((status = digest.Finish(digests)) != B_OK)
+        return status;
 
     outdp->Write(store.passphrase, strlen((char*)store.passphrase));
     outiv->Write(store.init_vector, strlen((char*)store.init_vector));
@@ -106,16 +212,13 @@ status_t EncryptData(BPositionIO* indata, ssize_t inlenght, const char* inpath,
 }
 
 status_t DecryptData(BPositionIO* indata, ssize_t inlenght, const char* pass,
-    const unsigned char* iv, BMallocIO* outdata, BPositionIO* outdp, BPositionIO* outiv)
+    const unsigned char* iv, BDataIO* outdata, BPositionIO* outdp, BPositionIO* outiv,
+    size_t buffersize)
 {
     CryptoUtilsStore store;
     store.context = EVP_CIPHER_CTX_new();
     store.passphrase = new unsigned char[32];
     store.init_vector = new unsigned char[16];
-    int blocksize = 1024;
-    store.inbuffer = new unsigned char[blocksize];
-    store.outbuffer = new unsigned char[blocksize];
-    outdata->SetBlockSize(blocksize);
 
     if(!store.context || !store.passphrase || !store.init_vector) {
         fprintf(stderr, "Error: data store could not be initialized.\n");
@@ -131,48 +234,204 @@ status_t DecryptData(BPositionIO* indata, ssize_t inlenght, const char* pass,
         return  B_ERROR;
     }
 
-    ssize_t readlength = 0;
-    ssize_t readchunk = 0;
-    int cryptolength = 0;
-    int outlength = 0;
-
-    while(readlength < inlenght) {
-        ssize_t curBlockSize = (inlenght - readlength < blocksize) ? (inlenght - readlength) : blocksize;
-        readchunk = indata->ReadAt(readlength, store.inbuffer, curBlockSize);
-        if (readchunk < 0) {
-            fprintf(stderr, "Error reading from cryptofile.\n");
-            break;
-        }
+    DataPipeline pipeline(buffersize);
+    status_t status = pipeline.Run(indata, 0, inlenght, outdata,
+        [&](const uint8* in, size_t inlength, uint8* out, size_t* outlength) {
+            int outlen = 0;
+            if(EVP_DecryptUpdate(store.context, out, &outlen, in, inlength) != 1) {
+                fprintf(stderr, "Error: could not decrypt chunk at %" B_PRIdOFF ".\n",
+                    pipeline.BytesRead());
+                return B_ERROR;
+            }
+            *outlength = outlen;
+            return B_OK;
+        },
+        [&](uint8* out, size_t* outlength) {
+            int outlen = 0;
+            if(EVP_DecryptFinal_ex(store.context, out, &outlen) != 1) {
+                fprintf(stderr, "Error: could not end decryption operation.\n");
+                return B_ERROR;
+            }
+            *outlength = outlen;
+            return B_OK;
+        });
+    if(status != B_OK)
+        return status;
 
-        if(EVP_DecryptUpdate(store.context, store.outbuffer, &outlength, store.inbuffer, readchunk) != 1) {
-            fprintf(stderr, "Error: could not decrypt chunk at %zd.\n", readlength);
-            break;
-        }
+    outdp->Write(store.passphrase, strlen((char*)store.passphrase));
+    outiv->Write(store.init_vector, strlen((char*)store.init_vector));
 
-        if (outdata->WriteAt(cryptolength, store.outbuffer, outlength) < 0) {
-            fprintf(stderr, "Error writing to alloc during decryption\n");
-            return B_ERROR;
-        }
+    return B_OK;
+}
 
-        readlength += readchunk;
-        cryptolength += outlength;
-    }
+status_t EncryptDataChunked(BPositionIO* indata, off_t inlength, const char* pass,
+    BDataIO* outdata, size_t chunksize, int32 threads, crypto_digests* digests)
+{
+    if(!indata || !outdata || !pass || inlength < 0 || chunksize == 0 ||
+    chunksize > kMaxCryptoChunkSize)
+        return B_BAD_VALUE;
+
+    unsigned char header[kChunkedHeaderSize];
+    memcpy(header, kChunkedMagic, sizeof(kChunkedMagic));
+    uint32 chunksize32 = B_HOST_TO_LENDIAN_INT32((uint32)chunksize);
+    uint32 iterations = B_HOST_TO_LENDIAN_INT32(kChunkedIterations);
+    uint64 length64 = B_HOST_TO_LENDIAN_INT64((uint64)inlength);
+    memcpy(header + 8, &chunksize32, 4);
+    memcpy(header + 12, &iterations, 4);
+    memcpy(header + 16, &length64, 8);
+
+    BMemoryIO salt(header + 24, kChunkedSaltSize);
+    if(GenerateSalt(kChunkedSaltSize, &salt) != B_OK)
+        return B_ERROR;
 
-    if(EVP_DecryptFinal_ex(store.context, store.outbuffer, &outlength) != 1) {
-        fprintf(stderr, "Error: could not end decryption operation.\n");
+    unsigned char key[32];
+    if(ChunkedKey(pass, header + 24, kChunkedIterations, key) != B_OK)
         return B_ERROR;
+
+    if(outdata->Write(header, kChunkedHeaderSize) != (ssize_t)kChunkedHeaderSize) {
+        memzero(key, sizeof(key));
+        return B_IO_ERROR;
     }
 
-    if (outlength > 0) {
-        if (outdata->WriteAt(cryptolength, store.outbuffer, outlength) < 0) {
-            fprintf(stderr, "Error writing final encrypted data\n");
-        }
+    DigestStream digest(digests != nullptr);
+    digest.AddOutput(header, kChunkedHeaderSize);
+    ChunkedCipher::written_func written = [&](const uint8* in, size_t inlen,
+        const uint8* out, size_t outlen) {
+            digest.AddInput(in, inlen);
+            digest.AddOutput(out, outlen);
+        };
+
+    // An empty input still has its (empty) last chunk, so it is authenticated too
+    uint64 count = inlength == 0 ? 1 : (inlength + chunksize - 1) / chunksize;
+    ChunkedCipher cipher(threads, chunksize, chunksize + kChunkedTagSize);
+    status_t status = cipher.Run(count,
+        [&](uint64 index, uint8* buffer) -> ssize_t {
+            off_t offset = index * chunksize;
+            size_t wanted = inlength - offset < (off_t)chunksize ? inlength - offset : chunksize;
+            size_t done = 0;
+            while(done < wanted) {
+                ssize_t read = indata->ReadAt(offset + done, buffer + done, wanted - done);
+                if(read <= 0)
+                    return read < 0 ? read : B_IO_ERROR;
+                done += read;
+            }
+            return done;
+        },
+        [&](EVP_CIPHER_CTX* context, uint64 index, const uint8* in, size_t inlen,
+        uint8* out, size_t* outlen) -> status_t {
+            unsigned char nonce[12];
+            ChunkedNonce(index, nonce);
+            uint64 aadindex = B_HOST_TO_LENDIAN_INT64(index);
+            unsigned char last = index == count - 1;
+            int len = 0, finallen = 0;
+            if(EVP_EncryptInit_ex(context, EVP_aes_256_gcm(), NULL, NULL, NULL) != 1 ||
+            EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_GCM_SET_IVLEN, sizeof(nonce), NULL) != 1 ||
+            EVP_EncryptInit_ex(context, NULL, NULL, key, nonce) != 1 ||
+            EVP_EncryptUpdate(context, NULL, &len, header, kChunkedHeaderSize) != 1 ||
+            EVP_EncryptUpdate(context, NULL, &len, (const unsigned char*)&aadindex, 8) != 1 ||
+            EVP_EncryptUpdate(context, NULL, &len, &last, 1) != 1 ||
+            EVP_EncryptUpdate(context, out + kChunkedTagSize, &len, in, inlen) != 1 ||
+            EVP_EncryptFinal_ex(context, out + kChunkedTagSize + len, &finallen) != 1 ||
+            EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_GCM_GET_TAG, kChunkedTagSize, out) != 1) {
+                fprintf(stderr, "Error: encryption error in chunk %" B_PRIu64 ".\n", index);
+                return B_ERROR;
+            }
+            *outlen = kChunkedTagSize + len + finallen;
+            return B_OK;
+        }, outdata, digests ? &written : nullptr);
+
+    memzero(key, sizeof(key));
+    if(status != B_OK)
+        return status;
+    return digest.Finish(digests);
+}
+
+status_t DecryptDataChunked(BPositionIO* indata, off_t inlength, const char* pass,
+    BDataIO* outdata, int32 threads)
+{
+    if(!indata || !outdata || !pass)
+        return B_BAD_VALUE;
+
+    unsigned char header[kChunkedHeaderSize];
+    if(inlength < (off_t)kChunkedHeaderSize ||
+    indata->ReadAt(0, header, kChunkedHeaderSize) != (ssize_t)kChunkedHeaderSize ||
+    memcmp(header, kChunkedMagic, sizeof(kChunkedMagic)) != 0) {
+        fprintf(stderr, "Error: not a chunked encrypted file.\n");
+        return B_BAD_DATA;
     }
 
-    outdp->Write(store.passphrase, strlen((char*)store.passphrase));
-    outiv->Write(store.init_vector, strlen((char*)store.init_vector));
+    uint32 chunksize, iterations;
+    uint64 length;
+    memcpy(&chunksize, header + 8, 4);
+    memcpy(&iterations, header + 12, 4);
+    memcpy(&length, header + 16, 8);
+    chunksize = B_LENDIAN_TO_HOST_INT32(chunksize);
+    iterations = B_LENDIAN_TO_HOST_INT32(iterations);
+    length = B_LENDIAN_TO_HOST_INT64(length);
+
+    uint64 count = length == 0 ? 1 : (length + chunksize - 1) / chunksize;
+    if(chunksize == 0 || chunksize > kMaxCryptoChunkSize || iterations == 0 ||
+    (off_t)(kChunkedHeaderSize + count * kChunkedTagSize + length) != inlength) {
+        fprintf(stderr, "Error: the chunked encrypted file is truncated or damaged.\n");
+        return B_BAD_DATA;
+    }
 
-    return B_OK;
+    unsigned char key[32];
+    if(ChunkedKey(pass, header + 24, iterations, key) != B_OK)
+        return B_ERROR;
+
+    ChunkedCipher cipher(threads, chunksize + kChunkedTagSize, chunksize);
+    status_t status = cipher.Run(count,
+        [&](uint64 index, uint8* buffer) -> ssize_t {
+            off_t offset = kChunkedHeaderSize + index * (chunksize + kChunkedTagSize);
+            size_t wanted = index == count - 1
+                ? length - index * chunksize + kChunkedTagSize
+                : chunksize + kChunkedTagSize;
+            size_t done = 0;
+            while(done < wanted) {
+                ssize_t read = indata->ReadAt(offset + done, buffer + done, wanted - done);
+                if(read <= 0)
+                    return read < 0 ? read : B_IO_ERROR;
+                done += read;
+            }
+            return done;
+        },
+        [&](EVP_CIPHER_CTX* context, uint64 index, const uint8* in, size_t inlen,
+        uint8* out, size_t* outlen) -> status_t {
+            unsigned char nonce[12];
+            ChunkedNonce(index, nonce);
+            uint64 aadindex = B_HOST_TO_LENDIAN_INT64(index);
+            unsigned char last = index == count - 1;
+            int len = 0, finallen = 0;
+            if(EVP_DecryptInit_ex(context, EVP_aes_256_gcm(), NULL, NULL, NULL) != 1 ||
+            EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_GCM_SET_IVLEN, sizeof(nonce), NULL) != 1 ||
+            EVP_DecryptInit_ex(context, NULL, NULL, key, nonce) != 1 ||
+            EVP_DecryptUpdate(context, NULL, &len, header, kChunkedHeaderSize) != 1 ||
+            EVP_DecryptUpdate(context, NULL, &len, (const unsigned char*)&aadindex, 8) != 1 ||
+            EVP_DecryptUpdate(context, NULL, &len, &last, 1) != 1 ||
+            EVP_DecryptUpdate(context, out, &len, in + kChunkedTagSize,
+                inlen - kChunkedTagSize) != 1 ||
+            EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_GCM_SET_TAG, kChunkedTagSize,
+                const_cast<uint8*>(in)) != 1)
+                return B_ERROR;
+            if(EVP_DecryptFinal_ex(context, out + len, &finallen) != 1) {
+                fprintf(stderr, "Error: chunk %" B_PRIu64 " failed authentication, "
+                    "wrong passphrase or damaged file.\n", index);
+                return B_NOT_ALLOWED;
+            }
+            *outlen = len + finallen;
+            return B_OK;
+        }, outdata);
+
+    memzero(key, sizeof(key));
+    return status;
+}
+
+bool IsChunkedCryptoData(BPositionIO* indata)
+{
+    char magic[sizeof(kChunkedMagic)];
+    return indata && indata->ReadAt(0, magic, sizeof(magic)) == (ssize_t)sizeof(magic)
+        && memcmp(magic, kChunkedMagic, sizeof(magic)) == 0;
 }
 
 status_t SHA256CheckSum(BPositionIO* indata, ssize_t inlength, BPositionIO* outdata)
@@ -229,7 +488,7 @@ status_t SHA256CheckSum(BPositionIO* indata, ssize_t inlength, BPositionIO* outd
     return B_OK;
 }
 
-const char* HashToHashstring(const unsigned char* indata, ssize_t inlenght)
+BString HashToHashstring(const unsigned char* indata, ssize_t inlenght)
 {
     BString out;
     char tmp[3];
@@ -239,7 +498,7 @@ const char* HashToHashstring(const unsigned char* indata, ssize_t inlenght)
         out.Append(tmp);
         i++;
     }
-    return out.String();
+    return out;
 }
 
 status_t GenerateSalt(size_t length, BPositionIO* outdata)
@@ -267,6 +526,50 @@ status_t GenerateSalt(size_t length, BPositionIO* outdata)
     return B_OK;
 }
 
+// #pragma mark - DigestIO
+
+DigestIO::DigestIO(BDataIO* target)
+: fTarget(target),
+  fContext(EVP_MD_CTX_new()),
+  fFailed(false)
+{
+    if(!fContext || EVP_DigestInit_ex(static_cast<EVP_MD_CTX*>(fContext),
+    EVP_sha256(), NULL) != 1)
+        fFailed = true;
+}
+
+DigestIO::~DigestIO()
+{
+    if(fContext)
+        EVP_MD_CTX_free(static_cast<EVP_MD_CTX*>(fContext));
+}
+
+ssize_t DigestIO::Write(const void* buffer, size_t size)
+{
+    if(fFailed || EVP_DigestUpdate(static_cast<EVP_MD_CTX*>(fContext), buffer, size) != 1) {
+        fFailed = true;
+        return B_ERROR;
+    }
+    if(fTarget) {
+        ssize_t written = fTarget->Write(buffer, size);
+        if(written != (ssize_t)size) {
+            fFailed = true;
+            return written < 0 ? written : B_IO_ERROR;
+        }
+    }
+    return size;
+}
+
+BString DigestIO::Hashstring()
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    if(fFailed || EVP_DigestFinal_ex(static_cast<EVP_MD_CTX*>(fContext), digest, &length) != 1)
+        return BString();
+    fFailed = true; // A digest is only taken once
+    return HashToHashstring(digest, length);
+}
+
 // #pragma mark - Private
 
 int InitializeKeyData(CryptoUtilsStore* store, const char* key, const unsigned char* iv)
@@ -293,6 +596,207 @@ int MakeDerivatedKey(const char* pass, const unsigned char* salt,
     return result;
 }
 
+static status_t ChunkedKey(const char* pass, const unsigned char* salt,
+    uint32 iterations, unsigned char* key)
+{
+    if(PKCS5_PBKDF2_HMAC(pass, strlen(pass), salt, kChunkedSaltSize, iterations,
+    EVP_sha256(), 32, key) != 1) {
+        fprintf(stderr, "Error: passphrase could not be derived.\n");
+        return B_ERROR;
+    }
+    return B_OK;
+}
+
+static void ChunkedNonce(uint64 index, unsigned char* nonce)
+{
+    uint64 bigindex = B_HOST_TO_BENDIAN_INT64(index);
+    memset(nonce, 0, 4);
+    memcpy(nonce + 4, &bigindex, 8);
+}
+
+// #pragma mark - DigestStream
+
+DigestStream::DigestStream(bool enabled)
+: fInput(nullptr),
+  fOutput(nullptr),
+  fFailed(false)
+{
+    if(!enabled)
+        return;
+
+    fInput = EVP_MD_CTX_new();
+    fOutput = EVP_MD_CTX_new();
+    fFailed = !fInput || !fOutput ||
+        EVP_DigestInit_ex(fInput, EVP_sha256(), NULL) != 1 ||
+        EVP_DigestInit_ex(fOutput, EVP_sha256(), NULL) != 1;
+}
+
+DigestStream::~DigestStream()
+{
+    if(fInput)
+        EVP_MD_CTX_free(fInput);
+    if(fOutput)
+        EVP_MD_CTX_free(fOutput);
+}
+
+void DigestStream::AddInput(const void* data, size_t length)
+{
+    if(fInput && !fFailed && length > 0)
+        fFailed = EVP_DigestUpdate(fInput, data, length) != 1;
+}
+
+void DigestStream::AddOutput(const void* data, size_t length)
+{
+    if(fOutput && !fFailed && length > 0)
+        fFailed = EVP_DigestUpdate(fOutput, data, length) != 1;
+}
+
+status_t DigestStream::Finish(crypto_digests* digests)
+{
+    if(!digests)
+        return B_OK;
+
+    unsigned int inlength = 0, outlength = 0;
+    if(fFailed || !fInput || !fOutput ||
+    EVP_DigestFinal_ex(fInput, digests->input, &inlength) != 1 ||
+    EVP_DigestFinal_ex(fOutput, digests->output, &outlength) != 1 ||
+    inlength != sizeof(digests->input) || outlength != sizeof(digests->output)) {
+        fprintf(stderr, "Error: bad digest finalization.\n");
+        return B_ERROR;
+    }
+    return B_OK;
+}
+
+// #pragma mark - ChunkedCipher
+
+ChunkedCipher::ChunkedCipher(int32 threads, size_t insize, size_t outsize)
+: fThreads(threads),
+  fInSize(insize),
+  fOutSize(outsize),
+  fNext(0),
+  fFailed(false),
+  fCount(0),
+  fRead(nullptr),
+  fProcess(nullptr)
+{
+    if(fThreads <= 0) {
+        system_info info;
+        get_system_info(&info);
+        fThreads = info.cpu_count;
+    }
+    if(fThreads <= 0)
+        fThreads = 1;
+
+    // Two chunks per thread, so the workers go on while the output is written
+    fSlots.resize(fThreads * 2);
+    for(chunk_slot& slot : fSlots) {
+        slot.in = new uint8[fInSize];
+        slot.out = new uint8[fOutSize];
+        slot.ready = create_sem(0, "chunk ready");
+    }
+    fWindow = create_sem(fSlots.size(), "chunk window");
+}
+
+ChunkedCipher::~ChunkedCipher()
+{
+    for(chunk_slot& slot : fSlots) {
+        memzero(slot.in, fInSize);
+        memzero(slot.out, fOutSize);
+        delete[] slot.in;
+        delete[] slot.out;
+        delete_sem(slot.ready);
+    }
+    delete_sem(fWindow);
+}
+
+// Run: the chunks are read and processed by the workers, and written here in order
+status_t ChunkedCipher::Run(uint64 count,
+    const std::function<ssize_t(uint64, uint8*)>& read, const chunk_func& process,
+    BDataIO* outdata, const written_func* written)
+{
+    fCount = count;
+    fRead = &read;
+    fProcess = &process;
+    fNext = 0;
+    fFailed = false;
+
+    std::vector<thread_id> workers;
+    int32 threads = (uint64)fThreads < count ? fThreads : (int32)count;
+    for(int32 i = 0; i < threads; i++) {
+        thread_id worker = spawn_thread(_CallWorker, "chunk worker",
+            B_NORMAL_PRIORITY, this);
+        if(worker < 0)
+            break;
+        workers.push_back(worker);
+        resume_thread(worker);
+    }
+
+    status_t status = workers.empty() ? B_NO_MORE_THREADS : B_OK;
+    for(uint64 index = 0; status == B_OK && index < count; index++) {
+        chunk_slot& slot = fSlots[index % fSlots.size()];
+        if(acquire_sem(slot.ready) != B_OK) {
+            status = B_ERROR;
+            break;
+        }
+        if((status = slot.status) != B_OK)
+            break;
+        if(outdata->Write(slot.out, slot.outlength) != (ssize_t)slot.outlength)
+            status = B_IO_ERROR;
+        else if(written)
+            (*written)(slot.in, slot.inlength, slot.out, slot.outlength);
+        release_sem(fWindow);
+    }
+
+    if(status != B_OK) {
+        // Whoever waits for a free slot has to wake up to see it is over
+        fFailed = true;
+        release_sem_etc(fWindow, fThreads, 0);
+    }
+    for(thread_id worker : workers) {
+        status_t result;
+        wait_for_thread(worker, &result);
+    }
+
+    return status;
+}
+
+int32 ChunkedCipher::_CallWorker(void* data)
+{
+    static_cast<ChunkedCipher*>(data)->_Work();
+    return 0;
+}
+
+void ChunkedCipher::_Work()
+{
+    EVP_CIPHER_CTX* context = EVP_CIPHER_CTX_new();
+    while(!fFailed) {
+        // A chunk is only taken with a slot to spare: as at most as many
+        //  chunks as slots are waiting to be written, the slot of this one
+        //  has already been written out
+        if(acquire_sem(fWindow) != B_OK || fFailed)
+            break;
+        uint64 index = fNext++;
+        if(index >= fCount)
+            break;
+        chunk_slot& slot = fSlots[index % fSlots.size()];
+
+        slot.inlength = slot.outlength = 0;
+        ssize_t length = (*fRead)(index, slot.in);
+        if(length < 0)
+            slot.status = length;
+        else if(!context)
+            slot.status = B_NO_MEMORY;
+        else {
+            slot.inlength = length;
+            slot.status = (*fProcess)(context, index, slot.in, length, slot.out,
+                &slot.outlength);
+        }
+        release_sem(slot.ready);
+    }
+    if(context)
+        EVP_CIPHER_CTX_free(context);
+}
+
 void memzero(void* ptr, size_t len)
 {
     volatile unsigned char* data = reinterpret_cast<volatile unsigned char*>(ptr);
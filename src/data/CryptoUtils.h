@@ -6,18 +6,65 @@
 #define __CRYPYO_UTILS_H_
 
 #include <DataIO.h>
+#include <String.h>
 #include <SupportDefs.h>
+#include "Compression.h"
 
+const size_t kDefaultCryptoBufferSize = 256 * 1024;
+
+/* SHA-256 of the data going in and of the data coming out, taken as it
+    streams through, so nothing has to be read again to checksum it */
+struct crypto_digests {
+    unsigned char input[32];
+    unsigned char output[32];
+};
+
+/* Both stream into the output, buffersize bytes at a time. With a
+    compression level, every buffer is compressed into a BlockCompressor
+    frame before being encrypted, and the decrypted data has to go through
+    a DecompressingIO. */
 status_t EncryptData(BPositionIO* indata, ssize_t inlenght, const char* inpath,
-    const char* pass, const unsigned char* iv, BMallocIO* outdata,
-    BPositionIO* outdp, BPositionIO* outiv);
+    const char* pass, const unsigned char* iv, BPositionIO* outdata,
+    BPositionIO* outdp, BPositionIO* outiv,
+    size_t buffersize = kDefaultCryptoBufferSize,
+    crypto_digests* digests = nullptr, int32 compression = kNoCompression);
 status_t DecryptData(BPositionIO* indata, ssize_t inlenght, const char* pass,
-    const unsigned char* iv, BMallocIO* outdata,
-    BPositionIO* outdp, BPositionIO* outiv);
+    const unsigned char* iv, BDataIO* outdata,
+    BPositionIO* outdp, BPositionIO* outiv,
+    size_t buffersize = kDefaultCryptoBufferSize);
+
+/* Chunked AES-256-GCM container: every chunk is encrypted and authenticated
+    on its own, so they are worked on in parallel by up to threads threads,
+    one per processor by default. The output is written in order. */
+const size_t kDefaultCryptoChunkSize = 256 * 1024;
+
+status_t EncryptDataChunked(BPositionIO* indata, off_t inlength, const char* pass,
+    BDataIO* outdata, size_t chunksize = kDefaultCryptoChunkSize,
+    int32 threads = 0, crypto_digests* digests = nullptr);
+status_t DecryptDataChunked(BPositionIO* indata, off_t inlength, const char* pass,
+    BDataIO* outdata, int32 threads = 0);
+bool IsChunkedCryptoData(BPositionIO* indata);
 
 status_t GenerateSalt(size_t length, BPositionIO* outdata);
 status_t SHA256CheckSum(BPositionIO* indata, ssize_t inlength, BPositionIO* outdata);
-const char* HashToHashstring(const unsigned char* indata, ssize_t inlenght);
+BString HashToHashstring(const unsigned char* indata, ssize_t inlenght);
+
+/* Takes the SHA-256 of what is written to it, and passes it on to the
+    target, if there is one */
+class DigestIO : public BDataIO
+{
+public:
+                DigestIO(BDataIO* target = nullptr);
+    virtual    ~DigestIO();
+
+    virtual ssize_t Write(const void* buffer, size_t size);
+    // Hashstring: the digest as HashToHashstring() gives it, empty on errors
+    BString     Hashstring();
+private:
+    BDataIO    *fTarget;
+    void       *fContext;
+    bool        fFailed;
+};
 
 void memzero(void* ptr, size_t len);
 
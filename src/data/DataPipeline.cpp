@@ -0,0 +1,239 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#include <cstdio>
+#include "DataPipeline.h"
+
+DataPipeline::DataPipeline(size_t bufferSize)
+: fBufferSize(bufferSize > 0 ? bufferSize : kDefaultPipelineBufferSize),
+  fInFree(-1),
+  fInFilled(-1),
+  fOutFree(-1),
+  fOutFilled(-1),
+  fStatus(B_OK),
+  fSource(nullptr),
+  fOffset(0),
+  fLength(0),
+  fSink(nullptr),
+  fBytesRead(0),
+  fBytesWritten(0)
+{
+    for(int i = 0; i < 2; i++) {
+        fIn[i].data = new uint8[fBufferSize];
+        fOut[i].data = new uint8[fBufferSize + kPipelineSlack];
+    }
+}
+
+DataPipeline::~DataPipeline()
+{
+    for(int i = 0; i < 2; i++) {
+        delete[] fIn[i].data;
+        delete[] fOut[i].data;
+    }
+}
+
+/* Run: reads length bytes of the source from offset, and writes what the
+    transformation makes of them at the current position of the sink.
+*/
+status_t DataPipeline::Run(BPositionIO* source, off_t offset, off_t length,
+    BDataIO* sink, const transform_func& transform, const finish_func& finish)
+{
+    if(!source || !sink || length < 0)
+        return B_BAD_VALUE;
+
+    fSource = source;
+    fOffset = offset;
+    fLength = length;
+    fSink = sink;
+    fBytesRead = fBytesWritten = 0;
+    fStatus = B_OK;
+
+    fInFree = create_sem(2, "pipeline free input");
+    fInFilled = create_sem(0, "pipeline filled input");
+    fOutFree = create_sem(2, "pipeline free output");
+    fOutFilled = create_sem(0, "pipeline filled output");
+    if(fInFree < 0 || fInFilled < 0 || fOutFree < 0 || fOutFilled < 0) {
+        delete_sem(fInFree);
+        delete_sem(fInFilled);
+        delete_sem(fOutFree);
+        delete_sem(fOutFilled);
+        return B_NO_MORE_SEMS;
+    }
+
+    thread_id reader = spawn_thread(_CallReader, "pipeline reader",
+        B_NORMAL_PRIORITY, this);
+    thread_id writer = spawn_thread(_CallWriter, "pipeline writer",
+        B_NORMAL_PRIORITY, this);
+    if(reader < 0 || writer < 0)
+        _Fail(B_NO_MORE_THREADS);
+    else {
+        resume_thread(reader);
+        resume_thread(writer);
+    }
+
+    int32 in = 0, out = 0;
+    bool last = false;
+    while(!last && fStatus == B_OK) {
+        if(acquire_sem(fInFilled) != B_OK || fStatus != B_OK)
+            break;
+        pipeline_slot& input = fIn[in];
+        last = input.last;
+
+        if(acquire_sem(fOutFree) != B_OK || fStatus != B_OK)
+            break;
+        pipeline_slot& output = fOut[out];
+        output.length = 0;
+        output.last = false;
+        status_t status = input.length > 0
+            ? transform(input.data, input.length, output.data, &output.length)
+            : B_OK;
+        release_sem(fInFree);
+        in = (in + 1) % 2;
+        if(status != B_OK) {
+            _Fail(status);
+            break;
+        }
+
+        if(last && finish) {
+            // What is left goes in a buffer of its own
+            release_sem(fOutFilled);
+            out = (out + 1) % 2;
+            if(acquire_sem(fOutFree) != B_OK || fStatus != B_OK)
+                break;
+            pipeline_slot& tail = fOut[out];
+            tail.length = 0;
+            if((status = finish(tail.data, &tail.length)) != B_OK) {
+                _Fail(status);
+                break;
+            }
+            tail.last = true;
+        }
+        else
+            output.last = last;
+        release_sem(fOutFilled);
+        out = (out + 1) % 2;
+    }
+
+    // The writer is done with the last buffer before the semaphores go away
+    status_t result;
+    if(fStatus == B_OK && writer >= 0)
+        wait_for_thread(writer, &result);
+    delete_sem(fInFree);
+    delete_sem(fInFilled);
+    delete_sem(fOutFree);
+    delete_sem(fOutFilled);
+    if(reader >= 0)
+        wait_for_thread(reader, &result);
+    if(writer >= 0)
+        wait_for_thread(writer, &result);
+    fInFree = fInFilled = fOutFree = fOutFilled = -1;
+
+    return fStatus;
+}
+
+size_t DataPipeline::BufferSize()
+{
+    return fBufferSize;
+}
+
+off_t DataPipeline::BytesRead()
+{
+    return fBytesRead;
+}
+
+off_t DataPipeline::BytesWritten()
+{
+    return fBytesWritten;
+}
+
+// #pragma mark - Private
+
+int32 DataPipeline::_CallReader(void* data)
+{
+    static_cast<DataPipeline*>(data)->_Read();
+    return 0;
+}
+
+int32 DataPipeline::_CallWriter(void* data)
+{
+    static_cast<DataPipeline*>(data)->_Write();
+    return 0;
+}
+
+void DataPipeline::_Read()
+{
+    int32 index = 0;
+    bool last = false;
+    while(!last) {
+        if(acquire_sem(fInFree) != B_OK || fStatus != B_OK)
+            return;
+
+        pipeline_slot& slot = fIn[index];
+        slot.length = 0;
+        off_t left = fLength - fBytesRead;
+        size_t wanted = left < (off_t)fBufferSize ? left : fBufferSize;
+        while(slot.length < wanted) {
+            ssize_t read = fSource->ReadAt(fOffset + fBytesRead + slot.length,
+                slot.data + slot.length, wanted - slot.length);
+            if(read < 0) {
+                fprintf(stderr, "Error: bad read at %" B_PRIdOFF ".\n",
+                    fOffset + fBytesRead + slot.length);
+                _Fail(read);
+                return;
+            }
+            if(read == 0) { // The source is shorter than told
+                fprintf(stderr, "Error: short read at %" B_PRIdOFF ", %" B_PRIdOFF
+                    " bytes expected.\n", fOffset + fBytesRead + slot.length, fLength);
+                _Fail(B_IO_ERROR);
+                return;
+            }
+            slot.length += read;
+        }
+        fBytesRead += slot.length;
+        last = fBytesRead == fLength;
+        slot.last = last;
+
+        release_sem(fInFilled);
+        index = (index + 1) % 2;
+    }
+}
+
+void DataPipeline::_Write()
+{
+    int32 index = 0;
+    bool last = false;
+    while(!last) {
+        if(acquire_sem(fOutFilled) != B_OK || fStatus != B_OK)
+            return;
+
+        pipeline_slot& slot = fOut[index];
+        last = slot.last;
+        size_t written = 0;
+        while(written < slot.length) {
+            ssize_t result = fSink->Write(slot.data + written, slot.length - written);
+            if(result <= 0) {
+                fprintf(stderr, "Error: bad write at %" B_PRIdOFF ".\n",
+                    fBytesWritten + written);
+                _Fail(result < 0 ? result : B_IO_ERROR);
+                return;
+            }
+            written += result;
+        }
+        fBytesWritten += written;
+
+        release_sem(fOutFree);
+        index = (index + 1) % 2;
+    }
+}
+
+// _Fail: keeps the first error, and wakes up whoever waits for the others
+void DataPipeline::_Fail(status_t status)
+{
+    status_t expected = B_OK;
+    fStatus.compare_exchange_strong(expected, status);
+    release_sem_etc(fInFree, 2, 0);
+    release_sem_etc(fOutFilled, 2, 0);
+    release_sem_etc(fInFilled, 2, 0);
+    release_sem_etc(fOutFree, 2, 0);
+}
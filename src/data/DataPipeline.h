@@ -0,0 +1,76 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef __DATA_PIPELINE_H_
+#define __DATA_PIPELINE_H_
+
+#include <DataIO.h>
+#include <OS.h>
+#include <SupportDefs.h>
+#include <atomic>
+#include <functional>
+
+const size_t kDefaultPipelineBufferSize = 256 * 1024;
+// Room past the buffer size for whatever a transformation adds to its input
+const size_t kPipelineSlack = 1024;
+
+/* Moves a stream of data from a source to a sink through a transformation.
+
+    The source is read in a thread of its own and the sink is written in
+    another, each one with two buffers, so reading the next buffer, working
+    on the current one and writing the previous one happen at the same time.
+    Memory use only depends on the buffer size, never on the data length.
+    A source that ends before the length it was given fails with B_IO_ERROR.
+*/
+class DataPipeline
+{
+public:
+    /* Transforms a whole input buffer into an output buffer of up to the
+        buffer size plus kPipelineSlack bytes */
+    typedef std::function<status_t(const uint8* in, size_t inLength,
+        uint8* out, size_t* outLength)> transform_func;
+    /* Produces whatever is left once all the input has been transformed */
+    typedef std::function<status_t(uint8* out, size_t* outLength)> finish_func;
+
+                DataPipeline(size_t bufferSize = kDefaultPipelineBufferSize);
+               ~DataPipeline();
+
+    status_t    Run(BPositionIO* source, off_t offset, off_t length,
+                    BDataIO* sink, const transform_func& transform,
+                    const finish_func& finish = nullptr);
+
+    size_t      BufferSize();
+    off_t       BytesRead();
+    off_t       BytesWritten();
+private:
+    struct pipeline_slot {
+        uint8  *data;
+        size_t  length;
+        bool    last;
+    };
+
+    static int32 _CallReader(void* data);
+    static int32 _CallWriter(void* data);
+    void        _Read();
+    void        _Write();
+    void        _Fail(status_t status);
+private:
+    size_t      fBufferSize;
+    pipeline_slot fIn[2],
+                fOut[2];
+    sem_id      fInFree,
+                fInFilled,
+                fOutFree,
+                fOutFilled;
+    std::atomic<status_t> fStatus;
+
+    BPositionIO *fSource;
+    off_t       fOffset,
+                fLength;
+    BDataIO    *fSink;
+    off_t       fBytesRead,
+                fBytesWritten;
+};
+
+#endif /* __DATA_PIPELINE_H_ */
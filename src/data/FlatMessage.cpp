@@ -0,0 +1,652 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include "FlatMessage.h"
+
+/* The layout of a flattened message, as in Haiku's MessagePrivate.h */
+static const uint32 kFormatHaiku = '1FMH';
+static const uint32 kFormatHaikuSwapped = 'HMF1';
+static const uint32 kFormatR5 = 'FOB1';
+static const uint32 kFormatR5Swapped = '1BOF';
+static const uint32 kFormatDano = 'FOB2';
+static const uint32 kFormatDanoSwapped = '2BOF';
+
+static const uint32 kMessageFlagValid = 0x0001;
+static const uint16 kFieldFlagValid = 0x0001;
+static const uint16 kFieldFlagFixedSize = 0x0002;
+
+static const uint32 kHashTableSize = 5;
+
+struct message_header {
+    uint32      format;
+    uint32      what;
+    uint32      flags;
+    int32       target;
+    int32       current_specifier;
+    int32       message_area;
+    int32       reply_port;
+    int32       reply_target;
+    int32       reply_team;
+    uint32      data_size;
+    uint32      field_count;
+    uint32      hash_table_size;
+    int32       hash_table[kHashTableSize];
+};
+
+struct field_header {
+    uint16      flags;
+    uint16      name_length;    // including its terminator
+    type_code   type;
+    uint32      count;
+    uint32      data_size;      // of the items, not the name
+    uint32      offset;         // of the name, in the data
+    int32       next_field;
+};
+
+// The buffer given to the reader needs not be aligned, so headers are copied
+static inline field_header FieldHeader(const uint8* fields, uint32 index)
+{
+    field_header header;
+    memcpy(&header, fields + index * sizeof(field_header), sizeof(field_header));
+    return header;
+}
+
+// HashName: the same as BMessage's, so BMessage finds the fields written here
+static uint32 HashName(const char* name)
+{
+    char ch;
+    uint32 result = 0;
+    while((ch = *name++) != 0) {
+        result = (result << 7) ^ (result >> 24);
+        result ^= ch;
+    }
+    result ^= result << 12;
+    return result;
+}
+
+// #pragma mark - FlatMessageReader
+
+FlatMessageReader::FlatMessageReader()
+: fBuffer(nullptr),
+  fLength(0),
+  fMapping(nullptr),
+  fMappingLength(0),
+  fFields(nullptr),
+  fData(nullptr),
+  fFieldCount(0),
+  fDataSize(0),
+  fInitStatus(B_NO_INIT)
+{
+}
+
+FlatMessageReader::FlatMessageReader(const char* path)
+: FlatMessageReader()
+{
+    SetTo(path);
+}
+
+FlatMessageReader::~FlatMessageReader()
+{
+    Unset();
+}
+
+status_t FlatMessageReader::SetTo(const char* path)
+{
+    Unset();
+    if(!path)
+        return fInitStatus = B_BAD_VALUE;
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return fInitStatus = errno == ENOENT ? B_ENTRY_NOT_FOUND : B_IO_ERROR;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return fInitStatus = B_BAD_VALUE;
+    }
+    if(st.st_size < (off_t)sizeof(message_header)) {
+        close(fd);
+        return fInitStatus = B_BAD_DATA;
+    }
+
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file
+    if(mapping == MAP_FAILED)
+        return fInitStatus = B_NO_MEMORY;
+
+    fMapping = mapping;
+    fMappingLength = st.st_size;
+    fBuffer = static_cast<const uint8*>(mapping);
+    fLength = st.st_size;
+    fInitStatus = _Check();
+    if(fInitStatus != B_OK)
+        _Unset(fInitStatus);
+
+    return fInitStatus;
+}
+
+// SetTo: the buffer is not copied, and has to outlive the reader
+status_t FlatMessageReader::SetTo(const void* buffer, size_t length)
+{
+    Unset();
+    if(!buffer)
+        return fInitStatus = B_BAD_VALUE;
+
+    fBuffer = static_cast<const uint8*>(buffer);
+    fLength = length;
+    fInitStatus = _Check();
+    if(fInitStatus != B_OK)
+        _Unset(fInitStatus);
+
+    return fInitStatus;
+}
+
+void FlatMessageReader::Unset()
+{
+    _Unset(B_NO_INIT);
+}
+
+status_t FlatMessageReader::InitCheck() const
+{
+    return fInitStatus;
+}
+
+uint32 FlatMessageReader::What() const
+{
+    if(fInitStatus != B_OK)
+        return 0;
+
+    message_header header;
+    memcpy(&header, fBuffer, sizeof(header));
+    return header.what;
+}
+
+size_t FlatMessageReader::FlattenedSize() const
+{
+    if(fInitStatus != B_OK)
+        return 0;
+
+    return sizeof(message_header) + fFieldCount * sizeof(field_header) + fDataSize;
+}
+
+int32 FlatMessageReader::CountFields() const
+{
+    return fInitStatus == B_OK ? fFieldCount : 0;
+}
+
+status_t FlatMessageReader::FieldAt(int32 index, flat_field* field) const
+{
+    if(fInitStatus != B_OK)
+        return fInitStatus;
+    if(index < 0 || (uint32)index >= fFieldCount)
+        return B_BAD_INDEX;
+    if(!field)
+        return B_BAD_VALUE;
+
+    field_header header = FieldHeader(fFields, index);
+    field->name = reinterpret_cast<const char*>(fData + header.offset);
+    field->type = header.type;
+    field->count = header.count;
+    field->fixedSize = (header.flags & kFieldFlagFixedSize) != 0;
+    field->data = fData + header.offset + header.name_length;
+    field->dataSize = header.data_size;
+    return B_OK;
+}
+
+/* FindField: fields are few enough in the messages read here that looking
+    at every one beats going through the hash table. */
+status_t FlatMessageReader::FindField(const char* name, flat_field* field) const
+{
+    if(fInitStatus != B_OK)
+        return fInitStatus;
+    if(!name)
+        return B_BAD_VALUE;
+
+    for(uint32 i = 0; i < fFieldCount; i++) {
+        field_header header = FieldHeader(fFields, i);
+        if(strcmp(reinterpret_cast<const char*>(fData + header.offset), name) == 0)
+            return field ? FieldAt(i, field) : B_OK;
+    }
+
+    return B_NAME_NOT_FOUND;
+}
+
+status_t FlatMessageReader::GetInfo(const char* name, type_code* type, int32* count) const
+{
+    flat_field field;
+    status_t status = FindField(name, &field);
+    if(status != B_OK)
+        return status;
+
+    if(type)
+        *type = field.type;
+    if(count)
+        *count = field.count;
+    return B_OK;
+}
+
+status_t FlatMessageReader::FindData(const char* name, type_code type, int32 index,
+    const void** data, ssize_t* size) const
+{
+    return _FindItem(name, type, index, 0, data, size);
+}
+
+// FindString: points into the message, where the string is terminated
+status_t FlatMessageReader::FindString(const char* name, int32 index, const char** string) const
+{
+    if(!string)
+        return B_BAD_VALUE;
+
+    const void* data;
+    ssize_t size;
+    status_t status = _FindItem(name, B_STRING_TYPE, index, 0, &data, &size);
+    if(status != B_OK)
+        return status;
+    if(size < 1 || static_cast<const char*>(data)[size - 1] != '\0')
+        return B_BAD_DATA;
+
+    *string = static_cast<const char*>(data);
+    return B_OK;
+}
+
+status_t FlatMessageReader::FindBool(const char* name, int32 index, bool* value) const
+{
+    if(!value)
+        return B_BAD_VALUE;
+
+    const void* data;
+    status_t status = _FindItem(name, B_BOOL_TYPE, index, sizeof(bool), &data, nullptr);
+    if(status == B_OK)
+        *value = *static_cast<const uint8*>(data) != 0;
+    return status;
+}
+
+status_t FlatMessageReader::FindInt32(const char* name, int32 index, int32* value) const
+{
+    if(!value)
+        return B_BAD_VALUE;
+
+    const void* data;
+    status_t status = _FindItem(name, B_INT32_TYPE, index, sizeof(int32), &data, nullptr);
+    if(status == B_OK)
+        memcpy(value, data, sizeof(int32));
+    return status;
+}
+
+status_t FlatMessageReader::FindUInt32(const char* name, int32 index, uint32* value) const
+{
+    if(!value)
+        return B_BAD_VALUE;
+
+    const void* data;
+    status_t status = _FindItem(name, B_UINT32_TYPE, index, sizeof(uint32), &data, nullptr);
+    if(status == B_OK)
+        memcpy(value, data, sizeof(uint32));
+    return status;
+}
+
+status_t FlatMessageReader::FindInt64(const char* name, int32 index, int64* value) const
+{
+    if(!value)
+        return B_BAD_VALUE;
+
+    const void* data;
+    status_t status = _FindItem(name, B_INT64_TYPE, index, sizeof(int64), &data, nullptr);
+    if(status == B_OK)
+        memcpy(value, data, sizeof(int64));
+    return status;
+}
+
+const char* FlatMessageReader::GetString(const char* name, const char* defaultValue) const
+{
+    const char* string;
+    return FindString(name, 0, &string) == B_OK ? string : defaultValue;
+}
+
+uint32 FlatMessageReader::GetUInt32(const char* name, uint32 defaultValue) const
+{
+    uint32 value;
+    return FindUInt32(name, 0, &value) == B_OK ? value : defaultValue;
+}
+
+// #pragma mark - FlatMessageReader private
+
+void FlatMessageReader::_Unset(status_t status)
+{
+    if(fMapping)
+        munmap(fMapping, fMappingLength);
+
+    fBuffer = nullptr;
+    fLength = 0;
+    fMapping = nullptr;
+    fMappingLength = 0;
+    fFields = nullptr;
+    fData = nullptr;
+    fFieldCount = 0;
+    fDataSize = 0;
+    fInitStatus = status;
+}
+
+/* _Check: everything the finds rely on is checked here, once, so that they
+    can trust the message afterwards: every field and every item lies inside
+    of the data, and every name is terminated. */
+status_t FlatMessageReader::_Check()
+{
+    if(fLength < sizeof(message_header))
+        return B_BAD_DATA;
+
+    message_header header;
+    memcpy(&header, fBuffer, sizeof(header));
+    switch(header.format)
+    {
+        case kFormatHaiku:
+            break;
+        case kFormatHaikuSwapped:
+        case kFormatR5:
+        case kFormatR5Swapped:
+        case kFormatDano:
+        case kFormatDanoSwapped:
+            return B_NOT_SUPPORTED;
+        default:
+            return B_BAD_DATA;
+    }
+    if((header.flags & kMessageFlagValid) == 0)
+        return B_BAD_DATA;
+
+    uint64 fieldsSize = (uint64)header.field_count * sizeof(field_header);
+    if(fieldsSize + header.data_size > fLength - sizeof(message_header))
+        return B_BAD_DATA;
+
+    fFields = fBuffer + sizeof(message_header);
+    fData = fFields + fieldsSize;
+    fFieldCount = header.field_count;
+    fDataSize = header.data_size;
+
+    for(uint32 i = 0; i < fFieldCount; i++) {
+        field_header field = FieldHeader(fFields, i);
+        if((field.flags & kFieldFlagValid) == 0 || field.name_length < 1)
+            return B_BAD_DATA;
+        uint64 end = (uint64)field.offset + field.name_length + field.data_size;
+        if(end > fDataSize)
+            return B_BAD_DATA;
+        if(fData[field.offset + field.name_length - 1] != '\0')
+            return B_BAD_DATA;
+
+        const uint8* items = fData + field.offset + field.name_length;
+        if(field.flags & kFieldFlagFixedSize) {
+            if(field.count == 0 || field.data_size % field.count != 0)
+                return B_BAD_DATA;
+            continue;
+        }
+
+        // Every variable sized item goes with its size in front
+        uint64 position = 0;
+        for(uint32 item = 0; item < field.count; item++) {
+            if(position + sizeof(uint32) > field.data_size)
+                return B_BAD_DATA;
+            uint32 size;
+            memcpy(&size, items + position, sizeof(uint32));
+            position += sizeof(uint32) + size;
+            if(position > field.data_size)
+                return B_BAD_DATA;
+        }
+    }
+
+    return B_OK;
+}
+
+/* _FindItem: a fixed size, if given, is the size the item has to have. The
+    items of variable size are walked up to the one wanted. */
+status_t FlatMessageReader::_FindItem(const char* name, type_code type, int32 index,
+    size_t fixedSize, const void** data, ssize_t* size) const
+{
+    if(!data)
+        return B_BAD_VALUE;
+
+    flat_field field;
+    status_t status = FindField(name, &field);
+    if(status != B_OK)
+        return status;
+    if(type != B_ANY_TYPE && field.type != type)
+        return B_BAD_TYPE;
+    if(index < 0 || index >= field.count)
+        return B_BAD_INDEX;
+
+    if(field.fixedSize) {
+        size_t itemSize = field.dataSize / field.count;
+        if(fixedSize != 0 && itemSize != fixedSize)
+            return B_BAD_DATA;
+        *data = field.data + index * itemSize;
+        if(size)
+            *size = itemSize;
+        return B_OK;
+    }
+
+    if(fixedSize != 0)
+        return B_BAD_DATA;
+
+    const uint8* item = field.data;
+    uint32 itemSize;
+    while(true) {
+        memcpy(&itemSize, item, sizeof(uint32));
+        if(index-- == 0)
+            break;
+        item += sizeof(uint32) + itemSize;
+    }
+    *data = item + sizeof(uint32);
+    if(size)
+        *size = itemSize;
+    return B_OK;
+}
+
+// #pragma mark - FlatMessageWriter
+
+FlatMessageWriter::FlatMessageWriter(uint32 what)
+{
+    MakeEmpty(what);
+}
+
+void FlatMessageWriter::MakeEmpty(uint32 what)
+{
+    fWhat = what;
+    fFields.clear();
+    fData.clear();
+    for(uint32 i = 0; i < kHashTableSize; i++)
+        fHashTable[i] = -1;
+}
+
+/* AddData: an item for a field that is already there goes at the end of it,
+    and the data of the fields after it is moved along. A field keeps the
+    type and the fixed size it was added with first. */
+status_t FlatMessageWriter::AddData(const char* name, type_code type, const void* data,
+    size_t size, bool fixedSize)
+{
+    if(!name || name[0] == '\0' || (!data && size > 0))
+        return B_BAD_VALUE;
+
+    size_t nameLength = strlen(name) + 1;
+    if(nameLength > UINT16_MAX || size > UINT32_MAX - sizeof(uint32))
+        return B_BAD_VALUE;
+
+    uint32 hash = HashName(name) % kHashTableSize;
+    int32 index = fHashTable[hash];
+    int32 last = -1;
+    while(index >= 0) {
+        const field_entry& entry = fFields[index];
+        if(strcmp(reinterpret_cast<const char*>(&fData[entry.offset]), name) == 0)
+            break;
+        last = index;
+        index = entry.nextField;
+    }
+
+    size_t itemLength = size + (fixedSize ? 0 : sizeof(uint32));
+    if(fData.size() + nameLength + itemLength > UINT32_MAX)
+        return B_NO_MEMORY;
+
+    if(index < 0) {
+        field_entry entry;
+        entry.flags = kFieldFlagValid | (fixedSize ? kFieldFlagFixedSize : 0);
+        entry.nameLength = nameLength;
+        entry.type = type;
+        entry.count = 0;
+        entry.dataSize = 0;
+        entry.offset = fData.size();
+        entry.nextField = -1;
+        fData.insert(fData.end(), name, name + nameLength);
+
+        index = fFields.size();
+        fFields.push_back(entry);
+        if(last < 0)
+            fHashTable[hash] = index;
+        else
+            fFields[last].nextField = index;
+    }
+
+    field_entry& entry = fFields[index];
+    if(entry.type != type)
+        return B_BAD_TYPE;
+    bool entryFixed = (entry.flags & kFieldFlagFixedSize) != 0;
+    if(entryFixed != fixedSize)
+        return B_BAD_VALUE;
+    if(fixedSize && entry.count > 0 && entry.dataSize / entry.count != size)
+        return B_BAD_VALUE;
+
+    uint32 end = entry.offset + entry.nameLength + entry.dataSize;
+    uint8 sizeBytes[sizeof(uint32)];
+    uint32 itemSize = size;
+    memcpy(sizeBytes, &itemSize, sizeof(uint32));
+    if(!fixedSize)
+        fData.insert(fData.begin() + end, sizeBytes, sizeBytes + sizeof(uint32));
+    const uint8* bytes = static_cast<const uint8*>(data);
+    fData.insert(fData.begin() + end + (fixedSize ? 0 : sizeof(uint32)), bytes, bytes + size);
+
+    entry.count++;
+    entry.dataSize += itemLength;
+    for(field_entry& other : fFields) {
+        if(other.offset >= end && &other != &entry)
+            other.offset += itemLength;
+    }
+
+    return B_OK;
+}
+
+status_t FlatMessageWriter::AddString(const char* name, const char* string)
+{
+    if(!string)
+        return B_BAD_VALUE;
+
+    return AddData(name, B_STRING_TYPE, string, strlen(string) + 1, false);
+}
+
+status_t FlatMessageWriter::AddBool(const char* name, bool value)
+{
+    uint8 byte = value ? 1 : 0;
+    return AddData(name, B_BOOL_TYPE, &byte, sizeof(byte));
+}
+
+status_t FlatMessageWriter::AddInt32(const char* name, int32 value)
+{
+    return AddData(name, B_INT32_TYPE, &value, sizeof(value));
+}
+
+status_t FlatMessageWriter::AddUInt32(const char* name, uint32 value)
+{
+    return AddData(name, B_UINT32_TYPE, &value, sizeof(value));
+}
+
+status_t FlatMessageWriter::AddInt64(const char* name, int64 value)
+{
+    return AddData(name, B_INT64_TYPE, &value, sizeof(value));
+}
+
+size_t FlatMessageWriter::FlattenedSize() const
+{
+    return sizeof(message_header) + fFields.size() * sizeof(field_header) + fData.size();
+}
+
+// Flatten: in three writes, the header, the fields and the data
+status_t FlatMessageWriter::Flatten(const write_func& write) const
+{
+    if(!write)
+        return B_BAD_VALUE;
+
+    message_header header;
+    header.format = kFormatHaiku;
+    header.what = fWhat;
+    header.flags = kMessageFlagValid;
+    header.target = -1;
+    header.current_specifier = -1;
+    header.message_area = -1;
+    header.reply_port = -1;
+    header.reply_target = -1;
+    header.reply_team = -1;
+    header.data_size = fData.size();
+    header.field_count = fFields.size();
+    header.hash_table_size = kHashTableSize;
+    memcpy(header.hash_table, fHashTable, sizeof(header.hash_table));
+
+    std::vector<field_header> fields(fFields.size());
+    for(size_t i = 0; i < fFields.size(); i++) {
+        const field_entry& entry = fFields[i];
+        fields[i].flags = entry.flags;
+        fields[i].name_length = entry.nameLength;
+        fields[i].type = entry.type;
+        fields[i].count = entry.count;
+        fields[i].data_size = entry.dataSize;
+        fields[i].offset = entry.offset;
+        fields[i].next_field = entry.nextField;
+    }
+
+    struct { const void* buffer; size_t length; } pieces[] = {
+        { &header, sizeof(header) },
+        { fields.data(), fields.size() * sizeof(field_header) },
+        { fData.data(), fData.size() }
+    };
+    for(const auto& piece : pieces) {
+        if(piece.length == 0)
+            continue;
+        ssize_t written = write(piece.buffer, piece.length);
+        if(written < 0)
+            return written;
+        if((size_t)written != piece.length)
+            return B_IO_ERROR;
+    }
+
+    return B_OK;
+}
+
+status_t FlatMessageWriter::Flatten(void* buffer, size_t length) const
+{
+    if(!buffer)
+        return B_BAD_VALUE;
+    if(length < FlattenedSize())
+        return B_BUFFER_OVERFLOW;
+
+    uint8* position = static_cast<uint8*>(buffer);
+    return Flatten([&position](const void* piece, size_t pieceLength) -> ssize_t {
+        memcpy(position, piece, pieceLength);
+        position += pieceLength;
+        return pieceLength;
+    });
+}
+
+#if defined(__HAIKU__)
+status_t FlatMessageWriter::Flatten(BDataIO* out) const
+{
+    if(!out)
+        return B_BAD_VALUE;
+
+    return Flatten([out](const void* piece, size_t pieceLength) -> ssize_t {
+        status_t status = out->WriteExactly(piece, pieceLength);
+        return status == B_OK ? (ssize_t)pieceLength : status;
+    });
+}
+#endif
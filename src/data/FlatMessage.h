@@ -0,0 +1,168 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef __FLAT_MESSAGE_H_
+#define __FLAT_MESSAGE_H_
+
+#include <sys/types.h>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#if defined(__HAIKU__)
+#include <DataIO.h>
+#include <SupportDefs.h>
+#include <TypeConstants.h>
+#else
+/* Enough of the Haiku definitions to build and run this anywhere */
+#include <cstdint>
+typedef int8_t      int8;
+typedef uint8_t     uint8;
+typedef int16_t     int16;
+typedef uint16_t    uint16;
+typedef int32_t     int32;
+typedef uint32_t    uint32;
+typedef int64_t     int64;
+typedef uint64_t    uint64;
+typedef int32       status_t;
+typedef uint32      type_code;
+
+#define B_GENERAL_ERROR_BASE INT32_MIN
+#define B_OK                0
+#define B_ERROR             (-1)
+#define B_NO_MEMORY         (B_GENERAL_ERROR_BASE + 0)
+#define B_IO_ERROR          (B_GENERAL_ERROR_BASE + 1)
+#define B_BAD_INDEX         (B_GENERAL_ERROR_BASE + 3)
+#define B_BAD_TYPE          (B_GENERAL_ERROR_BASE + 4)
+#define B_BAD_VALUE         (B_GENERAL_ERROR_BASE + 5)
+#define B_NAME_NOT_FOUND    (B_GENERAL_ERROR_BASE + 7)
+#define B_NO_INIT           (B_GENERAL_ERROR_BASE + 13)
+#define B_NOT_ALLOWED       (B_GENERAL_ERROR_BASE + 15)
+#define B_BAD_DATA          (B_GENERAL_ERROR_BASE + 16)
+#define B_NOT_SUPPORTED     (B_GENERAL_ERROR_BASE + 0x1000)
+#define B_BUFFER_OVERFLOW   (B_GENERAL_ERROR_BASE + 0x2000)
+#define B_ENTRY_NOT_FOUND   (B_GENERAL_ERROR_BASE + 0x6003)
+
+#define B_ANY_TYPE          'ANYT'
+#define B_BOOL_TYPE         'BOOL'
+#define B_INT32_TYPE        'LONG'
+#define B_INT64_TYPE        'LLNG'
+#define B_MESSAGE_TYPE      'MSGG'
+#define B_RAW_TYPE          'RAWT'
+#define B_STRING_TYPE       'CSTR'
+#define B_UINT32_TYPE       'ULNG'
+#define B_UINT64_TYPE       'ULLG'
+#endif
+
+/* The flattened BMessage format, read and written without a BMessage.
+
+    A flattened message is a header, the headers of its fields, and the data
+    of the fields, each one its name followed by its items. Items of a fixed
+    size field are all the same size and packed; those of any other field,
+    like strings, have their size in front. Only messages in the native byte
+    order of the current Haiku format are understood.
+
+    The reader maps a file, or takes a buffer, checks it once through, and
+    then finds fields and items in place: nothing is copied or allocated,
+    and the pointers it returns are valid until it is unset. The writer
+    takes fields one item at a time and writes the message in three pieces
+    once it is done, and its output unflattens into a BMessage.
+*/
+struct flat_field {
+    const char *name;
+    type_code   type;
+    int32       count;
+    bool        fixedSize;
+    const uint8 *data;          // of its items, right after its name
+    size_t      dataSize;
+};
+
+class FlatMessageReader
+{
+public:
+                FlatMessageReader();
+                FlatMessageReader(const char* path);
+               ~FlatMessageReader();
+
+    status_t    SetTo(const char* path);
+    status_t    SetTo(const void* buffer, size_t length);
+    void        Unset();
+    status_t    InitCheck() const;
+
+    uint32      What() const;
+    // FlattenedSize: of the message, any data past it is not looked at
+    size_t      FlattenedSize() const;
+    int32       CountFields() const;
+    status_t    FieldAt(int32 index, flat_field* field) const;
+    status_t    FindField(const char* name, flat_field* field) const;
+    // GetInfo: like BMessage's, B_NAME_NOT_FOUND without the field
+    status_t    GetInfo(const char* name, type_code* type, int32* count) const;
+
+    status_t    FindData(const char* name, type_code type, int32 index,
+                    const void** data, ssize_t* size) const;
+    status_t    FindString(const char* name, int32 index, const char** string) const;
+    status_t    FindBool(const char* name, int32 index, bool* value) const;
+    status_t    FindInt32(const char* name, int32 index, int32* value) const;
+    status_t    FindUInt32(const char* name, int32 index, uint32* value) const;
+    status_t    FindInt64(const char* name, int32 index, int64* value) const;
+
+    const char* GetString(const char* name, const char* defaultValue) const;
+    uint32      GetUInt32(const char* name, uint32 defaultValue) const;
+private:
+    void        _Unset(status_t status);
+    status_t    _Check();
+    status_t    _FindItem(const char* name, type_code type, int32 index,
+                    size_t fixedSize, const void** data, ssize_t* size) const;
+private:
+    const uint8 *fBuffer;
+    size_t      fLength;
+    void       *fMapping;       // when the buffer is a mapped file
+    size_t      fMappingLength;
+    const uint8 *fFields,
+                *fData;
+    uint32      fFieldCount,
+                fDataSize;
+    status_t    fInitStatus;
+};
+
+class FlatMessageWriter
+{
+public:
+    typedef std::function<ssize_t(const void* buffer, size_t length)> write_func;
+
+                FlatMessageWriter(uint32 what = 0);
+
+    void        MakeEmpty(uint32 what = 0);
+    status_t    AddData(const char* name, type_code type, const void* data,
+                    size_t size, bool fixedSize = true);
+    status_t    AddString(const char* name, const char* string);
+    status_t    AddBool(const char* name, bool value);
+    status_t    AddInt32(const char* name, int32 value);
+    status_t    AddUInt32(const char* name, uint32 value);
+    status_t    AddInt64(const char* name, int64 value);
+
+    size_t      FlattenedSize() const;
+    status_t    Flatten(const write_func& write) const;
+    status_t    Flatten(void* buffer, size_t length) const;
+#if defined(__HAIKU__)
+    status_t    Flatten(BDataIO* out) const;
+#endif
+private:
+    struct field_entry {
+        uint16      flags;
+        uint16      nameLength;
+        type_code   type;
+        uint32      count;
+        uint32      dataSize;
+        uint32      offset;
+        int32       nextField;
+    };
+private:
+    uint32      fWhat;
+    std::vector<field_entry> fFields;
+    std::vector<uint8> fData;
+    int32       fHashTable[5];
+};
+
+#endif /* __FLAT_MESSAGE_H_ */
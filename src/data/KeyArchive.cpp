@@ -0,0 +1,396 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#include <ByteOrder.h>
+#include <Key.h>
+#include <cstring>
+#include "CryptoUtils.h"
+#include "KeyArchive.h"
+
+static const char kArchiveMagic[8] = { 'K', 'E', 'Y', 'S', 'A', 'R', 'C', '1' };
+static const char kIndexMagic[4] = { 'K', 'I', 'D', 'X' };
+static const size_t kArchiveHeaderSize = 16;
+static const size_t kArchiveFooterSize = 16;
+static const uint32 kArchiveIndexWhat = 'KIDX';
+
+// EraseBuffer: records hold secrets, they are not left behind in freed memory
+static void EraseBuffer(BMallocIO& buffer)
+{
+    if(buffer.BufferLength() > 0)
+        memzero(const_cast<void*>(buffer.Buffer()), buffer.BufferLength());
+    buffer.SetSize(0);
+}
+
+KeyArchiveWriter::KeyArchiveWriter(int32 compression)
+: fCompressor(nullptr),
+  fIndex(kArchiveIndexWhat),
+  fCount(0)
+{
+    if(compression != kNoCompression)
+        fCompressor = new BlockCompressor(compression);
+}
+
+KeyArchiveWriter::~KeyArchiveWriter()
+{
+    EraseBuffer(fRecords);
+    delete fCompressor;
+}
+
+status_t KeyArchiveWriter::AddKey(const char* keyring, const BMessage& key)
+{
+    if(!keyring || !key.HasString("identifier"))
+        return B_BAD_VALUE;
+    if(fCompressor && fCompressor->InitCheck() != B_OK)
+        return fCompressor->InitCheck();
+
+    ssize_t size = key.FlattenedSize();
+    if(size <= 0)
+        return B_BAD_DATA;
+    std::vector<uint8> flat(size);
+    status_t status = key.Flatten(reinterpret_cast<char*>(flat.data()), size);
+
+    // A record is either the flattened key or a single frame of it
+    std::vector<uint8> frame;
+    const uint8* record = flat.data();
+    size_t length = size;
+    if(status == B_OK && fCompressor) {
+        frame.resize(BlockCompressor::FrameBound(size));
+        if((status = fCompressor->Compress(flat.data(), size, frame.data(), &length)) == B_OK)
+            record = frame.data();
+    }
+
+    off_t offset = kArchiveHeaderSize + fRecords.Position();
+    if(status == B_OK && fRecords.Write(record, length) != (ssize_t)length)
+        status = B_NO_MEMORY;
+    memzero(flat.data(), flat.size());
+    if(!frame.empty())
+        memzero(frame.data(), frame.size());
+    if(status != B_OK)
+        return status;
+
+    fIndex.AddString("keyring", keyring);
+    fIndex.AddString("identifier", key.GetString("identifier", ""));
+    fIndex.AddString("secondaryIdentifier", key.GetString("secondaryIdentifier", ""));
+    fIndex.AddUInt32("type", key.GetUInt32("type", B_KEY_TYPE_ANY));
+    fIndex.AddInt64("offset", offset);
+    fIndex.AddUInt32("length", length);
+    fCount++;
+
+    return B_OK;
+}
+
+status_t KeyArchiveWriter::AddKey(KeystoreBackend* backend, const char* keyring,
+    BKeyType type, const char* identifier, const char* secondaryIdentifier)
+{
+    if(!backend || !keyring || !identifier)
+        return B_BAD_VALUE;
+
+    status_t status;
+    BMessage archive;
+    if(type == B_KEY_TYPE_PASSWORD) {
+        BPasswordKey key;
+        if((status = backend->GetKey(keyring, type, identifier, secondaryIdentifier,
+        false, key)) != B_OK || (status = key.Flatten(archive)) != B_OK)
+            return status;
+    }
+    else if(type == B_KEY_TYPE_GENERIC) {
+        BKey key;
+        if((status = backend->GetKey(keyring, type, identifier, secondaryIdentifier,
+        false, key)) != B_OK || (status = key.Flatten(archive)) != B_OK)
+            return status;
+    }
+    else
+        return B_NOT_SUPPORTED;
+
+    return AddKey(keyring, archive);
+}
+
+int32 KeyArchiveWriter::CountKeys()
+{
+    return fCount;
+}
+
+/* WriteTo: an encrypted archive is put together in memory first, as the
+    whole of it goes through the cipher. */
+status_t KeyArchiveWriter::WriteTo(BDataIO* out, const char* password)
+{
+    if(!out)
+        return B_BAD_VALUE;
+    if(!password || password[0] == '\0')
+        return _WritePlain(out);
+
+    uint8 header[kArchiveHeaderSize] = {};
+    memcpy(header, kArchiveMagic, sizeof(kArchiveMagic));
+    uint32 flags = B_HOST_TO_LENDIAN_INT32(KEY_ARCHIVE_ENCRYPTED);
+    memcpy(header + 8, &flags, sizeof(flags));
+
+    BMallocIO plain;
+    status_t status = _WritePlain(&plain);
+    if(status == B_OK && out->WriteExactly(header, sizeof(header)) != B_OK)
+        status = B_IO_ERROR;
+    if(status == B_OK) {
+        plain.Seek(0, SEEK_SET);
+        status = EncryptDataChunked(&plain, plain.BufferLength(), password, out);
+    }
+    EraseBuffer(plain);
+
+    return status;
+}
+
+status_t KeyArchiveWriter::_WritePlain(BDataIO* out)
+{
+    uint8 header[kArchiveHeaderSize] = {};
+    memcpy(header, kArchiveMagic, sizeof(kArchiveMagic));
+    uint32 flags = B_HOST_TO_LENDIAN_INT32(fCompressor ? KEY_ARCHIVE_COMPRESSED : 0);
+    memcpy(header + 8, &flags, sizeof(flags));
+
+    uint64 indexOffset = B_HOST_TO_LENDIAN_INT64(kArchiveHeaderSize + fRecords.BufferLength());
+    uint32 indexLength = B_HOST_TO_LENDIAN_INT32((uint32)fIndex.FlattenedSize());
+    uint8 footer[kArchiveFooterSize];
+    memcpy(footer, &indexOffset, sizeof(indexOffset));
+    memcpy(footer + 8, &indexLength, sizeof(indexLength));
+    memcpy(footer + 12, kIndexMagic, sizeof(kIndexMagic));
+
+    if(out->WriteExactly(header, sizeof(header)) != B_OK ||
+    out->WriteExactly(fRecords.Buffer(), fRecords.BufferLength()) != B_OK ||
+    fIndex.Flatten(out) != B_OK ||
+    out->WriteExactly(footer, sizeof(footer)) != B_OK)
+        return B_IO_ERROR;
+
+    return B_OK;
+}
+
+// #pragma mark - KeyArchiveReader
+
+KeyArchiveReader::KeyArchiveReader()
+: fSource(nullptr),
+  fFlags(0),
+  fIndexOffset(0),
+  fKeyCount(0),
+  fInitStatus(B_NO_INIT)
+{
+}
+
+KeyArchiveReader::KeyArchiveReader(const char* path, const char* password)
+: fSource(nullptr),
+  fFlags(0),
+  fIndexOffset(0),
+  fKeyCount(0),
+  fInitStatus(B_NO_INIT)
+{
+    SetTo(path, password);
+}
+
+KeyArchiveReader::~KeyArchiveReader()
+{
+    _Unset();
+}
+
+status_t KeyArchiveReader::SetTo(const char* path, const char* password)
+{
+    _Unset();
+    if(!path)
+        return fInitStatus = B_BAD_VALUE;
+
+    off_t size = 0;
+    status_t status = fFile.SetTo(path, B_READ_ONLY);
+    if(status != B_OK || (status = fFile.GetSize(&size)) != B_OK)
+        return fInitStatus = status;
+
+    // An encrypted archive is a plain one behind a header and the cipher
+    bool encrypted;
+    if(!IsKeyArchive(&fFile, &encrypted))
+        return fInitStatus = B_BAD_DATA;
+    fSource = &fFile;
+    if(encrypted) {
+        if(!password || password[0] == '\0')
+            return fInitStatus = B_NOT_ALLOWED;
+        BMallocIO cipher;
+        std::vector<uint8> data(size - kArchiveHeaderSize);
+        if(fFile.ReadAt(kArchiveHeaderSize, data.data(), data.size()) != (ssize_t)data.size() ||
+        cipher.Write(data.data(), data.size()) != (ssize_t)data.size())
+            return fInitStatus = B_IO_ERROR;
+        if((status = DecryptDataChunked(&cipher, data.size(), password, &fBuffer)) != B_OK)
+            return fInitStatus = status;
+        fSource = &fBuffer;
+        size = fBuffer.BufferLength();
+    }
+
+    uint8 header[kArchiveHeaderSize];
+    if(fSource->ReadAt(0, header, sizeof(header)) != (ssize_t)sizeof(header) ||
+    memcmp(header, kArchiveMagic, sizeof(kArchiveMagic)) != 0)
+        return fInitStatus = B_BAD_DATA;
+    memcpy(&fFlags, header + 8, sizeof(fFlags));
+    fFlags = B_LENDIAN_TO_HOST_INT32(fFlags);
+    if(fFlags & KEY_ARCHIVE_ENCRYPTED)
+        return fInitStatus = B_BAD_DATA;
+
+    return fInitStatus = _ReadIndex(size);
+}
+
+status_t KeyArchiveReader::InitCheck()
+{
+    return fInitStatus;
+}
+
+int32 KeyArchiveReader::CountKeys()
+{
+    return fInitStatus == B_OK ? fKeyCount : 0;
+}
+
+const char* KeyArchiveReader::KeyringAt(int32 index)
+{
+    const char* keyring;
+    if(fInitStatus != B_OK || fIndex.FindString("keyring", index, &keyring) != B_OK)
+        return nullptr;
+
+    return keyring;
+}
+
+status_t KeyArchiveReader::KeyAt(int32 index, BMessage* key)
+{
+    if(fInitStatus != B_OK)
+        return fInitStatus;
+    if(!key)
+        return B_BAD_VALUE;
+
+    int64 offset;
+    uint32 length;
+    if(fIndex.FindInt64("offset", index, &offset) != B_OK ||
+    fIndex.FindUInt32("length", index, &length) != B_OK)
+        return B_BAD_INDEX;
+    if(offset < (off_t)kArchiveHeaderSize || length == 0 ||
+    offset + length > fIndexOffset)
+        return B_BAD_DATA;
+
+    std::vector<uint8> record(length);
+    if(fSource->ReadAt(offset, record.data(), length) != (ssize_t)length)
+        return B_IO_ERROR;
+
+    // Unflattened from a stream, so a damaged record cannot be read past its end
+    status_t status;
+    if(fFlags & KEY_ARCHIVE_COMPRESSED) {
+        BMallocIO flat;
+        DecompressingIO decompressor(&flat);
+        if(decompressor.Write(record.data(), length) != (ssize_t)length ||
+        decompressor.Finish() != B_OK)
+            status = B_BAD_DATA;
+        else {
+            BMemoryIO input(flat.Buffer(), flat.BufferLength());
+            status = key->Unflatten(&input);
+        }
+        EraseBuffer(flat);
+    }
+    else {
+        BMemoryIO input(record.data(), length);
+        status = key->Unflatten(&input);
+    }
+    memzero(record.data(), record.size());
+
+    return status;
+}
+
+status_t KeyArchiveReader::FindKey(const char* keyring, const char* identifier,
+    const char* secondaryIdentifier, BMessage* key)
+{
+    if(fInitStatus != B_OK)
+        return fInitStatus;
+
+    auto it = fLookup.find(_LookupKey(keyring, identifier, secondaryIdentifier));
+    if(it == fLookup.end())
+        return B_ENTRY_NOT_FOUND;
+
+    return KeyAt(it->second, key);
+}
+
+bool KeyArchiveReader::IsKeyArchive(BPositionIO* data, bool* encrypted)
+{
+    uint8 header[kArchiveHeaderSize];
+    if(!data || data->ReadAt(0, header, sizeof(header)) != (ssize_t)sizeof(header) ||
+    memcmp(header, kArchiveMagic, sizeof(kArchiveMagic)) != 0)
+        return false;
+
+    if(encrypted) {
+        uint32 flags;
+        memcpy(&flags, header + 8, sizeof(flags));
+        *encrypted = (B_LENDIAN_TO_HOST_INT32(flags) & KEY_ARCHIVE_ENCRYPTED) != 0;
+    }
+    return true;
+}
+
+// #pragma mark - Private
+
+void KeyArchiveReader::_Unset()
+{
+    fLookup.clear();
+    fIndex.Unset();
+    fIndexData.clear();
+    EraseBuffer(fBuffer);
+    fFile.Unset();
+    fSource = nullptr;
+    fFlags = 0;
+    fIndexOffset = 0;
+    fKeyCount = 0;
+    fInitStatus = B_NO_INIT;
+}
+
+status_t KeyArchiveReader::_ReadIndex(off_t size)
+{
+    uint8 footer[kArchiveFooterSize];
+    if(size < (off_t)(kArchiveHeaderSize + kArchiveFooterSize) ||
+    fSource->ReadAt(size - kArchiveFooterSize, footer, sizeof(footer)) != (ssize_t)sizeof(footer) ||
+    memcmp(footer + 12, kIndexMagic, sizeof(kIndexMagic)) != 0)
+        return B_BAD_DATA;
+
+    uint64 indexOffset;
+    uint32 indexLength;
+    memcpy(&indexOffset, footer, sizeof(indexOffset));
+    memcpy(&indexLength, footer + 8, sizeof(indexLength));
+    indexOffset = B_LENDIAN_TO_HOST_INT64(indexOffset);
+    indexLength = B_LENDIAN_TO_HOST_INT32(indexLength);
+    if(indexOffset < kArchiveHeaderSize ||
+    indexOffset + indexLength + kArchiveFooterSize != (uint64)size)
+        return B_BAD_DATA;
+
+    fIndexOffset = indexOffset;
+    fIndexData.resize(indexLength);
+    if(fSource->ReadAt(fIndexOffset, fIndexData.data(), indexLength) != (ssize_t)indexLength)
+        return B_IO_ERROR;
+    if(fIndex.SetTo(fIndexData.data(), indexLength) != B_OK ||
+    fIndex.What() != kArchiveIndexWhat)
+        return B_BAD_DATA;
+
+    // Every key has its entry in each of the fields
+    type_code type;
+    int32 count = 0, fieldCount;
+    fIndex.GetInfo("offset", &type, &count);
+    for(const char* field : { "keyring", "identifier", "secondaryIdentifier",
+    "type", "length" }) {
+        if(fIndex.GetInfo(field, &type, &fieldCount) != B_OK || fieldCount != count)
+            return B_BAD_DATA;
+    }
+
+    for(int32 i = 0; i < count; i++) {
+        const char *keyring, *identifier, *secondaryIdentifier;
+        if(fIndex.FindString("keyring", i, &keyring) != B_OK ||
+        fIndex.FindString("identifier", i, &identifier) != B_OK ||
+        fIndex.FindString("secondaryIdentifier", i, &secondaryIdentifier) != B_OK)
+            return B_BAD_DATA;
+        fLookup.emplace(_LookupKey(keyring, identifier, secondaryIdentifier), i);
+    }
+    fKeyCount = count;
+
+    return B_OK;
+}
+
+std::string KeyArchiveReader::_LookupKey(const char* keyring, const char* identifier,
+    const char* secondaryIdentifier)
+{
+    std::string key(keyring ? keyring : "");
+    key.push_back('\0');
+    key.append(identifier ? identifier : "");
+    key.push_back('\0');
+    key.append(secondaryIdentifier ? secondaryIdentifier : "");
+    return key;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef __KEY_ARCHIVE_H_
+#define __KEY_ARCHIVE_H_
+
+#include <DataIO.h>
+#include <File.h>
+#include <Message.h>
+#include <SupportDefs.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Compression.h"
+#include "FlatMessage.h"
+#include "KeystoreBackend.h"
+
+/* Many exported keys in a single file. Layout, little endian:
+
+        magic:char[8] "KEYSARC1" flags:uint32 reserved:uint32
+        records
+        index:flattened message
+        index offset:uint64 index length:uint32 magic:char[4] "KIDX"
+
+    Each record is a flattened key, as KeyImp::Export() gives it, or with
+    KEY_ARCHIVE_COMPRESSED a BlockCompressor frame of it. The index has the
+    keyring, identifier, secondary identifier and type of every key, and the
+    offset and length of its record, so any key is read without the others.
+
+    With a password, the whole archive is then encrypted as the chunked
+    container of EncryptDataChunked() is, behind a header of its own with
+    KEY_ARCHIVE_ENCRYPTED set, so it is still told apart from any other
+    encrypted file. It has to be decrypted into memory once to be read.
+*/
+enum {
+    KEY_ARCHIVE_COMPRESSED  = 0x1,
+    KEY_ARCHIVE_ENCRYPTED   = 0x2
+};
+
+class KeyArchiveWriter
+{
+public:
+                KeyArchiveWriter(int32 compression = kNoCompression);
+               ~KeyArchiveWriter();
+
+    status_t    AddKey(const char* keyring, const BMessage& key);
+    // AddKey: the key is read from the backend, it is safe to call off the looper
+    status_t    AddKey(KeystoreBackend* backend, const char* keyring,
+                    BKeyType type, const char* identifier,
+                    const char* secondaryIdentifier);
+    int32       CountKeys();
+    // WriteTo: in one go, encrypted if there is a password
+    status_t    WriteTo(BDataIO* out, const char* password = nullptr);
+private:
+    status_t    _WritePlain(BDataIO* out);
+private:
+    BlockCompressor *fCompressor;
+    BMallocIO   fRecords;
+    FlatMessageWriter fIndex;
+    int32       fCount;
+};
+
+class KeyArchiveReader
+{
+public:
+                KeyArchiveReader();
+                KeyArchiveReader(const char* path, const char* password = nullptr);
+               ~KeyArchiveReader();
+
+    status_t    SetTo(const char* path, const char* password = nullptr);
+    status_t    InitCheck();
+
+    int32       CountKeys();
+    const char* KeyringAt(int32 index);
+    status_t    KeyAt(int32 index, BMessage* key);
+    status_t    FindKey(const char* keyring, const char* identifier,
+                    const char* secondaryIdentifier, BMessage* key);
+
+    static bool IsKeyArchive(BPositionIO* data, bool* encrypted = nullptr);
+private:
+    void        _Unset();
+    status_t    _ReadIndex(off_t size);
+    static std::string _LookupKey(const char* keyring, const char* identifier,
+                    const char* secondaryIdentifier);
+private:
+    BFile       fFile;
+    BMallocIO   fBuffer;    // when the archive had to be decrypted
+    BPositionIO *fSource;
+    uint32      fFlags;
+    off_t       fIndexOffset;
+    std::vector<uint8> fIndexData;
+    FlatMessageReader fIndex;
+    std::unordered_map<std::string, int32> fLookup;
+    int32       fKeyCount;
+    status_t    fInitStatus;
+};
+
+#endif /* __KEY_ARCHIVE_H_ */
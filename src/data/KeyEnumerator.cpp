@@ -0,0 +1,164 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#include "KeyEnumerator.h"
+
+/* The keystore GetNextKey() hands the key message to the Unflatten() of the
+    key it is given. The generic and password keys only accept their own type, so
+    this one takes the metadata of any type instead, leaving the secret out.
+*/
+class KeyRecordCapture : public BKey
+{
+public:
+    KeyRecordCapture(key_record* record)
+    : fRecord(record)
+    {
+    }
+
+    virtual BKeyType Type() const
+    {
+        return fRecord->type;
+    }
+
+    virtual status_t Unflatten(const BMessage& message)
+    {
+        if(message.FindUInt32("type", (uint32*)&fRecord->type) != B_OK ||
+        message.FindUInt32("purpose", (uint32*)&fRecord->purpose) != B_OK ||
+        message.FindString("identifier", &fRecord->identifier) != B_OK)
+            return B_BAD_VALUE;
+
+        if(message.FindString("secondaryIdentifier", &fRecord->secondaryIdentifier) != B_OK)
+            fRecord->secondaryIdentifier.SetTo("");
+        if(message.FindString("owner", &fRecord->owner) != B_OK)
+            fRecord->owner.SetTo("");
+        if(message.FindInt64("creationTime", &fRecord->created) != B_OK)
+            fRecord->created = 0;
+
+        return B_OK;
+    }
+private:
+    key_record* fRecord;
+};
+
+KeyEnumerator::KeyEnumerator(KeystoreBackend* backend, const char* keyring,
+    BKeyType type, BKeyPurpose purpose, int32 prefetch)
+: fBackend(backend),
+  fKeyring(keyring),
+  fType(type),
+  fPurpose(purpose),
+  fCookie(0),
+  fRoundTrips(0),
+  fStatus(B_OK),
+  fCapacity(prefetch > 0 ? prefetch : 0),
+  fRing(nullptr),
+  fRingStatus(nullptr),
+  fHead(0),
+  fTail(0),
+  fFreeSlots(-1),
+  fFilledSlots(-1),
+  fPrefetcher(-1),
+  fQuitting(false)
+{
+    if(fCapacity == 0)
+        return;
+
+    fRing = new key_record[fCapacity];
+    fRingStatus = new status_t[fCapacity];
+    fFreeSlots = create_sem(fCapacity, "key enumerator free slots");
+    fFilledSlots = create_sem(0, "key enumerator filled slots");
+    if(fFreeSlots >= 0 && fFilledSlots >= 0)
+        fPrefetcher = spawn_thread(_CallPrefetcher, "key enumerator prefetch",
+            B_NORMAL_PRIORITY, this);
+
+    if(fPrefetcher < 0 || resume_thread(fPrefetcher) != B_OK) {
+        // Fall back to fetching on demand
+        fPrefetcher = -1;
+        fCapacity = 0;
+    }
+}
+
+KeyEnumerator::~KeyEnumerator()
+{
+    if(fPrefetcher >= 0) {
+        // Deleting the semaphores wakes up the prefetcher if it is waiting
+        fQuitting = true;
+        delete_sem(fFreeSlots);
+        delete_sem(fFilledSlots);
+        status_t result;
+        wait_for_thread(fPrefetcher, &result);
+    }
+    else {
+        if(fFreeSlots >= 0)
+            delete_sem(fFreeSlots);
+        if(fFilledSlots >= 0)
+            delete_sem(fFilledSlots);
+    }
+
+    delete[] fRing;
+    delete[] fRingStatus;
+}
+
+// Next: B_OK with a record, B_ENTRY_NOT_FOUND at the end, otherwise an error
+status_t KeyEnumerator::Next(key_record& record)
+{
+    if(fStatus != B_OK)
+        return fStatus;
+
+    if(fCapacity == 0)
+        return fStatus = _Fetch(record);
+
+    status_t status;
+    while((status = acquire_sem(fFilledSlots)) == B_INTERRUPTED)
+        ;
+    if(status != B_OK)
+        return fStatus = status;
+
+    status = fRingStatus[fTail];
+    if(status == B_OK)
+        record = fRing[fTail];
+    fTail = (fTail + 1) % fCapacity;
+    release_sem(fFreeSlots);
+
+    if(status != B_OK)
+        fStatus = status;
+    return status;
+}
+
+int32 KeyEnumerator::RoundTrips()
+{
+    return fRoundTrips;
+}
+
+// #pragma mark - Private
+
+status_t KeyEnumerator::_Fetch(key_record& record)
+{
+    KeyRecordCapture capture(&record);
+    fRoundTrips++;
+    return fBackend->GetNextKey(fKeyring.String(), fType, fPurpose, fCookie,
+        capture);
+}
+
+int32 KeyEnumerator::_CallPrefetcher(void* data)
+{
+    static_cast<KeyEnumerator*>(data)->_Prefetch();
+    return 0;
+}
+
+void KeyEnumerator::_Prefetch()
+{
+    status_t status = B_OK;
+    while(!fQuitting && status == B_OK) {
+        status_t result;
+        while((result = acquire_sem(fFreeSlots)) == B_INTERRUPTED)
+            ;
+        if(result != B_OK)
+            return; // The enumerator is going away
+
+        status = _Fetch(fRing[fHead]);
+        fRingStatus[fHead] = status;
+        fHead = (fHead + 1) % fCapacity;
+        release_sem(fFilledSlots);
+    }
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef __KEY_ENUMERATOR_H_
+#define __KEY_ENUMERATOR_H_
+
+#include <Key.h>
+#include <OS.h>
+#include <String.h>
+#include <SupportDefs.h>
+#include "KeystoreBackend.h"
+
+/* Key metadata as returned by the keystore, for a key of any type. The secret
+    is never kept.
+*/
+struct key_record {
+    BKeyType    type;
+    BKeyPurpose purpose;
+    BString     identifier;
+    BString     secondaryIdentifier;
+    BString     owner;
+    bigtime_t   created;
+};
+
+/* Single pass enumeration of the keys of a keyring, of all the types at once.
+
+    With a non-zero prefetch count, the keys are requested from a separate
+    thread that stays up to that many keys ahead of the caller, so the
+    requests to the server overlap with whatever the caller does with them.
+*/
+class KeyEnumerator
+{
+public:
+                KeyEnumerator(KeystoreBackend* backend, const char* keyring,
+                    BKeyType type = B_KEY_TYPE_ANY,
+                    BKeyPurpose purpose = B_KEY_PURPOSE_ANY,
+                    int32 prefetch = 32);
+               ~KeyEnumerator();
+
+    status_t    Next(key_record& record);
+    int32       RoundTrips();
+private:
+    status_t    _Fetch(key_record& record);
+    static int32 _CallPrefetcher(void* data);
+    void        _Prefetch();
+private:
+    KeystoreBackend *fBackend;
+    BString     fKeyring;
+    BKeyType    fType;
+    BKeyPurpose fPurpose;
+    uint32      fCookie;
+    int32       fRoundTrips;
+    status_t    fStatus;
+
+    /* Prefetching ring */
+    int32       fCapacity;
+    key_record *fRing;
+    status_t   *fRingStatus;
+    int32       fHead,
+                fTail;
+    sem_id      fFreeSlots,
+                fFilledSlots;
+    thread_id   fPrefetcher;
+    volatile bool fQuitting;
+};
+
+#endif /* __KEY_ENUMERATOR_H_ */
@@ -0,0 +1,170 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#include <Autolock.h>
+#include <Message.h>
+#include <atomic>
+#include "KeyringLoader.h"
+#include "KeystoreImp.h"
+#include "../KeysDefs.h"
+
+static const int32 kMaxLoaderWorkers = 4;
+
+// The state of one Start(), the workers of a cancelled run keep theirs
+struct KeyringLoader::run {
+    std::vector<BString> queue;
+    std::atomic<int32> next;
+    std::atomic<bool> cancelled;
+    uint32      generation;
+
+    run(uint32 generation)
+    : next(0),
+      cancelled(false),
+      generation(generation)
+    {
+    }
+};
+
+struct KeyringLoader::worker_data {
+    KeyringLoader *loader;
+    std::shared_ptr<run> current;
+};
+
+KeyringLoader::KeyringLoader(KeystoreImp* keystore, BMessenger target,
+    int32 workers)
+: fKeystore(keystore),
+  fTarget(target),
+  fMaxWorkers(workers),
+  fGeneration(0),
+  fLock("keyring loader")
+{
+    if(fMaxWorkers <= 0) {
+        system_info info;
+        get_system_info(&info);
+        fMaxWorkers = info.cpu_count < kMaxLoaderWorkers ? info.cpu_count
+            : kMaxLoaderWorkers;
+    }
+    if(fMaxWorkers <= 0)
+        fMaxWorkers = 1;
+}
+
+KeyringLoader::~KeyringLoader()
+{
+    Cancel();
+    for(thread_id worker : fWorkers) {
+        status_t result;
+        wait_for_thread(worker, &result);
+    }
+}
+
+// Start: queues the keyrings that are still stubs at this point
+status_t KeyringLoader::Start()
+{
+    Cancel();
+
+    std::shared_ptr<run> current(new run(fKeystore->Generation()));
+    for(int32 i = 0; i < fKeystore->KeyringCount(); i++) {
+        if(!fKeystore->KeyringAt(i)->IsLoaded())
+            current->queue.push_back(BString(fKeystore->KeyringAt(i)->Identifier()));
+    }
+    if(current->queue.empty())
+        return B_OK;
+
+    fLock.Lock();
+    fRun = current;
+    fGeneration = current->generation;
+    fLock.Unlock();
+
+    int32 count = (int32)current->queue.size() < fMaxWorkers
+        ? (int32)current->queue.size() : fMaxWorkers;
+    int32 started = 0;
+    for(int32 i = 0; i < count; i++) {
+        worker_data* data = new worker_data{ this, current };
+        thread_id worker = spawn_thread(_CallWorker, "keyring loader",
+            B_LOW_PRIORITY, data);
+        if(worker < 0) {
+            delete data;
+            break;
+        }
+        fWorkers.push_back(worker);
+        resume_thread(worker);
+        started++;
+    }
+
+    return started == 0 ? B_ERROR : B_OK;
+}
+
+/* Cancel: keyrings being read are finished, the rest are left as stubs.
+    The ones sent and not taken are deleted, their messages are stale now. */
+void KeyringLoader::Cancel()
+{
+    BAutolock lock(fLock);
+    if(fRun) {
+        fRun->cancelled = true;
+        fRun.reset();
+    }
+
+    for(KeyringImp* keyring : fPending)
+        delete keyring;
+    fPending.clear();
+}
+
+KeyringImp* KeyringLoader::Take(KeyringImp* keyring, uint32 generation)
+{
+    BAutolock lock(fLock);
+
+    // The pointer is only compared, it may be gone already
+    if(generation != fGeneration || fPending.erase(keyring) == 0)
+        return nullptr;
+
+    return keyring;
+}
+
+// #pragma mark - Private
+
+int32 KeyringLoader::_CallWorker(void* data)
+{
+    worker_data* worker = static_cast<worker_data*>(data);
+    worker->loader->_Work(worker->current.get());
+    delete worker;
+    return 0;
+}
+
+void KeyringLoader::_Work(run* current)
+{
+    // Keeps the strings of the keyrings being read across a reset
+    fKeystore->Strings()->Hold();
+
+    int32 index;
+    while(!current->cancelled
+        && (index = current->next++) < (int32)current->queue.size()) {
+        // Not attached to the keystore until it is adopted
+        KeyringImp* keyring = new KeyringImp(fKeystore,
+            current->queue[index].String());
+        keyring->Load();
+
+        BMessage loaded(M_KEYRING_LOADED);
+        loaded.AddString(kConfigKeyring, keyring->Identifier());
+        loaded.AddPointer(kConfigWho, keyring);
+        loaded.AddUInt32("generation", current->generation);
+
+        // Kept before it is sent, the receiver may take it right away
+        fLock.Lock();
+        bool cancelled = current->cancelled;
+        if(!cancelled)
+            fPending.insert(keyring);
+        fLock.Unlock();
+        if(cancelled) {
+            delete keyring;
+            break;
+        }
+        if(fTarget.SendMessage(&loaded) != B_OK) {
+            BAutolock lock(fLock);
+            if(fPending.erase(keyring) != 0)
+                delete keyring;
+        }
+    }
+
+    fKeystore->Strings()->Release();
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef __KEYRING_LOADER_H_
+#define __KEYRING_LOADER_H_
+
+#include <Locker.h>
+#include <Messenger.h>
+#include <OS.h>
+#include <String.h>
+#include <SupportDefs.h>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+class KeyringImp;
+class KeystoreImp;
+
+/* Reads the keyrings stubs of a keystore in the background with a bounded
+    pool of threads. Every keyring is read into a private KeyringImp that is
+    sent to the target inside a M_KEYRING_LOADED message, and the receiver
+    takes it with Take() and hands it to KeystoreImp::AdoptKeyring() from its
+    own thread. Until then the loader owns it: the keyrings not taken by the
+    time it is cancelled are deleted, so messages lost or left unread do not
+    leak them.
+
+    Cancel() does not wait for the workers, the ones still reading finish
+    their keyring and drop it. They hold the strings of the keystore until
+    then, so a reset in the meantime does not pull them from under them. Only
+    the destructor waits for them.
+*/
+class KeyringLoader
+{
+public:
+                KeyringLoader(KeystoreImp* keystore, BMessenger target,
+                    int32 workers = 0);
+               ~KeyringLoader();
+
+    status_t    Start();
+    void        Cancel();
+    // Take: nullptr if the keyring was deleted or is from a previous run
+    KeyringImp *Take(KeyringImp* keyring, uint32 generation);
+private:
+    struct run;
+    struct worker_data;
+
+    static int32 _CallWorker(void* data);
+    void        _Work(run* current);
+private:
+    KeystoreImp *fKeystore;
+    BMessenger  fTarget;
+    int32       fMaxWorkers;
+    uint32      fGeneration;
+
+    std::shared_ptr<run> fRun;     // shared with its workers
+    std::vector<thread_id> fWorkers; // of every run, joined when deleted
+
+    BLocker     fLock;
+    std::unordered_set<KeyringImp*> fPending; // sent, not taken yet
+};
+
+#endif /* __KEYRING_LOADER_H_ */
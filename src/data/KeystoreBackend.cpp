@@ -0,0 +1,247 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#include <Autolock.h>
+#include <OS.h>
+#include "KeystoreBackend.h"
+
+/* BKeyStore keeps no state of its own between the calls, so a single
+    instance can be shared by every thread.
+*/
+ServerKeystoreBackend::ServerKeystoreBackend()
+{
+}
+
+status_t ServerKeystoreBackend::GetNextKeyring(uint32& cookie, BString& keyring)
+{
+    return fKeyStore.GetNextKeyring(cookie, keyring);
+}
+
+status_t ServerKeystoreBackend::AddKeyring(const char* keyring)
+{
+    return fKeyStore.AddKeyring(keyring);
+}
+
+status_t ServerKeystoreBackend::RemoveKeyring(const char* keyring)
+{
+    return fKeyStore.RemoveKeyring(keyring);
+}
+
+bool ServerKeystoreBackend::IsKeyringUnlocked(const char* keyring)
+{
+    return fKeyStore.IsKeyringUnlocked(keyring);
+}
+
+status_t ServerKeystoreBackend::LockKeyring(const char* keyring)
+{
+    return fKeyStore.LockKeyring(keyring);
+}
+
+status_t ServerKeystoreBackend::SetUnlockKey(const char* keyring, const BKey& key)
+{
+    return fKeyStore.SetUnlockKey(keyring, key);
+}
+
+status_t ServerKeystoreBackend::RemoveUnlockKey(const char* keyring)
+{
+    return fKeyStore.RemoveUnlockKey(keyring);
+}
+
+status_t ServerKeystoreBackend::GetKey(const char* keyring, BKeyType type,
+    const char* identifier, const char* secondaryIdentifier,
+    bool secondaryIdentifierOptional, BKey& key)
+{
+    return fKeyStore.GetKey(keyring, type, identifier, secondaryIdentifier,
+        secondaryIdentifierOptional, key);
+}
+
+status_t ServerKeystoreBackend::GetNextKey(const char* keyring, BKeyType type,
+    BKeyPurpose purpose, uint32& cookie, BKey& key)
+{
+    return fKeyStore.GetNextKey(keyring, type, purpose, cookie, key);
+}
+
+status_t ServerKeystoreBackend::AddKey(const char* keyring, const BKey& key)
+{
+    return fKeyStore.AddKey(keyring, key);
+}
+
+status_t ServerKeystoreBackend::RemoveKey(const char* keyring, const BKey& key)
+{
+    return fKeyStore.RemoveKey(keyring, key);
+}
+
+status_t ServerKeystoreBackend::GetNextApplication(const char* keyring,
+    uint32& cookie, BString& signature)
+{
+    return fKeyStore.GetNextApplication(keyring, cookie, signature);
+}
+
+status_t ServerKeystoreBackend::RemoveApplication(const char* keyring,
+    const char* signature)
+{
+    return fKeyStore.RemoveApplication(keyring, signature);
+}
+
+// #pragma mark - CachingKeystoreBackend
+
+CachingKeystoreBackend::CachingKeystoreBackend(KeystoreBackend* backend,
+    bigtime_t lifetime)
+: fBackend(backend),
+  fLifetime(lifetime),
+  fLock("lock state cache"),
+  fGeneration(0)
+{
+}
+
+CachingKeystoreBackend::~CachingKeystoreBackend()
+{
+    delete fBackend;
+}
+
+KeystoreBackend* CachingKeystoreBackend::Backend()
+{
+    return fBackend;
+}
+
+status_t CachingKeystoreBackend::GetNextKeyring(uint32& cookie, BString& keyring)
+{
+    return fBackend->GetNextKeyring(cookie, keyring);
+}
+
+status_t CachingKeystoreBackend::AddKeyring(const char* keyring)
+{
+    _Forget(keyring);
+    return fBackend->AddKeyring(keyring);
+}
+
+status_t CachingKeystoreBackend::RemoveKeyring(const char* keyring)
+{
+    _Forget(keyring);
+    return fBackend->RemoveKeyring(keyring);
+}
+
+bool CachingKeystoreBackend::IsKeyringUnlocked(const char* keyring)
+{
+    if(!keyring)
+        return fBackend->IsKeyringUnlocked(keyring);
+
+    bigtime_t now = system_time();
+    uint64 generation;
+    {
+        BAutolock lock(fLock);
+        auto it = fLockStates.find(keyring);
+        if(it != fLockStates.end() && now - it->second.checked < fLifetime)
+            return it->second.unlocked;
+        generation = fGeneration;
+    }
+
+    // Not under the lock, the other threads do not have to wait for it
+    bool unlocked = fBackend->IsKeyringUnlocked(keyring);
+
+    // Anything forgotten meanwhile may have changed what was just asked
+    BAutolock lock(fLock);
+    if(generation == fGeneration)
+        fLockStates[keyring] = lock_state{ unlocked, now };
+    return unlocked;
+}
+
+status_t CachingKeystoreBackend::LockKeyring(const char* keyring)
+{
+    status_t status = fBackend->LockKeyring(keyring);
+    _Forget(keyring);
+    return status;
+}
+
+status_t CachingKeystoreBackend::SetUnlockKey(const char* keyring, const BKey& key)
+{
+    status_t status = fBackend->SetUnlockKey(keyring, key);
+    _Forget(keyring);
+    return status;
+}
+
+status_t CachingKeystoreBackend::RemoveUnlockKey(const char* keyring)
+{
+    status_t status = fBackend->RemoveUnlockKey(keyring);
+    _Forget(keyring);
+    return status;
+}
+
+status_t CachingKeystoreBackend::GetKey(const char* keyring, BKeyType type,
+    const char* identifier, const char* secondaryIdentifier,
+    bool secondaryIdentifierOptional, BKey& key)
+{
+    status_t status = fBackend->GetKey(keyring, type, identifier,
+        secondaryIdentifier, secondaryIdentifierOptional, key);
+    _Accessed(keyring, status);
+    return status;
+}
+
+/* Only the first key can make the server ask for the password, the rest of
+    the enumeration does not change the lock state.
+*/
+status_t CachingKeystoreBackend::GetNextKey(const char* keyring, BKeyType type,
+    BKeyPurpose purpose, uint32& cookie, BKey& key)
+{
+    bool first = cookie == 0;
+    status_t status = fBackend->GetNextKey(keyring, type, purpose, cookie, key);
+    if(first)
+        _Accessed(keyring, status);
+    return status;
+}
+
+status_t CachingKeystoreBackend::AddKey(const char* keyring, const BKey& key)
+{
+    status_t status = fBackend->AddKey(keyring, key);
+    _Accessed(keyring, status);
+    return status;
+}
+
+status_t CachingKeystoreBackend::RemoveKey(const char* keyring, const BKey& key)
+{
+    status_t status = fBackend->RemoveKey(keyring, key);
+    _Accessed(keyring, status);
+    return status;
+}
+
+status_t CachingKeystoreBackend::GetNextApplication(const char* keyring,
+    uint32& cookie, BString& signature)
+{
+    return fBackend->GetNextApplication(keyring, cookie, signature);
+}
+
+status_t CachingKeystoreBackend::RemoveApplication(const char* keyring,
+    const char* signature)
+{
+    return fBackend->RemoveApplication(keyring, signature);
+}
+
+void CachingKeystoreBackend::InvalidateCache(const char* keyring)
+{
+    _Forget(keyring);
+    fBackend->InvalidateCache(keyring);
+}
+
+void CachingKeystoreBackend::_Forget(const char* keyring)
+{
+    BAutolock lock(fLock);
+    fGeneration++;
+    if(keyring)
+        fLockStates.erase(keyring);
+    else
+        fLockStates.clear();
+}
+
+// _Accessed: the keys of a keyring were accessed, only a success tells its state
+void CachingKeystoreBackend::_Accessed(const char* keyring, status_t status)
+{
+    if(status != B_OK || !keyring) {
+        _Forget(keyring);
+        return;
+    }
+
+    BAutolock lock(fLock);
+    fGeneration++;
+    fLockStates[keyring] = lock_state{ true, system_time() };
+}
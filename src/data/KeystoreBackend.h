@@ -0,0 +1,141 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef __KEYSTORE_BACKEND_H_
+#define __KEYSTORE_BACKEND_H_
+
+#include <Key.h>
+#include <KeyStore.h>
+#include <Locker.h>
+#include <String.h>
+#include <SupportDefs.h>
+#include <string>
+#include <unordered_map>
+
+/* Everything the data model asks to the keystore database. The calls follow
+    the semantics of BKeyStore, so any implementation can stand in for the
+    keystore server. Implementations must be safe to call from several
+    threads at once.
+*/
+class KeystoreBackend
+{
+public:
+    virtual            ~KeystoreBackend() {}
+
+        /* Keyrings */
+    virtual status_t    GetNextKeyring(uint32& cookie, BString& keyring) = 0;
+    virtual status_t    AddKeyring(const char* keyring) = 0;
+    virtual status_t    RemoveKeyring(const char* keyring) = 0;
+    virtual bool        IsKeyringUnlocked(const char* keyring) = 0;
+    virtual status_t    LockKeyring(const char* keyring) = 0;
+    virtual status_t    SetUnlockKey(const char* keyring, const BKey& key) = 0;
+    virtual status_t    RemoveUnlockKey(const char* keyring) = 0;
+
+        /* Keys */
+    virtual status_t    GetKey(const char* keyring, BKeyType type,
+                            const char* identifier,
+                            const char* secondaryIdentifier,
+                            bool secondaryIdentifierOptional, BKey& key) = 0;
+    virtual status_t    GetNextKey(const char* keyring, BKeyType type,
+                            BKeyPurpose purpose, uint32& cookie, BKey& key) = 0;
+    virtual status_t    AddKey(const char* keyring, const BKey& key) = 0;
+    virtual status_t    RemoveKey(const char* keyring, const BKey& key) = 0;
+
+        /* Applications */
+    virtual status_t    GetNextApplication(const char* keyring, uint32& cookie,
+                            BString& signature) = 0;
+    virtual status_t    RemoveApplication(const char* keyring,
+                            const char* signature) = 0;
+
+        /* Drops whatever is remembered of a keyring, or of all of them */
+    virtual void        InvalidateCache(const char* keyring = nullptr) {}
+};
+
+/* The keystore server of the system, through BKeyStore */
+class ServerKeystoreBackend : public KeystoreBackend
+{
+public:
+                        ServerKeystoreBackend();
+
+    virtual status_t    GetNextKeyring(uint32& cookie, BString& keyring);
+    virtual status_t    AddKeyring(const char* keyring);
+    virtual status_t    RemoveKeyring(const char* keyring);
+    virtual bool        IsKeyringUnlocked(const char* keyring);
+    virtual status_t    LockKeyring(const char* keyring);
+    virtual status_t    SetUnlockKey(const char* keyring, const BKey& key);
+    virtual status_t    RemoveUnlockKey(const char* keyring);
+
+    virtual status_t    GetKey(const char* keyring, BKeyType type,
+                            const char* identifier,
+                            const char* secondaryIdentifier,
+                            bool secondaryIdentifierOptional, BKey& key);
+    virtual status_t    GetNextKey(const char* keyring, BKeyType type,
+                            BKeyPurpose purpose, uint32& cookie, BKey& key);
+    virtual status_t    AddKey(const char* keyring, const BKey& key);
+    virtual status_t    RemoveKey(const char* keyring, const BKey& key);
+
+    virtual status_t    GetNextApplication(const char* keyring, uint32& cookie,
+                            BString& signature);
+    virtual status_t    RemoveApplication(const char* keyring,
+                            const char* signature);
+private:
+    BKeyStore   fKeyStore;
+};
+
+/* Keeps the lock state of the keyrings of another backend, which it owns, so
+    asking for it does not cost a round trip every time. The state is asked
+    again after any call that may lock or unlock the keyring and once it gets
+    too old, as the keyrings can be locked from other applications. Any access
+    to its keys may make the server ask for its password, so a successful one
+    leaves the keyring known to be unlocked, and a failed one asks again.
+*/
+class CachingKeystoreBackend : public KeystoreBackend
+{
+public:
+                        CachingKeystoreBackend(KeystoreBackend* backend,
+                            bigtime_t lifetime = 2000000);
+    virtual            ~CachingKeystoreBackend();
+
+    KeystoreBackend    *Backend();
+
+    virtual status_t    GetNextKeyring(uint32& cookie, BString& keyring);
+    virtual status_t    AddKeyring(const char* keyring);
+    virtual status_t    RemoveKeyring(const char* keyring);
+    virtual bool        IsKeyringUnlocked(const char* keyring);
+    virtual status_t    LockKeyring(const char* keyring);
+    virtual status_t    SetUnlockKey(const char* keyring, const BKey& key);
+    virtual status_t    RemoveUnlockKey(const char* keyring);
+
+    virtual status_t    GetKey(const char* keyring, BKeyType type,
+                            const char* identifier,
+                            const char* secondaryIdentifier,
+                            bool secondaryIdentifierOptional, BKey& key);
+    virtual status_t    GetNextKey(const char* keyring, BKeyType type,
+                            BKeyPurpose purpose, uint32& cookie, BKey& key);
+    virtual status_t    AddKey(const char* keyring, const BKey& key);
+    virtual status_t    RemoveKey(const char* keyring, const BKey& key);
+
+    virtual status_t    GetNextApplication(const char* keyring, uint32& cookie,
+                            BString& signature);
+    virtual status_t    RemoveApplication(const char* keyring,
+                            const char* signature);
+
+    virtual void        InvalidateCache(const char* keyring = nullptr);
+private:
+    struct lock_state {
+        bool        unlocked;
+        bigtime_t   checked;
+    };
+
+    void                _Forget(const char* keyring);
+    void                _Accessed(const char* keyring, status_t status);
+private:
+    KeystoreBackend *fBackend;
+    bigtime_t   fLifetime;
+    BLocker     fLock;
+    std::unordered_map<std::string, lock_state> fLockStates;
+    uint64      fGeneration;    // of the forgotten states, see _Forget()
+};
+
+#endif /* __KEYSTORE_BACKEND_H_ */
@@ -0,0 +1,343 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#include <OS.h>
+#include <cstring>
+#include "CryptoUtils.h"
+#include "KeystoreDiff.h"
+
+/* The keystore hands the key message to the Unflatten() of the key it is
+    given, which only takes its own type. This one takes any, and keeps the
+    digests of the key instead of the key.
+*/
+class KeyDigestCapture : public BKey
+{
+public:
+    KeyDigestCapture()
+    : fType(B_KEY_TYPE_ANY)
+    {
+    }
+
+    virtual BKeyType Type() const
+    {
+        return fType;
+    }
+
+    virtual status_t Unflatten(const BMessage& message)
+    {
+        const char* identifier;
+        if(message.FindUInt32("type", (uint32*)&fType) != B_OK ||
+        message.FindString("identifier", &identifier) != B_OK)
+            return B_BAD_VALUE;
+
+        // Type, identifier and secondary identifier tell the key apart
+        uint32 type = fType;
+        fIndex.assign(reinterpret_cast<const char*>(&type), sizeof(type));
+        fIndex.append(identifier);
+        fIndex.push_back('\0');
+        fIndex.append(message.GetString("secondaryIdentifier", ""));
+
+        uint32 purpose = message.GetUInt32("purpose", B_KEY_PURPOSE_ANY);
+        int64 created = message.GetInt64("creationTime", 0);
+        const char* owner = message.GetString("owner", "");
+        DigestIO metadata;
+        metadata.Write(&purpose, sizeof(purpose));
+        metadata.Write(&created, sizeof(created));
+        metadata.Write(owner, strlen(owner) + 1);
+        fMetadata = metadata.Hashstring();
+
+        const void* data = nullptr;
+        ssize_t length = 0;
+        DigestIO secret;
+        if(message.FindData("data", B_RAW_TYPE, &data, &length) == B_OK && length > 0)
+            secret.Write(data, length);
+        fSecret = secret.Hashstring();
+
+        return B_OK;
+    }
+
+    BKeyType    fType;
+    std::string fIndex;
+    BString     fMetadata,
+                fSecret;
+};
+
+// #pragma mark - KeystoreDigest
+
+KeystoreDigest::KeystoreDigest()
+: fKeyCount(0)
+{
+}
+
+status_t KeystoreDigest::SetTo(KeystoreBackend* backend)
+{
+    fKeyrings.clear();
+    fKeyCount = 0;
+    if(!backend)
+        return B_BAD_VALUE;
+
+    uint32 cookie = 0;
+    BString keyring;
+    status_t status;
+    while((status = backend->GetNextKeyring(cookie, keyring)) == B_OK) {
+        if((status = _AddKeyring(backend, keyring.String())) != B_OK)
+            return status;
+    }
+
+    return status == B_ENTRY_NOT_FOUND ? B_OK : status;
+}
+
+int32 KeystoreDigest::CountKeys()
+{
+    return fKeyCount;
+}
+
+status_t KeystoreDigest::_AddKeyring(KeystoreBackend* backend, const char* name)
+{
+    keyring_digest& keyring = fKeyrings[name];
+    keyring.locked = !backend->IsKeyringUnlocked(name);
+    if(keyring.locked)
+        return B_OK;
+
+    uint32 cookie = 0;
+    status_t status;
+    KeyDigestCapture capture;
+    while((status = backend->GetNextKey(name, B_KEY_TYPE_ANY, B_KEY_PURPOSE_ANY,
+    cookie, capture)) == B_OK) {
+        key_digest& digest = keyring.keys[capture.fIndex];
+        digest.metadata = capture.fMetadata;
+        digest.secret = capture.fSecret;
+        fKeyCount++;
+    }
+    // Locked while it was being read
+    if(status == B_NOT_ALLOWED) {
+        fKeyCount -= keyring.keys.size();
+        keyring.keys.clear();
+        keyring.locked = true;
+        return B_OK;
+    }
+    if(status != B_ENTRY_NOT_FOUND)
+        return status;
+
+    cookie = 0;
+    BString signature;
+    while((status = backend->GetNextApplication(name, cookie, signature)) == B_OK)
+        keyring.applications.emplace(signature.String());
+
+    return status == B_ENTRY_NOT_FOUND ? B_OK : status;
+}
+
+// #pragma mark - KeystoreDiff
+
+KeystoreDiff::KeystoreDiff()
+: fElapsed(0)
+{
+}
+
+/* Compare: reading the keystore server is mostly waiting for it, so the
+    other side is read meanwhile. */
+status_t KeystoreDiff::Compare(KeystoreBackend* from, KeystoreBackend* to)
+{
+    bigtime_t start = system_time();
+    KeystoreDigest fromDigest, toDigest;
+    digest_job job = { &fromDigest, from, B_OK };
+    thread_id thread = spawn_thread(_CallDigest, "keystore digest",
+        B_NORMAL_PRIORITY, &job);
+    if(thread < 0 || resume_thread(thread) != B_OK) {
+        thread = -1;
+        _CallDigest(&job);
+    }
+
+    status_t status = toDigest.SetTo(to);
+    if(thread >= 0) {
+        status_t result;
+        wait_for_thread(thread, &result);
+    }
+    if(status == B_OK)
+        status = job.status;
+    if(status != B_OK)
+        return status;
+
+    Compare(fromDigest, toDigest);
+    fElapsed = system_time() - start;
+    return B_OK;
+}
+
+void KeystoreDiff::Compare(const KeystoreDigest& from, const KeystoreDigest& to)
+{
+    bigtime_t start = system_time();
+    fEntries.clear();
+
+    for(const auto& [name, keyring] : from.fKeyrings) {
+        auto other = to.fKeyrings.find(name);
+        if(other == to.fKeyrings.end()) {
+            _Add(DIFF_KEYRING, DIFF_REMOVED, name, "");
+            continue;
+        }
+        if(keyring.locked || other->second.locked) {
+            _Add(DIFF_KEYRING, DIFF_LOCKED, name, "");
+            continue;
+        }
+
+        for(const auto& [index, key] : keyring.keys) {
+            auto otherKey = other->second.keys.find(index);
+            if(otherKey == other->second.keys.end()) {
+                _Add(DIFF_KEY, DIFF_REMOVED, name, index);
+                continue;
+            }
+            uint32 changes = 0;
+            if(key.metadata != otherKey->second.metadata)
+                changes |= DIFF_KEY_METADATA;
+            if(key.secret != otherKey->second.secret)
+                changes |= DIFF_KEY_SECRET;
+            if(changes != 0)
+                _Add(DIFF_KEY, DIFF_MODIFIED, name, index, changes);
+        }
+        for(const auto& [index, key] : other->second.keys) {
+            if(keyring.keys.find(index) == keyring.keys.end())
+                _Add(DIFF_KEY, DIFF_ADDED, name, index);
+        }
+
+        for(const std::string& signature : keyring.applications) {
+            if(other->second.applications.count(signature) == 0)
+                _Add(DIFF_APPLICATION, DIFF_REMOVED, name, signature);
+        }
+        for(const std::string& signature : other->second.applications) {
+            if(keyring.applications.count(signature) == 0)
+                _Add(DIFF_APPLICATION, DIFF_ADDED, name, signature);
+        }
+    }
+
+    for(const auto& [name, keyring] : to.fKeyrings) {
+        if(from.fKeyrings.find(name) == from.fKeyrings.end())
+            _Add(DIFF_KEYRING, DIFF_ADDED, name, "");
+    }
+
+    fElapsed = system_time() - start;
+}
+
+int32 KeystoreDiff::CountEntries()
+{
+    return fEntries.size();
+}
+
+const diff_entry* KeystoreDiff::EntryAt(int32 index)
+{
+    if(index < 0 || index >= (int32)fEntries.size())
+        return nullptr;
+
+    return &fEntries[index];
+}
+
+int32 KeystoreDiff::Count(diff_item item, diff_change change)
+{
+    int32 count = 0;
+    for(const diff_entry& entry : fEntries) {
+        if(entry.item == item && entry.change == change)
+            count++;
+    }
+    return count;
+}
+
+bigtime_t KeystoreDiff::Elapsed()
+{
+    return fElapsed;
+}
+
+void KeystoreDiff::PrintReport(FILE* out)
+{
+    static const char* const kChanges[] = { "+", "-", "~", "!" };
+    for(const diff_entry& entry : fEntries) {
+        fprintf(out, "%s %s", kChanges[entry.change], entry.keyring.String());
+        if(entry.item == DIFF_KEY) {
+            fprintf(out, "/%s", entry.name.String());
+            if(!entry.secondaryIdentifier.IsEmpty())
+                fprintf(out, " (%s)", entry.secondaryIdentifier.String());
+            if(entry.changes & DIFF_KEY_METADATA)
+                fprintf(out, "  metadata");
+            if(entry.changes & DIFF_KEY_SECRET)
+                fprintf(out, "  secret");
+        }
+        else if(entry.item == DIFF_APPLICATION)
+            fprintf(out, "  application %s", entry.name.String());
+        else if(entry.change == DIFF_LOCKED)
+            fprintf(out, "  locked, not compared");
+        fprintf(out, "\n");
+    }
+    fprintf(out, "%s\n", Summary().String());
+}
+
+BString KeystoreDiff::Summary()
+{
+    BString summary;
+    summary.SetToFormat("Keyrings: %" B_PRId32 " added, %" B_PRId32 " removed, "
+        "%" B_PRId32 " locked. "
+        "Keys: %" B_PRId32 " added, %" B_PRId32 " removed, %" B_PRId32 " modified. "
+        "Applications: %" B_PRId32 " added, %" B_PRId32 " removed. Compared in %.3f s.",
+        Count(DIFF_KEYRING, DIFF_ADDED), Count(DIFF_KEYRING, DIFF_REMOVED),
+        Count(DIFF_KEYRING, DIFF_LOCKED),
+        Count(DIFF_KEY, DIFF_ADDED), Count(DIFF_KEY, DIFF_REMOVED),
+        Count(DIFF_KEY, DIFF_MODIFIED), Count(DIFF_APPLICATION, DIFF_ADDED),
+        Count(DIFF_APPLICATION, DIFF_REMOVED), fElapsed / 1000000.0);
+    return summary;
+}
+
+status_t KeystoreDiff::Archive(BMessage* reply)
+{
+    if(!reply)
+        return B_BAD_VALUE;
+
+    status_t status = B_OK;
+    for(const diff_entry& entry : fEntries) {
+        BMessage data(B_ARCHIVED_OBJECT);
+        data.AddInt32("item", entry.item);
+        data.AddInt32("change", entry.change);
+        data.AddString("keyring", entry.keyring);
+        if(entry.item != DIFF_KEYRING)
+            data.AddString("name", entry.name);
+        if(entry.item == DIFF_KEY) {
+            data.AddString("secondaryIdentifier", entry.secondaryIdentifier);
+            data.AddUInt32("type", entry.type);
+            data.AddUInt32("changes", entry.changes);
+        }
+        if((status = reply->AddMessage("result", &data)) != B_OK)
+            break;
+    }
+
+    return status;
+}
+
+// #pragma mark - Private
+
+int32 KeystoreDiff::_CallDigest(void* data)
+{
+    digest_job* job = static_cast<digest_job*>(data);
+    job->status = job->digest->SetTo(job->backend);
+    return 0;
+}
+
+// _Add: the name of a key is its index in the digest, see KeyDigestCapture
+void KeystoreDiff::_Add(diff_item item, diff_change change, const std::string& keyring,
+    const std::string& name, uint32 changes)
+{
+    diff_entry entry;
+    entry.item = item;
+    entry.change = change;
+    entry.keyring.SetTo(keyring.c_str());
+    entry.type = B_KEY_TYPE_ANY;
+    entry.changes = changes;
+
+    if(item == DIFF_KEY && name.size() > sizeof(uint32)) {
+        uint32 type;
+        memcpy(&type, name.data(), sizeof(type));
+        entry.type = (BKeyType)type;
+        const char* identifier = name.c_str() + sizeof(type);
+        entry.name.SetTo(identifier);
+        entry.secondaryIdentifier.SetTo(identifier + strlen(identifier) + 1);
+    }
+    else
+        entry.name.SetTo(name.c_str());
+
+    fEntries.push_back(entry);
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef __KEYSTORE_DIFF_H_
+#define __KEYSTORE_DIFF_H_
+
+#include <Key.h>
+#include <Message.h>
+#include <String.h>
+#include <SupportDefs.h>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "KeystoreBackend.h"
+
+enum diff_item {
+    DIFF_KEYRING = 0,
+    DIFF_KEY,
+    DIFF_APPLICATION
+};
+
+enum diff_change {
+    DIFF_ADDED = 0,
+    DIFF_REMOVED,
+    DIFF_MODIFIED,
+    DIFF_LOCKED         // of a keyring that could not be read on one side
+};
+
+// What changed of a modified key
+enum {
+    DIFF_KEY_METADATA   = 0x1,  // purpose, owner or creation time
+    DIFF_KEY_SECRET     = 0x2
+};
+
+struct diff_entry {
+    diff_item   item;
+    diff_change change;
+    BString     keyring;
+    BString     name;           // identifier of a key, signature of an application
+    BString     secondaryIdentifier;
+    BKeyType    type;
+    uint32      changes;        // of a modified key
+};
+
+/* What a keystore holds, with every key reduced to a digest of its metadata
+    and another of its secret, so two of them can be compared without their
+    secrets being kept around. */
+class KeystoreDigest
+{
+public:
+                KeystoreDigest();
+
+    /* SetTo: every key of every keyring is read once, in order. Locked
+        keyrings are only listed, and fail nothing. */
+    status_t    SetTo(KeystoreBackend* backend);
+    int32       CountKeys();
+private:
+    friend class KeystoreDiff;
+    struct key_digest {
+        BString     metadata,
+                    secret;
+    };
+    struct keyring_digest {
+        std::unordered_map<std::string, key_digest> keys;
+        std::unordered_set<std::string> applications;
+        bool        locked;
+    };
+
+    status_t    _AddKeyring(KeystoreBackend* backend, const char* name);
+private:
+    std::unordered_map<std::string, keyring_digest> fKeyrings;
+    int32       fKeyCount;
+};
+
+/* The changes needed to turn one keystore into another: keyrings, keys and
+    application grants added, removed, and keys modified. Keyrings locked on
+    either side are told as such, their contents are not compared. Each side
+    is read once and the comparison goes through hash maps, so it takes time
+    in proportion to the keys of both. Either side can be any backend, the
+    keystore server or a backup.
+*/
+class KeystoreDiff
+{
+public:
+                KeystoreDiff();
+
+    // Compare: both sides are read at the same time
+    status_t    Compare(KeystoreBackend* from, KeystoreBackend* to);
+    void        Compare(const KeystoreDigest& from, const KeystoreDigest& to);
+
+    int32       CountEntries();
+    const diff_entry* EntryAt(int32 index);
+    int32       Count(diff_item item, diff_change change);
+    bigtime_t   Elapsed();
+
+    void        PrintReport(FILE* out);
+    BString     Summary();
+    // Archive: a message per entry, in "result", as scripting replies have it
+    status_t    Archive(BMessage* reply);
+private:
+    struct digest_job {
+        KeystoreDigest* digest;
+        KeystoreBackend* backend;
+        status_t    status;
+    };
+
+    static int32 _CallDigest(void* data);
+    void        _Add(diff_item item, diff_change change, const std::string& keyring,
+                    const std::string& name, uint32 changes = 0);
+private:
+    std::vector<diff_entry> fEntries;
+    bigtime_t   fElapsed;
+};
+
+#endif /* __KEYSTORE_DIFF_H_ */
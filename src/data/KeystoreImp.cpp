@@ -2,11 +2,18 @@
  * Copyright 2024, cafeina <cafeina@world>
  * All rights reserved. Distributed under the terms of the MIT license.
  */
+#include <Autolock.h>
 #include <Catalog.h>
 #include <KeyStore.h>
 #include <Roster.h>
+#include <atomic>
 #include <cstdio>
+#include <functional>
+#include <unordered_set>
+#include <vector>
+#include "KeyEnumerator.h"
 #include "KeystoreImp.h"
+#include "../KeysDefs.h"
 
 #undef B_TRANSLATION_CONTEXT
 #define B_TRANSLATION_CONTEXT "Enum 4 string"
@@ -67,21 +74,23 @@ const char* StringForType(BKeyType type) {
 
 #undef B_TRANSLATION_CONTEXT
 
-bool IsExportedKey(BMessage* keyFileData)
+// Works the same on a BMessage and on a message read in place
+template <typename Message>
+static bool CheckExportedKey(const Message& keyFileData)
 {
     status_t status = B_ERROR;
     type_code code = B_ANY_TYPE;
     int32 found = 0;
 
-    status = keyFileData->GetInfo("type", &code, &found);
+    status = keyFileData.GetInfo("type", &code, &found);
     if(status == B_OK && code == B_UINT32_TYPE && found == 1)
-        status = keyFileData->GetInfo("purpose", &code, &found);
+        status = keyFileData.GetInfo("purpose", &code, &found);
     if(status == B_OK && code == B_UINT32_TYPE && found == 1)
-        status = keyFileData->GetInfo("identifier", &code, &found);
+        status = keyFileData.GetInfo("identifier", &code, &found);
     if(status == B_OK && code == B_STRING_TYPE && found == 1)
-        status = keyFileData->GetInfo("secondaryIdentifier", &code, &found);
+        status = keyFileData.GetInfo("secondaryIdentifier", &code, &found);
     if(status == B_OK && code == B_STRING_TYPE && found == 1)
-        status = keyFileData->GetInfo("data", &code, &found);
+        status = keyFileData.GetInfo("data", &code, &found);
     if(status == B_OK && code == B_ANY_TYPE && found == 1)
         status = B_OK; // We currently will not require owner and
                        // creationTime as they are not currently used in the API
@@ -89,6 +98,16 @@ bool IsExportedKey(BMessage* keyFileData)
     return status == B_OK;
 }
 
+bool IsExportedKey(BMessage* keyFileData)
+{
+    return CheckExportedKey(*keyFileData);
+}
+
+bool IsExportedKey(const FlatMessageReader& keyFileData)
+{
+    return keyFileData.InitCheck() == B_OK && CheckExportedKey(keyFileData);
+}
+
 /* Operation modes for read-write methods:
  *  + model-only: only works on the model ADT
  *  + model-and-database: works both on model and database
@@ -121,16 +140,35 @@ KeyImp::KeyImp(KeyringImp* parent, BKeyPurpose p, BKeyType t,
     SetTo(p, t, id, secid, dc, owner);
 }
 
-// SetTo: model-only
-void KeyImp::SetTo(BKeyPurpose p, BKeyType t,
+// SetTo: model-only, B_NO_MEMORY if its strings could not be stored
+status_t KeyImp::SetTo(BKeyPurpose p, BKeyType t,
     const char* id, const char* secid, bigtime_t dc, const char* owner)
 {
+    StringArena* strings = _Strings();
+
     fPurpose = p;
     fType = t;
-    fIdentifier.SetTo(id);
-    secid ? fSecIdentifier.SetTo(secid) : fSecIdentifier.SetTo("");
     fCreated = dc;
-    fOwner.SetTo(owner);
+    if((fInitStatus = strings->Intern(id, &fIdentifier)) == B_OK &&
+    (fInitStatus = strings->Intern(secid, &fSecIdentifier)) == B_OK)
+        fInitStatus = strings->Intern(owner, &fOwner);
+    return fInitStatus;
+}
+
+// InitCheck: a key that failed to initialize must not get in the model
+status_t KeyImp::InitCheck()
+{
+    return fInitStatus;
+}
+
+StringArena* KeyImp::_Strings()
+{
+    return fParent->Parent()->Strings();
+}
+
+KeystoreBackend* KeyImp::_Backend()
+{
+    return fParent->Parent()->Backend();
 }
 
 KeyringImp* KeyImp::Parent()
@@ -140,12 +178,12 @@ KeyringImp* KeyImp::Parent()
 
 const char* KeyImp::Identifier()
 {
-    return fIdentifier.String();
+    return _Strings()->String(fIdentifier);
 }
 
 const char* KeyImp::SecondaryIdentifier()
 {
-    return fSecIdentifier.String();
+    return _Strings()->String(fSecIdentifier);
 }
 
 BKeyType KeyImp::Type()
@@ -165,13 +203,13 @@ bigtime_t KeyImp::Created()
 
 const char* KeyImp::Owner()
 {
-    return fOwner.String();
+    return _Strings()->String(fOwner);
 }
 
 void KeyImp::Data(const void* ptr, size_t* len)
 {
     BKey key;
-    BKeyStore().GetKey(fParent->Identifier(), Type(), Identifier(),
+    _Backend()->GetKey(fParent->Identifier(), Type(), Identifier(),
         SecondaryIdentifier(), false, key);
     ptr = reinterpret_cast<const void*>(key.Data());
     *len = key.DataLength();
@@ -192,7 +230,7 @@ status_t KeyImp::Export(BMessage* archive)
         case B_KEY_TYPE_GENERIC:
         {
             BKey key;
-            if(BKeyStore().GetKey(fParent->Identifier(), B_KEY_TYPE_GENERIC,
+            if(_Backend()->GetKey(fParent->Identifier(), B_KEY_TYPE_GENERIC,
             Identifier(), SecondaryIdentifier(), false, key) != B_OK)
                 return B_ERROR;
             return key.Flatten(*archive);
@@ -200,7 +238,7 @@ status_t KeyImp::Export(BMessage* archive)
         case B_KEY_TYPE_PASSWORD:
         {
             BPasswordKey pwdkey;
-            if(BKeyStore().GetKey(fParent->Identifier(), B_KEY_TYPE_PASSWORD,
+            if(_Backend()->GetKey(fParent->Identifier(), B_KEY_TYPE_PASSWORD,
             Identifier(), SecondaryIdentifier(), false, pwdkey) != B_OK)
                 return B_ERROR;
             return pwdkey.Flatten(*archive);
@@ -245,7 +283,9 @@ void ApplicationAccessImp::PrintToStream()
 KeyringImp::KeyringImp(KeystoreImp* parent, const char* name)
 : fParent(parent),
   fHasUnlockKey(false),
-  fIsUnlocked(BKeyStore().IsKeyringUnlocked(name))
+  fIsUnlocked(_Backend()->IsKeyringUnlocked(name)),
+  fIsLoaded(false),
+  fIsAttached(false)
 {
     fName.SetTo(name);
 }
@@ -260,21 +300,82 @@ KeystoreImp* KeyringImp::Parent()
     return fParent;
 }
 
+KeystoreBackend* KeyringImp::_Backend()
+{
+    return fParent->Backend();
+}
+
 const char* KeyringImp::Identifier()
 {
     return fName.String();
 }
 
+bool KeyringImp::IsLoaded()
+{
+    return fIsLoaded;
+}
+
+// Load: database-only into model
+status_t KeyringImp::Load()
+{
+    const char* kr = Identifier();
+    status_t status = B_OK;
+
+    Reset();
+
+    // All the types at once: keys are inserted while the next ones are fetched
+    KeyEnumerator enumerator(_Backend(), kr);
+    key_record record;
+    while((status = enumerator.Next(record)) == B_OK) {
+        if(_AddToModel(new KeyImp(this, record.purpose, record.type,
+            record.identifier.String(), record.secondaryIdentifier.String(),
+            record.created, record.owner.String())) == B_NO_MEMORY) {
+            status = B_NO_MEMORY;
+            break;
+        }
+    }
+    __trace("Info: %s: %" B_PRId32 " keys in %" B_PRId32 " requests.\n", kr,
+        KeyCount(), enumerator.RoundTrips());
+    // The first error is the one reported, the applications are read anyway
+    status_t keysStatus = status == B_ENTRY_NOT_FOUND ? B_OK : status;
+
+    bool next = true;
+    uint32 appCookie = 0;
+    BString appSignature;
+
+    while(next) {
+        switch(status = _Backend()->GetNextApplication(kr, appCookie, appSignature))
+        {
+            case B_OK:
+                AddApplicationToList(appSignature.String());
+                break;
+            case B_BAD_VALUE:
+            case B_NOT_ALLOWED:
+            case B_ENTRY_NOT_FOUND:
+            default:
+                next = false;
+                break;
+        }
+    }
+
+    // Mark it even on errors, it will not be retried until the next reset
+    fIsLoaded = true;
+
+    if(keysStatus != B_OK)
+        return keysStatus;
+    return status == B_ENTRY_NOT_FOUND ? B_OK : status;
+}
+
 // IsUnlocked: database-only
 bool KeyringImp::IsUnlocked()
 {
-    return BKeyStore().IsKeyringUnlocked(fName.String());
+    return _Backend()->IsKeyringUnlocked(fName.String());
 }
 
 // Lock: database-only
 status_t KeyringImp::Lock()
 {
-    return BKeyStore().LockKeyring(fName.String());
+    return _Backend()->LockKeyring(fName.String());
 }
 
 // Unlock: none
@@ -290,7 +391,7 @@ status_t KeyringImp::SetUnlockKey(BMessage* data)
     if((status = key.Unflatten(*data)) != B_OK)
         return status;
 
-    if((status = BKeyStore().SetUnlockKey(fName.String(), key)) == B_OK)
+    if((status = _Backend()->SetUnlockKey(fName.String(), key)) == B_OK)
         fHasUnlockKey = true;
 
     return status;
@@ -300,7 +401,7 @@ status_t KeyringImp::RemoveUnlockKey()
 {
     status_t status = B_OK;
 
-    if((status = BKeyStore().RemoveUnlockKey(fName.String())) == B_OK)
+    if((status = _Backend()->RemoveUnlockKey(fName.String())) == B_OK)
         fHasUnlockKey = false;
 
     return status;
@@ -312,29 +413,41 @@ status_t KeyringImp::AddKey(BKeyPurpose p, BKeyType t, const char* id,
 {
     status_t status = B_OK;
 
+    if(KeyByIdentifier(SafeView(id), SafeView(secid), t) != nullptr)
+        return B_NAME_IN_USE;
+
+    // The model entry goes first, nothing is stored if it cannot be made
+    KeyImp* key = new KeyImp(this, p, t, id, secid);
+    if((status = key->InitCheck()) != B_OK) {
+        delete key;
+        return status;
+    }
+
     if(createInDb) {
         switch(t) {
             case B_KEY_TYPE_GENERIC:
-                status = BKeyStore().AddKey(Identifier(),
+                status = _Backend()->AddKey(Identifier(),
                     BKey(p, id, secid, data, length));
                 break;
             case B_KEY_TYPE_PASSWORD:
             {
                 const char* password = reinterpret_cast<const char*>(data);
-                status = BKeyStore().AddKey(Identifier(),
+                status = _Backend()->AddKey(Identifier(),
                     BPasswordKey(password, p, id, secid));
                 break;
             }
             default:
-                return B_NOT_SUPPORTED;
+                status = B_NOT_SUPPORTED;
+                break;
         }
     }
 
-    bool added = false;
-    if(status == B_OK)
-        added = fKeyList.AddItem(new KeyImp(this, p, t, id, secid));
+    if(status != B_OK) {
+        delete key;
+        return status;
+    }
 
-    return added ? B_OK : B_ERROR;
+    return _AddToModel(key);
 }
 
 // ImportKey: model-and-database
@@ -351,7 +464,7 @@ status_t KeyringImp::ImportKey(BMessage* archive)
             BKey key;
             if((status = key.Unflatten(*archive)) != B_OK)
                 return status;
-            if((status = BKeyStore().AddKey(Identifier(), key)) != B_OK)
+            if((status = _Backend()->AddKey(Identifier(), key)) != B_OK)
                 return status;
             // The following addition is model-only because it has just been directly added to db
             AddKey(key.Purpose(), key.Type(), key.Identifier(), key.SecondaryIdentifier());
@@ -362,7 +475,7 @@ status_t KeyringImp::ImportKey(BMessage* archive)
             BPasswordKey key;
             if((status = key.Unflatten(*archive)) != B_OK)
                 return status;
-            if((status = BKeyStore().AddKey(Identifier(), key)) != B_OK)
+            if((status = _Backend()->AddKey(Identifier(), key)) != B_OK)
                 return status;
             // The following addition is model-only because it has just been directly added to db
             AddKey(key.Purpose(), key.Type(), key.Identifier(), key.SecondaryIdentifier());
@@ -375,50 +488,43 @@ status_t KeyringImp::ImportKey(BMessage* archive)
     }
 }
 
-// RemoveKey: model-opt-database
-status_t KeyringImp::RemoveKey(const char* id, bool deleteInDb)
+/* ImportKey: model-and-database, adds every key of the archive to this
+    keyring, whatever keyring it was exported from, as one batch, see AddKeys() */
+status_t KeyringImp::ImportKey(KeyArchiveReader& archive, int32* added)
 {
-    status_t status = B_OK;
-
-    KeyImp* keyentry = FindInList(fKeyList, id);
-    if(!keyentry)
-        return B_ENTRY_NOT_FOUND;
+    status_t status = archive.InitCheck();
+    if(status != B_OK)
+        return status;
 
-    if(deleteInDb) {
-        switch(keyentry->Type()) {
-            case B_KEY_TYPE_GENERIC: {
-                BKey key;
-                if((status = BKeyStore().GetKey(Identifier(), keyentry->Type(),
-                keyentry->Identifier(), key)) != B_OK)
-                    return status;
-                status = BKeyStore().RemoveKey(Identifier(), key);
-                break;
-            }
-            case B_KEY_TYPE_PASSWORD: {
-                BPasswordKey key;
-                if((status = BKeyStore().GetKey(Identifier(), keyentry->Type(),
-                keyentry->Identifier(), key)) != B_OK)
-                    return status;
-                status = BKeyStore().RemoveKey(Identifier(), key);
-                break;
-            }
-            default:
-                return B_NOT_SUPPORTED;
+    int32 count = archive.CountKeys();
+    BObjectList<BMessage> archives(count > 0 ? count : 20, true);
+    for(int32 i = 0; i < count; i++) {
+        BMessage* key = new BMessage;
+        status_t result = archive.KeyAt(i, key);
+        if(result != B_OK) {
+            status = status == B_OK ? result : status;
+            delete key;
+            continue;
         }
+        archives.AddItem(key);
     }
 
-    bool removed = false;
-    if(status == B_OK)
-        removed = fKeyList.RemoveItem(keyentry);
+    status_t result = AddKeys(archives, added);
+    return status == B_OK ? result : status;
+}
 
-    return removed ? B_OK : B_ERROR;
+/* RemoveKey: model-opt-database, the key with no secondary identifier. The
+    database is asked for that same key, not for any with that identifier. */
+status_t KeyringImp::RemoveKey(const char* id, bool deleteInDb)
+{
+    return RemoveKey(id, nullptr, deleteInDb);
 }
 
 // RemoveKey: model-opt-database
 status_t KeyringImp::RemoveKey(const char* id, const char* secid, bool deleteInDb)
 {
     status_t status = B_OK;
-    KeyImp* keyentry = FindInList2(fKeyList, id, secid);
+    KeyImp* keyentry = KeyByIdentifier(id, secid);
     if(!keyentry) // does not necessarily mean that the key does not exist
         return B_ENTRY_NOT_FOUND;
 
@@ -426,20 +532,20 @@ status_t KeyringImp::RemoveKey(const char* id, const char* secid, bool deleteInD
         switch(keyentry->Type()) {
             case B_KEY_TYPE_GENERIC: {
                 BKey key;
-                if((status = BKeyStore().GetKey(Identifier(), keyentry->Type(),
+                if((status = _Backend()->GetKey(Identifier(), keyentry->Type(),
                 keyentry->Identifier(), keyentry->SecondaryIdentifier(), false,
                 key)) != B_OK)
                     return status;
-                status = BKeyStore().RemoveKey(Identifier(), key);
+                status = _Backend()->RemoveKey(Identifier(), key);
                 break;
             }
             case B_KEY_TYPE_PASSWORD: {
                 BPasswordKey key;
-                if((status = BKeyStore().GetKey(Identifier(), keyentry->Type(),
+                if((status = _Backend()->GetKey(Identifier(), keyentry->Type(),
                 keyentry->Identifier(), keyentry->SecondaryIdentifier(), false,
                 key)) != B_OK)
                     return status;
-                status = BKeyStore().RemoveKey(Identifier(), key);
+                status = _Backend()->RemoveKey(Identifier(), key);
                 break;
             }
             default:
@@ -447,11 +553,154 @@ status_t KeyringImp::RemoveKey(const char* id, const char* secid, bool deleteInD
         }
     }
 
-    bool removed = false;
-    if(status == B_OK)
-        removed = fKeyList.RemoveItem(keyentry);
+    if(status != B_OK)
+        return status;
 
-    return removed ? B_OK : B_ERROR;
+    return _RemoveFromModel(keyentry) ? B_OK : B_ERROR;
+}
+
+/* AddKeys: model-and-database, adds flattened keys like ImportKey() does.
+    The whole batch is validated first, the keys are then stored with their
+    requests overlapped and the model is updated once at the end. Returns
+    the first error, but every valid key is still added.
+*/
+status_t KeyringImp::AddKeys(const BObjectList<BMessage>& archives, int32* added)
+{
+    int32 count = archives.CountItems();
+    std::vector<status_t> results(count, B_OK);
+    std::unordered_set<KeyTuple, KeyTupleHash> batch;
+
+    // Validation, duplicates within the batch included
+    for(int32 i = 0; i < count; i++) {
+        BMessage* archive = archives.ItemAt(i);
+        BKeyType type = (BKeyType)archive->GetUInt32("type", B_KEY_TYPE_ANY);
+        KeyTuple tuple{ SafeView(archive->GetString("identifier", "")),
+            SafeView(archive->GetString("secondaryIdentifier", "")), type };
+        if(type != B_KEY_TYPE_GENERIC && type != B_KEY_TYPE_PASSWORD)
+            results[i] = B_NOT_SUPPORTED;
+        else if(tuple.identifier.empty())
+            results[i] = B_BAD_DATA;
+        else if(fKeyIndex.find(tuple) != fKeyIndex.end() ||
+        !batch.insert(tuple).second)
+            results[i] = B_NAME_IN_USE;
+    }
+
+    _RunBatch(count, results.data(), [&](int32 i) {
+        BMessage* archive = archives.ItemAt(i);
+        status_t status;
+        if(archive->GetUInt32("type", B_KEY_TYPE_ANY) == B_KEY_TYPE_PASSWORD) {
+            BPasswordKey key;
+            if((status = key.Unflatten(*archive)) != B_OK)
+                return status;
+            return _Backend()->AddKey(Identifier(), key);
+        }
+        BKey key;
+        if((status = key.Unflatten(*archive)) != B_OK)
+            return status;
+        return _Backend()->AddKey(Identifier(), key);
+    });
+
+    status_t status = B_OK;
+    int32 addedCount = 0;
+    for(int32 i = 0; i < count; i++) {
+        if(results[i] != B_OK) {
+            if(status == B_OK)
+                status = results[i];
+            continue;
+        }
+        BMessage* archive = archives.ItemAt(i);
+        status_t result = _AddToModel(new KeyImp(this,
+            (BKeyPurpose)archive->GetUInt32("purpose", B_KEY_PURPOSE_ANY),
+            (BKeyType)archive->GetUInt32("type", B_KEY_TYPE_ANY),
+            archive->GetString("identifier", ""),
+            archive->GetString("secondaryIdentifier", ""),
+            archive->GetInt64("creationTime", 0),
+            archive->GetString("owner", "")));
+        if(result == B_OK)
+            addedCount++;
+        else if(result == B_NO_MEMORY && status == B_OK)
+            status = result;
+    }
+
+    if(added)
+        *added = addedCount;
+    return status;
+}
+
+/* RemoveKeys: model-opt-database, removes keys of this keyring. The removals
+    from the database are overlapped and the model is rebuilt in one pass
+    instead of once per key. Returns the first error, but every key that
+    could be removed is.
+*/
+status_t KeyringImp::RemoveKeys(const BObjectList<KeyImp>& keys, bool deleteInDb,
+    int32* removed)
+{
+    int32 count = keys.CountItems();
+    std::vector<status_t> results(count, B_OK);
+    std::unordered_set<KeyImp*> batch;
+
+    for(int32 i = 0; i < count; i++) {
+        KeyImp* key = keys.ItemAt(i);
+        if(key == nullptr || key->Parent() != this || !batch.insert(key).second)
+            results[i] = B_ENTRY_NOT_FOUND;
+        else if(key->Type() != B_KEY_TYPE_GENERIC && key->Type() != B_KEY_TYPE_PASSWORD)
+            results[i] = B_NOT_SUPPORTED;
+    }
+
+    if(deleteInDb) {
+        // The server only removes a key when given its secret too
+        _RunBatch(count, results.data(), [&](int32 i) {
+            KeyImp* entry = keys.ItemAt(i);
+            status_t status;
+            if(entry->Type() == B_KEY_TYPE_PASSWORD) {
+                BPasswordKey key;
+                if((status = _Backend()->GetKey(Identifier(), entry->Type(),
+                entry->Identifier(), entry->SecondaryIdentifier(), false,
+                key)) != B_OK)
+                    return status;
+                return _Backend()->RemoveKey(Identifier(), key);
+            }
+            BKey key;
+            if((status = _Backend()->GetKey(Identifier(), entry->Type(),
+            entry->Identifier(), entry->SecondaryIdentifier(), false,
+            key)) != B_OK)
+                return status;
+            return _Backend()->RemoveKey(Identifier(), key);
+        });
+    }
+
+    status_t status = B_OK;
+    batch.clear();
+    for(int32 i = 0; i < count; i++) {
+        if(results[i] != B_OK) {
+            if(status == B_OK)
+                status = results[i];
+            continue;
+        }
+        KeyImp* key = keys.ItemAt(i);
+        fKeyIndex.erase(KeyTuple{ key->Identifier(), key->SecondaryIdentifier(),
+            key->Type() });
+        _CountKey(key, -1);
+        batch.insert(key);
+    }
+
+    // Single pass over the list, keeping its order
+    if(!batch.empty()) {
+        BObjectList<KeyImp> survivors(fKeyList.CountItems() - batch.size() + 1);
+        for(int32 i = 0; i < fKeyList.CountItems(); i++) {
+            KeyImp* key = fKeyList.ItemAt(i);
+            if(batch.find(key) == batch.end())
+                survivors.AddItem(key);
+        }
+        fKeyList.MakeEmpty(false);
+        fKeyList.AddList(&survivors);
+        for(KeyImp* key : batch)
+            delete key;
+    }
+
+    if(removed)
+        *removed = batch.size();
+    return status;
 }
 
 KeyImp* KeyringImp::KeyAt(int32 index)
@@ -459,34 +708,54 @@ KeyImp* KeyringImp::KeyAt(int32 index)
     return fKeyList.ItemAt(index);
 }
 
-KeyImp* KeyringImp::KeyByIdentifier(const char* id)
+KeyImp* KeyringImp::KeyByIdentifier(const char* id, const char* secondary_id)
 {
-    // return FindInList(fKeyList, id);
-    return FindInList2(fKeyList, id, "");
+    if(!id)
+        return nullptr;
+
+    return KeyByIdentifier(SafeView(id), SafeView(secondary_id));
 }
 
-KeyImp* KeyringImp::KeyByIdentifier(const char* id, const char* secondary_id)
+KeyImp* KeyringImp::KeyByIdentifier(std::string_view id, std::string_view secondary_id)
 {
-    if(!secondary_id)
-        secondary_id = "";
+    if(id.empty())
+        return nullptr;
+
+    // Partial duplicates of different type are allowed by the API, so the
+    //  first match in type order is returned
+    for(const auto& type : { B_KEY_TYPE_GENERIC, B_KEY_TYPE_PASSWORD,
+    B_KEY_TYPE_CERTIFICATE }) {
+        KeyImp* key = KeyByIdentifier(id, secondary_id, type);
+        if(key)
+            return key;
+    }
+
+    return nullptr;
+}
 
-    return FindInList2(fKeyList, id, secondary_id);
+KeyImp* KeyringImp::KeyByIdentifier(std::string_view id, std::string_view secondary_id,
+    BKeyType type)
+{
+    auto it = fKeyIndex.find(KeyTuple{ id, secondary_id, type });
+    return it != fKeyIndex.end() ? it->second : nullptr;
 }
 
 int32 KeyringImp::KeyCount(BKeyType type, BKeyPurpose purpose)
 {
-    int count = 0;
-    for(int i = 0; i < fKeyList.CountItems(); i++) {
-        if((type == B_KEY_TYPE_ANY || fKeyList.ItemAt(i)->Type() == type) &&
-        (purpose == B_KEY_PURPOSE_ANY || fKeyList.ItemAt(i)->Purpose() == purpose))
-            count++;
-    }
-    return count;
+    return fKeyCounts.Count(type, purpose);
 }
 
 void KeyringImp::AddApplicationToList(const char* signature)
 {
-    fAppList.AddItem(new ApplicationAccessImp(this, signature));
+    if(ApplicationBySignature(signature) != nullptr)
+        return;
+
+    ApplicationAccessImp* app = new ApplicationAccessImp(this, signature);
+    if(!fAppList.AddItem(app)) {
+        delete app;
+        return;
+    }
+    fAppIndex.emplace(app->Identifier(), app);
 }
 
 status_t KeyringImp::RemoveApplication(const char* signature, bool deleteInDb)
@@ -494,12 +763,16 @@ status_t KeyringImp::RemoveApplication(const char* signature, bool deleteInDb)
     status_t status = B_OK;
 
     if(deleteInDb)
-        status = BKeyStore().RemoveApplication(Identifier(), signature);
+        status = _Backend()->RemoveApplication(Identifier(), signature);
 
-    ApplicationAccessImp* app = FindInList(fAppList, signature);
+    ApplicationAccessImp* app = ApplicationBySignature(signature);
     if(status == B_OK && app) {
+        fAppIndex.erase(app->Identifier());
         bool result = fAppList.RemoveItem(app);
-        if(result) status = B_OK;
+        if(result) {
+            delete app;
+            status = B_OK;
+        }
         else status = B_ERROR;
     }
 
@@ -513,7 +786,16 @@ ApplicationAccessImp* KeyringImp::ApplicationAt(int32 index)
 
 ApplicationAccessImp* KeyringImp::ApplicationBySignature(const char* signature)
 {
-    return FindInList(fAppList, signature);
+    if(!signature)
+        return nullptr;
+
+    return ApplicationBySignature(std::string_view(signature));
+}
+
+ApplicationAccessImp* KeyringImp::ApplicationBySignature(std::string_view signature)
+{
+    auto it = fAppIndex.find(signature);
+    return it != fAppIndex.end() ? it->second : nullptr;
 }
 
 int32 KeyringImp::ApplicationCount()
@@ -533,36 +815,206 @@ void KeyringImp::PrintToStream()
 
 void KeyringImp::Reset()
 {
-    // Reset the data structure without touching the actual data on disk
+    // Reset the data structure without touching the actual data on disk.
+    //  The indices go first as their keys are views into the entries. The
+    //  strings of the keys stay in the keystore arena until the whole
+    //  keystore is reset, reading the keyring again reuses them
+    fIsLoaded = false;
+    if(fParent)
+        _Backend()->InvalidateCache(Identifier());
+    fKeyIndex.clear();
+    fAppIndex.clear();
+    if(fParent && fIsAttached)
+        fParent->_KeyCounts().Add(fKeyCounts, -1);
+    fKeyCounts.Clear();
+
     for(int i = 0; i < fKeyList.CountItems(); i++)
-        fKeyList.RemoveItem(fKeyList.ItemAt(i));
+        delete fKeyList.ItemAt(i);
+    fKeyList.MakeEmpty(false);
     for(int i = 0; i < fAppList.CountItems(); i++)
-        fAppList.RemoveItem(fAppList.ItemAt(i));
+        delete fAppList.ItemAt(i);
+    fAppList.MakeEmpty(false);
+}
+
+// _AddToModel: model-only, takes ownership of the key
+status_t KeyringImp::_AddToModel(KeyImp* key)
+{
+    status_t status = key->InitCheck();
+    if(status != B_OK) {
+        // Its empty identifiers would collide with other keys in the index
+        delete key;
+        return status;
+    }
+
+    KeyTuple tuple{ key->Identifier(), key->SecondaryIdentifier(), key->Type() };
+    if(fKeyIndex.find(tuple) != fKeyIndex.end() || !fKeyList.AddItem(key)) {
+        delete key;
+        return B_ERROR;
+    }
+    fKeyIndex.emplace(tuple, key);
+    _CountKey(key, 1);
+
+    return B_OK;
+}
+
+// _RemoveFromModel: model-only
+bool KeyringImp::_RemoveFromModel(KeyImp* key)
+{
+    fKeyIndex.erase(KeyTuple{ key->Identifier(), key->SecondaryIdentifier(), key->Type() });
+    if(!fKeyList.RemoveItem(key, false))
+        return false;
+
+    _CountKey(key, -1);
+    delete key;
+    return true;
+}
+
+struct batch_run {
+    const std::function<status_t(int32)>* call;
+    status_t           *results;
+    int32               count;
+    std::atomic<int32>  next;
+};
+
+static int32 _BatchWorker(void* data)
+{
+    batch_run* run = static_cast<batch_run*>(data);
+    int32 index;
+    while((index = run->next++) < run->count) {
+        if(run->results[index] == B_OK)
+            run->results[index] = (*run->call)(index);
+    }
+    return 0;
+}
+
+/* _RunBatch: database-only, calls the backend for every entry still without
+    an error, from a few threads so the round trips overlap. The first call
+    is made alone, so a locked keyring asks for its password only once.
+*/
+void KeyringImp::_RunBatch(int32 count, status_t* results,
+    const std::function<status_t(int32)>& call)
+{
+    int32 first = 0;
+    while(first < count && results[first] != B_OK)
+        first++;
+    if(first == count)
+        return;
+    results[first] = call(first);
+
+    batch_run run;
+    run.call = &call;
+    run.results = results;
+    run.count = count;
+    run.next = first + 1;
+
+    int32 workers = (count - first - 1) / 16;
+    if(workers > 4)
+        workers = 4;
+
+    std::vector<thread_id> threads;
+    for(int32 i = 0; i < workers; i++) {
+        thread_id thread = spawn_thread(_BatchWorker, "batch worker",
+            B_NORMAL_PRIORITY, &run);
+        if(thread < 0)
+            break;
+        threads.push_back(thread);
+        resume_thread(thread);
+    }
+
+    // The caller takes its share too, and all of it if no thread started
+    _BatchWorker(&run);
+    for(thread_id thread : threads) {
+        status_t result;
+        wait_for_thread(thread, &result);
+    }
+}
+
+// _CountKey: model-only
+void KeyringImp::_CountKey(KeyImp* key, int32 delta)
+{
+    fKeyCounts.Add(key->Type(), key->Purpose(), delta);
+    // Keyrings read in the background are counted when adopted
+    if(fParent && fIsAttached)
+        fParent->_KeyCounts().Add(key->Type(), key->Purpose(), delta);
+}
+
+/* _Adopt: model-only, moves the contents of a keyring read outside of the
+    model into this one, so the pointers handed out to this keyring and its
+    stub state stay valid. The other keyring is left empty.
+*/
+void KeyringImp::_Adopt(KeyringImp* other)
+{
+    for(int32 i = 0; i < other->fKeyList.CountItems(); i++) {
+        KeyImp* key = other->fKeyList.ItemAt(i);
+        key->fParent = this;
+        fKeyList.AddItem(key);
+    }
+    other->fKeyList.MakeEmpty(false);
+    for(int32 i = 0; i < other->fAppList.CountItems(); i++) {
+        ApplicationAccessImp* app = other->fAppList.ItemAt(i);
+        app->fParent = this;
+        fAppList.AddItem(app);
+    }
+    other->fAppList.MakeEmpty(false);
+
+    // The index keys are views into the entries, they moved along
+    fKeyIndex.swap(other->fKeyIndex);
+    fAppIndex.swap(other->fAppIndex);
+    other->fKeyIndex.clear();
+    other->fAppIndex.clear();
+
+    fKeyCounts = other->fKeyCounts;
+    other->fKeyCounts.Clear();
+    if(fParent && fIsAttached)
+        fParent->_KeyCounts().Add(fKeyCounts, 1);
+
+    fIsUnlocked = other->fIsUnlocked;
+    fIsLoaded = true;
 }
 
 // #pragma mark - KeystoreImp
 
-KeystoreImp::KeystoreImp()
+// KeystoreImp: the whole model shares one client, and its lock states
+KeystoreImp::KeystoreImp(KeystoreBackend* backend)
+: fBackend(new CachingKeystoreBackend(backend ? backend
+      : new ServerKeystoreBackend())),
+  fGeneration(0),
+  fLock("keystore model")
 {
 }
 
 KeystoreImp::~KeystoreImp()
 {
     Reset();
+    delete fBackend;
 }
 
 status_t KeystoreImp::AddKeyring(const char* name, bool createInDb)
 {
+    BAutolock lock(fLock);
     status_t status = B_OK;
 
     if(createInDb) {
-        status = BKeyStore().AddKeyring(name);
+        status = fBackend->AddKeyring(name);
     }
 
     if(status == B_OK) {
-        bool result = fKeyringList.AddItem(new KeyringImp(this, name));
-        if(result) status = B_OK;
-        else status = B_ERROR;
+        if(HasKeyring(name))
+            return B_OK; // Already in the model
+
+        KeyringImp* keyring = new KeyringImp(this, name);
+        if(createInDb) // A new keyring has nothing to read from the database
+            keyring->fIsLoaded = true;
+        bool result = fKeyringList.AddItem(keyring);
+        if(result) {
+            keyring->fIsAttached = true;
+            fKeyringIndex.emplace(keyring->Identifier(), keyring);
+            status = B_OK;
+        }
+        else {
+            delete keyring;
+            status = B_ERROR;
+        }
     }
 
     return status;
@@ -570,13 +1022,18 @@ status_t KeystoreImp::AddKeyring(const char* name, bool createInDb)
 
 status_t KeystoreImp::RemoveKeyring(const char* name, bool deleteInDb)
 {
+    BAutolock lock(fLock);
     status_t status = B_OK;
 
-    KeyringImp* keyring = FindInList(fKeyringList, name);
+    KeyringImp* keyring = FindKeyring(name);
     if(keyring) {
-        bool removed = fKeyringList.RemoveItem(keyring);
-        if(removed && deleteInDb) {
-            status = BKeyStore().RemoveKeyring(name);
+        fKeyringIndex.erase(keyring->Identifier());
+        bool removed = fKeyringList.RemoveItem(keyring, false);
+        if(removed) {
+            // The name may belong to the keyring itself, so delete it last
+            if(deleteInDb)
+                status = fBackend->RemoveKeyring(name);
+            delete keyring;
         }
     }
     else
@@ -592,7 +1049,45 @@ KeyringImp* KeystoreImp::KeyringAt(int32 index)
 
 KeyringImp* KeystoreImp::KeyringByName(const char* name)
 {
-    return FindInList(fKeyringList, name);
+    if(!name)
+        return nullptr;
+
+    return KeyringByName(std::string_view(name));
+}
+
+/* KeyringByName: model, reads the keyring from the database on first access.
+    The reading is done under the model lock, so it does not overlap with the
+    adoption of a copy read in the background.
+*/
+KeyringImp* KeystoreImp::KeyringByName(std::string_view name)
+{
+    BAutolock lock(fLock);
+    auto it = fKeyringIndex.find(name);
+    if(it == fKeyringIndex.end())
+        return nullptr;
+
+    if(!it->second->IsLoaded())
+        it->second->Load();
+
+    return it->second;
+}
+
+/* FindKeyring: model-only, the keyring may still be a stub. For existence
+    checks and the calls that do not read its keys, like the lock state ones.
+*/
+KeyringImp* KeystoreImp::FindKeyring(const char* name)
+{
+    if(!name)
+        return nullptr;
+
+    BAutolock lock(fLock);
+    auto it = fKeyringIndex.find(std::string_view(name));
+    return it != fKeyringIndex.end() ? it->second : nullptr;
+}
+
+bool KeystoreImp::HasKeyring(const char* name)
+{
+    return FindKeyring(name) != nullptr;
 }
 
 int32 KeystoreImp::KeyringCount()
@@ -600,9 +1095,103 @@ int32 KeystoreImp::KeyringCount()
     return fKeyringList.CountItems();
 }
 
+/* AdoptKeyring: model-only, takes ownership of a keyring read outside of the
+    model and moves its contents into its stub, which stays in place. The
+    keyring is discarded if the stub is gone, has been read in the meantime
+    or the model has been reset since the reading started.
+*/
+status_t KeystoreImp::AdoptKeyring(KeyringImp* keyring, uint32 generation)
+{
+    if(!keyring)
+        return B_BAD_VALUE;
+
+    BAutolock lock(fLock);
+    auto it = fKeyringIndex.find(keyring->Identifier());
+    if(generation != fGeneration || it == fKeyringIndex.end()
+        || it->second->IsLoaded()) {
+        delete keyring;
+        return B_NOT_ALLOWED;
+    }
+
+    it->second->_Adopt(keyring);
+    delete keyring;
+
+    return B_OK;
+}
+
+/* ImportKeys: model-and-database, takes a message with a field per keyring,
+    named after it, holding flattened keys. Missing keyrings are created and
+    each one gets its keys in a single batch. Keys already there are left as
+    they are, and not counted.
+*/
+status_t KeystoreImp::ImportKeys(const BMessage& keys, int32* added)
+{
+    status_t status = B_OK;
+    int32 addedCount = 0;
+    char* name = nullptr;
+    type_code type;
+    int32 count = 0;
+    for(int32 i = 0; keys.GetInfo(B_MESSAGE_TYPE, i, &name, &type, &count) == B_OK; i++) {
+        KeyringImp* keyring = KeyringByName(name);
+        if(!keyring) {
+            status_t result = AddKeyring(name, true);
+            if(result != B_OK || (keyring = KeyringByName(name)) == nullptr) {
+                if(status == B_OK)
+                    status = result != B_OK ? result : B_ERROR;
+                continue;
+            }
+        }
+
+        BObjectList<BMessage> archives(count, true);
+        for(int32 k = 0; k < count; k++) {
+            BMessage* archive = new BMessage;
+            if(keys.FindMessage(name, k, archive) == B_OK)
+                archives.AddItem(archive);
+            else
+                delete archive;
+        }
+
+        int32 keyringAdded = 0;
+        status_t result = keyring->AddKeys(archives, &keyringAdded);
+        addedCount += keyringAdded;
+        if(result != B_OK && result != B_NAME_IN_USE && status == B_OK)
+            status = result;
+    }
+
+    if(added)
+        *added = addedCount;
+    return status;
+}
+
+void KeystoreImp::LoadAll()
+{
+    BAutolock lock(fLock);
+    for(int i = 0; i < fKeyringList.CountItems(); i++) {
+        if(!fKeyringList.ItemAt(i)->IsLoaded())
+            fKeyringList.ItemAt(i)->Load();
+    }
+}
+
+// KeyCount: model-only, keyrings not loaded yet are not counted
+int32 KeystoreImp::KeyCount(BKeyType type, BKeyPurpose purpose)
+{
+    return fKeyCounts.Count(type, purpose);
+}
+
+StringArena* KeystoreImp::Strings()
+{
+    return &fStrings;
+}
+
+KeystoreBackend* KeystoreImp::Backend()
+{
+    return fBackend;
+}
+
 void KeystoreImp::PrintToStream()
 {
     printf("Keystore. %d keyrings.\n", fKeyringList.CountItems());
+    fStrings.PrintToStream();
 
     for(int i = 0; i < fKeyringList.CountItems(); i++)
         fKeyringList.ItemAt(i)->PrintToStream();
@@ -616,8 +1205,35 @@ bool KeystoreImp::IsEmpty()
 void KeystoreImp::Reset()
 {
     // Reset the data structure without touching the actual data on disk
+    BAutolock lock(fLock);
+    fKeyringIndex.clear();
     if(!IsEmpty()) {
         for(int i = 0; i < fKeyringList.CountItems(); i++)
-            fKeyringList.RemoveItem(fKeyringList.ItemAt(i), true);
+            delete fKeyringList.ItemAt(i);
+        fKeyringList.MakeEmpty(false);
     }
+    fKeyCounts.Clear();
+    fBackend->InvalidateCache();
+    // Keyrings still being read belong to the old model
+    fGeneration++;
+    // With no keys left, all the key metadata can go in one step. Keyrings
+    //  still being read hold it, then it goes with the next reset
+    fStrings.Reset();
+}
+
+uint32 KeystoreImp::Generation()
+{
+    return fGeneration;
+}
+
+/* Locker: held by the readers on other threads while they walk a keyring,
+    the looper may fill it in the meantime otherwise. */
+BLocker* KeystoreImp::Locker()
+{
+    return &fLock;
+}
+
+KeyHistogram& KeystoreImp::_KeyCounts()
+{
+    return fKeyCounts;
 }
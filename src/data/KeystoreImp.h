@@ -6,11 +6,20 @@
 #define __KEYRING_IMP_H_
 
 #include <Key.h>
+#include <Locker.h>
+#include <Message.h>
 #include <ObjectList.h>
 #include <SupportDefs.h>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+#include "FlatMessage.h"
+#include "KeyArchive.h"
+#include "StringArena.h"
+#include "KeystoreBackend.h"
 
 template <typename T>
-T* FindInList(BObjectList<T> list, const char* idstring) {
+T* FindInList(const BObjectList<T>& list, const char* idstring) {
 	T* selection = NULL;
 
     if(list.IsEmpty() || !idstring || strcmp(idstring, "") == 0) {
@@ -31,34 +40,77 @@ T* FindInList(BObjectList<T> list, const char* idstring) {
 	return selection;
 }
 
-template <typename T>
-T* FindInList2(BObjectList<T> list, const char* idstring, const char* secstring) {
-    T* selection = NULL;
+/* Null-safe conversion for the string view based lookups. The views never
+    own their data: the ones stored in the indices point to the strings of the
+    indexed entry itself, so they are valid as long as the entry is alive.
+*/
+inline std::string_view SafeView(const char* string)
+{
+    return string ? std::string_view(string) : std::string_view();
+}
 
-    if(list.IsEmpty() || !idstring || strcmp(idstring, "") == 0) {
-        return selection; // is NULL
+struct KeyTuple {
+    std::string_view identifier;
+    std::string_view secondaryIdentifier;
+    BKeyType         type;
+
+    bool operator==(const KeyTuple& other) const {
+        return type == other.type && identifier == other.identifier &&
+            secondaryIdentifier == other.secondaryIdentifier;
     }
+};
 
-	int i = 0;
-	bool found = false;
+struct KeyTupleHash {
+    size_t operator()(const KeyTuple& tuple) const {
+        size_t hash = std::hash<std::string_view>()(tuple.identifier);
+        hash ^= std::hash<std::string_view>()(tuple.secondaryIdentifier)
+            + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+        return hash ^ (static_cast<size_t>(tuple.type) << 1);
+    }
+};
 
-	while(i < list.CountItems() && !found) {
-		if(strcmp(list.ItemAt(i)->Identifier(), idstring) == 0 &&
-        strcmp(list.ItemAt(i)->SecondaryIdentifier(), secstring) == 0) {
-			found = true;
-			selection = list.ItemAt(i);
-		}
-		i++;
-	}
+/* Key counters indexed by type and purpose. The B_KEY_TYPE_ANY row and the
+    B_KEY_PURPOSE_ANY column hold the totals, so any query is a single read.
+*/
+struct KeyHistogram {
+    int32   counts[B_KEY_TYPE_CERTIFICATE + 1][B_KEY_PURPOSE_VOLUME + 1] = {};
 
-	return selection;
-}
+    void Add(BKeyType type, BKeyPurpose purpose, int32 delta = 1) {
+        bool validType = type > B_KEY_TYPE_ANY && type <= B_KEY_TYPE_CERTIFICATE;
+        bool validPurpose = purpose > B_KEY_PURPOSE_ANY && purpose <= B_KEY_PURPOSE_VOLUME;
+        counts[B_KEY_TYPE_ANY][B_KEY_PURPOSE_ANY] += delta;
+        if(validType)
+            counts[type][B_KEY_PURPOSE_ANY] += delta;
+        if(validPurpose)
+            counts[B_KEY_TYPE_ANY][purpose] += delta;
+        if(validType && validPurpose)
+            counts[type][purpose] += delta;
+    }
+
+    void Add(const KeyHistogram& other, int32 sign = 1) {
+        for(int t = 0; t <= B_KEY_TYPE_CERTIFICATE; t++)
+            for(int p = 0; p <= B_KEY_PURPOSE_VOLUME; p++)
+                counts[t][p] += sign * other.counts[t][p];
+    }
+
+    int32 Count(BKeyType type, BKeyPurpose purpose) const {
+        if(type < B_KEY_TYPE_ANY || type > B_KEY_TYPE_CERTIFICATE ||
+        purpose < B_KEY_PURPOSE_ANY || purpose > B_KEY_PURPOSE_VOLUME)
+            return 0;
+        return counts[type][purpose];
+    }
+
+    void Clear() {
+        *this = KeyHistogram();
+    }
+};
 
 BKeyPurpose PurposeForString(const char* purposeString);
 BKeyType TypeForString(const char* typeString);
 const char* StringForPurpose(BKeyPurpose);
 const char* StringForType(BKeyType);
 bool IsExportedKey(BMessage* keyFileData);
+bool IsExportedKey(const FlatMessageReader& keyFileData);
 
 class KeyringImp;
 class KeystoreImp;
@@ -81,6 +133,7 @@ public:
     bigtime_t   Created();
     const char *Owner();
     void        Data(const void* ptr, size_t* len);
+    status_t    InitCheck();
 
         /* No setters: the API does not seem to allow direct key editing... */
 
@@ -89,16 +142,20 @@ public:
     void        PrintToStream();
     status_t    Export(BMessage* archive);
 private:
-    void        SetTo(BKeyPurpose, BKeyType t, const char* id, const char* secid,
+    status_t    SetTo(BKeyPurpose, BKeyType t, const char* id, const char* secid,
                     bigtime_t dc, const char* owner);
+    StringArena *_Strings();
+    KeystoreBackend *_Backend();
 private:
+    friend class KeyringImp;
     KeyringImp *fParent;
     BKeyPurpose fPurpose;
     BKeyType    fType;
-    BString     fIdentifier,
+    string_handle fIdentifier,
                 fSecIdentifier,
                 fOwner;
     bigtime_t   fCreated;
+    status_t    fInitStatus;
 };
 
 class ApplicationAccessImp
@@ -112,6 +169,7 @@ public:
     [[maybe_unused]]
     void        PrintToStream();
 private:
+    friend class KeyringImp;
     KeyringImp *fParent;
     BString     fSignature;
 };
@@ -124,6 +182,8 @@ public:
 
    KeystoreImp *Parent();
     const char *Identifier();
+    bool        IsLoaded();
+    status_t    Load();
     bool        IsUnlocked();
     status_t    Lock();
     status_t    Unlock();
@@ -134,51 +194,93 @@ public:
                     const char* secid, const uint8* data = nullptr,
                     size_t length = 0, bool createInDb = false);
     status_t    ImportKey(BMessage* archive);
+    status_t    ImportKey(KeyArchiveReader& archive, int32* added = nullptr);
     status_t    RemoveKey(const char* id, bool deleteInDb = false);
     status_t    RemoveKey(const char* id, const char* secid = nullptr,
                     bool deleteInDb = false);
+    status_t    AddKeys(const BObjectList<BMessage>& archives,
+                    int32* added = nullptr);
+    status_t    RemoveKeys(const BObjectList<KeyImp>& keys,
+                    bool deleteInDb = false, int32* removed = nullptr);
 
     KeyImp     *KeyAt(int32 index);
-    KeyImp     *KeyByIdentifier(const char* id);
-    KeyImp     *KeyByIdentifier(const char* id, const char* secondary_id);
+    KeyImp     *KeyByIdentifier(const char* id, const char* secondary_id = nullptr);
+    KeyImp     *KeyByIdentifier(std::string_view id, std::string_view secondary_id);
+    KeyImp     *KeyByIdentifier(std::string_view id, std::string_view secondary_id,
+                    BKeyType type);
     int32       KeyCount(BKeyType = B_KEY_TYPE_ANY, BKeyPurpose = B_KEY_PURPOSE_ANY);
 
     void        AddApplicationToList(const char* signature);
     status_t    RemoveApplication(const char* signature, bool deleteInDb = false);
     ApplicationAccessImp *ApplicationAt(int32 index);
     ApplicationAccessImp *ApplicationBySignature(const char* signature);
+    ApplicationAccessImp *ApplicationBySignature(std::string_view signature);
     int32       ApplicationCount();
 
     [[maybe_unused]]
     void        PrintToStream();
     void        Reset();
 private:
+    status_t    _AddToModel(KeyImp* key);
+    bool        _RemoveFromModel(KeyImp* key);
+    void        _CountKey(KeyImp* key, int32 delta);
+    void        _Adopt(KeyringImp* other);
+    KeystoreBackend *_Backend();
+    void        _RunBatch(int32 count, status_t* results,
+                    const std::function<status_t(int32)>& call);
+private:
+    friend class KeystoreImp;
    KeystoreImp *fParent;
     BString     fName;
     bool        fHasUnlockKey,
-                fIsUnlocked;
+                fIsUnlocked,
+                fIsLoaded,
+                fIsAttached; // counted in the keystore
     BObjectList<KeyImp> fKeyList;
     BObjectList<ApplicationAccessImp> fAppList;
+    std::unordered_map<KeyTuple, KeyImp*, KeyTupleHash> fKeyIndex;
+    std::unordered_map<std::string_view, ApplicationAccessImp*> fAppIndex;
+    KeyHistogram fKeyCounts;
 };
 
 class KeystoreImp
 {
 public:
-    KeystoreImp();
+    KeystoreImp(KeystoreBackend* backend = nullptr);
     ~KeystoreImp();
 
     status_t    AddKeyring(const char* name, bool createInDb = false);
     status_t    RemoveKeyring(const char* name, bool deleteInDb = false);
     KeyringImp *KeyringAt(int32 index);
     KeyringImp *KeyringByName(const char* name);
+    KeyringImp *KeyringByName(std::string_view name);
+    KeyringImp *FindKeyring(const char* name);
+    bool        HasKeyring(const char* name);
     int32       KeyringCount();
+    status_t    AdoptKeyring(KeyringImp* keyring, uint32 generation);
+    status_t    ImportKeys(const BMessage& keys, int32* added = nullptr);
+    void        LoadAll();
+    int32       KeyCount(BKeyType = B_KEY_TYPE_ANY, BKeyPurpose = B_KEY_PURPOSE_ANY);
+    StringArena *Strings();
+    KeystoreBackend *Backend();
+    uint32      Generation();
+    BLocker    *Locker();
 
     [[maybe_unused]]
     void        PrintToStream();
     bool        IsEmpty();
     void        Reset();
+private:
+    friend class KeyringImp;
+    KeyHistogram &_KeyCounts();
 private:
     BObjectList<KeyringImp> fKeyringList;
+    KeystoreBackend *fBackend;
+    std::unordered_map<std::string_view, KeyringImp*> fKeyringIndex;
+    KeyHistogram fKeyCounts; // aggregate of all the keyrings
+    StringArena fStrings;     // key metadata of all the keyrings
+    uint32      fGeneration;  // bumped on every Reset()
+    BLocker     fLock;        // the keyring list, shared with the window
 };
 
 #endif
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#include <AppDefs.h>
+#include <Looper.h>
+#include <Message.h>
+#include <Messenger.h>
+#include <Roster.h>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include "KeystoreServer.h"
+
+// Checked again this often in case the roster notification went missing
+static const bigtime_t kServerRecheckInterval = 100000;
+
+/* Wakes whoever waits on it when the roster tells the server launched or quit */
+class ServerWatcher : public BLooper
+{
+public:
+    ServerWatcher()
+    : BLooper("keystore server watcher"),
+      fEvent(create_sem(0, "keystore server event"))
+    {
+    }
+    virtual ~ServerWatcher()
+    {
+        delete_sem(fEvent);
+    }
+
+    virtual void MessageReceived(BMessage* msg)
+    {
+        switch(msg->what)
+        {
+            case B_SOME_APP_LAUNCHED:
+            case B_SOME_APP_QUIT:
+                if(strcmp(msg->GetString("be:signature", ""), kKeyStoreServerSignature) == 0)
+                    release_sem(fEvent);
+                break;
+            default:
+                BLooper::MessageReceived(msg);
+                break;
+        }
+    }
+
+    status_t Wait(bigtime_t timeout)
+    {
+        return acquire_sem_etc(fEvent, 1, B_RELATIVE_TIMEOUT, timeout);
+    }
+private:
+    sem_id      fEvent;
+};
+
+/* WaitFor: the condition is checked once the roster is being watched, so
+    nothing happening in between is missed. */
+static status_t WaitFor(const std::function<bool()>& condition, bigtime_t timeout)
+{
+    ServerWatcher* watcher = new ServerWatcher;
+    watcher->Run();
+    BMessenger messenger(watcher);
+    be_roster->StartWatching(messenger, B_REQUEST_LAUNCHED | B_REQUEST_QUIT);
+
+    status_t status = B_TIMED_OUT;
+    bigtime_t deadline = system_time() + timeout;
+    while(true) {
+        if(condition()) {
+            status = B_OK;
+            break;
+        }
+        bigtime_t left = deadline - system_time();
+        if(left <= 0)
+            break;
+        watcher->Wait(left < kServerRecheckInterval ? left : kServerRecheckInterval);
+    }
+
+    be_roster->StopWatching(messenger);
+    watcher->Lock();
+    watcher->Quit();
+    return status;
+}
+
+// #pragma mark - Public
+
+/* StopKeystoreServer: the server is asked to quit once, and killed if it has
+    not by the timeout. It is only stopped once its team is gone, and with it
+    its hold on the database. */
+status_t StopKeystoreServer(bigtime_t timeout)
+{
+    team_id team = be_roster->TeamFor(kKeyStoreServerSignature);
+    if(team < 0)
+        return B_OK;
+
+    auto gone = [team]() {
+        team_info info;
+        return get_team_info(team, &info) != B_OK;
+    };
+
+    BMessenger(kKeyStoreServerSignature, team).SendMessage(B_QUIT_REQUESTED);
+    status_t status = WaitFor(gone, timeout);
+    if(status == B_TIMED_OUT) {
+        fprintf(stderr, "Warning: the keystore server did not quit in time, killing it.\n");
+        kill_team(team);
+        status = WaitFor(gone, kServerKillTimeout);
+    }
+    if(status != B_OK)
+        fprintf(stderr, "Error: the keystore server could not be stopped.\n");
+
+    return status;
+}
+
+status_t StartKeystoreServer(bigtime_t timeout)
+{
+    status_t status = be_roster->Launch(kKeyStoreServerSignature);
+    if(status != B_OK && status != B_ALREADY_RUNNING)
+        return status;
+
+    return WaitForKeystoreServer(timeout);
+}
+
+status_t WaitForKeystoreServer(bigtime_t timeout)
+{
+    return WaitFor([]() {
+        return BMessenger(kKeyStoreServerSignature).IsValid();
+    }, timeout);
+}
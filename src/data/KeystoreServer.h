@@ -0,0 +1,28 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef __KEYSTORE_SERVER_H_
+#define __KEYSTORE_SERVER_H_
+
+#include <OS.h>
+#include <SupportDefs.h>
+
+#define kKeyStoreServerSignature "application/x-vnd.Haiku-keystore_server"
+
+const bigtime_t kServerStopTimeout = 5000000;
+const bigtime_t kServerKillTimeout = 1000000;
+const bigtime_t kServerStartTimeout = 5000000;
+
+/* Starting and stopping the keystore server, waiting for it to happen.
+
+    The waits are woken by the roster as the server launches or quits, and
+    are bounded by their timeout. A server that does not quit in time after
+    being asked to is killed.
+*/
+status_t StopKeystoreServer(bigtime_t timeout = kServerStopTimeout);
+status_t StartKeystoreServer(bigtime_t timeout = kServerStartTimeout);
+// WaitForKeystoreServer: until it runs, without launching it
+status_t WaitForKeystoreServer(bigtime_t timeout);
+
+#endif /* __KEYSTORE_SERVER_H_ */
@@ -0,0 +1,457 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#include <Autolock.h>
+#include <File.h>
+#include <OS.h>
+#include <cstring>
+#include "LocalKeystoreBackend.h"
+
+LocalKeystoreBackend::LocalKeystoreBackend(const char* path, bigtime_t latency)
+: fLock("local keystore"),
+  fLatency(latency),
+  fRequests(0),
+  fDirty(false)
+{
+    if(path) {
+        fPath.SetTo(path);
+        _Read();
+    }
+}
+
+LocalKeystoreBackend::~LocalKeystoreBackend()
+{
+    Flush();
+    for(local_keyring* keyring : fKeyrings)
+        delete keyring;
+}
+
+void LocalKeystoreBackend::SetLatency(bigtime_t latency)
+{
+    fLatency = latency;
+}
+
+bigtime_t LocalKeystoreBackend::Latency()
+{
+    return fLatency;
+}
+
+int32 LocalKeystoreBackend::CountRequests()
+{
+    return atomic_get(&fRequests);
+}
+
+// Flush: writes the keystore to its file, if it has one and it was changed
+status_t LocalKeystoreBackend::Flush()
+{
+    BAutolock lock(fLock);
+    if(fPath.IsEmpty() || !fDirty)
+        return B_OK;
+
+    status_t status = _Write();
+    if(status == B_OK)
+        fDirty = false;
+    return status;
+}
+
+// #pragma mark - Keyrings
+
+status_t LocalKeystoreBackend::GetNextKeyring(uint32& cookie, BString& keyring)
+{
+    _Wait();
+    BAutolock lock(fLock);
+
+    if(cookie >= fKeyrings.size())
+        return B_ENTRY_NOT_FOUND;
+
+    keyring = fKeyrings[cookie++]->name;
+    return B_OK;
+}
+
+status_t LocalKeystoreBackend::AddKeyring(const char* keyring)
+{
+    _Wait();
+    BAutolock lock(fLock);
+
+    if(!keyring || _Keyring(keyring) != nullptr)
+        return B_NAME_IN_USE;
+
+    local_keyring* entry = new local_keyring;
+    entry->name.SetTo(keyring);
+    entry->hasUnlockKey = false;
+    entry->isUnlocked = true;
+    fKeyrings.push_back(entry);
+    fDirty = true;
+
+    return B_OK;
+}
+
+status_t LocalKeystoreBackend::RemoveKeyring(const char* keyring)
+{
+    _Wait();
+    BAutolock lock(fLock);
+
+    for(auto it = fKeyrings.begin(); it != fKeyrings.end(); it++) {
+        if((*it)->name == keyring) {
+            delete *it;
+            fKeyrings.erase(it);
+            fDirty = true;
+            return B_OK;
+        }
+    }
+
+    return B_ENTRY_NOT_FOUND;
+}
+
+bool LocalKeystoreBackend::IsKeyringUnlocked(const char* keyring)
+{
+    _Wait();
+    BAutolock lock(fLock);
+
+    local_keyring* entry = _Keyring(keyring);
+    return entry != nullptr && entry->isUnlocked;
+}
+
+status_t LocalKeystoreBackend::LockKeyring(const char* keyring)
+{
+    _Wait();
+    BAutolock lock(fLock);
+
+    local_keyring* entry = _Keyring(keyring);
+    if(!entry)
+        return B_BAD_VALUE;
+    if(!entry->hasUnlockKey)
+        return B_NOT_ALLOWED;
+
+    entry->isUnlocked = false;
+    return B_OK;
+}
+
+status_t LocalKeystoreBackend::SetUnlockKey(const char* keyring, const BKey& key)
+{
+    _Wait();
+    BAutolock lock(fLock);
+
+    local_keyring* entry = _Keyring(keyring);
+    if(!entry)
+        return B_BAD_VALUE;
+
+    status_t status = B_OK;
+    entry->unlockKey.MakeEmpty();
+    if((status = key.Flatten(entry->unlockKey)) != B_OK)
+        return status;
+
+    entry->hasUnlockKey = true;
+    fDirty = true;
+    return B_OK;
+}
+
+status_t LocalKeystoreBackend::RemoveUnlockKey(const char* keyring)
+{
+    _Wait();
+    BAutolock lock(fLock);
+
+    local_keyring* entry = _Keyring(keyring);
+    if(!entry)
+        return B_BAD_VALUE;
+
+    entry->unlockKey.MakeEmpty();
+    entry->hasUnlockKey = false;
+    entry->isUnlocked = true;
+    fDirty = true;
+    return B_OK;
+}
+
+// #pragma mark - Keys
+
+status_t LocalKeystoreBackend::GetKey(const char* keyring, BKeyType type,
+    const char* identifier, const char* secondaryIdentifier,
+    bool secondaryIdentifierOptional, BKey& key)
+{
+    _Wait();
+    BAutolock lock(fLock);
+
+    local_keyring* entry = _Keyring(keyring, true);
+    if(!entry)
+        return B_BAD_VALUE;
+
+    ssize_t index = _FindKey(entry, type, identifier, secondaryIdentifier,
+        secondaryIdentifierOptional);
+    if(index < 0)
+        return B_ENTRY_NOT_FOUND;
+
+    return key.Unflatten(entry->keys[index]);
+}
+
+status_t LocalKeystoreBackend::GetNextKey(const char* keyring, BKeyType type,
+    BKeyPurpose purpose, uint32& cookie, BKey& key)
+{
+    _Wait();
+    BAutolock lock(fLock);
+
+    local_keyring* entry = _Keyring(keyring, true);
+    if(!entry)
+        return B_BAD_VALUE;
+
+    while(cookie < entry->keys.size()) {
+        const BMessage& stored = entry->keys[cookie++];
+        uint32 storedType = stored.GetUInt32("type", B_KEY_TYPE_ANY);
+        uint32 storedPurpose = stored.GetUInt32("purpose", B_KEY_PURPOSE_ANY);
+        if((type == B_KEY_TYPE_ANY || storedType == (uint32)type) &&
+        (purpose == B_KEY_PURPOSE_ANY || storedPurpose == (uint32)purpose))
+            return key.Unflatten(stored);
+    }
+
+    return B_ENTRY_NOT_FOUND;
+}
+
+status_t LocalKeystoreBackend::AddKey(const char* keyring, const BKey& key)
+{
+    _Wait();
+    BAutolock lock(fLock);
+
+    local_keyring* entry = _Keyring(keyring, true);
+    if(!entry)
+        return B_BAD_VALUE;
+
+    if(_FindKey(entry, key.Type(), key.Identifier(), key.SecondaryIdentifier(),
+    false) >= 0)
+        return B_NAME_IN_USE;
+
+    BMessage stored;
+    status_t status = key.Flatten(stored);
+    if(status != B_OK)
+        return status;
+    // The server stamps the key when it is stored
+    if(stored.GetInt64("creationTime", 0) == 0) {
+        stored.RemoveName("creationTime");
+        stored.AddInt64("creationTime", real_time_clock_usecs());
+    }
+
+    entry->index.emplace(_IndexKey(key.Type(), key.Identifier(),
+        key.SecondaryIdentifier()), entry->keys.size());
+    entry->keys.push_back(stored);
+    fDirty = true;
+
+    return B_OK;
+}
+
+status_t LocalKeystoreBackend::RemoveKey(const char* keyring, const BKey& key)
+{
+    _Wait();
+    BAutolock lock(fLock);
+
+    local_keyring* entry = _Keyring(keyring, true);
+    if(!entry)
+        return B_BAD_VALUE;
+
+    ssize_t index = _FindKey(entry, key.Type(), key.Identifier(),
+        key.SecondaryIdentifier(), false);
+    if(index < 0)
+        return B_ENTRY_NOT_FOUND;
+
+    // Like the server, only a caller that knows the secret can remove it
+    const void* data = nullptr;
+    ssize_t length = 0;
+    if(entry->keys[index].FindData("data", B_RAW_TYPE, &data, &length) != B_OK)
+        length = 0;
+    if((size_t)length != key.DataLength() ||
+    (length > 0 && memcmp(data, key.Data(), length) != 0))
+        return B_NOT_ALLOWED;
+
+    // The last key takes the place of the removed one
+    size_t last = entry->keys.size() - 1;
+    const BMessage& moved = entry->keys[last];
+    entry->index.erase(_IndexKey(key.Type(), key.Identifier(),
+        key.SecondaryIdentifier()));
+    if((size_t)index != last) {
+        entry->index[_IndexKey(moved.GetUInt32("type", B_KEY_TYPE_ANY),
+            moved.GetString("identifier", ""),
+            moved.GetString("secondaryIdentifier", ""))] = index;
+        entry->keys[index] = moved;
+    }
+    entry->keys.pop_back();
+    fDirty = true;
+
+    return B_OK;
+}
+
+// #pragma mark - Applications
+
+status_t LocalKeystoreBackend::GetNextApplication(const char* keyring,
+    uint32& cookie, BString& signature)
+{
+    _Wait();
+    BAutolock lock(fLock);
+
+    local_keyring* entry = _Keyring(keyring);
+    if(!entry)
+        return B_BAD_VALUE;
+
+    if(cookie >= entry->applications.size())
+        return B_ENTRY_NOT_FOUND;
+
+    signature = entry->applications[cookie++];
+    return B_OK;
+}
+
+status_t LocalKeystoreBackend::RemoveApplication(const char* keyring,
+    const char* signature)
+{
+    _Wait();
+    BAutolock lock(fLock);
+
+    local_keyring* entry = _Keyring(keyring);
+    if(!entry)
+        return B_BAD_VALUE;
+
+    for(auto it = entry->applications.begin(); it != entry->applications.end(); it++) {
+        if(*it == signature) {
+            entry->applications.erase(it);
+            fDirty = true;
+            return B_OK;
+        }
+    }
+
+    return B_ENTRY_NOT_FOUND;
+}
+
+// #pragma mark - Private
+
+// _Wait: the time of a round trip to the server
+void LocalKeystoreBackend::_Wait()
+{
+    atomic_add(&fRequests, 1);
+    if(fLatency > 0)
+        snooze(fLatency);
+}
+
+/* _Keyring: only the calls that access keys pass access, looking the keyring
+    up for anything else leaves its lock state as it is */
+LocalKeystoreBackend::local_keyring* LocalKeystoreBackend::_Keyring(const char* name,
+    bool access)
+{
+    if(!name)
+        return nullptr;
+
+    for(local_keyring* keyring : fKeyrings) {
+        if(keyring->name == name) {
+            // There is no one to ask for the password, so a locked keyring
+            //  opens on access to its keys as if it had been given
+            if(access)
+                keyring->isUnlocked = true;
+            return keyring;
+        }
+    }
+
+    return nullptr;
+}
+
+ssize_t LocalKeystoreBackend::_FindKey(local_keyring* keyring, BKeyType type,
+    const char* identifier, const char* secondaryIdentifier,
+    bool secondaryIdentifierOptional)
+{
+    if(!identifier)
+        return -1;
+    if(!secondaryIdentifier)
+        secondaryIdentifier = "";
+
+    for(const auto& t : { B_KEY_TYPE_GENERIC, B_KEY_TYPE_PASSWORD,
+    B_KEY_TYPE_CERTIFICATE }) {
+        if(type != B_KEY_TYPE_ANY && type != t)
+            continue;
+        auto it = keyring->index.find(_IndexKey(t, identifier, secondaryIdentifier));
+        if(it != keyring->index.end())
+            return it->second;
+    }
+
+    if(!secondaryIdentifierOptional)
+        return -1;
+
+    // Any secondary identifier will do
+    for(size_t i = 0; i < keyring->keys.size(); i++) {
+        const BMessage& stored = keyring->keys[i];
+        if((type == B_KEY_TYPE_ANY ||
+        stored.GetUInt32("type", B_KEY_TYPE_ANY) == (uint32)type) &&
+        strcmp(stored.GetString("identifier", ""), identifier) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+std::string LocalKeystoreBackend::_IndexKey(uint32 type, const char* identifier,
+    const char* secondaryIdentifier)
+{
+    std::string key(reinterpret_cast<const char*>(&type), sizeof(type));
+    key.append(identifier ? identifier : "");
+    key.push_back('\0');
+    key.append(secondaryIdentifier ? secondaryIdentifier : "");
+    return key;
+}
+
+/* On disk, the keystore is a flattened message with one message per keyring,
+    named after it, holding its flattened keys, applications and unlock key.
+*/
+status_t LocalKeystoreBackend::_Read()
+{
+    BFile file(fPath.String(), B_READ_ONLY);
+    if(file.InitCheck() != B_OK)
+        return B_OK; // a new keystore
+
+    BMessage root;
+    status_t status = root.Unflatten(&file);
+    if(status != B_OK)
+        return status;
+
+    char* name = nullptr;
+    type_code type;
+    for(int32 i = 0; root.GetInfo(B_MESSAGE_TYPE, i, &name, &type) == B_OK; i++) {
+        BMessage data;
+        if(root.FindMessage(name, &data) != B_OK)
+            continue;
+
+        local_keyring* entry = new local_keyring;
+        entry->name.SetTo(name);
+        entry->hasUnlockKey = data.FindMessage("unlock key", &entry->unlockKey) == B_OK;
+        entry->isUnlocked = !entry->hasUnlockKey;
+
+        BMessage key;
+        for(int32 k = 0; data.FindMessage("key", k, &key) == B_OK; k++) {
+            entry->index.emplace(_IndexKey(key.GetUInt32("type", B_KEY_TYPE_ANY),
+                key.GetString("identifier", ""),
+                key.GetString("secondaryIdentifier", "")), entry->keys.size());
+            entry->keys.push_back(key);
+        }
+        BString signature;
+        for(int32 a = 0; data.FindString("application", a, &signature) == B_OK; a++)
+            entry->applications.push_back(signature);
+
+        fKeyrings.push_back(entry);
+    }
+
+    return B_OK;
+}
+
+status_t LocalKeystoreBackend::_Write()
+{
+    BMessage root;
+    for(local_keyring* entry : fKeyrings) {
+        BMessage data;
+        for(const BMessage& key : entry->keys)
+            data.AddMessage("key", &key);
+        for(const BString& signature : entry->applications)
+            data.AddString("application", signature);
+        if(entry->hasUnlockKey)
+            data.AddMessage("unlock key", &entry->unlockKey);
+        root.AddMessage(entry->name.String(), &data);
+    }
+
+    BFile file(fPath.String(), B_WRITE_ONLY | B_CREATE_FILE | B_ERASE_FILE);
+    status_t status = file.InitCheck();
+    if(status != B_OK)
+        return status;
+
+    return root.Flatten(&file);
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef __LOCAL_KEYSTORE_BACKEND_H_
+#define __LOCAL_KEYSTORE_BACKEND_H_
+
+#include <Locker.h>
+#include <Message.h>
+#include <String.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "KeystoreBackend.h"
+
+/* A stand-in for the keystore server that keeps the keystore in memory,
+    optionally read from and written to a file, so the data model can be
+    exercised without a running server.
+
+    Every call waits for the configured latency before being served, like a
+    round trip to the server would. The calls are served one at a time.
+
+    Keyrings with an unlock key start locked and keep their state until a
+    key in them is accessed, which unlocks them as if the server had asked
+    for the password and been given it, or until LockKeyring().
+*/
+class LocalKeystoreBackend : public KeystoreBackend
+{
+public:
+                        LocalKeystoreBackend(const char* path = nullptr,
+                            bigtime_t latency = 0);
+    virtual            ~LocalKeystoreBackend();
+
+    void                SetLatency(bigtime_t latency);
+    bigtime_t           Latency();
+    int32               CountRequests();
+    status_t            Flush();
+
+    virtual status_t    GetNextKeyring(uint32& cookie, BString& keyring);
+    virtual status_t    AddKeyring(const char* keyring);
+    virtual status_t    RemoveKeyring(const char* keyring);
+    virtual bool        IsKeyringUnlocked(const char* keyring);
+    virtual status_t    LockKeyring(const char* keyring);
+    virtual status_t    SetUnlockKey(const char* keyring, const BKey& key);
+    virtual status_t    RemoveUnlockKey(const char* keyring);
+
+    virtual status_t    GetKey(const char* keyring, BKeyType type,
+                            const char* identifier,
+                            const char* secondaryIdentifier,
+                            bool secondaryIdentifierOptional, BKey& key);
+    virtual status_t    GetNextKey(const char* keyring, BKeyType type,
+                            BKeyPurpose purpose, uint32& cookie, BKey& key);
+    virtual status_t    AddKey(const char* keyring, const BKey& key);
+    virtual status_t    RemoveKey(const char* keyring, const BKey& key);
+
+    virtual status_t    GetNextApplication(const char* keyring, uint32& cookie,
+                            BString& signature);
+    virtual status_t    RemoveApplication(const char* keyring,
+                            const char* signature);
+private:
+    struct local_keyring {
+        BString                 name;
+        std::vector<BMessage>   keys;       // flattened BKeys
+        std::unordered_map<std::string, size_t> index;
+        std::vector<BString>    applications;
+        BMessage                unlockKey;
+        bool                    hasUnlockKey;
+        bool                    isUnlocked;
+    };
+
+    void                _Wait();
+    local_keyring      *_Keyring(const char* name, bool access = false);
+    ssize_t             _FindKey(local_keyring* keyring, BKeyType type,
+                            const char* identifier,
+                            const char* secondaryIdentifier,
+                            bool secondaryIdentifierOptional);
+    static std::string  _IndexKey(uint32 type, const char* identifier,
+                            const char* secondaryIdentifier);
+    status_t            _Read();
+    status_t            _Write();
+private:
+    BLocker     fLock;
+    BString     fPath;
+    bigtime_t   fLatency;
+    int32       fRequests;
+    bool        fDirty;
+    std::vector<local_keyring*> fKeyrings;
+};
+
+#endif /* __LOCAL_KEYSTORE_BACKEND_H_ */
@@ -0,0 +1,367 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#include <DataIO.h>
+#include <Message.h>
+#include <cstdio>
+#include <cstring>
+#include "BackupRepository.h"
+#include "SnapshotKeystoreBackend.h"
+
+SnapshotKeystoreBackend::SnapshotKeystoreBackend()
+: fInitStatus(B_NO_INIT)
+{
+}
+
+SnapshotKeystoreBackend::SnapshotKeystoreBackend(const char* path,
+    const char* password)
+: fInitStatus(B_NO_INIT)
+{
+    SetTo(path, password);
+}
+
+/* SetTo: a plain copy of the database is only mapped. Whatever else the file
+    is, it is told apart and decoded by ReadKeystoreBackup(). Either way, what
+    comes out must have the shape of a database, see _Parse(). */
+status_t SnapshotKeystoreBackend::SetTo(const char* path, const char* password,
+    const progress_func& progress)
+{
+    _Unset();
+
+    status_t status = fDatabase.SetTo(path);
+    if(status == B_OK && fDatabase.What() != BACKUP_MANIFEST &&
+    fDatabase.FindField("target_file_name", nullptr) != B_OK)
+        return fInitStatus = _Parse();
+
+    fDatabase.Unset();
+    if(status != B_OK && status != B_BAD_DATA)
+        return fInitStatus = status;
+    if((status = ReadKeystoreBackup(path, password, &fBuffer, progress)) != B_OK)
+        return fInitStatus = status;
+    if((status = fDatabase.SetTo(fBuffer.Buffer(), fBuffer.BufferLength())) != B_OK)
+        return fInitStatus = status;
+
+    return fInitStatus = _Parse();
+}
+
+status_t SnapshotKeystoreBackend::InitCheck()
+{
+    return fInitStatus;
+}
+
+int32 SnapshotKeystoreBackend::CountKeys()
+{
+    int32 count = 0;
+    for(const snapshot_keyring& keyring : fKeyrings)
+        count += keyring.keys.size();
+    return count;
+}
+
+status_t SnapshotKeystoreBackend::CopyKeys(const char* keyring, const char* identifier,
+    const char* secondaryIdentifier, BMessage* keys)
+{
+    const snapshot_keyring* entry = _Keyring(keyring);
+    if(!entry || !keys)
+        return B_BAD_VALUE;
+
+    int32 copied = 0;
+    for(const snapshot_key& stored : entry->keys) {
+        if(identifier && (strcmp(stored.identifier, identifier) != 0 ||
+        (secondaryIdentifier &&
+        strcmp(stored.secondaryIdentifier, secondaryIdentifier) != 0)))
+            continue;
+
+        BMessage archive;
+        status_t status = _Unflatten(stored, archive);
+        if(status == B_OK)
+            status = keys->AddMessage(keyring, &archive);
+        if(status != B_OK)
+            return status;
+        copied++;
+    }
+
+    return copied > 0 ? B_OK : B_ENTRY_NOT_FOUND;
+}
+
+// #pragma mark - Keyrings
+
+status_t SnapshotKeystoreBackend::GetNextKeyring(uint32& cookie, BString& keyring)
+{
+    if(fInitStatus != B_OK)
+        return fInitStatus;
+    if(cookie >= fKeyrings.size())
+        return B_ENTRY_NOT_FOUND;
+
+    keyring = fKeyrings[cookie++].name;
+    return B_OK;
+}
+
+status_t SnapshotKeystoreBackend::AddKeyring(const char* keyring)
+{
+    return B_NOT_ALLOWED;
+}
+
+status_t SnapshotKeystoreBackend::RemoveKeyring(const char* keyring)
+{
+    return B_NOT_ALLOWED;
+}
+
+// IsKeyringUnlocked: what could be read of a keyring is shown as is
+bool SnapshotKeystoreBackend::IsKeyringUnlocked(const char* keyring)
+{
+    return _Keyring(keyring) != nullptr;
+}
+
+status_t SnapshotKeystoreBackend::LockKeyring(const char* keyring)
+{
+    return B_NOT_ALLOWED;
+}
+
+status_t SnapshotKeystoreBackend::SetUnlockKey(const char* keyring, const BKey& key)
+{
+    return B_NOT_ALLOWED;
+}
+
+status_t SnapshotKeystoreBackend::RemoveUnlockKey(const char* keyring)
+{
+    return B_NOT_ALLOWED;
+}
+
+// #pragma mark - Keys
+
+status_t SnapshotKeystoreBackend::GetKey(const char* keyring, BKeyType type,
+    const char* identifier, const char* secondaryIdentifier,
+    bool secondaryIdentifierOptional, BKey& key)
+{
+    const snapshot_keyring* entry = _Keyring(keyring);
+    if(!entry)
+        return B_BAD_VALUE;
+
+    ssize_t index = _FindKey(entry, type, identifier, secondaryIdentifier,
+        secondaryIdentifierOptional);
+    if(index < 0)
+        return B_ENTRY_NOT_FOUND;
+
+    return _Unflatten(entry->keys[index], key);
+}
+
+status_t SnapshotKeystoreBackend::GetNextKey(const char* keyring, BKeyType type,
+    BKeyPurpose purpose, uint32& cookie, BKey& key)
+{
+    const snapshot_keyring* entry = _Keyring(keyring);
+    if(!entry)
+        return B_BAD_VALUE;
+
+    while(cookie < entry->keys.size()) {
+        const snapshot_key& stored = entry->keys[cookie++];
+        if((type == B_KEY_TYPE_ANY || stored.type == (uint32)type) &&
+        (purpose == B_KEY_PURPOSE_ANY || stored.purpose == (uint32)purpose))
+            return _Unflatten(stored, key);
+    }
+
+    return B_ENTRY_NOT_FOUND;
+}
+
+status_t SnapshotKeystoreBackend::AddKey(const char* keyring, const BKey& key)
+{
+    return B_NOT_ALLOWED;
+}
+
+status_t SnapshotKeystoreBackend::RemoveKey(const char* keyring, const BKey& key)
+{
+    return B_NOT_ALLOWED;
+}
+
+// #pragma mark - Applications
+
+status_t SnapshotKeystoreBackend::GetNextApplication(const char* keyring,
+    uint32& cookie, BString& signature)
+{
+    const snapshot_keyring* entry = _Keyring(keyring);
+    if(!entry)
+        return B_BAD_VALUE;
+
+    if(cookie >= entry->applications.size())
+        return B_ENTRY_NOT_FOUND;
+
+    signature = entry->applications[cookie++];
+    return B_OK;
+}
+
+status_t SnapshotKeystoreBackend::RemoveApplication(const char* keyring,
+    const char* signature)
+{
+    return B_NOT_ALLOWED;
+}
+
+// #pragma mark - Private
+
+void SnapshotKeystoreBackend::_Unset()
+{
+    fKeyringIndex.clear();
+    fKeyrings.clear();
+    fDatabase.Unset();
+    fBuffer.SetSize(0);
+    fInitStatus = B_NO_INIT;
+}
+
+/* The database, as the keystore server writes it, is a message with one
+    message per keyring, named after it. A keyring holds its keys as a
+    flattened message in "data", with one field per identifier and one
+    flattened key per item, the signatures of its applications as the names
+    of the fields of "applications", and its unlock key, if it has one, in
+    "unlockKey".
+*/
+status_t SnapshotKeystoreBackend::_Parse()
+{
+    flat_field field;
+    for(int32 i = 0; fDatabase.FieldAt(i, &field) == B_OK; i++) {
+        if(field.type != B_MESSAGE_TYPE)
+            continue;
+
+        // Every keyring holds its keys in "data", even when it has none
+        const void* data;
+        ssize_t length;
+        FlatMessageReader keyringData;
+        if(fDatabase.FindData(field.name, B_MESSAGE_TYPE, 0, &data, &length) != B_OK ||
+        keyringData.SetTo(data, length) != B_OK ||
+        keyringData.FindData("data", B_ANY_TYPE, 0, &data, &length) != B_OK) {
+            fprintf(stderr, "Error: %s is not a keyring of a keystore database.\n",
+                field.name);
+            _Unset();
+            return B_BAD_DATA;
+        }
+
+        snapshot_keyring keyring;
+        keyring.name.SetTo(field.name);
+        keyring.hasUnlockKey = keyringData.FindField("unlockKey", nullptr) == B_OK;
+        _ParseKeys(keyring, data, length);
+
+        FlatMessageReader applications;
+        flat_field application;
+        if(keyringData.FindData("applications", B_MESSAGE_TYPE, 0, &data, &length) == B_OK &&
+        applications.SetTo(data, length) == B_OK) {
+            for(int32 a = 0; applications.FieldAt(a, &application) == B_OK; a++)
+                keyring.applications.push_back(BString(application.name));
+        }
+
+        fKeyringIndex.emplace(field.name, fKeyrings.size());
+        fKeyrings.push_back(keyring);
+    }
+
+    // Any other message, like a key exported or a settings file, has no keyrings
+    if(fKeyrings.empty() && fDatabase.CountFields() > 0) {
+        _Unset();
+        return B_BAD_DATA;
+    }
+
+    return B_OK;
+}
+
+// _ParseKeys: keys that cannot be read are left out rather than failing the keyring
+void SnapshotKeystoreBackend::_ParseKeys(snapshot_keyring& keyring,
+    const void* data, size_t length)
+{
+    FlatMessageReader keys;
+    if(keys.SetTo(data, length) != B_OK)
+        return;
+
+    flat_field field;
+    for(int32 i = 0; keys.FieldAt(i, &field) == B_OK; i++) {
+        if(field.type != B_MESSAGE_TYPE)
+            continue;
+
+        for(int32 k = 0; k < field.count; k++) {
+            snapshot_key key;
+            ssize_t keyLength;
+            FlatMessageReader keyData;
+            if(keys.FindData(field.name, B_MESSAGE_TYPE, k, &key.data, &keyLength) != B_OK ||
+            keyData.SetTo(key.data, keyLength) != B_OK ||
+            keyData.FindUInt32("type", 0, &key.type) != B_OK ||
+            keyData.FindString("identifier", 0, &key.identifier) != B_OK)
+                continue;
+
+            key.length = keyLength;
+            key.purpose = keyData.GetUInt32("purpose", B_KEY_PURPOSE_ANY);
+            key.secondaryIdentifier = keyData.GetString("secondaryIdentifier", "");
+            keyring.index.emplace(_IndexKey(key.type, key.identifier,
+                key.secondaryIdentifier), keyring.keys.size());
+            keyring.keys.push_back(key);
+        }
+    }
+}
+
+const SnapshotKeystoreBackend::snapshot_keyring* SnapshotKeystoreBackend::_Keyring(
+    const char* name)
+{
+    if(!name || fInitStatus != B_OK)
+        return nullptr;
+
+    auto it = fKeyringIndex.find(name);
+    return it != fKeyringIndex.end() ? &fKeyrings[it->second] : nullptr;
+}
+
+ssize_t SnapshotKeystoreBackend::_FindKey(const snapshot_keyring* keyring,
+    BKeyType type, const char* identifier, const char* secondaryIdentifier,
+    bool secondaryIdentifierOptional)
+{
+    if(!identifier)
+        return -1;
+    if(!secondaryIdentifier)
+        secondaryIdentifier = "";
+
+    for(const auto& t : { B_KEY_TYPE_GENERIC, B_KEY_TYPE_PASSWORD,
+    B_KEY_TYPE_CERTIFICATE }) {
+        if(type != B_KEY_TYPE_ANY && type != t)
+            continue;
+        auto it = keyring->index.find(_IndexKey(t, identifier, secondaryIdentifier));
+        if(it != keyring->index.end())
+            return it->second;
+    }
+
+    if(!secondaryIdentifierOptional)
+        return -1;
+
+    // Any secondary identifier will do
+    for(size_t i = 0; i < keyring->keys.size(); i++) {
+        const snapshot_key& stored = keyring->keys[i];
+        if((type == B_KEY_TYPE_ANY || stored.type == (uint32)type) &&
+        strcmp(stored.identifier, identifier) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+std::string SnapshotKeystoreBackend::_IndexKey(uint32 type, const char* identifier,
+    const char* secondaryIdentifier)
+{
+    std::string key(reinterpret_cast<const char*>(&type), sizeof(type));
+    key.append(identifier ? identifier : "");
+    key.push_back('\0');
+    key.append(secondaryIdentifier ? secondaryIdentifier : "");
+    return key;
+}
+
+/* _Unflatten: the key is read within its record, a flattened message that
+    claims to be larger than the record fails instead of reading past it. */
+status_t SnapshotKeystoreBackend::_Unflatten(const snapshot_key& stored,
+    BMessage& message)
+{
+    if(!stored.data || stored.length == 0)
+        return B_BAD_DATA;
+
+    BMemoryIO record(stored.data, stored.length);
+    return message.Unflatten(&record);
+}
+
+status_t SnapshotKeystoreBackend::_Unflatten(const snapshot_key& stored, BKey& key)
+{
+    BMessage message;
+    status_t status = _Unflatten(stored, message);
+    if(status != B_OK)
+        return status;
+
+    return key.Unflatten(message);
+}
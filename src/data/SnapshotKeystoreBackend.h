@@ -0,0 +1,106 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef __SNAPSHOT_KEYSTORE_BACKEND_H_
+#define __SNAPSHOT_KEYSTORE_BACKEND_H_
+
+#include <DataIO.h>
+#include <Message.h>
+#include <String.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "BackUpUtils.h"
+#include "FlatMessage.h"
+#include "KeystoreBackend.h"
+
+/* The keystore of a backup, read without the keystore server, for the data
+    model to browse it without restoring it first.
+
+    A plain copy of the database is mapped and read in place; encrypted
+    backups and snapshots are read into memory first. Either way the keys
+    are only located once, and each one is unflattened when asked for. The
+    backup is never changed: everything that would change it fails with
+    B_NOT_ALLOWED. As nothing changes once it is set, it can be read from
+    several threads at once.
+*/
+class SnapshotKeystoreBackend : public KeystoreBackend
+{
+public:
+                        SnapshotKeystoreBackend();
+                        SnapshotKeystoreBackend(const char* path,
+                            const char* password = nullptr);
+
+    // SetTo: the path of any backup, see ReadKeystoreBackup()
+    status_t            SetTo(const char* path, const char* password = nullptr,
+                            const progress_func& progress = nullptr);
+    status_t            InitCheck();
+    int32               CountKeys();
+    /* CopyKeys: adds the flattened keys of a keyring to the message, in a
+        field named after it. Without an identifier all of them are, else
+        those with it and, unless it is nullptr, the secondary identifier;
+        an empty one only matches keys without a secondary identifier. */
+    status_t            CopyKeys(const char* keyring, const char* identifier,
+                            const char* secondaryIdentifier, BMessage* keys);
+
+    virtual status_t    GetNextKeyring(uint32& cookie, BString& keyring);
+    virtual status_t    AddKeyring(const char* keyring);
+    virtual status_t    RemoveKeyring(const char* keyring);
+    virtual bool        IsKeyringUnlocked(const char* keyring);
+    virtual status_t    LockKeyring(const char* keyring);
+    virtual status_t    SetUnlockKey(const char* keyring, const BKey& key);
+    virtual status_t    RemoveUnlockKey(const char* keyring);
+
+    virtual status_t    GetKey(const char* keyring, BKeyType type,
+                            const char* identifier,
+                            const char* secondaryIdentifier,
+                            bool secondaryIdentifierOptional, BKey& key);
+    virtual status_t    GetNextKey(const char* keyring, BKeyType type,
+                            BKeyPurpose purpose, uint32& cookie, BKey& key);
+    virtual status_t    AddKey(const char* keyring, const BKey& key);
+    virtual status_t    RemoveKey(const char* keyring, const BKey& key);
+
+    virtual status_t    GetNextApplication(const char* keyring, uint32& cookie,
+                            BString& signature);
+    virtual status_t    RemoveApplication(const char* keyring,
+                            const char* signature);
+private:
+    struct snapshot_key {
+        const void     *data;       // the flattened key, in the backup
+        size_t          length;
+        uint32          type,
+                        purpose;
+        const char     *identifier,
+                       *secondaryIdentifier;
+    };
+    struct snapshot_keyring {
+        BString                 name;
+        std::vector<snapshot_key> keys;
+        std::unordered_map<std::string, size_t> index;
+        std::vector<BString>    applications;
+        bool                    hasUnlockKey;
+    };
+
+    void                _Unset();
+    status_t            _Parse();
+    void                _ParseKeys(snapshot_keyring& keyring,
+                            const void* data, size_t length);
+    const snapshot_keyring *_Keyring(const char* name);
+    ssize_t             _FindKey(const snapshot_keyring* keyring, BKeyType type,
+                            const char* identifier,
+                            const char* secondaryIdentifier,
+                            bool secondaryIdentifierOptional);
+    static std::string  _IndexKey(uint32 type, const char* identifier,
+                            const char* secondaryIdentifier);
+    static status_t     _Unflatten(const snapshot_key& stored, BMessage& message);
+    static status_t     _Unflatten(const snapshot_key& stored, BKey& key);
+private:
+    FlatMessageReader   fDatabase;
+    BMallocIO           fBuffer;    // when the backup had to be decoded
+    std::vector<snapshot_keyring> fKeyrings;
+    std::unordered_map<std::string, size_t> fKeyringIndex;
+    status_t            fInitStatus;
+};
+
+#endif /* __SNAPSHOT_KEYSTORE_BACKEND_H_ */
@@ -0,0 +1,240 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#include <Autolock.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "StringArena.h"
+
+/* Rough per-string cost of the previous layout: every BString keeps its
+    characters in its own heap allocation, preceded by a reference count,
+    and the allocator adds its own header on top of that.
+*/
+static const size_t kBStringOverhead = sizeof(int32) + 16;
+
+StringArena::StringArena(size_t blockSize)
+: fLock("string arena"),
+  fBlockSize(blockSize),
+  fCurrent(nullptr),
+  fAvailable(0),
+  fAllocated(0),
+  fHolds(0),
+  fCount(0),
+  fRequests(0),
+  fRequestedBytes(0)
+{
+    memset(fDirectory, 0, sizeof(fDirectory));
+    Reset();
+}
+
+StringArena::~StringArena()
+{
+    Reset();
+    free(fDirectory[0]);
+}
+
+status_t StringArena::Intern(const char* string, string_handle* handle)
+{
+    if(!string) {
+        *handle = kEmptyString;
+        return B_OK;
+    }
+
+    return Intern(std::string_view(string), handle);
+}
+
+/* Intern: B_NO_MEMORY if the string could not be stored, the handle is the
+    empty string then, which must not stand for the string. */
+status_t StringArena::Intern(std::string_view string, string_handle* handle)
+{
+    *handle = kEmptyString;
+    if(string.empty())
+        return B_OK;
+
+    BAutolock lock(fLock);
+
+    fRequests++;
+    fRequestedBytes += string.length() + 1;
+
+    uint32 count = fCount.load(std::memory_order_relaxed);
+    if((count + 1) * 2 > fIndex.size())
+        _GrowIndex();
+
+    size_t mask = fIndex.size() - 1;
+    size_t slot = std::hash<std::string_view>()(string) & mask;
+    while(fIndex[slot] != kEmptyString) {
+        if(_Matches(fIndex[slot], string)) {
+            *handle = fIndex[slot];
+            return B_OK;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    uint32 chunk = count >> kChunkShift;
+    if(chunk >= kMaxChunks) {
+        fprintf(stderr, "Error: string arena is full.\n");
+        return B_NO_MEMORY;
+    }
+    if(!fDirectory[chunk]) {
+        fDirectory[chunk] = static_cast<const char**>(calloc(kChunkSize, sizeof(const char*)));
+        if(!fDirectory[chunk])
+            return B_NO_MEMORY;
+    }
+
+    char* storage = _Allocate(string.length() + 1);
+    if(!storage)
+        return B_NO_MEMORY;
+    memcpy(storage, string.data(), string.length());
+    storage[string.length()] = '\0';
+
+    fDirectory[chunk][count & (kChunkSize - 1)] = storage;
+    fIndex[slot] = count;
+    fCount.store(count + 1, std::memory_order_release);
+
+    *handle = count;
+    return B_OK;
+}
+
+const char* StringArena::String(string_handle handle) const
+{
+    if(handle >= fCount.load(std::memory_order_acquire))
+        return "";
+
+    return fDirectory[handle >> kChunkShift][handle & (kChunkSize - 1)];
+}
+
+int32 StringArena::CountStrings() const
+{
+    return fCount.load(std::memory_order_acquire);
+}
+
+size_t StringArena::FootprintBytes() const
+{
+    BAutolock lock(fLock);
+
+    size_t directoryBytes = 0;
+    for(uint32 i = 0; i < kMaxChunks && fDirectory[i]; i++)
+        directoryBytes += kChunkSize * sizeof(const char*);
+
+    // Handles are 32 bit wide, the string pointers of the old layout were not
+    return fAllocated + directoryBytes + fIndex.capacity() * sizeof(string_handle)
+        + fRequests * sizeof(string_handle);
+}
+
+size_t StringArena::SeparateFootprintBytes() const
+{
+    BAutolock lock(fLock);
+
+    return fRequestedBytes + fRequests * (kBStringOverhead + sizeof(char*));
+}
+
+void StringArena::PrintToStream() const
+{
+    size_t arenaBytes = FootprintBytes();
+    size_t separateBytes = SeparateFootprintBytes();
+
+    BAutolock lock(fLock);
+    printf("String arena: %" B_PRIu32 " unique of %" B_PRIu32 " strings, "
+        "%zu blocks.\n", fCount.load(), fRequests, fBlocks.size());
+    printf("\tInterned layout: %zu bytes. Separate strings: %zu bytes.\n",
+        arenaBytes, separateBytes);
+}
+
+// Hold: the strings interned from now on stay valid until Release()
+void StringArena::Hold()
+{
+    BAutolock lock(fLock);
+    fHolds++;
+}
+
+void StringArena::Release()
+{
+    BAutolock lock(fLock);
+    fHolds--;
+}
+
+// Reset: invalidates every handle given so far, unless the arena is held
+void StringArena::Reset()
+{
+    BAutolock lock(fLock);
+    if(fHolds > 0)
+        return;
+
+    std::vector<string_handle>().swap(fIndex);
+    for(char* block : fBlocks)
+        free(block);
+    fBlocks.clear();
+    fCurrent = nullptr;
+    fAvailable = 0;
+    fAllocated = 0;
+
+    // Keep the first chunk around, the rest is released with the blocks
+    for(uint32 i = 1; i < kMaxChunks && fDirectory[i]; i++) {
+        free(fDirectory[i]);
+        fDirectory[i] = nullptr;
+    }
+    if(!fDirectory[0])
+        fDirectory[0] = static_cast<const char**>(calloc(kChunkSize, sizeof(const char*)));
+
+    // Handle 0 is always the empty string
+    static const char* kEmpty = "";
+    if(fDirectory[0])
+        fDirectory[0][kEmptyString] = kEmpty;
+    fCount.store(1, std::memory_order_release);
+    fRequests = 0;
+    fRequestedBytes = 0;
+}
+
+// #pragma mark - Private
+
+bool StringArena::_Matches(string_handle handle, std::string_view string) const
+{
+    const char* stored = String(handle);
+    return strncmp(stored, string.data(), string.length()) == 0
+        && stored[string.length()] == '\0';
+}
+
+void StringArena::_GrowIndex()
+{
+    std::vector<string_handle> index(fIndex.empty() ? 1024 : fIndex.size() * 2,
+        kEmptyString);
+    size_t mask = index.size() - 1;
+
+    for(string_handle handle : fIndex) {
+        if(handle == kEmptyString)
+            continue;
+
+        size_t slot = std::hash<std::string_view>()(String(handle)) & mask;
+        while(index[slot] != kEmptyString)
+            slot = (slot + 1) & mask;
+        index[slot] = handle;
+    }
+
+    fIndex.swap(index);
+}
+
+char* StringArena::_Allocate(size_t length)
+{
+    if(length > fAvailable) {
+        // Oversized strings get a block of their own
+        size_t size = length > fBlockSize ? length : fBlockSize;
+        char* block = static_cast<char*>(malloc(size));
+        if(!block)
+            return nullptr;
+
+        fBlocks.push_back(block);
+        fAllocated += size;
+        if(length > fBlockSize)
+            return block;
+
+        fCurrent = block;
+        fAvailable = size;
+    }
+
+    char* storage = fCurrent;
+    fCurrent += length;
+    fAvailable -= length;
+    return storage;
+}
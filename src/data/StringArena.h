@@ -0,0 +1,72 @@
+/*
+ * Copyright 2026, cafeina <cafeina@world>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+#ifndef __STRING_ARENA_H_
+#define __STRING_ARENA_H_
+
+#include <Locker.h>
+#include <SupportDefs.h>
+#include <atomic>
+#include <string_view>
+#include <vector>
+
+typedef uint32 string_handle;
+
+/* Append-only string storage with interning. Strings are copied into large
+    blocks and deduplicated, and they are referenced by handles that stay
+    valid until Reset(), which releases everything at once. A Reset() while
+    the arena is held by a reader on another thread leaves the strings in
+    place, they are released by the next one.
+
+    Interning is serialized, but resolving a handle does not lock: the slot
+    of a handle, and its chunk of the directory, are filled before the count
+    that makes the handle valid is published, and they never move.
+*/
+class StringArena
+{
+public:
+                    StringArena(size_t blockSize = 64 * 1024);
+                   ~StringArena();
+
+    status_t        Intern(const char* string, string_handle* handle);
+    status_t        Intern(std::string_view string, string_handle* handle);
+    const char     *String(string_handle handle) const;
+
+    int32           CountStrings() const;
+    size_t          FootprintBytes() const;
+    size_t          SeparateFootprintBytes() const;
+    [[maybe_unused]]
+    void            PrintToStream() const;
+    void            Hold();
+    void            Release();
+    void            Reset();
+
+    static const string_handle kEmptyString = 0;
+private:
+    char           *_Allocate(size_t length);
+    bool            _Matches(string_handle handle, std::string_view string) const;
+    void            _GrowIndex();
+private:
+    static const uint32 kChunkShift = 12;
+    static const uint32 kChunkSize = 1 << kChunkShift;
+    static const uint32 kMaxChunks = 4096;
+
+    mutable BLocker fLock;
+    size_t          fBlockSize;
+    std::vector<char*> fBlocks;
+    char           *fCurrent;
+    size_t          fAvailable;
+    size_t          fAllocated;
+    int32           fHolds;
+
+    const char    **fDirectory[kMaxChunks];
+    std::atomic<uint32> fCount;    // released by Intern(), acquired by String()
+    std::vector<string_handle> fIndex; // open addressing, 0 means free
+
+    /* Statistics for the footprint report */
+    uint32          fRequests;
+    size_t          fRequestedBytes;
+};
+
+#endif /* __STRING_ARENA_H_ */
@@ -104,7 +104,7 @@ void AddKeyringDialogBox::MessageReceived(BMessage* msg)
     }
 }
 
-status_t AddKeyringDialogBox::_IsValid(KeystoreImp ks, BString name)
+status_t AddKeyringDialogBox::_IsValid(KeystoreImp& ks, BString name)
 {
     status_t status = B_OK;
 
@@ -112,7 +112,7 @@ status_t AddKeyringDialogBox::_IsValid(KeystoreImp ks, BString name)
         status = B_NOT_ALLOWED;
     else if(name == "")
         status = B_BAD_VALUE;
-    else if(ks.KeyringByName(name) != NULL)
+    else if(ks.HasKeyring(name))
         status = B_NAME_IN_USE;
 
     return status;
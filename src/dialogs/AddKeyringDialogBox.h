@@ -18,7 +18,7 @@ public:
                   AddKeyringDialogBox(BWindow* parent, BRect frame, KeystoreImp& _ks);
     virtual void  MessageReceived(BMessage* msg);
 private:
-    status_t      _IsValid(KeystoreImp ks, BString name);
+    status_t      _IsValid(KeystoreImp& ks, BString name);
     void          _UpdateTextControlUI(bool tcinvalid, bool saveenabled,
                     BString erroricon, BString errortooltip, rgb_color errorcolor);
     void          _CallAddKeyring(KeystoreImp& ks, BString name);
@@ -10,6 +10,7 @@
 #include <SeparatorView.h>
 #include "BackUpDBDialogBox.h"
 #include "../KeysDefs.h"
+#include "../data/Compression.h"
 
 #undef B_TRANSLATION_CONTEXT
 #define B_TRANSLATION_CONTEXT "Backupper dialog"
@@ -23,6 +24,12 @@ static struct BackUpMethod {
         BKP_MODE_COPY, B_TRANSLATE("Simple copy"),
         B_TRANSLATE("Creates a simple copy of the keystore database.\nIt is not "
         "encrypted and anyone with access to the file could read its contents.")
+    },
+    {
+        BKP_MODE_REPO, B_TRANSLATE("Snapshot in the backup repository"),
+        B_TRANSLATE("Stores a snapshot of the keystore database in the backup "
+        "repository.\nOnly what changed since the other snapshots takes space. It "
+        "is not encrypted.")
     }
 // #if defined(USE_OPENSSL)
     ,
@@ -30,20 +37,47 @@ static struct BackUpMethod {
         'ssl ', B_TRANSLATE("Encrypted copy"),
         B_TRANSLATE("Creates an encrypted copy of the keystore database.\nOnce "
         "created, it can only be read by decrypting it with the proper passphrase.")
+    },
+    {
+        'gcm ', B_TRANSLATE("Encrypted copy (authenticated)"),
+        B_TRANSLATE("Creates an encrypted copy of the keystore database, in "
+        "pieces that are\nencrypted in parallel and checked against tampering "
+        "when it is restored.")
     }
 // #endif
 };
 
+static struct CompressionLevel {
+    int32 level;
+    const char* title;
+} levels [] = {
+    { kNoCompression, B_TRANSLATE("None") },
+    { 1, B_TRANSLATE("Fast") },
+    { kDefaultCompressionLevel, B_TRANSLATE("Default") },
+    { 9, B_TRANSLATE("Best") }
+};
+
 BackUpDBDialogBox::BackUpDBDialogBox(BWindow* parent, BRect frame)
 : BWindow(frame, B_TRANSLATE("Back-up keystore database"), B_FLOATING_WINDOW,
     B_ASYNCHRONOUS_CONTROLS | B_AUTO_UPDATE_SIZE_LIMITS | B_CLOSE_ON_ESCAPE),
   fParent(parent),
-  fKind(BKP_MODE_COPY)
+  fKind(BKP_MODE_COPY),
+  fCompression(kNoCompression)
 {
     fPumKind = new BPopUpMenu("pum_kind");
     for(uint32 i = 0; i < sizeof(methods) / sizeof(methods[0]); i++)
         fPumKind->AddItem(new BMenuItem(methods[i].title, new BMessage(methods[i].what)));
     fMfKind = new BMenuField("mf_kind", B_TRANSLATE("Kind"), fPumKind);
+    fPumCompression = new BPopUpMenu("pum_compression");
+    for(uint32 i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        BMessage* level = new BMessage(BKP_COMPRESSION);
+        level->AddInt32("level", levels[i].level);
+        fPumCompression->AddItem(new BMenuItem(levels[i].title, level));
+    }
+    fPumCompression->ItemAt(0)->SetMarked(true);
+    fMfCompression = new BMenuField("mf_compression", B_TRANSLATE("Compression"),
+        fPumCompression);
+    fMfCompression->SetEnabled(false);
     fSvMthdDescription = new BStringView("sv_mthddesc", "");
     fTcPassword = new BTextControl("tc_pass", B_TRANSLATE("Password"), "", new BMessage(BKP_PASSWORD));
     fTcPassword->TextView()->HideTyping(true);
@@ -55,6 +89,7 @@ BackUpDBDialogBox::BackUpDBDialogBox(BWindow* parent, BRect frame)
             .SetInsets(B_USE_WINDOW_INSETS, B_USE_WINDOW_INSETS, B_USE_WINDOW_INSETS, B_USE_SMALL_INSETS)
             .Add(fMfKind)
             .Add(fSvMthdDescription)
+            .Add(fMfCompression)
             .Add(fTcPassword)
         .End()
         .Add(new BSeparatorView())
@@ -84,8 +119,10 @@ void BackUpDBDialogBox::MessageReceived(BMessage* msg)
     {
 // #if defined(USE_OPENSSL)
         case BKP_MODE_SSL:
+        case BKP_MODE_GCM:
 // #endif
         case BKP_MODE_COPY:
+        case BKP_MODE_REPO:
         {
             int i = 0;
             while(methods[i].what != msg->what)
@@ -93,27 +130,32 @@ void BackUpDBDialogBox::MessageReceived(BMessage* msg)
             if(methods[i].what == msg->what) {
                 fKind = msg->what;
                 fSvMthdDescription->SetText(methods[i].description);
-                if(msg->what == BKP_MODE_COPY) {
+                if(!_NeedsPassword()) {
                     fTcPassword->SetText("");
                 }
-                fTcPassword->SetEnabled(!fMfKind->Menu()->FindItem(BKP_MODE_COPY)->IsMarked());
-                fBtSave->SetEnabled(fMfKind->Menu()->FindItem(BKP_MODE_COPY)->IsMarked() ||
-                    (!fMfKind->Menu()->FindItem(BKP_MODE_COPY)->IsMarked() && fTcPassword->TextLength() > 0));
+                fTcPassword->SetEnabled(_NeedsPassword());
+                // Only the single stream encryption takes compressed data
+                fMfCompression->SetEnabled(fKind == BKP_MODE_SSL);
+                fBtSave->SetEnabled(!_NeedsPassword() || fTcPassword->TextLength() > 0);
             }
             break;
         }
+        case BKP_COMPRESSION:
+            fCompression = msg->GetInt32("level", kNoCompression);
+            break;
         case BKP_PASSWORD:
-            if(!fMfKind->Menu()->FindItem(BKP_MODE_COPY)->IsMarked())
+            if(_NeedsPassword())
                 fTcPassword->MarkAsInvalid(fTcPassword->TextLength() == 0);
             break;
         case BKP_MODIFIED:
-            fBtSave->SetEnabled(fMfKind->Menu()->FindItem(BKP_MODE_COPY)->IsMarked() ||
-                (!fMfKind->Menu()->FindItem(BKP_MODE_COPY)->IsMarked() && fTcPassword->TextLength() > 0));
+            fBtSave->SetEnabled(!_NeedsPassword() || fTcPassword->TextLength() > 0);
             break;
         case BKP_SAVE:
         {
             BMessage request(M_KEYSTORE_BACKUP);
             request.AddUInt32("method", fKind);
+            if(fKind == BKP_MODE_SSL)
+                request.AddInt32("compression", fCompression);
             request.AddString("password", fTcPassword->Text());
             be_app->PostMessage(&request);
             Quit();
@@ -124,3 +166,10 @@ void BackUpDBDialogBox::MessageReceived(BMessage* msg)
             break;
     }
 }
+
+// #pragma mark - Private
+
+bool BackUpDBDialogBox::_NeedsPassword()
+{
+    return fKind != BKP_MODE_COPY && fKind != BKP_MODE_REPO;
+}
@@ -15,8 +15,11 @@
 
 #if defined(USE_OPENSSL)
 #define BKP_MODE_SSL    'ssl '
+#define BKP_MODE_GCM    'gcm '
 #endif
 #define BKP_MODE_COPY   'copy'
+#define BKP_MODE_REPO   'repo'
+#define BKP_COMPRESSION 'cmpr'
 #define BKP_PASSWORD    'pass'
 #define BKP_MODIFIED    'modf'
 #define BKP_CANCEL      'cncl'
@@ -28,16 +31,21 @@ public:
                     BackUpDBDialogBox(BWindow* parent, BRect frame);
     virtual void    MessageReceived(BMessage* msg);
     virtual void    FrameResized(float, float);
+private:
+            bool    _NeedsPassword();
 private:
     BButton        *fBtSave,
                    *fBtCancel;
-    BMenuField     *fMfKind;
-    BPopUpMenu     *fPumKind;
+    BMenuField     *fMfKind,
+                   *fMfCompression;
+    BPopUpMenu     *fPumKind,
+                   *fPumCompression;
     BStringView    *fSvMthdDescription;
     BTextControl   *fTcPassword;
     BWindow        *fParent;
 
     uint32          fKind;
+    int32           fCompression;
 };
 
 #endif /* _BACKUP_DB_DLG_H_ */
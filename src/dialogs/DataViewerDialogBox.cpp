@@ -2,6 +2,7 @@
  * Copyright 2024, cafeina <cafeina@world>
  * All rights reserved. Distributed under the terms of the MIT license.
  */
+#include <Autolock.h>
 #include <Catalog.h>
 #include <KeyStore.h>
 #include <string>
@@ -124,6 +125,7 @@ void DataViewerDialogBox::MessageReceived(BMessage* msg)
 
 void DataViewerDialogBox::_InitUIData()
 {
+    BAutolock lock(fImp->Locker());
     KeyImp* key = fImp->KeyringByName(fKeyringName)->KeyByIdentifier(fKeyId, fKeySecondaryId);
 
     tcIdentifier->SetText(key->Identifier());
@@ -160,7 +162,7 @@ void DataViewerDialogBox::_InitUIData()
 
     if(_type == B_KEY_TYPE_PASSWORD) {
         BPasswordKey pwdkey;
-        BKeyStore().GetKey(fKeyringName, B_KEY_TYPE_PASSWORD, fKeyId, fKeySecondaryId, false, pwdkey);
+        fImp->Backend()->GetKey(fKeyringName, B_KEY_TYPE_PASSWORD, fKeyId, fKeySecondaryId, false, pwdkey);
         tvData->SetText((const char*)pwdkey.Data());
         size_t inlength = pwdkey.DataLength();
         BString outdata;
@@ -171,7 +173,7 @@ void DataViewerDialogBox::_InitUIData()
     }
     else {
         BKey key;
-        BKeyStore().GetKey(fKeyringName, B_KEY_TYPE_GENERIC, fKeyId, fKeySecondaryId, false, key);
+        fImp->Backend()->GetKey(fKeyringName, B_KEY_TYPE_GENERIC, fKeyId, fKeySecondaryId, false, key);
         tvData->SetText((const char*)key.Data());
         size_t inlength = key.DataLength();
         BString outdata;
@@ -2,6 +2,7 @@
  * Copyright 2024, cafeina <cafeina@world>
  * All rights reserved. Distributed under the terms of the MIT license.
  */
+#include <Autolock.h>
 #include <Button.h>
 #include <Catalog.h>
 #include <CheckBox.h>
@@ -23,7 +24,7 @@ KeyringViewerDialogBox::KeyringViewerDialogBox(BWindow* parent, BRect frame, Key
 {
     BString title(B_TRANSLATE("Keyring: %name% %status%"));
     title.ReplaceAll("%name%", fKeyringName);
-    title.ReplaceAll("%status%", fImp->KeyringByName(fKeyringName)->IsUnlocked() ?
+    title.ReplaceAll("%status%", fImp->FindKeyring(fKeyringName)->IsUnlocked() ?
         "" /* Nothing */ : B_TRANSLATE("(locked)"));
     SetTitle(title.String());
 
@@ -83,11 +84,13 @@ void KeyringViewerDialogBox::MessageReceived(BMessage* msg)
 
 void KeyringViewerDialogBox::InitUIData()
 {
-    int gkeyc = fImp->KeyringByName(fKeyringName)->KeyCount(B_KEY_TYPE_GENERIC);
-    int pkeyc = fImp->KeyringByName(fKeyringName)->KeyCount(B_KEY_TYPE_PASSWORD);
-    int keyc = gkeyc + pkeyc;
-    int appc = fImp->KeyringByName(fKeyringName)->ApplicationCount();
-    bool unlocked = fImp->KeyringByName(fKeyringName)->IsUnlocked();
+    BAutolock lock(fImp->Locker());
+    KeyringImp* keyring = fImp->KeyringByName(fKeyringName);
+    int gkeyc = keyring->KeyCount(B_KEY_TYPE_GENERIC);
+    int pkeyc = keyring->KeyCount(B_KEY_TYPE_PASSWORD);
+    int keyc = keyring->KeyCount();
+    int appc = keyring->ApplicationCount();
+    bool unlocked = keyring->IsUnlocked();
 
     fTcName->SetText(fKeyringName);
     fCbLocked->SetValue(unlocked ? B_CONTROL_OFF : B_CONTROL_ON);
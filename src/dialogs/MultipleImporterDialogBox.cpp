@@ -13,6 +13,7 @@
 #include <private/interface/ColumnListView.h>
 #include <private/interface/ColumnTypes.h>
 #include "MultipleImporterDialogBox.h"
+#include "../data/FlatMessage.h"
 #include "../data/KeystoreImp.h"
 #include "../ui/ListViewEx.h"
 #include "../KeysDefs.h"
@@ -184,28 +185,34 @@ void MultipleImporterDialogBox::_InitAppData(BMessage* accepted, BMessage* disca
     int32 index = 0;
     entry_ref ref;
     BRow* row = NULL;
-    BFile keyFile;
-    BMessage keyFileData;
+    FlatMessageReader keyFileData;
     BString reason;
 
     while(accepted->FindRef("refs", index, &ref) == B_OK) {
-        keyFile.SetTo(&ref, B_READ_ONLY); // No need for sanitization, already done before
-        keyFileData.Unflatten(&keyFile);
-        BEntry entry(&ref);
-        BPath path;
-        entry.GetPath(&path);
-
+        BPath path(&ref);
+        // No need for sanitization, already done before
         row = new BRow();
         row->SetField(new BCheckStringField(ref.name, B_CONTROL_ON), 0);
-        row->SetField(new BStringField(keyFileData.GetString("identifier")), 1);
-        row->SetField(new BStringField(keyFileData.GetString("secondaryIdentifier")), 2);
-        row->SetField(new BStringField(StringForType(static_cast<BKeyType>(keyFileData.GetUInt32("type", B_KEY_TYPE_ANY)))), 3);
-        row->SetField(new BStringField(StringForPurpose(static_cast<BKeyPurpose>(keyFileData.GetUInt32("purpose", B_KEY_PURPOSE_ANY)))), 4);
+        if(keyFileData.SetTo(path.Path()) == B_OK) {
+            row->SetField(new BStringField(keyFileData.GetString("identifier", "")), 1);
+            row->SetField(new BStringField(keyFileData.GetString("secondaryIdentifier", "")), 2);
+            row->SetField(new BStringField(StringForType(static_cast<BKeyType>(keyFileData.GetUInt32("type", B_KEY_TYPE_ANY)))), 3);
+            row->SetField(new BStringField(StringForPurpose(static_cast<BKeyPurpose>(keyFileData.GetUInt32("purpose", B_KEY_PURPOSE_ANY)))), 4);
+        }
+        else {
+            // An archive of many keys
+            KeyArchiveReader archive(path.Path());
+            BString keys(B_TRANSLATE("%count% keys"));
+            keys.ReplaceAll("%count%", BString() << archive.CountKeys());
+            row->SetField(new BStringField(keys.String()), 1);
+            row->SetField(new BStringField(""), 2);
+            row->SetField(new BStringField(B_TRANSLATE("Archive")), 3);
+            row->SetField(new BStringField(""), 4);
+        }
         row->SetField(new BStringField(path.Path()), 5);
         fImportableView->AddRow(row);
 
-        keyFileData.MakeEmpty();
-        keyFile.Unset();
+        keyFileData.Unset();
         index++;
     }
 
@@ -3,11 +3,18 @@
  * All rights reserved. Distributed under the terms of the MIT license.
  */
 #include <Catalog.h>
+#include <Path.h>
 #include <cstdio>
+#include "data/BackUpUtils.h"
+#include "data/BackupVerifier.h"
+#include "data/KeystoreImp.h"
+#include "data/SnapshotKeystoreBackend.h"
 #include "ui/KeysApplication.h"
 #include "KeysDefs.h"
 
 int option(const char* op);
+int verify(const char* directory, const char* password);
+int browse(const char* path, const char* password);
 
 #undef B_TRANSLATION_CONTEXT
 #define B_TRANSLATION_CONTEXT "main"
@@ -21,6 +28,10 @@ int main (int argc, char** argv)
                 return help();
             case 2:
                 return version();
+            case 3:
+                return verify(argc > 2 ? argv[2] : NULL, argc > 3 ? argv[3] : NULL);
+            case 4:
+                return browse(argc > 2 ? argv[2] : NULL, argc > 3 ? argv[3] : NULL);
             default:
                 break;
         }
@@ -40,6 +51,10 @@ int help()
         "[option] includes\n"
         "\t%helpParam%               %helpParamDesc%\n"
         "\t%versionParam%            %versionParamDesc%\n"
+        "\t%verifyParam% [dir] [password]\n"
+        "\t                         %verifyParamDesc%\n"
+        "\t%browseParam% <backup> [password]\n"
+        "\t                         %browseParamDesc%\n"
         "\n"
         "Graphic interface usage: %appName% [option 1] [option ...]\n"
         "[option N] includes one or several of these\n"
@@ -56,6 +71,12 @@ int help()
     helpString.ReplaceAll("%helpParamDesc%", B_TRANSLATE("Shows the help (this message)."));
     helpString.ReplaceAll("%versionParam%", "--version");
     helpString.ReplaceAll("%versionParamDesc%", B_TRANSLATE("Shows the application version."));
+    helpString.ReplaceAll("%verifyParam%", "--verify-backups");
+    helpString.ReplaceAll("%verifyParamDesc%", B_TRANSLATE("Verifies the encrypted backups in [dir], "
+        "by default where the keystore database is, and with the password, tries to decrypt them."));
+    helpString.ReplaceAll("%browseParam%", "--browse-backup");
+    helpString.ReplaceAll("%browseParamDesc%", B_TRANSLATE("Lists the keyrings, keys and applications in "
+        "<backup> without restoring it. Encrypted backups are given by their metadata file, and need the password."));
     helpString.ReplaceAll("%keyringParam%", "--keyring");
     helpString.ReplaceAll("%keyringParamDesc%", B_TRANSLATE("Opens the user interface with <name> keyring in focus."));
     helpString.ReplaceAll("%resetSetsParam%", "--reset-settings");
@@ -74,12 +95,85 @@ int version()
     return 0;
 }
 
+// verify: returns 1 if any of the backups failed, 2 if they could not be verified
+int verify(const char* directory, const char* password)
+{
+    BPath dbpath, parent, catalogpath;
+    if(!directory) {
+        if(DBPath(&dbpath) != B_OK || dbpath.GetParent(&parent) != B_OK) {
+            fprintf(stderr, "Error: the keystore database could not be found.\n");
+            return 2;
+        }
+        directory = parent.Path();
+    }
+
+    BackupVerifier verifier(directory);
+    if(BackupCatalogPath(&catalogpath) == B_OK)
+        verifier.SetCatalog(catalogpath.Path());
+    status_t status = verifier.Run(password);
+    if(status != B_OK) {
+        fprintf(stderr, "Error: %s could not be read (%s).\n", directory, strerror(status));
+        return 2;
+    }
+
+    verifier.PrintReport(stdout);
+    return verifier.CountFailed() > 0 ? 1 : 0;
+}
+
+// browse: returns 1 if the backup could not be read
+int browse(const char* path, const char* password)
+{
+    if(!path) {
+        fprintf(stderr, "Error: no backup given.\n");
+        return 1;
+    }
+
+    bigtime_t start = system_time();
+    SnapshotKeystoreBackend* backend = new SnapshotKeystoreBackend(path, password);
+    status_t status = backend->InitCheck();
+    if(status != B_OK) {
+        fprintf(stderr, "Error: %s could not be read (%s).\n", path, strerror(status));
+        delete backend;
+        return 1;
+    }
+
+    KeystoreImp ks(backend);
+    uint32 cookie = 0;
+    BString name;
+    while(backend->GetNextKeyring(cookie, name) == B_OK)
+        ks.AddKeyring(name.String());
+    ks.LoadAll();
+    bigtime_t elapsed = system_time() - start;
+
+    for(int32 i = 0; i < ks.KeyringCount(); i++) {
+        KeyringImp* keyring = ks.KeyringAt(i);
+        printf("%s: %" B_PRId32 " keys, %" B_PRId32 " applications\n",
+            keyring->Identifier(), keyring->KeyCount(), keyring->ApplicationCount());
+        for(int32 k = 0; k < keyring->KeyCount(); k++) {
+            KeyImp* key = keyring->KeyAt(k);
+            printf("\t%s\t%s\t%s\t%s\n", StringForType(key->Type()),
+                StringForPurpose(key->Purpose()), key->Identifier(),
+                key->SecondaryIdentifier());
+        }
+        for(int32 a = 0; a < keyring->ApplicationCount(); a++)
+            printf("\t%s\n", keyring->ApplicationAt(a)->Identifier());
+    }
+    fprintf(stderr, "%" B_PRId32 " keyrings, %" B_PRId32 " keys read in %" B_PRIdBIGTIME " ms.\n",
+        ks.KeyringCount(), ks.KeyCount(), elapsed / 1000);
+
+    return 0;
+}
+
 int option(const char* op)
 {
     if(strcmp(op, "--help") == 0)
         return 1;
     if(strcmp(op, "--version") == 0)
         return 2;
+    if(strcmp(op, "--verify-backups") == 0)
+        return 3;
+    if(strcmp(op, "--browse-backup") == 0)
+        return 4;
     else
         return 0;
 }
@@ -2,6 +2,7 @@
  * Copyright 2024, cafeina <cafeina@world>
  * All rights reserved. Distributed under the terms of the MIT license.
  */
+#include <Autolock.h>
 #include <Catalog.h>
 #include <Clipboard.h>
 #include <IconUtils.h>
@@ -315,10 +316,16 @@ void KeyringView::_InitAppData(const char* data)
     if(!data)
 		return;
 
+    // The looper may fill or reset the keyring meanwhile otherwise
+    BAutolock lock(ks->Locker());
+    KeyringImp* keyring = ks->KeyringByName(keyringname);
+    if(!keyring)
+        return;
+
     BRow* row = NULL;
 
-    for(int i = 0; i < ks->KeyringByName(keyringname)->KeyCount(); i++) {
-        KeyImp* key = ks->KeyringByName(keyringname)->KeyAt(i);
+    for(int i = 0; i < keyring->KeyCount(); i++) {
+        KeyImp* key = keyring->KeyAt(i);
 
         row = new BRow();
 
@@ -372,10 +379,10 @@ void KeyringView::_InitAppData(const char* data)
         keylistview->AddRow(row);
     }
 
-    for(int i = 0; i < ks->KeyringByName(keyringname)->ApplicationCount(); i++) {
+    for(int i = 0; i < keyring->ApplicationCount(); i++) {
         row = new BRow();
 
-        const char* signature = ks->KeyringByName(keyringname)->ApplicationAt(i)->Identifier();
+        const char* signature = keyring->ApplicationAt(i)->Identifier();
         const char* name;
         entry_ref ref;
         if(be_roster->FindApp(signature, &ref) == B_OK)
@@ -431,8 +438,7 @@ void KeyringView::_RemoveKey(KeystoreImp* ks, const char* id, const char* sec)
 
 void KeyringView::_RemoveApp(KeystoreImp* ks, const char* signature)
 {
-    KeyringImp* keyring = ks->KeyringByName(keyringname);
-    if(!keyring) {
+    if(!ks->HasKeyring(keyringname)) {
     	__trace("Error: no keyring.\n");
         return;
     }
@@ -12,15 +12,25 @@
 #include <PropertyInfo.h>
 #include <private/interface/AboutWindow.h>
 #include <atomic>
+#include <cerrno>
 #include <cstdio>
+#include <memory>
 #include <unordered_map>
+#include <vector>
 #include "KeysApplication.h"
 #include "KeysWindow.h"
 #include "../KeysDefs.h"
 #include "../data/BackUpUtils.h"
+#include "../data/BackupCatalog.h"
+#include "../data/BackupRepository.h"
+#include "../data/BackupVerifier.h"
 #include "../data/CryptoUtils.h"
+#include "../data/KeyArchive.h"
+#include "../data/KeystoreDiff.h"
 #include "../data/KeystoreImp.h"
+#include "../data/KeystoreServer.h"
 #include "../data/PasswordStrength.h"
+#include "../data/SnapshotKeystoreBackend.h"
 
 #undef B_TRANSLATION_CONTEXT
 #define B_TRANSLATION_CONTEXT "Scripting properties"
@@ -66,10 +76,49 @@ static property_info kKeysProperties[] = {
         .extra_data = 0,
         .types      = { B_STRING_TYPE }
     },
+    {
+        .name       = "Backups",
+        .commands   = { B_GET_PROPERTY, B_COUNT_PROPERTIES, 0 },
+        .specifiers = { B_DIRECT_SPECIFIER, 0 },
+        .usage      = B_TRANSLATE("Backups catalog: query information."),
+        .extra_data = 0,
+        .types      = { B_MESSAGE_TYPE, B_INT32_TYPE }
+    },
+    {
+        .name       = "RestoreKeys",
+        .commands   = { B_EXECUTE_PROPERTY, 0 },
+        .specifiers = { B_DIRECT_SPECIFIER, 0 },
+        .usage      = B_TRANSLATE("Keys from a backup: restoration, with backup, keyring and optionally "
+            "identifier, secondary and password."),
+        .extra_data = 0,
+        .types      = { B_INT32_TYPE }
+    },
+    {
+        .name       = "Diff",
+        .commands   = { B_EXECUTE_PROPERTY, 0 },
+        .specifiers = { B_DIRECT_SPECIFIER, 0 },
+        .usage      = B_TRANSLATE("Changes between the keystore and a backup: comparison, with backup and "
+            "optionally password, or between two backups, with to and optionally password_to too, "
+            "and optionally report, the file the changes are written to."),
+        .extra_data = 0,
+        .types      = { B_INT32_TYPE }
+    },
+    {
+        .name       = "ExportKeys",
+        .commands   = { B_EXECUTE_PROPERTY, 0 },
+        .specifiers = { B_DIRECT_SPECIFIER, 0 },
+        .usage      = B_TRANSLATE("Keys of a keyring: export to a single archive, with path, keyring and "
+            "optionally identifier and secondary for each key, compression and password."),
+        .extra_data = 0,
+        .types      = { B_INT32_TYPE }
+    },
     { 0 }
 };
-enum { PROPERTY_SERVER, PROPERTY_KEYRINGS, PROPERTY_KEYRING_READ, PROPERTY_KEYRING_CREATE, PROPERTY_KEYRING_DELETE };
-const char* kKeyStoreServerSignature = "application/x-vnd.Haiku-keystore_server";
+enum { PROPERTY_SERVER, PROPERTY_KEYRINGS, PROPERTY_KEYRING_READ, PROPERTY_KEYRING_CREATE, PROPERTY_KEYRING_DELETE,
+    PROPERTY_BACKUPS, PROPERTY_RESTORE_KEYS, PROPERTY_DIFF, PROPERTY_EXPORT_KEYS };
+
+static void ErasePassword(BString* password);
+static void BackupPassword(const char* path, const char* given, BString* password);
 
 // #pragma mark -
 
@@ -78,6 +127,8 @@ KeysApplication::KeysApplication()
   window(NULL),
   frame(BRect(50, 50, 720, 480)),
   ks(new KeystoreImp()),
+  keyringLoader(NULL),
+  backupJobs(NULL),
   inFocus(NULL),
   hasDataCopied(false)
 {
@@ -87,6 +138,8 @@ KeysApplication::KeysApplication()
     /* Data initialization */
     LoadSettings();
     _InitAppData(&currentSettings);
+    keyringLoader = new KeyringLoader(ks, BMessenger(this));
+    backupJobs = new BackupJobQueue(BMessenger(this));
     _InitKeystoreData(ks, &keystore);
 
     window = new KeysWindow(frame, ks, &keystore);
@@ -104,8 +157,10 @@ KeysApplication::KeysApplication()
 
 KeysApplication::~KeysApplication()
 {
+    delete backupJobs; // Cancels whatever is running and waits for it
     delete clipboardCleanerRunner;
     watch_node(&databaseNRef, B_STOP_WATCHING, this);
+    delete keyringLoader; // Its keyrings use the keystore strings
     delete ks;
 }
 
@@ -166,6 +221,38 @@ void KeysApplication::MessageReceived(BMessage* msg)
         case B_ABOUT_REQUESTED:
             AboutRequested();
             break;
+        case M_KEYRING_LOADED:
+        {
+            // A keyring read in the background: it replaces its stub
+            KeyringImp* keyring = nullptr;
+            uint32 generation = 0;
+            if(msg->IsSourceRemote() ||
+            msg->FindPointer(kConfigWho, reinterpret_cast<void**>(&keyring)) != B_OK ||
+            msg->FindUInt32("generation", &generation) != B_OK)
+                break;
+
+            // Only the loader knows if it is still there, it keeps it until then
+            keyring = keyringLoader->Take(keyring, generation);
+            if(!keyring || ks->AdoptKeyring(keyring, generation) != B_OK) {
+                __trace("Info: discarded background copy of %s\n",
+                    msg->GetString(kConfigKeyring, ""));
+                break;
+            }
+
+            // The window may be showing the stub, it has contents now
+            if(window != nullptr) {
+                BMessage loaded(M_KEYRING_LOADED);
+                loaded.AddString(kConfigKeyring, msg->GetString(kConfigKeyring, ""));
+                window->PostMessage(&loaded);
+            }
+            break;
+        }
+        case M_MODEL_REBUILD:
+            if(msg->IsSourceRemote())
+                break;
+
+            _RebuildModel();
+            break;
         case M_ASK_FOR_REFRESH:
         {
             // Someone asked for an update to its respective entry in the data model
@@ -173,9 +260,9 @@ void KeysApplication::MessageReceived(BMessage* msg)
             BString keyring;
             status_t status = B_ERROR;
             if(msg->FindString(kConfigKeyring, &keyring) == B_OK &&
-            ks->KeyringByName(keyring.String()) != nullptr) {
-                ks->KeyringByName(keyring.String())->Reset();
-                _InitKeyring(ks, &keystore, keyring.String());
+            ks->HasKeyring(keyring.String())) {
+                // It will be read again on its next access
+                ks->FindKeyring(keyring.String())->Reset();
                 status = B_OK;
             }
             reply.AddInt32("result", status);
@@ -206,6 +293,51 @@ void KeysApplication::MessageReceived(BMessage* msg)
                          // but possibly allow drag and drop backups
             KeystoreRestore(msg);
             break;
+        case M_KEYSTORE_VERIFY:
+            if(msg->IsSourceRemote() || msg->WasDropped())
+                break;
+
+            KeystoreVerify(msg);
+            break;
+        case M_KEYSTORE_RESTORE_KEYS:
+            if(msg->IsSourceRemote() || msg->WasDropped())
+                break;
+
+            KeystoreRestoreKeys(msg);
+            break;
+        case M_JOB_PROGRESS:
+            window->PostMessage(msg);
+            break;
+        case M_JOB_FINISHED:
+            if(msg->IsSourceRemote())
+                break;
+
+            /* The database changed under the server. The restore may have
+                stopped it and failed afterwards, so it is started whatever
+                the result; it is left alone if it is still running. */
+            if(msg->GetInt32(kConfigWhat, 0) == M_KEYSTORE_RESTORE) {
+                StartServer(true);
+                window->Update();
+            }
+            // The keys read from the backup are added here, where the model lives
+            if(msg->GetInt32(kConfigWhat, 0) == M_KEYSTORE_RESTORE_KEYS &&
+            msg->GetInt32(kConfigResult, B_ERROR) == B_OK) {
+                BMessage keys;
+                int32 added = 0;
+                msg->FindMessage("keys", &keys);
+                msg->RemoveName("keys");
+                msg->ReplaceInt32(kConfigResult, ks->ImportKeys(keys, &added));
+                msg->AddInt32("restored", added);
+                window->Update();
+            }
+            window->PostMessage(msg);
+            break;
+        case M_JOB_CANCEL:
+            if(msg->IsSourceRemote())
+                break;
+
+            backupJobs->Cancel(msg->GetInt32(kConfigJob, -1));
+            break;
         case M_KEYSTORE_WIPE_CONTENTS:
             if(msg->IsSourceRemote() || msg->WasDropped())
                 break;
@@ -267,15 +399,7 @@ void KeysApplication::MessageReceived(BMessage* msg)
             if(msg->IsSourceRemote())
                 break;
 
-            int32 i = 0;
-            entry_ref ref;
-            while(msg->FindRef("refs", i, &ref) == B_OK) {
-                BMessage request(msg->what);
-                request.AddString(kConfigKeyring, msg->GetString(kConfigKeyring));
-                request.AddRef("refs", &ref);
-                ImportKey(&request);
-                i++;
-            }
+            ImportKey(msg); // All the refs at once
             break;
         }
         case M_KEY_EXPORT:
@@ -284,6 +408,12 @@ void KeysApplication::MessageReceived(BMessage* msg)
 
             ExportKey(msg);
             break;
+        case M_KEYS_EXPORT:
+            if(msg->IsSourceRemote() || msg->WasDropped())
+                break;
+
+            ExportKeys(msg);
+            break;
         case M_KEY_DELETE:
             if(msg->IsSourceRemote() || msg->WasDropped())
                 break;
@@ -357,7 +487,7 @@ void KeysApplication::ArgvReceived(int32 argc, char** argv)
 
     for(const auto& it : paramMap) {
         if(strcmp(it.first, "--keyring") == 0) {// Parse it to be dealt by ReadyToRun()
-            if(it.second && ks->KeyringByName(it.second)) {
+            if(it.second && ks->HasKeyring(it.second)) {
                 // Do not do anything if it is NULL or there is not a keyring named <it.second>
                 __trace("Info: in focus: \'%s\'.\n", it.second);
                 inFocus = it.second;
@@ -523,6 +653,8 @@ void KeysApplication::HandleScripting(BMessage* msg)
                         status = B_ENTRY_NOT_FOUND;
                         break;
                     }
+                    if(!keyring->IsLoaded())
+                        keyring->Load();
 
                     BMessage replyData(B_ARCHIVED_OBJECT);
                     replyData.AddString("name", keyring->Identifier());
@@ -543,13 +675,13 @@ void KeysApplication::HandleScripting(BMessage* msg)
                         break;
                     }
 
-                    if(ks->KeyringByName(name)) {
+                    if(ks->HasKeyring(name)) {
                         status = EEXIST;
                         break;
                     }
 
                     status = ks->AddKeyring(name, true);
-                    if(status == B_OK && ks->KeyringByName(name))
+                    if(status == B_OK && ks->HasKeyring(name))
                         _RebuildModel();
                     else
                         status = B_ERROR;
@@ -565,19 +697,141 @@ void KeysApplication::HandleScripting(BMessage* msg)
                         break;
                     }
 
-                    if(!ks->KeyringByName(name)) {
+                    if(!ks->HasKeyring(name)) {
                         status = B_ENTRY_NOT_FOUND;
                         break;
                     }
 
                     status = ks->RemoveKeyring(name, true);
-                    if(status == B_OK && !ks->KeyringByName(name))
+                    if(status == B_OK && !ks->HasKeyring(name))
                         _RebuildModel();
                     else
                         status = B_ERROR;
                 }
                 break;
             }
+            case PROPERTY_BACKUPS:
+            {
+                BPath catalogpath;
+                BObjectList<catalog_entry> entries(20, true);
+                if((status = BackupCatalogPath(&catalogpath)) != B_OK ||
+                (status = BackupCatalog(catalogpath.Path()).GetEntries(&entries)) != B_OK)
+                    break;
+
+                if(msg->what == B_GET_PROPERTY) {
+                    for(int32 i = 0; i < entries.CountItems(); i++) {
+                        catalog_entry* entry = entries.ItemAt(i);
+                        BMessage replyData(B_ARCHIVED_OBJECT);
+                        replyData.AddString("name", entry->name);
+                        replyData.AddInt32("kind", entry->kind);
+                        replyData.AddInt64("time", entry->time);
+                        replyData.AddInt64("original_size", entry->originalSize);
+                        replyData.AddInt64("stored_size", entry->storedSize);
+                        if(entry->hasHashes) {
+                            replyData.AddString("original_hash",
+                                HashToHashstring(entry->originalHash, sizeof(entry->originalHash)));
+                            replyData.AddString("stored_hash",
+                                HashToHashstring(entry->storedHash, sizeof(entry->storedHash)));
+                        }
+                        replyData.AddString("cipher", entry->cipher);
+                        replyData.AddString("codec", entry->codec);
+                        if(entry->verifiedTime > 0) {
+                            replyData.AddInt64("verified_time", entry->verifiedTime);
+                            replyData.AddInt32("verification", entry->verification);
+                        }
+                        reply.AddMessage("result", &replyData);
+                    }
+                    status = B_OK;
+                }
+                else if(msg->what == B_COUNT_PROPERTIES) {
+                    reply.AddInt32("result", entries.CountItems());
+                    status = B_OK;
+                }
+                break;
+            }
+            case PROPERTY_RESTORE_KEYS:
+            {
+                if(msg->what == B_EXECUTE_PROPERTY) {
+                    const char* keyring = msg->GetString("keyring");
+                    if(!msg->HasString("backup") || !keyring) {
+                        status = B_BAD_VALUE;
+                        break;
+                    }
+
+                    BMessage request(M_KEYSTORE_RESTORE_KEYS);
+                    request.AddString("backup", msg->GetString("backup"));
+                    if(msg->HasString("password"))
+                        request.AddString("password", msg->GetString("password"));
+                    request.AddString(kConfigKeyring, keyring);
+                    request.AddString(kConfigKeyName, msg->GetString("identifier", ""));
+                    request.AddString(kConfigKeyAltName, msg->GetString("secondary", ""));
+                    // Without a secondary identifier, the key is taken whatever its one is
+                    request.AddBool("any_secondary", !msg->HasString("secondary"));
+
+                    // The job runs on its own, its ID tells it in the window
+                    int32 job = -1;
+                    if((status = KeystoreRestoreKeys(&request, &job)) == B_OK)
+                        reply.AddInt32("result", job);
+                }
+                break;
+            }
+            case PROPERTY_DIFF:
+            {
+                if(msg->what == B_EXECUTE_PROPERTY) {
+                    if(!msg->HasString("backup")) {
+                        status = B_BAD_VALUE;
+                        break;
+                    }
+
+                    BMessage request(M_KEYSTORE_DIFF);
+                    const char* const kFields[] = { "backup", "password", "to",
+                        "password_to", "report" };
+                    for(const char* field : kFields) {
+                        if(msg->HasString(field))
+                            request.AddString(field, msg->GetString(field));
+                    }
+
+                    // The job runs on its own, its ID tells it in the window
+                    int32 job = -1;
+                    if((status = KeystoreCompare(&request, &job)) == B_OK)
+                        reply.AddInt32("result", job);
+                }
+                break;
+            }
+            case PROPERTY_EXPORT_KEYS:
+            {
+                if(msg->what == B_EXECUTE_PROPERTY) {
+                    BPath path(msg->GetString("path")), parent;
+                    const char* keyring = msg->GetString("keyring");
+                    entry_ref dirref;
+                    if(path.InitCheck() != B_OK || !keyring ||
+                    path.GetParent(&parent) != B_OK ||
+                    get_ref_for_path(parent.Path(), &dirref) != B_OK) {
+                        status = B_BAD_VALUE;
+                        break;
+                    }
+
+                    BMessage request(M_KEYS_EXPORT);
+                    request.AddRef("directory", &dirref);
+                    request.AddString("name", path.Leaf());
+                    request.AddString(kConfigKeyring, keyring);
+                    const char* id;
+                    for(int32 i = 0; msg->FindString("identifier", i, &id) == B_OK; i++) {
+                        request.AddString(kConfigKeyName, id);
+                        request.AddString(kConfigKeyAltName, msg->GetString("secondary", i, ""));
+                    }
+                    if(msg->HasInt32("compression"))
+                        request.AddInt32("compression", msg->GetInt32("compression", kNoCompression));
+                    if(msg->HasString("password"))
+                        request.AddString("password", msg->GetString("password"));
+
+                    // The job runs on its own, its ID tells it in the window
+                    int32 job = -1;
+                    if((status = ExportKeys(&request, &job)) == B_OK)
+                        reply.AddInt32("result", job);
+                }
+                break;
+            }
             default:
                 return BApplication::MessageReceived(msg);
         }
@@ -665,8 +919,9 @@ status_t KeysApplication::StartServer(bool rebuildModel, bool forceRestart)
     BMessenger msgr(kKeyStoreServerSignature);
     if(!msgr.IsValid()) {
         __trace("Info: Keystore server is not currently running. Starting it...\n");
-        status = be_roster->Launch(kKeyStoreServerSignature);
-        if(status != B_OK && status != B_ALREADY_RUNNING) {
+        // Only returns once the server can take messages, or it timed out
+        status = StartKeystoreServer();
+        if(status != B_OK) {
             __trace("Error: The server could not be launched successfully.\n");
             return B_ERROR;
         }
@@ -689,13 +944,11 @@ status_t KeysApplication::StartServer(bool rebuildModel, bool forceRestart)
 status_t KeysApplication::StopServer(bool rebuildModel)
 {
     if(be_roster->IsRunning(kKeyStoreServerSignature)) {
-        team_id team = be_roster->TeamFor(kKeyStoreServerSignature);
-        if(team == B_ERROR)
-            return B_BAD_TEAM_ID;
-
         fprintf(stderr, "Info: trying to stop keystore server...\n");
-        BMessenger msgr(kKeyStoreServerSignature, team);
-        msgr.SendMessage(B_QUIT_REQUESTED);
+        // Waits for the server to be gone, killing it if it takes too long
+        status_t status = StopKeystoreServer();
+        if(status != B_OK)
+            return status;
 
         BMessage reply(B_REPLY);
         reply.AddInt32(kConfigWhat, I_SERVER_STOP);
@@ -708,6 +961,7 @@ status_t KeysApplication::StopServer(bool rebuildModel)
         // here we should rebuild the data model
         if(rebuildModel) {
             fprintf(stderr, "Info: Rebuilding model...\n");
+            keyringLoader->Cancel();
             ks->Reset();
 
             if(window != nullptr) { // Only notify to the window if there is a window
@@ -722,6 +976,33 @@ status_t KeysApplication::StopServer(bool rebuildModel)
 
 // #pragma mark - Keystore operations
 
+/* ErasePassword: secure erase memory containing the password, then delete it.
+    Used as the deleter of the passwords handed to the backup jobs, so they are
+    erased whether the job ran or was cancelled. */
+static void ErasePassword(BString* password)
+{
+    size_t passwordLength = password->Length();
+    char* passwordData = password->LockBuffer(0);
+    memzero(passwordData, passwordLength);
+    std::atomic_thread_fence(std::memory_order_seq_cst); // Force zero-ing after usage
+    password->UnlockBuffer(-1);
+    delete password;
+}
+
+/* BackupPassword: the one given or, for encrypted backups, the one in their
+    metadata, as restores use it */
+static void BackupPassword(const char* path, const char* given, BString* password)
+{
+    password->SetTo(given ? given : "");
+    if(!password->IsEmpty())
+        return;
+
+    BFile datafile(path, B_READ_ONLY);
+    BMessage data;
+    if(data.Unflatten(&datafile) == B_OK)
+        password->SetTo(data.GetString("pass", ""));
+}
+
 status_t KeysApplication::KeystoreBackup(BMessage* msg)
 {
     if(!msg) {
@@ -730,44 +1011,45 @@ status_t KeysApplication::KeystoreBackup(BMessage* msg)
     }
 
     uint32 method;
-    BString* password = new BString;
+    std::shared_ptr<BString> password(new BString, ErasePassword);
     if(msg->FindUInt32("method", &method) != B_OK ||
-    msg->FindString("password", password) != B_OK) {
+    msg->FindString("password", password.get()) != B_OK) {
         __trace("Error: %s. There are missing fields.\n", strerror(B_BAD_DATA));
         return B_BAD_DATA;
     }
-
-    status_t status = B_ERROR;
-    switch(method) {
-        case 'copy': {
-            status = DoPlainKeystoreBackup();
-            break;
-        }
+    int32 compression = msg->GetInt32("compression", kNoCompression);
+
+    // Run in the background, the window is told of the progress and the result
+    status_t status = backupJobs->AddJob(msg->what,
+        [method, password, compression](const progress_func& progress,
+        BMessage* result) -> status_t {
+            switch(method) {
+                case 'copy':
+                    return DoPlainKeystoreBackup(progress);
+                case 'repo':
+                    return DoRepositoryKeystoreBackup(nullptr, progress);
 // #if defined(USE_OPENSSL)
-        case 'ssl ':
-            status = DoEncryptedKeystoreBackup(password->String());
-            break;
+                case 'ssl ':
+                    return DoEncryptedKeystoreBackup(password->String(),
+                        BACKUP_CIPHER_AES_CBC, compression, progress);
+                case 'gcm ':
+                    return DoEncryptedKeystoreBackup(password->String(),
+                        BACKUP_CIPHER_AES_GCM_CHUNKED, kNoCompression, progress);
 // #endif
-        default:
-            break;
-    }
+                default:
+                    return B_ERROR;
+            }
+        });
 
-    if(status != B_OK) { // Notify any errors
+    if(status < B_OK) { // Notify any errors
         BMessage reply(B_REPLY);
         reply.AddInt32(kConfigWhat, msg->what);
         reply.AddInt32(kConfigResult, status);
         window->PostMessage(&reply);
+        return status;
     }
 
-    /* Secure erase memory containing the password */
-    size_t passwordLength = password->Length();
-    char* passwordData = password->LockBuffer(0);
-    memzero(passwordData, passwordLength);
-    std::atomic_thread_fence(std::memory_order_seq_cst); // Force zero-ing after usage
-    password->UnlockBuffer(-1);
-    delete password;
-
-    return status;
+    return B_OK;
 }
 
 status_t KeysApplication::KeystoreRestore(BMessage* msg)
@@ -778,28 +1060,188 @@ status_t KeysApplication::KeystoreRestore(BMessage* msg)
     }
 
     entry_ref ref;
-    BString pass;
     msg->FindRef("refs", &ref);
 
     BFile datafile(&ref, B_READ_ONLY);
     BPath path(&ref);
     BMessage data;
     data.Unflatten(&datafile);
-    pass = data.GetString("pass");
+    std::shared_ptr<BString> pass(new BString(data.GetString("pass", "")), ErasePassword);
+
+    // Either the metadata of an encrypted backup or the manifest of a snapshot.
+    //  The server is started again once the job is finished, see M_JOB_FINISHED
+    BString datapath(path.Path());
+    bool snapshot = data.what == BACKUP_MANIFEST;
+    status_t status = backupJobs->AddJob(msg->what,
+        [datapath, pass, snapshot](const progress_func& progress,
+        BMessage* result) -> status_t {
+            return snapshot
+                ? RestoreRepositoryKeystoreBackup(datapath.String(), progress)
+                : RestoreEncryptedKeystoreBackup(datapath.String(), pass->String(),
+                    progress);
+        });
+
+    if(status < B_OK) { // Notify any errors
+        BMessage reply(B_REPLY);
+        reply.AddInt32(kConfigWhat, msg->what);
+        reply.AddInt32(kConfigResult, status);
+        window->PostMessage(&reply);
+        return status;
+    }
+
+    return B_OK;
+}
+
+/* KeystoreVerify: the encrypted backups next to the database are checked
+    against their metadata, without a password, as a job of its own. The
+    report goes back to the window along with the result. */
+status_t KeysApplication::KeystoreVerify(BMessage* msg)
+{
+    BPath dbpath, directory, catalogpath;
+    status_t status = DBPath(&dbpath);
+    if(status == B_OK)
+        status = dbpath.GetParent(&directory);
+    if(status == B_OK && BackupCatalogPath(&catalogpath) != B_OK)
+        status = B_ERROR;
 
-    status_t status = RestoreEncryptedKeystoreBackup(path.Path(), pass.String());
     if(status == B_OK) {
-        StartServer(true);
-        window->Update();
+        BString directorypath(directory.Path()), catalog(catalogpath.Path());
+        status = backupJobs->AddJob(msg->what,
+            [directorypath, catalog](const progress_func& progress,
+            BMessage* result) -> status_t {
+                BackupVerifier verifier(directorypath.String());
+                verifier.SetCatalog(catalog.String());
+                status_t status = verifier.Run();
+                if(status != B_OK)
+                    return status;
+
+                BString report;
+                for(int32 i = 0; i < verifier.CountResults(); i++) {
+                    const verify_result* item = verifier.ResultAt(i);
+                    report << (item->Passed() ? "PASS  " : "FAIL  ")
+                        << (item->target.IsEmpty() ? item->name : item->target) << "\n";
+                }
+                report << "\n" << verifier.Summary();
+                result->AddString("report", report);
+                result->AddInt32("failed", verifier.CountFailed());
+                return B_OK;
+            });
     }
-    else { // Notify any errors
+
+    if(status < B_OK) {
         BMessage reply(B_REPLY);
         reply.AddInt32(kConfigWhat, msg->what);
         reply.AddInt32(kConfigResult, status);
         window->PostMessage(&reply);
+        return status;
     }
 
-    return status;
+    return B_OK;
+}
+
+/* KeystoreRestoreKeys: the keys selected, see ReadKeystoreBackupKeys(), are
+    read from the backup as a job of its own, while the server keeps running,
+    and added once it is finished, see M_JOB_FINISHED. Encrypted backups not
+    given a password use the one in their metadata, as whole restores do. */
+status_t KeysApplication::KeystoreRestoreKeys(BMessage* msg, int32* job)
+{
+    const char* path = msg->GetString("backup");
+    if(!path || !msg->HasString(kConfigKeyring))
+        return B_BAD_VALUE;
+
+    std::shared_ptr<BString> pass(new BString, ErasePassword);
+    BackupPassword(path, msg->GetString("password"), pass.get());
+
+    BString backuppath(path);
+    BMessage selection(*msg);
+    selection.RemoveName("password");
+    int32 id = backupJobs->AddJob(msg->what,
+        [backuppath, pass, selection](const progress_func& progress,
+        BMessage* result) -> status_t {
+            BMessage keys;
+            status_t status = ReadKeystoreBackupKeys(backuppath.String(),
+                pass->IsEmpty() ? nullptr : pass->String(), selection, &keys,
+                progress);
+            if(status == B_OK)
+                status = result->AddMessage("keys", &keys);
+            return status;
+        });
+
+    if(id < B_OK) {
+        BMessage reply(B_REPLY);
+        reply.AddInt32(kConfigWhat, msg->what);
+        reply.AddInt32(kConfigResult, id);
+        window->PostMessage(&reply);
+        return id;
+    }
+
+    if(job)
+        *job = id;
+    return B_OK;
+}
+
+/* KeystoreCompare: the keystore, or a second backup if "to" is given, is
+    compared to the backup as a job of its own. The changes come back in the
+    result, and are written to "report" too if it is given. */
+status_t KeysApplication::KeystoreCompare(BMessage* msg, int32* job)
+{
+    const char* path = msg->GetString("backup");
+    if(!path)
+        return B_BAD_VALUE;
+
+    std::shared_ptr<BString> pass(new BString, ErasePassword);
+    BackupPassword(path, msg->GetString("password"), pass.get());
+    std::shared_ptr<BString> topass(new BString, ErasePassword);
+    BString backuppath(path), topath(msg->GetString("to", "")),
+        reportpath(msg->GetString("report", ""));
+    if(!topath.IsEmpty())
+        BackupPassword(topath.String(), msg->GetString("password_to"), topass.get());
+
+    KeystoreBackend* backend = ks->Backend();
+    int32 id = backupJobs->AddJob(msg->what,
+        [backend, backuppath, pass, topath, topass, reportpath](
+        const progress_func& progress, BMessage* result) -> status_t {
+            SnapshotKeystoreBackend backup(backuppath.String(),
+                pass->IsEmpty() ? nullptr : pass->String());
+            status_t status = backup.InitCheck();
+            if(status != B_OK)
+                return status;
+
+            KeystoreDiff diff;
+            if(!topath.IsEmpty()) {
+                SnapshotKeystoreBackend to(topath.String(),
+                    topass->IsEmpty() ? nullptr : topass->String());
+                if((status = to.InitCheck()) == B_OK)
+                    status = diff.Compare(&backup, &to);
+            }
+            else
+                status = diff.Compare(backend, &backup);
+            if(status != B_OK || (status = diff.Archive(result)) != B_OK)
+                return status;
+            result->AddString("summary", diff.Summary());
+
+            if(!reportpath.IsEmpty()) {
+                FILE* report = fopen(reportpath.String(), "w");
+                if(!report)
+                    return static_cast<status_t>(errno);
+                diff.PrintReport(report);
+                if(fclose(report) != 0)
+                    return B_IO_ERROR;
+            }
+            return B_OK;
+        });
+
+    if(id < B_OK) {
+        BMessage reply(B_REPLY);
+        reply.AddInt32(kConfigWhat, msg->what);
+        reply.AddInt32(kConfigResult, id);
+        window->PostMessage(&reply);
+        return id;
+    }
+
+    if(job)
+        *job = id;
+    return B_OK;
 }
 
 void KeysApplication::WipeKeystoreContents(BMessage* msg)
@@ -840,7 +1282,7 @@ status_t KeysApplication::AddKeyring(BMessage* msg)
 		return B_NOT_ALLOWED;
 	}
 
-    if(ks->KeyringByName(keyring.String())) {
+    if(ks->HasKeyring(keyring.String())) {
         __trace("Error: %s.\n", strerror(B_NAME_IN_USE));
         return B_NAME_IN_USE;
     }
@@ -872,12 +1314,12 @@ status_t KeysApplication::LockKeyring(BMessage* msg)
 
     BString keyring;
     if(msg->FindString(kConfigKeyring, &keyring) != B_OK ||
-    !ks->KeyringByName(keyring.String())) {
+    !ks->HasKeyring(keyring.String())) {
         __trace("Error: %s. No keyring name received or bad keyring name.\n", strerror(B_BAD_DATA));
         return B_BAD_DATA;
     }
 
-    status_t status = ks->KeyringByName(keyring.String())->Lock();
+    status_t status = ks->FindKeyring(keyring.String())->Lock();
     if(status == B_OK) {
         __trace("Info: keyring \"%s\" was successfully locked.\n", keyring.String());
         window->Update((const void*)keyring.String()); // Update in focus
@@ -902,7 +1344,7 @@ status_t KeysApplication::SetKeyringLockKey(BMessage* msg)
 
     BString keyring;
     if(msg->FindString(kConfigKeyring, &keyring) != B_OK ||
-    !ks->KeyringByName(keyring.String())) {
+    !ks->HasKeyring(keyring.String())) {
         __trace("Error: %s. No keyring name received or bad keyring name.\n", strerror(B_BAD_DATA));
         return B_BAD_DATA;
     }
@@ -920,7 +1362,7 @@ status_t KeysApplication::SetKeyringLockKey(BMessage* msg)
     dummy->Flatten(*key);
     delete dummy;
 
-    status_t status = ks->KeyringByName(keyring.String())->SetUnlockKey(key);
+    status_t status = ks->FindKeyring(keyring.String())->SetUnlockKey(key);
     if(status == B_OK)
         window->Update(keyring.String()); // Update in focus
     else {
@@ -944,12 +1386,12 @@ status_t KeysApplication::RemoveKeyringLockKey(BMessage* msg)
 
     BString keyring;
     if(msg->FindString(kConfigKeyring, &keyring) != B_OK ||
-    !ks->KeyringByName(keyring.String())) {
+    !ks->HasKeyring(keyring.String())) {
         __trace("Error: %s. No keyring name received or bad keyring name.\n", strerror(B_BAD_DATA));
         return B_BAD_DATA;
     }
 
-    status_t status = ks->KeyringByName(keyring.String())->RemoveUnlockKey();
+    status_t status = ks->FindKeyring(keyring.String())->RemoveUnlockKey();
     if(status == B_OK)
         window->Update(keyring.String()); // Update in focus
     else {
@@ -974,15 +1416,20 @@ void KeysApplication::WipeKeyringContents(BMessage* msg)
     //  mostly for dev purposes
     BString keyring;
     if(msg->FindString(kConfigKeyring, &keyring) != B_OK ||
-    !ks->KeyringByName(keyring.String())) {
+    !ks->HasKeyring(keyring.String())) {
         __trace("Error: %s. No keyring name received or bad keyring name.\n", strerror(B_BAD_DATA));
         return;
     }
 
     KeyringImp* target = ks->KeyringByName(keyring.String());
     int count = target->KeyCount();
-    for(int i = count - 1 ; i >= 0; i--)
-        target->RemoveKey(target->KeyAt(i)->Identifier(), true);
+    BObjectList<KeyImp> keys(count > 0 ? count : 1);
+    for(int i = 0; i < count; i++)
+        keys.AddItem(target->KeyAt(i));
+
+    status_t status = target->RemoveKeys(keys, true);
+    if(status != B_OK)
+        __trace("Error: %s. Not all the keys could be removed.\n", strerror(status));
 
     window->Update(keyring.String()); // Update in focus
 }
@@ -996,7 +1443,7 @@ status_t KeysApplication::RemoveKeyring(BMessage* msg)
 
     BString keyring;
     if(msg->FindString(kConfigKeyring, &keyring) != B_OK ||
-    !ks->KeyringByName(keyring.String())) {
+    !ks->HasKeyring(keyring.String())) {
         __trace("Error: bad data. No keyring name received or bad keyring name.\n");
         return B_BAD_DATA;
     }
@@ -1031,7 +1478,7 @@ status_t KeysApplication::AddKey(BMessage* msg)
 
     BString keyring;
     if(msg->FindString(kConfigKeyring, &keyring) != B_OK ||
-    !ks->KeyringByName(keyring.String())) {
+    !ks->HasKeyring(keyring.String())) {
         __trace("Error: %s. No keyring name received or bad keyring name.\n", strerror(B_BAD_DATA));
         return B_BAD_DATA;
     }
@@ -1054,7 +1501,8 @@ status_t KeysApplication::AddKey(BMessage* msg)
         as long as they are either of different type or have different
         secondary identifiers.
     */
-    KeyImp* key = ks->KeyringByName(keyring.String())->KeyByIdentifier(id.String(), sec.String());
+    KeyImp* key = ks->KeyringByName(keyring.String())->KeyByIdentifier(id.String(),
+        sec.String(), t);
     if(key) {
         fprintf(stderr, "Error: key (%s, %s) in %s already exists.\n", id.String(), sec.String(), keyring.String());
         BMessage answer(B_REPLY);
@@ -1093,7 +1541,7 @@ status_t KeysApplication::GeneratePwdKey(BMessage* msg)
     status_t status = B_OK;
     BString keyring;
     if(msg->FindString(kConfigKeyring, &keyring) != B_OK ||
-    !ks->KeyringByName(keyring.String())) {
+    !ks->HasKeyring(keyring.String())) {
         __trace("Error: %s. No keyring name received or bad keyring name.\n", strerror(B_BAD_DATA));
         return B_BAD_DATA;
     }
@@ -1140,59 +1588,89 @@ status_t KeysApplication::ImportKey(BMessage* msg)
 
     BString keyring;
     if(msg->FindString(kConfigKeyring, &keyring) != B_OK ||
-    !ks->KeyringByName(keyring.String())) {
+    !ks->HasKeyring(keyring.String())) {
         __trace("Error: %s. No keyring name received or bad keyring name.\n", strerror(B_BAD_DATA));
         return B_BAD_DATA;
     }
 
-    entry_ref ref;
-    if(msg->FindRef("refs", &ref) != B_OK) {
+    if(!msg->HasRef("refs")) {
         __trace("Error: %s. No entry reference received.\n", strerror(B_BAD_DATA));
         return B_BAD_DATA;
     }
 
-    BFile file(&ref, B_READ_ONLY);
-    status_t status = file.InitCheck();
-    if(status != B_OK) {
-        __trace("Error: %s. No file from where import.\n", strerror(status));
-        return status;
-    }
+    /* Every file is read and checked first, the keys are then added in one batch.
+        Archives of many keys are added as a batch of their own. */
+    status_t status = B_OK;
+    KeyringImp* kr = ks->KeyringByName(keyring.String());
+    BObjectList<BMessage> archives(20, true);
+    int32 added = 0;
+    entry_ref ref;
+    for(int32 i = 0; msg->FindRef("refs", i, &ref) == B_OK; i++) {
+        BFile file(&ref, B_READ_ONLY);
+        status_t result = file.InitCheck();
+        if(result != B_OK) {
+            __trace("Error: %s. No file from where import.\n", strerror(result));
+            status = status == B_OK ? result : status;
+            continue;
+        }
 
-    BMessage* archive = new BMessage;
-    status = archive->Unflatten(&file);
-    if(status != B_OK) {
-        __trace("Error: %s. The message could not be unflattened from file.\n", strerror(status));
-        delete archive;
-        return status;
-    }
+        if(KeyArchiveReader::IsKeyArchive(&file)) {
+            KeyArchiveReader reader(BPath(&ref).Path(), msg->GetString("password"));
+            int32 archiveAdded = 0;
+            if((result = kr->ImportKey(reader, &archiveAdded)) != B_OK) {
+                __trace("Error: %s. The keys could not be imported from the archive.\n", strerror(result));
+                status = status == B_OK ? result : status;
+            }
+            added += archiveAdded;
+            continue;
+        }
 
-    BString id, sec;
-    if(archive->FindString("identifier", &id) != B_OK ||
-    archive->FindString("secondaryIdentifier", &sec) != B_OK) {
-        __trace("Error: %s. Key message with missing fields.\n", strerror(B_BAD_DATA));
-        delete archive;
-        return B_BAD_DATA;
-    }
+        BMessage* archive = new BMessage;
+        result = archive->Unflatten(&file);
+        if(result != B_OK) {
+            __trace("Error: %s. The message could not be unflattened from file.\n", strerror(result));
+            status = status == B_OK ? result : status;
+            delete archive;
+            continue;
+        }
 
-    status = B_NAME_IN_USE;
-    KeyringImp* kr = ks->KeyringByName(keyring.String());
-    if(kr->KeyByIdentifier(id.String(), sec.String()) == nullptr) {
-        status = kr->ImportKey(archive);
+        BString id, sec;
+        if(archive->FindString("identifier", &id) != B_OK ||
+        archive->FindString("secondaryIdentifier", &sec) != B_OK) {
+            __trace("Error: %s. Key message with missing fields.\n", strerror(B_BAD_DATA));
+            status = status == B_OK ? B_BAD_DATA : status;
+            delete archive;
+            continue;
+        }
+
+        if(kr->KeyByIdentifier(id.String(), sec.String()) != nullptr) {
+            __trace("Error: key already exists in keyring.\n");
+            status = status == B_OK ? B_NAME_IN_USE : status;
+            delete archive;
+            continue;
+        }
+
+        archives.AddItem(archive);
     }
 
-    if(status == B_OK) {
-        __trace("Info: key successfully imported.\n");
-        window->Update(kr->Identifier());
+    int32 batchAdded = 0;
+    status_t result = kr->AddKeys(archives, &batchAdded);
+    if(status == B_OK)
+        status = result;
+    added += batchAdded;
+
+    if(added > 0) {
+        __trace("Info: %" B_PRId32 " keys successfully imported.\n", added);
+        window->Update(kr->Identifier()); // Once for the whole batch
     }
-    else {
-        __trace("Error: key already exists in keyring or there was an error during the import.\n");
+    if(status != B_OK) {
+        __trace("Error: there was an error during the import.\n");
         BMessage reply(B_REPLY);
         reply.AddInt32(kConfigWhat, msg->what);
         reply.AddInt32(kConfigResult, status);
         window->PostMessage(&reply);
     }
 
-    delete archive;
     return status;
 }
 
@@ -1205,7 +1683,7 @@ status_t KeysApplication::ExportKey(BMessage* msg)
 
     BString keyring;
     if(msg->FindString(kConfigKeyring, &keyring) != B_OK ||
-    !ks->KeyringByName(keyring.String())) {
+    !ks->HasKeyring(keyring.String())) {
         __trace("Error: %s. No keyring name received or bad keyring name.\n", strerror(B_BAD_DATA));
         return B_BAD_DATA;
     }
@@ -1254,6 +1732,119 @@ status_t KeysApplication::ExportKey(BMessage* msg)
     return status;
 }
 
+/* ExportKeys: the keys given, or all the keys of the keyring, into a single
+    archive file, see KeyArchiveWriter. Which keys they are is settled here,
+    where the model lives; they are then read, compressed and encrypted as a
+    job of its own, see M_JOB_FINISHED. The archive is only written once
+    every key could be exported. */
+status_t KeysApplication::ExportKeys(BMessage* msg, int32* job)
+{
+    if(!msg) {
+        __trace("Error: %s.", strerror(B_BAD_VALUE));
+        return B_BAD_VALUE;
+    }
+
+    BString keyring;
+    if(msg->FindString(kConfigKeyring, &keyring) != B_OK ||
+    !ks->HasKeyring(keyring.String())) {
+        __trace("Error: %s. No keyring name received or bad keyring name.\n", strerror(B_BAD_DATA));
+        return B_BAD_DATA;
+    }
+
+    entry_ref dirref;
+    BString name;
+    if(msg->FindRef("directory", &dirref) != B_OK ||
+    msg->FindString("name", &name) != B_OK) {
+        __trace("Error: %s. There are missing fields.\n", strerror(B_BAD_DATA));
+        return B_BAD_DATA;
+    }
+
+    KeyringImp* kr = ks->KeyringByName(keyring.String());
+    if(!kr->IsLoaded())
+        kr->Load();
+
+    struct export_key {
+        BKeyType    type;
+        BString     identifier,
+                    secondaryIdentifier;
+    };
+    std::vector<export_key> keys;
+    BString identifier, secondary;
+    for(int32 i = 0; msg->FindString(kConfigKeyName, i, &identifier) == B_OK; i++) {
+        if(msg->FindString(kConfigKeyAltName, i, &secondary) != B_OK)
+            secondary.SetTo("");
+        KeyImp* key = kr->KeyByIdentifier(identifier.String(), secondary.String());
+        if(!key) {
+            __trace("Error: the key (%s, %s) is not in %s.\n", identifier.String(),
+                secondary.String(), keyring.String());
+            return B_ENTRY_NOT_FOUND;
+        }
+        keys.push_back({ key->Type(), key->Identifier(), key->SecondaryIdentifier() });
+    }
+    if(keys.empty()) {
+        for(int32 i = 0; i < kr->KeyCount(); i++) {
+            KeyImp* key = kr->KeyAt(i);
+            keys.push_back({ key->Type(), key->Identifier(), key->SecondaryIdentifier() });
+        }
+    }
+
+    BPath path(&dirref);
+    path.Append(name.String());
+    int32 compression = msg->GetInt32("compression", kNoCompression);
+    std::shared_ptr<BString> pass(new BString(msg->GetString("password", "")), ErasePassword);
+    KeystoreBackend* backend = ks->Backend();
+    int32 id = backupJobs->AddJob(M_KEYS_EXPORT,
+        [backend, keyring, keys, path, compression, pass](const progress_func& progress,
+        BMessage* result) -> status_t {
+            KeyArchiveWriter writer(compression);
+            for(size_t i = 0; i < keys.size(); i++) {
+                if(progress && !progress(i, keys.size()))
+                    return B_CANCELED;
+                const export_key& key = keys[i];
+                status_t status = writer.AddKey(backend, keyring.String(), key.type,
+                    key.identifier.String(), key.secondaryIdentifier.String());
+                if(status != B_OK) {
+                    fprintf(stderr, "Error: the key (%s, %s) in %s could not be exported.\n",
+                        key.identifier.String(), key.secondaryIdentifier.String(),
+                        keyring.String());
+                    return status;
+                }
+            }
+
+            BFile file(path.Path(), B_READ_WRITE | B_CREATE_FILE | B_FAIL_IF_EXISTS);
+            status_t status = file.InitCheck();
+            if(status != B_OK) {
+                fprintf(stderr, "Error: the file %s to where export the keys could not be "
+                    "initialized.\n", path.Path());
+                return status;
+            }
+            // Only the creator can handle the exported keys
+            file.SetPermissions(S_IRUSR | S_IWUSR);
+            if((status = writer.WriteTo(&file, pass->IsEmpty() ? nullptr : pass->String())) == B_OK)
+                status = file.Sync();
+            if(status != B_OK) {
+                file.Unset();
+                BEntry(path.Path()).Remove();
+                return status;
+            }
+
+            result->AddInt32("exported", writer.CountKeys());
+            return B_OK;
+        });
+
+    if(id < B_OK) {
+        BMessage reply(B_REPLY);
+        reply.AddInt32(kConfigWhat, msg->what);
+        reply.AddInt32(kConfigResult, id);
+        window->PostMessage(&reply);
+        return id;
+    }
+
+    if(job)
+        *job = id;
+    return B_OK;
+}
+
 status_t KeysApplication::RemoveKey(BMessage* msg)
 {
     if(!msg) {
@@ -1263,7 +1854,7 @@ status_t KeysApplication::RemoveKey(BMessage* msg)
 
     BString keyring;
     if(msg->FindString(kConfigKeyring, &keyring) != B_OK ||
-    !ks->KeyringByName(keyring.String())) {
+    !ks->HasKeyring(keyring.String())) {
         __trace("Error: %s. No keyring name received or bad keyring name.\n", strerror(B_BAD_DATA));
         return B_BAD_DATA;
     }
@@ -1298,7 +1889,7 @@ status_t KeysApplication::CopyKeyData(BMessage* msg)
 
     BString keyring;
     if(msg->FindString(kConfigKeyring, &keyring) != B_OK ||
-    !ks->KeyringByName(keyring.String())) {
+    !ks->HasKeyring(keyring.String())) {
         __trace("Error: %s. No keyring name received or bad keyring name.\n", strerror(B_BAD_DATA));
         return B_BAD_DATA;
     }
@@ -1322,13 +1913,13 @@ status_t KeysApplication::CopyKeyData(BMessage* msg)
     size_t dataLength = 0;
     if(type == B_KEY_TYPE_PASSWORD) {
         BPasswordKey pwdkey;
-        BKeyStore().GetKey(keyring.String(), type, id.String(), alt.String(), false, pwdkey);
+        ks->Backend()->GetKey(keyring.String(), type, id.String(), alt.String(), false, pwdkey);
         data = reinterpret_cast<const uint8*>(pwdkey.Password());
         dataLength = strlen(pwdkey.Password());
     }
     else {
         BKey key;
-        BKeyStore().GetKey(keyring.String(), type, id.String(), alt.String(), false, key);
+        ks->Backend()->GetKey(keyring.String(), type, id.String(), alt.String(), false, key);
         data = reinterpret_cast<const uint8*>(key.Data());
         dataLength = key.DataLength();
     }
@@ -1372,7 +1963,7 @@ status_t KeysApplication::RemoveApp(BMessage* msg)
 
     BString keyring;
     if(msg->FindString(kConfigKeyring, &keyring) != B_OK ||
-    !ks->KeyringByName(keyring.String())) {
+    !ks->HasKeyring(keyring.String())) {
         __trace("Error: bad data. No keyring name received or bad keyring name.\n");
         return B_BAD_DATA;
     }
@@ -1414,16 +2005,18 @@ void KeysApplication::_InitKeystoreData(KeystoreImp*& ks, BKeyStore* keystore)
     uint32 keyringCookie = 0;
     BString keyringName;
 
+    // The keyrings being read would refer to the old strings
+    keyringLoader->Cancel();
     ks->Reset();
 
     while(next) {
-        switch(keystore->GetNextKeyring(keyringCookie, keyringName))
+        switch(ks->Backend()->GetNextKeyring(keyringCookie, keyringName))
         {
             case B_OK:
             {
+                // Only a stub: its contents are read on its first access
                 __trace("Info: found keyring: %s\n", keyringName.String());
                 ks->AddKeyring(keyringName.String());
-                _InitKeyring(ks, keystore, keyringName.String());
                 break;
             }
             case B_ENTRY_NOT_FOUND:
@@ -1436,92 +2029,10 @@ void KeysApplication::_InitKeystoreData(KeystoreImp*& ks, BKeyStore* keystore)
                 break;
         }
     }
-}
-
-void KeysApplication::_InitKeyring(KeystoreImp*& ks, BKeyStore* keystore, const char* kr)
-{
-    bool next = true;
-    uint32 keyCookie = 0;
-    BKey key;
 
-    ks->KeyringByName(kr)->Reset();
-
-    while(next) {
-        switch(keystore->GetNextKey(kr, B_KEY_TYPE_GENERIC, B_KEY_PURPOSE_ANY,
-            keyCookie, key))
-        {
-            case B_OK:
-                ks->KeyringByName(kr)->AddKey(key.Purpose(), key.Type(),
-                    key.Identifier(), key.SecondaryIdentifier());
-                break;
-            case B_BAD_VALUE:
-                // fprintf(stderr, "%s : bad value, this should not have happened\n", kr);
-                next = false;
-                break;
-            case B_NOT_ALLOWED:
-                // fprintf(stderr, "%s : access denied\n", kr);
-                next = false;
-                break;
-            case B_ENTRY_NOT_FOUND:
-                // fprintf(stderr, "%s : keys not found\n", kr);
-                next = false;
-                break;
-            default:
-                // fprintf(stderr, "%s : comms error\n", kr);
-                next = false;
-                break;
-        }
-    }
-
-    next = true;
-    keyCookie = 0;
-    BPasswordKey pwdkey;
-
-    while(next) {
-        switch(keystore->GetNextKey(kr, B_KEY_TYPE_PASSWORD, B_KEY_PURPOSE_ANY,
-            keyCookie, pwdkey))
-        {
-            case B_OK:
-                ks->KeyringByName(kr)->AddKey(pwdkey.Purpose(), pwdkey.Type(),
-                    pwdkey.Identifier(), pwdkey.SecondaryIdentifier());
-                break;
-            case B_BAD_VALUE:
-                // fprintf(stderr, "%s : bad value, this should not have happened\n", kr);
-                next = false;
-                break;
-            case B_NOT_ALLOWED:
-                // fprintf(stderr, "%s : access denied\n", kr);
-                next = false;
-                break;
-            case B_ENTRY_NOT_FOUND:
-                // fprintf(stderr, "%s : keys not found\n", kr);
-                next = false;
-                break;
-            default:
-                // fprintf(stderr, "%s : comms error\n", kr);
-                next = false;
-                break;
-        }
-    }
-
-    next = true;
-    uint32 appCookie = 0;
-    BString appSignature;
-
-    while(next) {
-        switch(keystore->GetNextApplication(kr, appCookie, appSignature))
-        {
-            case B_OK:
-                ks->KeyringByName(kr)->AddApplicationToList(appSignature.String());
-                break;
-            case B_BAD_VALUE:
-            case B_NOT_ALLOWED:
-            case B_ENTRY_NOT_FOUND:
-            default:
-                next = false;
-                break;
-        }
-    }
+    // Fill the stubs in the background, the looper adopts the results
+    if(keyringLoader->Start() != B_OK)
+        __trace("Error: could not start the keyring loader\n");
 }
 
 void KeysApplication::_Notify(void* ptr, BMessage* msg, status_t result)
@@ -1538,27 +2049,18 @@ void KeysApplication::_Notify(void* ptr, BMessage* msg, status_t result)
 
 int32 KeysApplication::_CallServerMonitor(void* data)
 {
-    bool stop = false;
-    app_info info;
-    while(!stop) {
+    // Woken as soon as the server is launched again
+    while(WaitForKeystoreServer(kServerStartTimeout) == B_TIMED_OUT)
         fprintf(stderr, "Not running\n");
-        snooze(500000);
-        be_roster->GetAppInfo(kKeyStoreServerSignature, &info);
-        if(info.team != -1)
-            stop = true;
-    }
     fprintf(stderr, "running\n");
-    on_exit_thread(_CallRebuildModel, data);
+    // The model belongs to the looper, it is rebuilt there
+    static_cast<KeysApplication*>(data)->PostMessage(M_MODEL_REBUILD);
     return 0;
 }
 
-void KeysApplication::_CallRebuildModel(void* data)
-{
-    ((KeysApplication*)data)->_RebuildModel();
-}
-
 void KeysApplication::_RebuildModel()
 {
+    keyringLoader->Cancel();
     ks->Reset();
     _InitKeystoreData(ks, &keystore);
     window->Update();
@@ -10,6 +10,8 @@
 #include "KeysWindow.h"
 #include "../KeysDefs.h"
 #include "../data/KeystoreImp.h"
+#include "../data/BackupJobQueue.h"
+#include "../data/KeyringLoader.h"
 
 class KeysApplication : public BApplication
 {
@@ -40,6 +42,9 @@ public:
 
             status_t    KeystoreBackup(BMessage* msg);
             status_t    KeystoreRestore(BMessage* msg);
+            status_t    KeystoreVerify(BMessage* msg);
+            status_t    KeystoreRestoreKeys(BMessage* msg, int32* job = nullptr);
+            status_t    KeystoreCompare(BMessage* msg, int32* job = nullptr);
             void        WipeKeystoreContents(BMessage* msg);
             status_t    AddKeyring(BMessage* msg);
             status_t    LockKeyring(BMessage* msg);
@@ -51,18 +56,16 @@ public:
             status_t    GeneratePwdKey(BMessage* msg);
             status_t    ImportKey(BMessage* msg);
             status_t    ExportKey(BMessage* msg);
+            status_t    ExportKeys(BMessage* msg, int32* job = nullptr);
             status_t    RemoveKey(BMessage* msg);
             status_t    CopyKeyData(BMessage* msg);
             status_t    RemoveApp(BMessage* msg);
 private:
             void        _InitAppData(const BMessage* data);
             void        _InitKeystoreData(KeystoreImp*& ks, BKeyStore* keystore);
-            void        _InitKeyring(KeystoreImp*& ks, BKeyStore* keystore,
-                            const char* kr);
 
             void        _Notify(void* ptr, BMessage* msg, status_t result);
     static  int32       _CallServerMonitor(void* data);
-    static  void        _CallRebuildModel(void* data);
             void        _RebuildModel();
             void        _ClipboardJanitor();
 private:
@@ -71,6 +74,8 @@ private:
     BRect           frame;
     BKeyStore       keystore;
     KeystoreImp    *ks;
+    KeyringLoader  *keyringLoader;
+    BackupJobQueue *backupJobs;
     node_ref        databaseNRef;
     thread_id       thServerMonitor;
     const char     *inFocus;
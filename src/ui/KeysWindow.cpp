@@ -103,7 +103,8 @@ KeysWindow::KeysWindow(BRect frame, KeystoreImp* _ks, BKeyStore* _keystore)
   fIsLockedKeyring(nullptr),
   fMenuKeyring(nullptr),
   fMenuKey(nullptr),
-  fAppKey(nullptr)
+  fAppKey(nullptr),
+  fJob(-1)
 {
     init_shared_icons();
 
@@ -128,6 +129,13 @@ KeysWindow::KeysWindow(BRect frame, KeystoreImp* _ks, BKeyStore* _keystore)
     removeKeyringButton->SetEnabled(false);
     removeKeyringButton->SetExplicitMinSize(BSize(listScroll->Bounds().Width() / 2, 32));
 
+    /* Backup jobs, only shown while one runs */
+    fJobStatus = new BStatusBar("sb_job");
+    fJobStatus->SetMaxValue(100.0f);
+    fJobStatus->Hide();
+    fJobCancelButton = new BButton("bt_jobcn", B_TRANSLATE("Cancel"), new BMessage(I_JOB_CANCEL));
+    fJobCancelButton->Hide();
+
     /* Fields for file panels */
     BMessenger msgr(this);
     BPath path;
@@ -162,6 +170,10 @@ KeysWindow::KeysWindow(BRect frame, KeystoreImp* _ks, BKeyStore* _keystore)
                 .End()
                 .Add(keyringView)
             .End()
+            .AddGroup(B_HORIZONTAL)
+                .Add(fJobStatus)
+                .Add(fJobCancelButton)
+            .End()
         .End()
     .End();
 
@@ -191,6 +203,11 @@ void KeysWindow::MessageReceived(BMessage* msg)
         case I_DATA_REFRESH:
             // _InitAppData(ks);
             break;
+        case M_KEYRING_LOADED:
+            // Read in the background, only the keyring in focus is shown
+            if(currentKeyring == msg->GetString(kConfigKeyring, ""))
+                keyringView->Update(currentKeyring);
+            break;
         case I_ABOUT:
             be_app->PostMessage(B_ABOUT_REQUESTED);
             break;
@@ -201,7 +218,7 @@ void KeysWindow::MessageReceived(BMessage* msg)
         {
             const char* sel = ((BStringItem*)listView->ItemAt(listView->CurrentSelection()))->Text();
 
-            assert(ks->KeyringByName(sel));
+            assert(ks->HasKeyring(sel));
 
             keyringView->Update(sel);
             SetUIStatus(S_UI_HAS_KEYRING_IN_FOCUS);
@@ -220,7 +237,8 @@ void KeysWindow::MessageReceived(BMessage* msg)
             B_TRANSLATE("Do you want to restore a backup of the keystore database?\n"
             "The keystore server will be stop temporarily during the operation.\n\n"
             "If you select to restore a simple copy, choose the file in the file panel.\n"
-            "For an encrypted backup, choose the datafile where the metadata is contained.\n"),
+            "For an encrypted backup, choose the datafile where the metadata is contained.\n"
+            "For a snapshot of the backup repository, choose its file in the \"snapshots\" folder.\n"),
             B_TRANSLATE("Restore simple copy"), B_TRANSLATE("Restore encrypted copy"),
             B_TRANSLATE("Cancel"), B_WIDTH_FROM_LABEL, B_IDEA_ALERT))->Go()) {
                 case 0:
@@ -246,6 +264,19 @@ void KeysWindow::MessageReceived(BMessage* msg)
             }
             break;
         }
+        case I_JOB_CANCEL:
+        {
+            BMessage request(M_JOB_CANCEL);
+            request.AddInt32(kConfigJob, fJob);
+            be_app->PostMessage(&request);
+            break;
+        }
+        case I_KEYSTORE_VERIFY:
+        {
+            BMessage request(M_KEYSTORE_VERIFY);
+            be_app->PostMessage(&request);
+            break;
+        }
         case I_KEYSTORE_CLEAR:
         {
             if((new BAlert(B_TRANSLATE("Wipe keystore"),
@@ -270,7 +301,7 @@ void KeysWindow::MessageReceived(BMessage* msg)
         {
             BListView* list = (BListView*)msg->GetPointer("origin");
             BStringItem* item = (BStringItem*)msg->GetPointer("item_to_delete");
-            if(list && item && ks->KeyringByName(item->Text())) {
+            if(list && item && ks->HasKeyring(item->Text())) {
                 list->ScrollTo(list->IndexOf(item));
                 _RemoveKeyring(item->Text());
             }
@@ -354,7 +385,7 @@ void KeysWindow::MessageReceived(BMessage* msg)
                 break;
             }
 
-            BFile keyFile;
+            FlatMessageReader keyFileData;
             entry_ref ref;
             int32 index = 0;
             BMessage importerData;
@@ -362,29 +393,40 @@ void KeysWindow::MessageReceived(BMessage* msg)
             while(msg->FindRef("refs", index, &ref) == B_OK) {
                 index++;
 
-                keyFile.SetTo(&ref, B_READ_ONLY);
-                if(keyFile.InitCheck() != B_OK) { // Drop any invalid references
-                    droppedData.AddRef("refs", &ref);
-                    droppedData.AddString("reason", B_TRANSLATE_COMMENT("Bad file descriptor",
-                        "This is from strerror(B_FILE_ERROR)"));
-                    continue;
-                }
-                BMessage keyFileData;
-                if(keyFileData.Unflatten(&keyFile) == B_OK) {
+                BPath path(&ref);
+                status_t status = path.InitCheck() == B_OK
+                    ? keyFileData.SetTo(path.Path()) : path.InitCheck();
+                if(status == B_OK) {
                     // Presanitization to drop any non-exported-key flattened BMessage
-                    if(IsExportedKey(&keyFileData))
+                    if(IsExportedKey(keyFileData))
                         importerData.AddRef("refs", &ref);
                     else {
                         droppedData.AddRef("refs", &ref);
                         droppedData.AddString("reason", B_TRANSLATE("Message is not an exported key"));
                     }
                 }
-                else { // Drop any foreign formats
+                else if(status == B_BAD_DATA || status == B_NOT_SUPPORTED) {
+                    BFile file(&ref, B_READ_ONLY);
+                    bool encrypted;
+                    bool archive = KeyArchiveReader::IsKeyArchive(&file, &encrypted);
+                    if(archive && !encrypted) // Archives of many keys
+                        importerData.AddRef("refs", &ref);
+                    else if(archive) { // No password is asked for them
+                        droppedData.AddRef("refs", &ref);
+                        droppedData.AddString("reason", B_TRANSLATE("Archive is encrypted"));
+                    }
+                    else { // Drop any foreign formats
+                        droppedData.AddRef("refs", &ref);
+                        droppedData.AddString("reason", B_TRANSLATE_COMMENT("Data is not a message",
+                            "This is from strerror(B_NOT_A_MESSAGE)"));
+                    }
+                }
+                else { // Drop any invalid references
                     droppedData.AddRef("refs", &ref);
-                    droppedData.AddString("reason", B_TRANSLATE_COMMENT("Data is not a message",
-                        "This is from strerror(B_NOT_A_MESSAGE)"));
+                    droppedData.AddString("reason", B_TRANSLATE_COMMENT("Bad file descriptor",
+                        "This is from strerror(B_FILE_ERROR)"));
                 }
-                keyFile.Unset();
+                keyFileData.Unset();
             }
 
             MultipleImporterDialogBox* importer = new MultipleImporterDialogBox(this, currentKeyring, &importerData, &droppedData);
@@ -453,6 +495,12 @@ void KeysWindow::MessageReceived(BMessage* msg)
         case B_REPLY:
             _HandleReplyBacks(msg);
             break;
+        case M_JOB_PROGRESS:
+            _JobProgress(msg);
+            break;
+        case M_JOB_FINISHED:
+            _JobFinished(msg);
+            break;
         default:
             BWindow::MessageReceived(msg);
             break;
@@ -525,7 +573,7 @@ void KeysWindow::SetUIStatus(ui_status status, const char* focus)
             fRemKeyring->SetEnabled(true);
             fMenuKeyring->SetEnabled(true);
             removeKeyringButton->SetEnabled(true);
-            fIsLockedKeyring->SetMarked(!(ks->KeyringByName(currentKeyring)->IsUnlocked()));
+            fIsLockedKeyring->SetMarked(!(ks->FindKeyring(currentKeyring)->IsUnlocked()));
             keyringView->Update(currentKeyring);
             BMessage reply(B_REPLY);
             reply.AddBool("keyring_changed", true);
@@ -550,7 +598,7 @@ ui_status KeysWindow::GetUIStatus()
 void KeysWindow::Update(const void* data)
 {
 	_InitAppData(ks);
-    if(data != nullptr && ks->KeyringByName((const char*)data)) {
+    if(data != nullptr && ks->HasKeyring((const char*)data)) {
         fprintf(stderr, "Received: %s\n", (const char*)data);
         BStringItem* item = find_item(listView, reinterpret_cast<const char*>(data));
         if(item) {
@@ -569,9 +617,11 @@ void KeysWindow::_InitAppData(KeystoreImp* ks)
     __trace("CALLED.\n");
     LockLooper();
     listView->MakeEmpty();
+    ks->Locker()->Lock();
     for(int i = 0; i < ks->KeyringCount(); i++) {
         listView->AddItem(new BStringItem(ks->KeyringAt(i)->Identifier()));
     }
+    ks->Locker()->Unlock();
     // Preselect something to avoid protection faults when selecting a key
     //  without a keyring selected in the other view
     if(listView->CountItems() > 0) {
@@ -601,6 +651,57 @@ void KeysWindow::_HandleReplyBacks(BMessage* reply)
         case M_KEYSTORE_RESTORE:
             alertText.SetTo("Keystore restore error: ");
             break;
+        case M_KEYSTORE_VERIFY:
+        {
+            // The report comes along, whatever the result
+            BString report(reply->GetString("report", ""));
+            status_t result = reply->GetInt32(kConfigResult, B_OK);
+            if(result != B_OK)
+                report.Append(strerror(result));
+            BAlert* alert = new BAlert;
+            alert->SetText(report.String());
+            alert->SetTitle(B_TRANSLATE("Verify keystore backups"));
+            alert->SetType(result == B_OK && reply->GetInt32("failed", 0) == 0
+                ? alert_type::B_INFO_ALERT : alert_type::B_WARNING_ALERT);
+            alert->AddButton(B_TRANSLATE("Close"));
+            alert->Go();
+            return;
+        }
+        case M_KEYSTORE_RESTORE_KEYS:
+        {
+            status_t result = reply->GetInt32(kConfigResult, B_OK);
+            if(result != B_OK) {
+                alertText.SetTo("Keys restore error: ");
+                break;
+            }
+
+            BString text;
+            text.SetToFormat(B_TRANSLATE("%" B_PRId32 " key(s) restored from the backup."),
+                reply->GetInt32("restored", 0));
+            BAlert* alert = new BAlert;
+            alert->SetText(text.String());
+            alert->SetTitle(B_TRANSLATE("Restore keys"));
+            alert->SetType(alert_type::B_INFO_ALERT);
+            alert->AddButton(B_TRANSLATE("Close"));
+            alert->Go();
+            return;
+        }
+        case M_KEYSTORE_DIFF:
+        {
+            status_t result = reply->GetInt32(kConfigResult, B_OK);
+            if(result != B_OK) {
+                alertText.SetTo("Keystore comparison error: ");
+                break;
+            }
+
+            BAlert* alert = new BAlert;
+            alert->SetText(reply->GetString("summary", ""));
+            alert->SetTitle(B_TRANSLATE("Compare keystores"));
+            alert->SetType(alert_type::B_INFO_ALERT);
+            alert->AddButton(B_TRANSLATE("Close"));
+            alert->Go();
+            return;
+        }
         case M_KEYRING_CREATE:
             alertText.SetTo("Keyring creation error: ");
             break;
@@ -628,6 +729,9 @@ void KeysWindow::_HandleReplyBacks(BMessage* reply)
         case M_KEY_EXPORT:
             alertText.SetTo("Key export error: ");
             break;
+        case M_KEYS_EXPORT:
+            alertText.SetTo("Keys export error: ");
+            break;
         case M_KEY_DELETE:
             alertText.SetTo("Key deletion error: ");
             break;
@@ -649,6 +753,67 @@ void KeysWindow::_HandleReplyBacks(BMessage* reply)
     alert->Go();
 }
 
+void KeysWindow::_JobProgress(BMessage* msg)
+{
+    fJob = msg->GetInt32(kConfigJob, -1);
+    off_t done = msg->GetInt64(kConfigJobDone, 0);
+    off_t total = msg->GetInt64(kConfigJobTotal, 0);
+    bigtime_t eta = msg->GetInt64(kConfigJobETA, 0);
+
+    BString text;
+    switch(msg->GetInt32(kConfigWhat, 0))
+    {
+        case M_KEYSTORE_BACKUP:
+            text.SetTo(B_TRANSLATE("Backing up the keystore"));
+            break;
+        case M_KEYSTORE_RESTORE:
+            text.SetTo(B_TRANSLATE("Restoring the keystore"));
+            break;
+        case M_KEYSTORE_RESTORE_KEYS:
+            text.SetTo(B_TRANSLATE("Reading the keys from the backup"));
+            break;
+        case M_KEYSTORE_DIFF:
+            text.SetTo(B_TRANSLATE("Comparing the keystores"));
+            break;
+        case M_KEYS_EXPORT:
+            text.SetTo(B_TRANSLATE("Exporting the keys"));
+            break;
+        default:
+            text.SetTo(B_TRANSLATE("Working"));
+            break;
+    }
+    BString trailing;
+    trailing.SetToFormat(B_TRANSLATE("%.1f MB/s, %" B_PRId64 " s left"),
+        msg->GetDouble(kConfigJobRate, 0.0), (int64)(eta / 1000000));
+
+    fJobStatus->SetTo(total > 0 ? done * 100.0f / total : 0.0f, text.String(),
+        trailing.String());
+    if(fJobStatus->IsHidden())
+        fJobStatus->Show();
+    if(fJobCancelButton->IsHidden())
+        fJobCancelButton->Show();
+}
+
+void KeysWindow::_JobFinished(BMessage* msg)
+{
+    // A job cancelled before it ran does not hide the one running
+    if(msg->GetInt32(kConfigJob, -1) == fJob) {
+        fJob = -1;
+        fJobStatus->Reset();
+        if(!fJobStatus->IsHidden())
+            fJobStatus->Hide();
+        if(!fJobCancelButton->IsHidden())
+            fJobCancelButton->Hide();
+    }
+
+    // Errors are told as always, and the verification report comes along
+    status_t result = msg->GetInt32(kConfigResult, B_OK);
+    int32 what = msg->GetInt32(kConfigWhat, 0);
+    if((result != B_OK && result != B_CANCELED) || what == M_KEYSTORE_VERIFY ||
+    (result == B_OK && (what == M_KEYSTORE_RESTORE_KEYS || what == M_KEYSTORE_DIFF)))
+        _HandleReplyBacks(msg);
+}
+
 // #pragma mark - Keystore management calls
 
 #undef B_TRANSLATION_CONTEXT
@@ -656,10 +821,17 @@ void KeysWindow::_HandleReplyBacks(BMessage* reply)
 
 void KeysWindow::_KeystoreInfo()
 {
+    ks->Locker()->Lock();
+    ks->LoadAll();
     int keyringc = ks->KeyringCount();
+    int keyc = ks->KeyCount();
+    int gkeyc = ks->KeyCount(B_KEY_TYPE_GENERIC);
+    int pkeyc = ks->KeyCount(B_KEY_TYPE_PASSWORD);
+    ks->Locker()->Unlock();
 
     BString desc;
-    desc.SetToFormat(B_TRANSLATE("Keystore.\n\n%d keyring(s).\n"), keyringc);
+    desc.SetToFormat(B_TRANSLATE("Keystore.\n\n%d keyring(s).\n%d key(s): "
+        "%d generic, %d password.\n"), keyringc, keyc, gkeyc, pkeyc);
 
     BAlert *alert = new BAlert();
     alert->SetType(B_INFO_ALERT);
@@ -902,6 +1074,7 @@ BMenuBar* KeysWindow::_InitMenu()
             .AddSeparator()
             // .AddItem(backupDBItem)
             // .AddItem(restoreDBItem)
+            .AddItem(B_TRANSLATE("Verify keystore backups"), I_KEYSTORE_VERIFY)
             .AddItem(B_TRANSLATE("Wipe keystore database" B_UTF8_ELLIPSIS), I_KEYSTORE_CLEAR)
             .AddSeparator()
             .AddItem(B_TRANSLATE("Keystore statistics" B_UTF8_ELLIPSIS), I_KEYSTORE_INFO)
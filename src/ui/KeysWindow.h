@@ -8,8 +8,10 @@
 #include <FilePanel.h>
 #include <InterfaceKit.h>
 #include <KeyStore.h>
+#include <Path.h>
 #include <list>
 #include "../KeysDefs.h"
+#include "../data/FlatMessage.h"
 #include "../data/KeystoreImp.h"
 #include "../dialogs/AddKeyDialogBox.h"
 #include "KeyringView.h"
@@ -24,6 +26,8 @@
 #define I_TAB_SELECTED     'tsel'
 #define I_KEYSTORE_BACKUP  'iksb'
 #define I_KEYSTORE_RESTORE 'iksr'
+#define I_KEYSTORE_VERIFY  'iksv'
+#define I_JOB_CANCEL       'ijcn'
 #define I_KEYSTORE_INFO    'iksi'
 #define I_KEYSTORE_CLEAR   'iksw'
 #define I_KEYRING_ADD      'ikra'
@@ -74,21 +78,34 @@ public:
                IsValidFile(*ref);
     }
 private:
+    /* Run on every file of the folder shown, so the message is read in place
+        rather than unflattened, for what BKey::Unflatten would look for. */
     bool IsValidFile(entry_ref ref) {
-        BFile file(&ref, B_READ_ONLY);
-        if(file.InitCheck() != B_OK)
+        BPath path(&ref);
+        FlatMessageReader data(path.Path());
+        if(data.InitCheck() != B_OK) {
+            // Archives of many keys are imported as well, but encrypted
+            //  ones need a password that is not asked for here
+            BFile file(&ref, B_READ_ONLY);
+            bool encrypted;
+            return KeyArchiveReader::IsKeyArchive(&file, &encrypted) && !encrypted;
+        }
+
+        uint32 type;
+        const char* string;
+        int64 creationTime;
+        const void* keyData;
+        ssize_t keyDataLength;
+        if(data.FindUInt32("type", 0, &type) != B_OK ||
+           (type != B_KEY_TYPE_GENERIC && type != B_KEY_TYPE_PASSWORD))
             return false;
 
-        BMessage data;
-        if(data.Unflatten(&file) != B_OK)
-            return false;
-
-        BKey key;
-        BPasswordKey pwdkey;
-        if(key.Unflatten(data) != B_OK && pwdkey.Unflatten(data) != B_OK)
-            return false;
-
-        return true;
+        return data.FindUInt32("purpose", 0, &type) == B_OK &&
+               data.FindString("identifier", 0, &string) == B_OK &&
+               data.FindString("secondaryIdentifier", 0, &string) == B_OK &&
+               data.FindString("owner", 0, &string) == B_OK &&
+               data.FindInt64("creationTime", 0, &creationTime) == B_OK &&
+               data.FindData("data", B_RAW_TYPE, 0, &keyData, &keyDataLength) == B_OK;
     }
 };
 
@@ -105,6 +122,8 @@ public:
 private:
     void                    _InitAppData(KeystoreImp* ks);
     void                    _HandleReplyBacks(BMessage* reply);
+    void                    _JobProgress(BMessage* msg);
+    void                    _JobFinished(BMessage* msg);
 
     void                    _KeystoreInfo();
     status_t                _AddKeyring();
@@ -147,6 +166,9 @@ private:
                            *fAppKey;
     BPopUpMenu             *fKeystorePopMenu,
                            *fKeyringItemMenu;
+    BStatusBar             *fJobStatus;
+    BButton                *fJobCancelButton;
+    int32                   fJob;
 };
 
 #endif /* __KEYS_WIN_H_ */